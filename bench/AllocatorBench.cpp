@@ -0,0 +1,380 @@
+#include "BenchUtil.h"
+#include "DrmAllocator.h"
+#include "DrmBufferPool.h"
+#include "DrmFormat.h"
+#include "MemAllocatorDevice.h"
+#include "MemoryAccounting.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * Allocator micro benchmark.
+ *
+ * For every allocator of src/drm and src/mem and every resolution of the
+ * sweep it measures allocation/free latency, the cost of exporting the
+ * dma-buf, mmap and first touch of a fresh mapping, framebuffer creation
+ * and sustained CPU write bandwidth into the mapping. The report is JSON.
+ *
+ * Runs on a plain Linux machine with vkms and the system dma-heap:
+ *   modprobe vkms && ./AllocatorBench --card /dev/dri/card0 --output alloc.json
+ */
+
+using namespace evs::early;
+using namespace evs::early::drm;
+using namespace evs::early::bench;
+
+namespace {
+
+typedef struct {
+    std::string card;
+    std::string heap;
+    std::string output;
+    std::string resolutions;
+    std::string format;
+    uint32_t iterations;
+    uint32_t passes;
+    uint32_t poolDepth;
+} Options;
+
+typedef struct {
+    bool available;
+    size_t bytes;
+    Samples alloc;
+    Samples free;
+    Samples expose;
+    Samples mmap;
+    Samples firstTouch;
+    Samples addFb;
+    double writeGBps;
+    size_t peakBytes;
+} Result;
+
+static bool parseOptions(int argc, char **argv, Options &opts) {
+    OptionParser parser(opts.output);
+    parser.add("--card <path>", "DRM card (default /dev/dri/card0)", opts.card);
+    parser.add("--heap <path>", "dma-heap for src/mem (default /dev/dma_heap/system)", opts.heap);
+    parser.add("--sizes <WxH,...>", "resolution sweep (default 640x480,1280x720,1920x1080,3840x2160)", opts.resolutions);
+    parser.add("--format <fourcc>", "DRM fourcc, e.g. XR24 or NV12 (default XR24)", opts.format);
+    parser.add("--iterations <n>", "allocations per allocator and resolution (default 50)", opts.iterations);
+    parser.add("--passes <n>", "full buffer writes for the bandwidth test (default 20)", opts.passes);
+    parser.add("--pool-depth <n>", "buffers kept by the pooled allocator (default 4)", opts.poolDepth);
+    if ((parser.parse(argc, argv) == false) || (opts.iterations == 0U)) {
+        parser.usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+static uint32_t parseFourcc(const std::string &name) {
+    if (name.size() != 4U) {
+        return 0U;
+    }
+    return fourcc_code(name[0], name[1], name[2], name[3]);
+}
+
+static BufferInfo makeInfo(uint32_t width, uint32_t height, uint32_t format) {
+    const DrmFormatInfo *fmt = DrmFormat::info(format);
+    BufferInfo info = {};
+    info.width = width;
+    info.height = height;
+    info.bpp = static_cast<uint8_t>((fmt != nullptr) ? fmt->cpp[0] * 8U : 32U);
+    info.depth = 24U;
+    info.format = static_cast<int>(format);
+    info.tag = MemoryTag::DISPLAY;
+    return info;
+}
+
+/**
+ * @brief mmap a fresh mapping of @p dmaFd and fault in every page.
+ */
+static void measureMapping(int dmaFd, size_t size, Result &result) {
+    uint64_t start = nowNs();
+    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, dmaFd, 0);
+    uint64_t mapped = nowNs();
+    if (ptr == MAP_FAILED) {
+        return;
+    }
+    result.mmap.addNs(mapped - start);
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    volatile uint8_t *bytes = static_cast<volatile uint8_t *>(ptr);
+    start = nowNs();
+    for (size_t offset = 0; offset < size; offset += static_cast<size_t>(pageSize)) {
+        bytes[offset] = 0U;
+    }
+    result.firstTouch.addNs(nowNs() - start);
+    munmap(ptr, size);
+}
+
+static void measureAddFb(int drmFd, const DrmBuffer *buf, const BufferInfo &info, Result &result) {
+    uint32_t fbId = 0;
+    uint64_t start = nowNs();
+    if (addFramebuffer(drmFd, info, buf->handles, buf->strides, buf->offsets, fbId) != 0) {
+        return;
+    }
+    result.addFb.addNs(nowNs() - start);
+    drmModeRmFB(drmFd, fbId);
+}
+
+static double measureWriteBandwidth(void *ptr, size_t size, uint32_t passes) {
+    if ((ptr == nullptr) || (size == 0U) || (passes == 0U)) {
+        return 0.0;
+    }
+    // Warm up so the first pass does not measure page faults
+    memset(ptr, 0, size);
+    uint64_t start = nowNs();
+    for (uint32_t pass = 0; pass < passes; pass++) {
+        memset(ptr, static_cast<int>(pass & 0xffU), size);
+    }
+    uint64_t elapsed = nowNs() - start;
+    return (elapsed > 0U) ? (static_cast<double>(size) * passes) / static_cast<double>(elapsed) : 0.0;
+}
+
+static void benchDrmAllocator(AllocatorType type, int drmFd, const BufferInfo &info, const Options &opts, Result &result) {
+    for (uint32_t i = 0; i < opts.iterations; i++) {
+        uint64_t start = nowNs();
+        DrmBuffer *buf = DrmAllocator::allocate(type, drmFd, info);
+        uint64_t allocated = nowNs();
+        if (buf == nullptr) {
+            break;
+        }
+        result.available = true;
+        result.bytes = buf->size;
+        result.alloc.addNs(allocated - start);
+
+        start = nowNs();
+        int dmaFd = DrmAllocator::exposeHandleToFd(drmFd, buf);
+        if (dmaFd >= 0) {
+            result.expose.addNs(nowNs() - start);
+            measureMapping(dmaFd, buf->size, result);
+        }
+        measureAddFb(drmFd, buf, info, result);
+        if (i == 0U) {
+            result.writeGBps = measureWriteBandwidth(buf->ptr, buf->size, opts.passes);
+        }
+
+        start = nowNs();
+        DrmAllocator::release(drmFd, buf);
+        result.free.addNs(nowNs() - start);
+    }
+}
+
+/**
+ * @brief DrmBufferPool on top of the dumb allocator, as used by the
+ *        display across re-initialisation. After the pool is warm the
+ *        alloc/free numbers are the cost of a pool hit; exposeHandleToFd
+ *        returns the fd cached on the first export.
+ */
+static void benchPooled(int drmFd, const BufferInfo &info, const Options &opts, Result &result) {
+    DrmBufferPool pool(drmFd, opts.poolDepth);
+    std::vector<DrmBuffer *> warm{};
+    for (uint32_t i = 0; i < opts.poolDepth; i++) {
+        DrmBuffer *buf = pool.acquire(AllocatorType::DRM_ALLOCATOR_MMAP, info);
+        if (buf == nullptr) {
+            break;
+        }
+        warm.push_back(buf);
+    }
+    if (warm.empty()) {
+        return;
+    }
+    result.available = true;
+    result.bytes = warm.front()->size;
+    for (DrmBuffer *buf : warm) {
+        pool.park(buf);
+    }
+
+    for (uint32_t i = 0; i < opts.iterations; i++) {
+        uint64_t start = nowNs();
+        DrmBuffer *buf = pool.acquire(AllocatorType::DRM_ALLOCATOR_MMAP, info);
+        result.alloc.addNs(nowNs() - start);
+        if (buf == nullptr) {
+            break;
+        }
+
+        start = nowNs();
+        int dmaFd = DrmAllocator::exposeHandleToFd(drmFd, buf);
+        if (dmaFd >= 0) {
+            result.expose.addNs(nowNs() - start);
+        }
+        if (i == 0U) {
+            result.writeGBps = measureWriteBandwidth(buf->ptr, buf->size, opts.passes);
+        }
+
+        start = nowNs();
+        pool.park(buf);
+        result.free.addNs(nowNs() - start);
+    }
+    pool.trim();
+}
+
+/**
+ * @brief The src/mem heap device (dma-heap or ION, depending on the kernel).
+ *        Allocation includes the CPU mapping; AddFB is measured as a PRIME
+ *        import of the dma-buf into the DRM device.
+ */
+static void benchMemDevice(int drmFd, const BufferInfo &info, const Options &opts, Result &result) {
+    MemDevice device(opts.heap, MemoryTag::DISPLAY);
+    if (device.open() < 0) {
+        return;
+    }
+
+    uint32_t planes = 0;
+    uint32_t pitches[DRM_MAX_PLANES] = {};
+    uint32_t offsets[DRM_MAX_PLANES] = {};
+    size_t size = resolvePlaneLayout(info, planes, pitches, offsets);
+
+    for (uint32_t i = 0; i < opts.iterations; i++) {
+        uint64_t start = nowNs();
+        BufferHandlePtr handle = device.allocate(size);
+        uint64_t allocated = nowNs();
+        if (handle == nullptr) {
+            break;
+        }
+        result.available = true;
+        result.bytes = handle->length;
+        result.alloc.addNs(allocated - start);
+
+        measureMapping(handle->fd, handle->length, result);
+
+        BufferInfo importInfo = info;
+        importInfo.size = handle->length;
+        start = nowNs();
+        DrmBuffer *buf = DrmAllocator::import(drmFd, handle->fd, importInfo, false);
+        if (buf != nullptr) {
+            result.addFb.addNs(nowNs() - start);
+            DrmAllocator::release(drmFd, buf);
+        }
+        if (i == 0U) {
+            result.writeGBps = measureWriteBandwidth(handle->virt, handle->length, opts.passes);
+        }
+
+        start = nowNs();
+        handle.reset();
+        result.free.addNs(nowNs() - start);
+    }
+    device.close();
+}
+
+static void writeResult(JsonWriter &json, const char *name, uint32_t width, uint32_t height, const Result &result) {
+    json.beginObject();
+    json.value("allocator", name);
+    json.value("width", static_cast<uint64_t>(width));
+    json.value("height", static_cast<uint64_t>(height));
+    json.value("available", result.available);
+    if (result.available) {
+        json.value("bytes", static_cast<uint64_t>(result.bytes));
+        json.stats("alloc_us", result.alloc);
+        json.stats("free_us", result.free);
+        json.stats("expose_fd_us", result.expose);
+        json.stats("mmap_us", result.mmap);
+        json.stats("first_touch_us", result.firstTouch);
+        json.stats("addfb_us", result.addFb);
+        json.value("write_gbps", result.writeGBps);
+        json.value("peak_bytes", static_cast<uint64_t>(result.peakBytes));
+    }
+    json.endObject();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opts = {};
+    opts.card = "/dev/dri/card0";
+    opts.heap = "/dev/dma_heap/system";
+    opts.output = "allocator_bench.json";
+    opts.resolutions = "640x480,1280x720,1920x1080,3840x2160";
+    opts.format = "XR24";
+    opts.iterations = 50U;
+    opts.passes = 20U;
+    opts.poolDepth = 4U;
+
+    if (parseOptions(argc, argv, opts) == false) {
+        return 1;
+    }
+
+    uint32_t format = parseFourcc(opts.format);
+    if (DrmFormat::info(format) == nullptr) {
+        fprintf(stderr, "Unsupported format %s\n", opts.format.c_str());
+        return 1;
+    }
+    auto resolutions = parseResolutions(opts.resolutions);
+    if (resolutions.empty()) {
+        fprintf(stderr, "Invalid resolution list %s\n", opts.resolutions.c_str());
+        return 1;
+    }
+
+    int drmFd = open(opts.card.c_str(), O_RDWR | O_CLOEXEC);
+    if (drmFd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", opts.card.c_str(), strerror(errno));
+        return 1;
+    }
+
+    typedef struct {
+        const char *name;
+        int kind;
+        AllocatorType type;
+    } Candidate;
+    static constexpr int KIND_DRM = 0;
+    static constexpr int KIND_POOLED = 1;
+    static constexpr int KIND_MEM = 2;
+    const Candidate candidates[] = {
+        {"drm-dumb", KIND_DRM, AllocatorType::DRM_ALLOCATOR_MMAP},
+        {"drm-dma-heap", KIND_DRM, AllocatorType::DRM_ALLOCATOR_HEAP_DMA},
+#ifdef SUPPORT_ION_ALLOCATOR
+        {"drm-ion", KIND_DRM, AllocatorType::DRM_ALLOCATOR_ION},
+#endif // SUPPORT_ION_ALLOCATOR
+        {"drm-dumb-pooled", KIND_POOLED, AllocatorType::DRM_ALLOCATOR_MMAP},
+#if defined(USE_DMA_HEAP)
+        {"mem-dma-heap", KIND_MEM, AllocatorType::DRM_ALLOCATOR_UNKNOWN},
+#else
+        {"mem-ion", KIND_MEM, AllocatorType::DRM_ALLOCATOR_UNKNOWN},
+#endif
+    };
+
+    bool written = writeReport(opts.output, "allocator", [&](JsonWriter &json) {
+        json.value("card", opts.card);
+        json.value("heap", opts.heap);
+        json.value("format", opts.format);
+        json.value("iterations", static_cast<uint64_t>(opts.iterations));
+        json.value("write_passes", static_cast<uint64_t>(opts.passes));
+        json.beginArray("results");
+        for (const auto &resolution : resolutions) {
+            BufferInfo info = makeInfo(resolution.first, resolution.second, format);
+            for (const auto &candidate : candidates) {
+                Result result = {};
+                MemoryAccounting::instance().resetPeak();
+                if (candidate.kind == KIND_DRM) {
+                    benchDrmAllocator(candidate.type, drmFd, info, opts, result);
+                } else if (candidate.kind == KIND_POOLED) {
+                    benchPooled(drmFd, info, opts, result);
+                } else {
+                    benchMemDevice(drmFd, info, opts, result);
+                }
+                result.peakBytes = MemoryAccounting::instance().stats(MemoryTag::DISPLAY).peak;
+                writeResult(json, candidate.name, resolution.first, resolution.second, result);
+                fprintf(stderr,
+                        "%-16s %4ux%-4u alloc p50 %8.1f us, free p50 %8.1f us, write %6.2f GB/s%s\n",
+                        candidate.name,
+                        resolution.first,
+                        resolution.second,
+                        result.alloc.percentile(0.50),
+                        result.free.percentile(0.50),
+                        result.writeGBps,
+                        result.available ? "" : " (unavailable)");
+            }
+        }
+        json.endArray();
+    });
+
+    close(drmFd);
+    return written ? 0 : 1;
+}
@@ -0,0 +1,367 @@
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "DrmDevice.h"
+
+namespace evs {
+namespace early {
+namespace bench {
+
+static inline uint64_t nowNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+/**
+ * @brief Collects samples (in microseconds) and reports percentiles.
+ */
+class Samples
+{
+public:
+    void reserve(size_t count) { m_values.reserve(count); }
+    void add(double value) { m_values.push_back(value); }
+    void addNs(uint64_t ns) { m_values.push_back(static_cast<double>(ns) / 1000.0); }
+    size_t count() const { return m_values.size(); }
+    bool empty() const { return m_values.empty(); }
+    void clear() { m_values.clear(); }
+
+    double percentile(double p) const {
+        if (m_values.empty()) {
+            return 0.0;
+        }
+        std::vector<double> sorted = m_values;
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size())));
+        rank = (rank > 0U) ? rank - 1U : 0U;
+        return sorted[std::min(rank, sorted.size() - 1U)];
+    }
+
+    double mean() const {
+        if (m_values.empty()) {
+            return 0.0;
+        }
+        double sum = 0.0;
+        for (double value : m_values) {
+            sum += value;
+        }
+        return sum / static_cast<double>(m_values.size());
+    }
+
+    double max() const {
+        return m_values.empty() ? 0.0 : *std::max_element(m_values.begin(), m_values.end());
+    }
+
+private:
+    std::vector<double> m_values{};
+};
+
+/**
+ * @brief Minimal streaming JSON writer for benchmark reports.
+ * Keys and values are written in call order, commas are inserted
+ * automatically. Strings are expected to be plain ASCII identifiers.
+ */
+class JsonWriter
+{
+public:
+    explicit JsonWriter(FILE *file)
+        : m_file(file) {
+    }
+
+    void beginObject(const char *key = nullptr) { open(key, '{'); }
+    void endObject() { close('}'); }
+    void beginArray(const char *key = nullptr) { open(key, '['); }
+    void endArray() { close(']'); }
+
+    void value(const char *key, const char *str) {
+        prefix(key);
+        fprintf(m_file, "\"%s\"", str);
+    }
+    void value(const char *key, const std::string &str) { value(key, str.c_str()); }
+    void value(const char *key, double number) {
+        prefix(key);
+        if (std::isfinite(number)) {
+            fprintf(m_file, "%.3f", number);
+        } else {
+            fprintf(m_file, "null");
+        }
+    }
+    void value(const char *key, uint64_t number) {
+        prefix(key);
+        fprintf(m_file, "%llu", static_cast<unsigned long long>(number));
+    }
+    void value(const char *key, bool flag) {
+        prefix(key);
+        fprintf(m_file, "%s", flag ? "true" : "false");
+    }
+    void null(const char *key) {
+        prefix(key);
+        fprintf(m_file, "null");
+    }
+
+    /**
+     * @brief Write p50/p90/p99/max/mean of @p samples as an object, or null
+     *        when nothing was measured.
+     */
+    void stats(const char *key, const Samples &samples) {
+        if (samples.empty()) {
+            null(key);
+            return;
+        }
+        beginObject(key);
+        value("count", static_cast<uint64_t>(samples.count()));
+        value("p50", samples.percentile(0.50));
+        value("p90", samples.percentile(0.90));
+        value("p99", samples.percentile(0.99));
+        value("max", samples.max());
+        value("mean", samples.mean());
+        endObject();
+    }
+
+    void finish() {
+        fprintf(m_file, "\n");
+        fflush(m_file);
+    }
+
+private:
+    void prefix(const char *key) {
+        if (m_first.empty() == false) {
+            if (m_first.back() == false) {
+                fprintf(m_file, ",");
+            }
+            m_first.back() = false;
+            fprintf(m_file, "\n%*s", static_cast<int>(m_first.size() * 2U), "");
+        }
+        if (key != nullptr) {
+            fprintf(m_file, "\"%s\": ", key);
+        }
+    }
+
+    void open(const char *key, char bracket) {
+        prefix(key);
+        fprintf(m_file, "%c", bracket);
+        m_first.push_back(true);
+    }
+
+    void close(char bracket) {
+        bool empty = m_first.empty() || m_first.back();
+        m_first.pop_back();
+        if (empty == false) {
+            fprintf(m_file, "\n%*s", static_cast<int>(m_first.size() * 2U), "");
+        }
+        fprintf(m_file, "%c", bracket);
+    }
+
+    FILE *m_file{nullptr};
+    std::vector<bool> m_first{};
+};
+
+/**
+ * @brief Parse a "WxH[,WxH...]" resolution list.
+ */
+static inline std::vector<std::pair<uint32_t, uint32_t>> parseResolutions(const std::string &list) {
+    std::vector<std::pair<uint32_t, uint32_t>> result{};
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        std::string item = list.substr(pos, (end == std::string::npos) ? std::string::npos : end - pos);
+        unsigned int width = 0;
+        unsigned int height = 0;
+        if (sscanf(item.c_str(), "%ux%u", &width, &height) == 2 && width > 0 && height > 0) {
+            result.emplace_back(width, height);
+        }
+        if (end == std::string::npos) {
+            break;
+        }
+        pos = end + 1U;
+    }
+    return result;
+}
+
+static inline FILE *openReport(const std::string &path) {
+    if (path.empty() || path == "-") {
+        return stdout;
+    }
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open %s for writing\n", path.c_str());
+    }
+    return file;
+}
+
+static inline void closeReport(FILE *file) {
+    if ((file != nullptr) && (file != stdout)) {
+        fclose(file);
+    }
+}
+
+/**
+ * @brief Command line of a benchmark, "--name value" pairs.
+ * Every option is bound to the variable holding its default, so the
+ * defaults are set before the options are added. --output, the JSON report
+ * bound to @p output, is always there.
+ */
+class OptionParser
+{
+public:
+    using Parse = std::function<bool(const char *value)>;
+
+    explicit OptionParser(std::string &output) {
+        std::string help = "JSON report, '-' for stdout (default " + output + ")";
+        add("--output <file>", help.c_str(), output);
+    }
+
+    /**
+     * @brief Add an option. @p usage is the flag and its placeholder, e.g.
+     *        "--frames <n>", @p help ends with the default.
+     */
+    void add(const char *usage, const char *help, Parse parse) {
+        std::string text = usage;
+        m_options.push_back({text.substr(0, text.find(' ')), text, help, std::move(parse)});
+    }
+    void add(const char *usage, const char *help, int &value) {
+        add(usage, help, [&value](const char *arg) {
+            value = atoi(arg);
+            return true;
+        });
+    }
+    void add(const char *usage, const char *help, uint32_t &value) {
+        add(usage, help, [&value](const char *arg) {
+            value = static_cast<uint32_t>(strtoul(arg, nullptr, 10));
+            return true;
+        });
+    }
+    void add(const char *usage, const char *help, double &value) {
+        add(usage, help, [&value](const char *arg) {
+            value = atof(arg);
+            return true;
+        });
+    }
+    void add(const char *usage, const char *help, bool &value) {
+        add(usage, help, [&value](const char *arg) {
+            value = (atoi(arg) != 0);
+            return true;
+        });
+    }
+    void add(const char *usage, const char *help, std::string &value) {
+        add(usage, help, [&value](const char *arg) {
+            value = arg;
+            return true;
+        });
+    }
+
+    /**
+     * @brief Parse @p argv. False on --help, an unknown option or a bad value.
+     */
+    bool parse(int argc, char **argv) const {
+        bool success = true;
+        for (int i = 1; (i < argc) && (success == true); i++) {
+            std::string arg = argv[i];
+            const Option *option = nullptr;
+            for (const auto &candidate : m_options) {
+                option = (candidate.name == arg) ? &candidate : option;
+            }
+            success = (option != nullptr) && (i + 1 < argc) && option->parse(argv[++i]);
+        }
+        return success;
+    }
+
+    /**
+     * @brief Print the options, --output last.
+     */
+    void usage(const char *name) const {
+        fprintf(stderr, "Usage: %s [options]\n", name);
+        for (size_t i = 1; i <= m_options.size(); i++) {
+            const Option &option = m_options[i % m_options.size()];
+            fprintf(stderr, "  %-20s%s\n", option.usage.c_str(), option.help.c_str());
+        }
+    }
+
+private:
+    typedef struct {
+        std::string name;
+        std::string usage;
+        std::string help;
+        Parse parse;
+    } Option;
+
+    std::vector<Option> m_options{};
+};
+
+/**
+ * @brief Write the JSON report of @p benchmark to @p path, one object with
+ *        the name and whatever @p body writes.
+ */
+static inline bool writeReport(const std::string &path, const char *benchmark, const std::function<void(JsonWriter &json)> &body) {
+    FILE *report = openReport(path);
+    if (report == nullptr) {
+        return false;
+    }
+    JsonWriter json(report);
+    json.beginObject();
+    json.value("benchmark", benchmark);
+    body(json);
+    json.endObject();
+    json.finish();
+    closeReport(report);
+    return true;
+}
+
+/**
+ * @brief The device fields of a report.
+ */
+static inline void writeDevice(JsonWriter &json, drm::DrmDevice &device) {
+    json.value("card", device.getCardName());
+    json.value("driver", device.getDriverName());
+    json.value("atomic", device.isAtomic());
+}
+
+/**
+ * @brief Connected connectors of @p device, with @p activeCrtc only those a
+ *        CRTC already drives (vkms lights its CRTC when loaded).
+ */
+static inline std::vector<const drm::DrmConnectorInfo *> findDisplays(drm::DrmDevice &device, bool activeCrtc) {
+    std::vector<const drm::DrmConnectorInfo *> displays{};
+    for (const auto &entry : device.getConnectors()) {
+        if ((entry.second.connected == true) && ((activeCrtc == false) || (entry.second.encoder.crtc.id != 0U))) {
+            displays.push_back(&entry.second);
+        }
+    }
+    return displays;
+}
+
+/**
+ * @brief Open @p device and pick its first display (see findDisplays()).
+ * @return nullptr with the device closed if there is none.
+ */
+static inline const drm::DrmConnectorInfo *openDisplay(drm::DrmDevice &device, int card, bool activeCrtc = true) {
+    if ((device.open() == false) || (device.eventLoop() == nullptr)) {
+        fprintf(stderr, "Failed to open card %d\n", card);
+        return nullptr;
+    }
+    device.queryAllDeviceInfo();
+    std::vector<const drm::DrmConnectorInfo *> displays = findDisplays(device, activeCrtc);
+    if (displays.empty() == true) {
+        fprintf(stderr, "No usable connector on card %d\n", card);
+        device.close();
+        return nullptr;
+    }
+    return displays.front();
+}
+
+} // namespace bench
+} // namespace early
+} // namespace evs
+
+#endif // BENCHUTIL_H
@@ -0,0 +1,162 @@
+#include "BenchUtil.h"
+#include "DrmDevice.h"
+#include "FastCopy.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+/**
+ * Display commit benchmark.
+ *
+ * Shows two alternating buffers on the first connected connector and
+ * compares the per-frame submission paths of DrmDevice: a legacy
+ * drmModeSetCrtc() modeset per frame, legacy page flips and atomic
+ * nonblocking FB_ID commits. For each it reports the CPU cost of the
+ * submit call and the interval between completed frames. Runs on vkms:
+ *
+ *   modprobe vkms && ./CommitBench --card 0 --frames 300 --output commit.json
+ */
+
+using namespace evs::early;
+using namespace evs::early::drm;
+using namespace evs::early::bench;
+
+namespace {
+
+typedef struct {
+    int card;
+    uint32_t frames;
+    std::string output;
+} Options;
+
+typedef struct {
+    const char *name;
+    bool available;
+    Samples submit;
+    Samples interval;
+    uint32_t failures;
+} Result;
+
+static constexpr int PATH_SETCRTC = 0;
+static constexpr int PATH_PAGE_FLIP = 1;
+static constexpr int PATH_ATOMIC = 2;
+
+static bool parseOptions(int argc, char **argv, Options &opts) {
+    OptionParser parser(opts.output);
+    parser.add("--card <n>", "DRM card index (default 0)", opts.card);
+    parser.add("--frames <n>", "frames per submission path (default 300)", opts.frames);
+    if ((parser.parse(argc, argv) == false) || (opts.frames == 0U)) {
+        parser.usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+static void runPath(DrmDevice &device, int path, uint32_t frames, Result &result) {
+    if (path == PATH_ATOMIC) {
+        device.setAtomicEnabled(true);
+        if (device.isAtomic() == false) {
+            return;
+        }
+    } else {
+        device.setAtomicEnabled(false);
+    }
+    result.available = true;
+
+    uint64_t last = 0;
+    for (uint32_t i = 0; i < frames; i++) {
+        uint64_t start = nowNs();
+        bool ok = false;
+        if (path == PATH_SETCRTC) {
+            ok = device.setModeCrtc(device.buffer(static_cast<int>(i & 1U)));
+        } else {
+            int index = device.acquireBuffer(1000);
+            ok = (index >= 0) && device.queueBuffer(index, true);
+        }
+        result.submit.addNs(nowNs() - start);
+        if (ok == false) {
+            result.failures++;
+            continue;
+        }
+        if (path != PATH_SETCRTC) {
+            // Measure completed frames, not submissions
+            device.waitFlipEvent();
+        }
+        uint64_t now = nowNs();
+        if (last != 0U) {
+            result.interval.addNs(now - last);
+        }
+        last = now;
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opts = {};
+    opts.card = 0;
+    opts.frames = 300U;
+    opts.output = "commit_bench.json";
+
+    if (parseOptions(argc, argv, opts) == false) {
+        return 1;
+    }
+
+    DrmDevice device(opts.card);
+    const DrmConnectorInfo *connector = openDisplay(device, opts.card);
+    if (connector == nullptr) {
+        return 1;
+    }
+    if (device.initDisplay(*connector, 32U) == false) {
+        fprintf(stderr, "Failed to initialize the display on card %d\n", opts.card);
+        device.close();
+        return 1;
+    }
+
+    // Distinguishable content, so flicker would be visible on a real panel
+    for (int i = 0; i < 2; i++) {
+        DrmBuffer *buffer = device.buffer(i);
+        FastCopy::fill(buffer->ptr, buffer->size, (i == 0) ? 0xff203040U : 0xff402030U);
+    }
+
+    Result results[] = {
+        {"setcrtc", false, {}, {}, 0U},
+        {"page_flip", false, {}, {}, 0U},
+        {"atomic", false, {}, {}, 0U},
+    };
+    for (int path = PATH_SETCRTC; path <= PATH_ATOMIC; path++) {
+        runPath(device, path, opts.frames, results[path]);
+    }
+    // Reported as supported, not as left by the last path
+    device.setAtomicEnabled(true);
+
+    writeReport(opts.output, "commit", [&](JsonWriter &json) {
+        writeDevice(json, device);
+        json.value("width", static_cast<uint64_t>(device.width()));
+        json.value("height", static_cast<uint64_t>(device.height()));
+        json.value("frames", static_cast<uint64_t>(opts.frames));
+        json.beginArray("results");
+        for (const auto &result : results) {
+            json.beginObject();
+            json.value("path", result.name);
+            json.value("available", result.available);
+            json.value("failures", static_cast<uint64_t>(result.failures));
+            json.stats("submit_us", result.submit);
+            json.stats("frame_interval_us", result.interval);
+            json.endObject();
+            fprintf(stderr,
+                    "%-10s submit p50 %8.1f us, p99 %8.1f us, frame p50 %8.1f us, failures %u\n",
+                    result.name,
+                    result.submit.percentile(0.50),
+                    result.submit.percentile(0.99),
+                    result.interval.percentile(0.50),
+                    result.failures);
+        }
+        json.endArray();
+    });
+
+    device.deInitDisplay();
+    device.close();
+    return 0;
+}
@@ -0,0 +1,304 @@
+#include "BenchUtil.h"
+#include "DrmAllocator.h"
+#include "FastCopy.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <drm/drm_fourcc.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Copy engine benchmark.
+ *
+ * First validates every FastCopy kernel against memcpy and a byte-wise
+ * reference fill for random sizes and misalignments; the benchmark exits
+ * with an error when a single byte differs. Then it measures full frame
+ * copies and fills with the libc routines and the FastCopy kernels into
+ * a cached (malloc) destination and into a write-combined dumb buffer
+ * mapping, for every resolution of the sweep.
+ *
+ *   ./CopyBench --card /dev/dri/card0 --sizes 1920x1080 --output copy.json
+ */
+
+using namespace evs::early;
+using namespace evs::early::drm;
+using namespace evs::early::bench;
+
+namespace {
+
+typedef struct {
+    std::string card;
+    std::string output;
+    std::string resolutions;
+    uint32_t iterations;
+    uint32_t validations;
+} Options;
+
+typedef struct {
+    const char *name;
+    uint8_t *ptr;
+    size_t stride;
+    DrmBuffer *drmBuffer;
+} Target;
+
+static constexpr uint32_t BYTES_PER_PIXEL = 4U;
+
+static bool parseOptions(int argc, char **argv, Options &opts) {
+    OptionParser parser(opts.output);
+    parser.add("--card <path>", "DRM card for the write-combined target (default /dev/dri/card0)", opts.card);
+    parser.add("--sizes <WxH,...>", "resolution sweep (default 1280x720,1920x1080,3840x2160)", opts.resolutions);
+    parser.add("--iterations <n>", "runs per operation (default 50)", opts.iterations);
+    parser.add("--validate <n>", "random validation cases (default 2000)", opts.validations);
+    if ((parser.parse(argc, argv) == false) || (opts.iterations == 0U)
+        || (parseResolutions(opts.resolutions).empty() == true)) {
+        parser.usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+static void referenceFill(uint8_t *dst, size_t size, uint32_t pattern) {
+    for (size_t i = 0; i < size; i++) {
+        dst[i] = static_cast<uint8_t>(pattern >> ((i & 3U) * 8U));
+    }
+}
+
+/**
+ * @brief Compare every kernel and mode against the reference implementation.
+ * @return Number of failed cases.
+ */
+static uint32_t validate(uint32_t cases) {
+    static constexpr size_t MAX_SIZE = 3U * FastCopy::STREAMING_THRESHOLD;
+    static const FastCopy::Mode modes[] = {FastCopy::Mode::AUTO, FastCopy::Mode::CACHED, FastCopy::Mode::STREAMING};
+
+    std::mt19937 rng(0x5eed);
+    std::vector<uint8_t> src(MAX_SIZE + 128U);
+    std::vector<uint8_t> dst(MAX_SIZE + 128U);
+    std::vector<uint8_t> ref(MAX_SIZE + 128U);
+    for (auto &byte : src) {
+        byte = static_cast<uint8_t>(rng());
+    }
+
+    uint32_t failures = 0;
+    for (uint32_t i = 0; i < cases; i++) {
+        size_t size = rng() % MAX_SIZE;
+        size_t srcOff = rng() % 64U;
+        size_t dstOff = rng() % 64U;
+        uint32_t pattern = static_cast<uint32_t>(rng());
+        FastCopy::Mode mode = modes[i % 3U];
+
+        std::fill(dst.begin(), dst.end(), 0xa5);
+        std::fill(ref.begin(), ref.end(), 0xa5);
+        FastCopy::copy(dst.data() + dstOff, src.data() + srcOff, size, mode);
+        std::memcpy(ref.data() + dstOff, src.data() + srcOff, size);
+        if (dst != ref) {
+            fprintf(stderr, "copy mismatch: size=%zu src+%zu dst+%zu\n", size, srcOff, dstOff);
+            failures++;
+        }
+
+        std::fill(dst.begin(), dst.end(), 0xa5);
+        std::fill(ref.begin(), ref.end(), 0xa5);
+        FastCopy::fill(dst.data() + dstOff, size, pattern, mode);
+        referenceFill(ref.data() + dstOff, size, pattern);
+        if (dst != ref) {
+            fprintf(stderr, "fill mismatch: size=%zu dst+%zu pattern=0x%08x\n", size, dstOff, pattern);
+            failures++;
+        }
+
+        // Strided copy and rect fill on a small random surface
+        size_t widthBytes = 1U + rng() % 512U;
+        size_t rows = 1U + rng() % 32U;
+        size_t srcStride = widthBytes + rng() % 64U;
+        size_t dstStride = widthBytes + rng() % 64U;
+        if ((dstOff + dstStride * rows <= dst.size()) && (srcOff + srcStride * rows <= src.size())) {
+            std::fill(dst.begin(), dst.end(), 0xa5);
+            std::fill(ref.begin(), ref.end(), 0xa5);
+            FastCopy::copy2D(dst.data() + dstOff, dstStride, src.data() + srcOff, srcStride, widthBytes, rows, mode);
+            for (size_t row = 0; row < rows; row++) {
+                std::memcpy(ref.data() + dstOff + row * dstStride, src.data() + srcOff + row * srcStride, widthBytes);
+            }
+            if (dst != ref) {
+                fprintf(stderr, "copy2D mismatch: width=%zu rows=%zu strides=%zu/%zu\n", widthBytes, rows, srcStride, dstStride);
+                failures++;
+            }
+
+            uint32_t bpp = 1U + static_cast<uint32_t>(rng() % 4U);
+            uint32_t w = static_cast<uint32_t>(widthBytes / bpp);
+            uint32_t x = (w > 1U) ? static_cast<uint32_t>(rng() % (w / 2U + 1U)) : 0U;
+            uint32_t y = static_cast<uint32_t>(rng() % rows);
+            uint32_t rw = w - x;
+            uint32_t rh = static_cast<uint32_t>(rows) - y;
+            std::fill(dst.begin(), dst.end(), 0xa5);
+            std::fill(ref.begin(), ref.end(), 0xa5);
+            FastCopy::fillRect(dst.data() + dstOff, dstStride, x, y, rw, rh, bpp, pattern, mode);
+            for (uint32_t line = y; line < y + rh; line++) {
+                uint8_t *pixel = ref.data() + dstOff + line * dstStride + x * bpp;
+                for (uint32_t px = 0; px < rw; px++) {
+                    for (uint32_t b = 0; b < bpp; b++) {
+                        pixel[b] = static_cast<uint8_t>(pattern >> (b * 8U));
+                    }
+                    pixel += bpp;
+                }
+            }
+            if (dst != ref) {
+                fprintf(stderr, "fillRect mismatch: %ux%u+%u+%u bpp=%u stride=%zu\n", rw, rh, x, y, bpp, dstStride);
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+static double gbps(size_t bytes, const Samples &samples) {
+    double us = samples.percentile(0.50);
+    return (us > 0.0) ? static_cast<double>(bytes) / (us * 1000.0) : 0.0;
+}
+
+static void runTarget(JsonWriter &json, const Target &target, uint32_t width, uint32_t height, uint32_t iterations) {
+    size_t rowBytes = static_cast<size_t>(width) * BYTES_PER_PIXEL;
+    size_t frameBytes = rowBytes * height;
+    size_t linearBytes = target.stride * height;
+    std::vector<uint8_t> frame(frameBytes);
+    for (size_t i = 0; i < frameBytes; i++) {
+        frame[i] = static_cast<uint8_t>(i * 7U);
+    }
+
+    Samples memcpyCost{};
+    Samples copyCost{};
+    Samples copy2DCost{};
+    Samples memsetCost{};
+    Samples fillCost{};
+    Samples rectCost{};
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint64_t start = nowNs();
+        std::memcpy(target.ptr, frame.data(), frameBytes);
+        memcpyCost.addNs(nowNs() - start);
+
+        start = nowNs();
+        FastCopy::copy(target.ptr, frame.data(), frameBytes);
+        copyCost.addNs(nowNs() - start);
+
+        start = nowNs();
+        FastCopy::copy2D(target.ptr, target.stride, frame.data(), rowBytes, rowBytes, height);
+        copy2DCost.addNs(nowNs() - start);
+
+        start = nowNs();
+        std::memset(target.ptr, static_cast<int>(i), linearBytes);
+        memsetCost.addNs(nowNs() - start);
+
+        start = nowNs();
+        FastCopy::fill(target.ptr, linearBytes, 0xff202020U);
+        fillCost.addNs(nowNs() - start);
+
+        start = nowNs();
+        FastCopy::fillRect(target.ptr, target.stride, width / 4U, height / 4U, width / 2U, height / 2U, BYTES_PER_PIXEL, 0xff00ff00U);
+        rectCost.addNs(nowNs() - start);
+    }
+
+    json.beginObject();
+    json.value("target", target.name);
+    json.value("width", static_cast<uint64_t>(width));
+    json.value("height", static_cast<uint64_t>(height));
+    json.value("stride", static_cast<uint64_t>(target.stride));
+    json.stats("memcpy_us", memcpyCost);
+    json.stats("fast_copy_us", copyCost);
+    json.stats("fast_copy2d_us", copy2DCost);
+    json.stats("memset_us", memsetCost);
+    json.stats("fast_fill_us", fillCost);
+    json.stats("fast_fill_rect_us", rectCost);
+    json.value("memcpy_gbps", gbps(frameBytes, memcpyCost));
+    json.value("fast_copy_gbps", gbps(frameBytes, copyCost));
+    json.value("memset_gbps", gbps(linearBytes, memsetCost));
+    json.value("fast_fill_gbps", gbps(linearBytes, fillCost));
+    json.endObject();
+
+    fprintf(stderr,
+            "%-8s %4ux%-4u copy %6.2f -> %6.2f GB/s, fill %6.2f -> %6.2f GB/s\n",
+            target.name,
+            width,
+            height,
+            gbps(frameBytes, memcpyCost),
+            gbps(frameBytes, copyCost),
+            gbps(linearBytes, memsetCost),
+            gbps(linearBytes, fillCost));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opts = {};
+    opts.card = "/dev/dri/card0";
+    opts.output = "copy_bench.json";
+    opts.resolutions = "1280x720,1920x1080,3840x2160";
+    opts.iterations = 50U;
+    opts.validations = 2000U;
+
+    if (parseOptions(argc, argv, opts) == false) {
+        return 1;
+    }
+    auto resolutions = parseResolutions(opts.resolutions);
+
+    uint32_t failures = validate(opts.validations);
+    fprintf(stderr, "backend %s, %u validation cases, %u failures\n", FastCopy::backend(), opts.validations, failures);
+    if (failures > 0U) {
+        return 1;
+    }
+
+    int drmFd = open(opts.card.c_str(), O_RDWR | O_CLOEXEC);
+    if (drmFd < 0) {
+        fprintf(stderr, "Failed to open %s, write-combined target skipped\n", opts.card.c_str());
+    }
+
+    bool written = writeReport(opts.output, "copy", [&](JsonWriter &json) {
+        json.value("backend", FastCopy::backend());
+        json.value("streaming_threshold", static_cast<uint64_t>(FastCopy::STREAMING_THRESHOLD));
+        json.value("validation_cases", static_cast<uint64_t>(opts.validations));
+        json.value("iterations", static_cast<uint64_t>(opts.iterations));
+        json.beginArray("results");
+        for (const auto &resolution : resolutions) {
+            uint32_t width = resolution.first;
+            uint32_t height = resolution.second;
+
+            // Cached target, padded like a typical kernel pitch so copy2D has work to do
+            size_t cachedStride = (static_cast<size_t>(width) * BYTES_PER_PIXEL + 255U) & ~static_cast<size_t>(255U);
+            if (cachedStride == static_cast<size_t>(width) * BYTES_PER_PIXEL) {
+                cachedStride += 256U;
+            }
+            void *cached = nullptr;
+            if (posix_memalign(&cached, 4096U, cachedStride * height) == 0) {
+                Target target = {"cached", static_cast<uint8_t *>(cached), cachedStride, nullptr};
+                runTarget(json, target, width, height, opts.iterations);
+                free(cached);
+            }
+
+            if (drmFd >= 0) {
+                BufferInfo info = {};
+                info.width = width;
+                info.height = height;
+                info.bpp = 32U;
+                info.depth = 24U;
+                info.format = DRM_FORMAT_XRGB8888;
+                info.tag = MemoryTag::DISPLAY;
+                DrmBuffer *buf = DrmAllocator::allocate(AllocatorType::DRM_ALLOCATOR_MMAP, drmFd, info);
+                if ((buf != nullptr) && (buf->ptr != nullptr)) {
+                    Target target = {"wc-dumb", static_cast<uint8_t *>(buf->ptr) + buf->offset, buf->stride, buf};
+                    runTarget(json, target, width, height, opts.iterations);
+                }
+                if (buf != nullptr) {
+                    DrmAllocator::release(drmFd, buf);
+                }
+            }
+        }
+        json.endArray();
+    });
+
+    if (drmFd >= 0) {
+        close(drmFd);
+    }
+    return written ? 0 : 1;
+}
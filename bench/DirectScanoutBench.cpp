@@ -0,0 +1,325 @@
+#include "BenchUtil.h"
+#include "DrmDevice.h"
+#include "DrmDirectScanout.h"
+#include "FastCopy.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * Direct scanout benchmark.
+ *
+ * Shows a ring of camera buffers (dumb buffers of a second DRM fd, shared as
+ * dma-bufs) through DrmDirectScanout and, for comparison, by copying each
+ * into the swapchain. Reports the CPU cost per frame, the frame interval
+ * and, for the direct path, the time until a frame is handed back. Also
+ * checks that presenting a dma-buf still on screen is refused with BUSY and
+ * that the frame on screen is still returned. Runs on vkms:
+ *
+ *   modprobe vkms && ./DirectScanoutBench --card 0 --frames 300 --output direct_scanout.json
+ */
+
+using namespace evs::early;
+using namespace evs::early::drm;
+using namespace evs::early::bench;
+
+namespace {
+
+typedef struct {
+    int card;
+    uint32_t frames;
+    uint32_t buffers;
+    std::string output;
+} Options;
+
+typedef struct {
+    const char *name;
+    uint32_t failures;
+    Samples cpu;
+    Samples interval;
+    Samples release;
+} Result;
+
+typedef struct {
+    DrmBuffer *buffer;
+    int dmaFd;
+    bool onScreen;
+    uint64_t presentedNs;
+} CameraSlot;
+
+static bool parseOptions(int argc, char **argv, Options &opts) {
+    OptionParser parser(opts.output);
+    parser.add("--card <n>", "DRM card index (default 0)", opts.card);
+    parser.add("--frames <n>", "frames per path (default 300)", opts.frames);
+    parser.add("--buffers <n>", "camera buffers in the ring (default 4)", opts.buffers);
+    if ((parser.parse(argc, argv) == false) || (opts.frames == 0U) || (opts.buffers < 2U)) {
+        parser.usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Camera frames handed back by DrmDirectScanout, on the event thread.
+ */
+class ReleaseQueue
+{
+public:
+    void release(void *userData) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        CameraSlot *slot = static_cast<CameraSlot *>(userData);
+        slot->onScreen = false;
+        m_latency.addNs(nowNs() - slot->presentedNs);
+        m_cond.notify_all();
+    }
+
+    bool waitFree(CameraSlot &slot, int timeoutMs) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        return m_cond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&slot]() { return slot.onScreen == false; });
+    }
+
+    void markOnScreen(CameraSlot &slot) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        slot.onScreen = true;
+        slot.presentedNs = nowNs();
+    }
+
+    void cancel(CameraSlot &slot) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        slot.onScreen = false;
+        m_cond.notify_all();
+    }
+
+    Samples takeLatency() {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        Samples latency = m_latency;
+        m_latency = Samples();
+        return latency;
+    }
+
+private:
+    std::mutex m_mtx;
+    std::condition_variable m_cond;
+    Samples m_latency{};
+};
+
+static DrmDirectScanout::Frame makeFrame(DrmDevice &device, CameraSlot &slot) {
+    DrmDirectScanout::Frame frame = {};
+    frame.dmaFd = slot.dmaFd;
+    frame.info.width = device.width();
+    frame.info.height = device.height();
+    frame.info.format = static_cast<int>(device.format());
+    frame.info.pitch = static_cast<int>(slot.buffer->stride);
+    frame.modifier = DrmImportCache::MODIFIER_NONE;
+    frame.encoding = DrmColorEncoding::DEFAULT;
+    frame.range = DrmColorRange::DEFAULT;
+    frame.userData = &slot;
+    return frame;
+}
+
+static void runDirect(DrmDevice &device, DrmDirectScanout &scanout, ReleaseQueue &queue, std::vector<CameraSlot> &slots, uint32_t frames, Result &result) {
+    uint64_t last = 0;
+    for (uint32_t i = 0; i < frames; i++) {
+        CameraSlot &slot = slots[i % slots.size()];
+        if (queue.waitFree(slot, 1000) == false) {
+            result.failures++;
+            continue;
+        }
+        queue.markOnScreen(slot);
+        uint64_t start = nowNs();
+        DrmDirectScanout::Path path = scanout.present(makeFrame(device, slot));
+        result.cpu.addNs(nowNs() - start);
+        if (path != DrmDirectScanout::Path::DIRECT) {
+            if (path != DrmDirectScanout::Path::DROPPED) {
+                queue.cancel(slot);
+            }
+            result.failures++;
+            continue;
+        }
+        device.waitFlipEvent();
+        uint64_t now = nowNs();
+        if (last != 0U) {
+            result.interval.addNs(now - last);
+        }
+        last = now;
+    }
+    result.release = queue.takeLatency();
+}
+
+static void runCopy(DrmDevice &device, std::vector<CameraSlot> &slots, uint32_t frames, Result &result) {
+    uint64_t last = 0;
+    for (uint32_t i = 0; i < frames; i++) {
+        const CameraSlot &slot = slots[i % slots.size()];
+        uint64_t start = nowNs();
+        int index = device.acquireBuffer(1000);
+        DrmBuffer *target = device.buffer(index);
+        bool ok = (target != nullptr);
+        if (ok == true) {
+            FastCopy::copy(target->ptr, slot.buffer->ptr, std::min(target->size, slot.buffer->size));
+            ok = device.queueBuffer(index, true);
+        }
+        result.cpu.addNs(nowNs() - start);
+        if (ok == false) {
+            result.failures++;
+            continue;
+        }
+        device.waitFlipEvent();
+        uint64_t now = nowNs();
+        if (last != 0U) {
+            result.interval.addNs(now - last);
+        }
+        last = now;
+    }
+}
+
+/**
+ * @brief Present a camera buffer while it is on screen: refused with BUSY,
+ *        and the frame shown returned once the next one replaced it.
+ */
+static bool checkBusy(DrmDevice &device, DrmDirectScanout &scanout, ReleaseQueue &queue, std::vector<CameraSlot> &slots) {
+    CameraSlot &first = slots[0];
+    CameraSlot &second = slots[1];
+    if ((queue.waitFree(first, 1000) == false) || (queue.waitFree(second, 1000) == false)) {
+        return false;
+    }
+    queue.markOnScreen(first);
+    if (scanout.present(makeFrame(device, first)) != DrmDirectScanout::Path::DIRECT) {
+        return false;
+    }
+    device.waitFlipEvent();
+    bool busy = (scanout.present(makeFrame(device, first)) == DrmDirectScanout::Path::BUSY);
+
+    queue.markOnScreen(second);
+    if (scanout.present(makeFrame(device, second)) != DrmDirectScanout::Path::DIRECT) {
+        queue.cancel(second);
+        return false;
+    }
+    device.waitFlipEvent();
+    bool returned = queue.waitFree(first, 1000);
+    queue.takeLatency();
+    return busy && returned;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opts = {};
+    opts.card = 0;
+    opts.frames = 300U;
+    opts.buffers = 4U;
+    opts.output = "direct_scanout_bench.json";
+
+    if (parseOptions(argc, argv, opts) == false) {
+        return 1;
+    }
+
+    DrmDevice device(opts.card);
+    const DrmConnectorInfo *connector = openDisplay(device, opts.card);
+    if (connector == nullptr) {
+        return 1;
+    }
+    if ((device.initDisplay(*connector, 32U) == false) || (device.planeAssigner() == nullptr)) {
+        fprintf(stderr, "No atomic display with plane assignment on card %d\n", opts.card);
+        device.close();
+        return 1;
+    }
+
+    // The camera side allocates on its own fd, as an exporter would
+    std::string node = "/dev/dri/card" + std::to_string(opts.card);
+    int cameraFd = ::open(node.c_str(), O_RDWR | O_CLOEXEC);
+    std::vector<CameraSlot> slots{};
+    for (uint32_t i = 0; (cameraFd >= 0) && (i < opts.buffers); i++) {
+        BufferInfo info = {};
+        info.width = device.width();
+        info.height = device.height();
+        info.bpp = 32U;
+        info.depth = 24U;
+        info.format = static_cast<int>(device.format());
+        info.tag = MemoryTag::CAMERA;
+        DrmBuffer *buffer = DrmAllocator::allocate(AllocatorType::DRM_ALLOCATOR_MMAP, cameraFd, info);
+        int dmaFd = DrmAllocator::exposeHandleToFd(cameraFd, buffer);
+        if (dmaFd < 0) {
+            DrmAllocator::release(cameraFd, buffer);
+            break;
+        }
+        FastCopy::fill(buffer->ptr, buffer->size, 0xff000000U | (0x00304050U * (i + 1U)));
+        slots.push_back({buffer, dmaFd, false, 0U});
+    }
+    if (slots.size() < opts.buffers) {
+        fprintf(stderr, "Failed to allocate %u camera buffers on %s\n", opts.buffers, node.c_str());
+        for (CameraSlot &slot : slots) {
+            DrmAllocator::release(cameraFd, slot.buffer);
+        }
+        if (cameraFd >= 0) {
+            ::close(cameraFd);
+        }
+        device.deInitDisplay();
+        device.close();
+        return 1;
+    }
+
+    ReleaseQueue queue;
+    Result results[] = {
+        {"direct", 0U, {}, {}, {}},
+        {"copy", 0U, {}, {}, {}},
+    };
+    bool busyPassed = false;
+    uint64_t direct = 0;
+    {
+        DrmDirectScanout scanout(device, [&queue](void *userData) { queue.release(userData); });
+        runDirect(device, scanout, queue, slots, opts.frames, results[0]);
+        busyPassed = checkBusy(device, scanout, queue, slots);
+        direct = scanout.directFrames();
+
+        // Swapchain flips switch the camera plane off and hand its frame back
+        scanout.stop();
+        runCopy(device, slots, opts.frames, results[1]);
+    }
+    fprintf(stderr, "present while on screen: %s\n", busyPassed ? "pass" : "FAIL");
+
+    writeReport(opts.output, "direct_scanout", [&](JsonWriter &json) {
+        writeDevice(json, device);
+        json.value("width", static_cast<uint64_t>(device.width()));
+        json.value("height", static_cast<uint64_t>(device.height()));
+        json.value("frames", static_cast<uint64_t>(opts.frames));
+        json.value("buffers", static_cast<uint64_t>(opts.buffers));
+        json.value("direct_frames", direct);
+        json.value("busy_check", busyPassed);
+        json.beginArray("results");
+        for (const Result &result : results) {
+            json.beginObject();
+            json.value("path", result.name);
+            json.value("failures", static_cast<uint64_t>(result.failures));
+            json.stats("cpu_us", result.cpu);
+            json.stats("frame_interval_us", result.interval);
+            json.stats("release_us", result.release);
+            json.endObject();
+            fprintf(stderr,
+                    "%-7s cpu p50 %8.1f us, p99 %8.1f us, frame p50 %8.1f us, release p50 %8.1f us, failures %u\n",
+                    result.name,
+                    result.cpu.percentile(0.50),
+                    result.cpu.percentile(0.99),
+                    result.interval.percentile(0.50),
+                    result.release.percentile(0.50),
+                    result.failures);
+        }
+        json.endArray();
+    });
+
+    for (CameraSlot &slot : slots) {
+        device.importCache()->evict(slot.dmaFd);
+        DrmAllocator::release(cameraFd, slot.buffer);
+    }
+    ::close(cameraFd);
+    device.deInitDisplay();
+    device.close();
+    return busyPassed ? 0 : 1;
+}
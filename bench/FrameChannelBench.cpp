@@ -0,0 +1,325 @@
+#include "BenchUtil.h"
+#include "FrameChannel.h"
+#include "MemAllocatorDevice.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <drm/drm_fourcc.h>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Frame channel IPC benchmark.
+ *
+ * A forked consumer process connects to a FramePublisher and returns every
+ * frame as soon as it arrives. The publisher measures the cost of
+ * publish(), the publish -> release round trip and the consumer measures
+ * the one-way latency from the capture timestamp. As reference, the report
+ * also contains the cost of copying one frame, which is what the channel
+ * avoids.
+ *
+ *   ./FrameChannelBench --frames 2000 --size 1920x1080 --output ipc.json
+ */
+
+using namespace evs::early;
+using namespace evs::early::bench;
+
+namespace {
+
+typedef struct {
+    std::string socket;
+    std::string heap;
+    std::string output;
+    std::string size;
+    uint32_t frames;
+    uint32_t buffers;
+    uint32_t credits;
+} Options;
+
+typedef struct {
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<uint64_t> sentNs;
+    std::vector<bool> inFlight;
+    Samples roundTrip;
+} PublisherState;
+
+typedef struct {
+    int fd;
+    void *ptr;
+    size_t size;
+    BufferHandlePtr handle;
+} Buffer;
+
+static bool parseOptions(int argc, char **argv, Options &opts) {
+    OptionParser parser(opts.output);
+    parser.add("--frames <n>", "frames to publish (default 2000)", opts.frames);
+    parser.add("--size <WxH>", "NV12 frame size (default 1920x1080)", opts.size);
+    parser.add("--buffers <n>", "buffers in the ring (default 4)", opts.buffers);
+    parser.add("--credits <n>", "consumer credits (default 2)", opts.credits);
+    parser.add("--socket <path>", "socket path (default /tmp/evs_frame_bench.sock)", opts.socket);
+    parser.add("--heap <path>", "dma-heap, falls back to memfd (default /dev/dma_heap/system)", opts.heap);
+    if ((parser.parse(argc, argv) == false) || (opts.frames == 0U) || (opts.buffers == 0U)
+        || (parseResolutions(opts.size).empty() == true)) {
+        parser.usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Consumer process: receive, touch and release every frame, then
+ *        write the one-way latencies (in ns) to @p resultFd.
+ */
+static int runConsumer(const Options &opts, int resultFd) {
+    FrameConsumer consumer;
+    int ret = -1;
+    for (int attempt = 0; attempt < 200; attempt++) {
+        ret = consumer.connect(opts.socket, opts.credits);
+        if (ret == 0) {
+            break;
+        }
+        usleep(5000);
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Consumer failed to connect: %d\n", ret);
+        return 1;
+    }
+
+    std::vector<uint64_t> latencies{};
+    latencies.reserve(opts.frames);
+    SharedFrame frame = {};
+    while (consumer.receive(frame, 1000) == 0) {
+        latencies.push_back(nowNs() - frame.timestampNs);
+        consumer.release(frame);
+    }
+    consumer.disconnect();
+
+    size_t bytes = latencies.size() * sizeof(uint64_t);
+    const char *data = reinterpret_cast<const char *>(latencies.data());
+    while (bytes > 0U) {
+        ssize_t written = write(resultFd, data, bytes);
+        if (written <= 0) {
+            break;
+        }
+        data += written;
+        bytes -= static_cast<size_t>(written);
+    }
+    close(resultFd);
+    return 0;
+}
+
+static void onReleased(uint32_t bufferId, void *param) {
+    PublisherState *state = static_cast<PublisherState *>(param);
+    uint64_t now = nowNs();
+    std::unique_lock<std::mutex> lock(state->mtx);
+    if (bufferId < state->inFlight.size()) {
+        state->roundTrip.addNs(now - state->sentNs[bufferId]);
+        state->inFlight[bufferId] = false;
+    }
+    state->cv.notify_all();
+}
+
+static bool allocateBuffers(const Options &opts, size_t size, std::vector<Buffer> &buffers) {
+    MemDevice device(opts.heap, MemoryTag::CAMERA);
+    bool useHeap = (device.open() == 0);
+    for (uint32_t i = 0; i < opts.buffers; i++) {
+        Buffer buffer = {};
+        if (useHeap) {
+            buffer.handle = device.allocate(size);
+            if (buffer.handle == nullptr) {
+                return false;
+            }
+            buffer.fd = buffer.handle->fd;
+            buffer.ptr = buffer.handle->virt;
+            buffer.size = buffer.handle->length;
+        } else {
+            buffer.fd = memfd_create("evs-frame", MFD_CLOEXEC);
+            if ((buffer.fd < 0) || (ftruncate(buffer.fd, static_cast<off_t>(size)) != 0)) {
+                return false;
+            }
+            buffer.ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer.fd, 0);
+            if (buffer.ptr == MAP_FAILED) {
+                return false;
+            }
+            buffer.size = size;
+        }
+        buffers.push_back(buffer);
+    }
+    device.close();
+    return true;
+}
+
+static void freeBuffers(std::vector<Buffer> &buffers) {
+    for (auto &buffer : buffers) {
+        if (buffer.handle == nullptr) {
+            munmap(buffer.ptr, buffer.size);
+            close(buffer.fd);
+        }
+    }
+    buffers.clear();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opts = {};
+    opts.socket = "/tmp/evs_frame_bench.sock";
+    opts.heap = "/dev/dma_heap/system";
+    opts.output = "frame_channel_bench.json";
+    opts.size = "1920x1080";
+    opts.frames = 2000U;
+    opts.buffers = 4U;
+    opts.credits = 2U;
+
+    if (parseOptions(argc, argv, opts) == false) {
+        return 1;
+    }
+    auto resolutions = parseResolutions(opts.size);
+    uint32_t width = resolutions.front().first;
+    uint32_t height = resolutions.front().second;
+    size_t frameSize = static_cast<size_t>(width) * height * 3U / 2U;
+
+    std::vector<Buffer> buffers{};
+    if (allocateBuffers(opts, frameSize, buffers) == false) {
+        fprintf(stderr, "Failed to allocate %u frame buffers\n", opts.buffers);
+        freeBuffers(buffers);
+        return 1;
+    }
+
+    int pipeFds[2] = {-1, -1};
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+        freeBuffers(buffers);
+        return 1;
+    }
+
+    // Fork before any thread exists, the consumer retries until the socket is up
+    pid_t child = fork();
+    if (child == 0) {
+        close(pipeFds[0]);
+        _exit(runConsumer(opts, pipeFds[1]));
+    }
+    close(pipeFds[1]);
+
+    FramePublisher publisher;
+    PublisherState state;
+    state.sentNs.assign(opts.buffers, 0U);
+    state.inFlight.assign(opts.buffers, false);
+    publisher.setReleaseCallback(onReleased, &state);
+    if (publisher.start(opts.socket) != 0) {
+        fprintf(stderr, "Failed to start publisher on %s\n", opts.socket.c_str());
+        close(pipeFds[0]);
+        kill(child, SIGTERM);
+        waitpid(child, nullptr, 0);
+        freeBuffers(buffers);
+        return 1;
+    }
+
+    while (publisher.consumerCount() == 0U) {
+        usleep(1000);
+    }
+    // Let the HELLO with the credits arrive
+    usleep(10000);
+
+    FrameLayout layout = {};
+    layout.width = width;
+    layout.height = height;
+    layout.format = DRM_FORMAT_NV12;
+    layout.planes = 2U;
+    layout.strides[0] = width;
+    layout.strides[1] = width;
+    layout.offsets[1] = width * height;
+
+    Samples publishCost{};
+    publishCost.reserve(opts.frames);
+    uint64_t sentFrames = 0;
+    uint64_t start = nowNs();
+    for (uint32_t seq = 0; seq < opts.frames; seq++) {
+        uint32_t bufferId = seq % opts.buffers;
+        {
+            // Wait for the buffer to come back, like a camera ring would
+            std::unique_lock<std::mutex> lock(state.mtx);
+            state.cv.wait_for(lock, std::chrono::milliseconds(100), [&] { return state.inFlight[bufferId] == false; });
+            if (state.inFlight[bufferId] == true) {
+                continue;
+            }
+            state.sentNs[bufferId] = nowNs();
+            state.inFlight[bufferId] = true;
+        }
+        uint64_t ts = nowNs();
+        int sent = publisher.publish(bufferId, buffers[bufferId].fd, layout, seq, ts);
+        publishCost.addNs(nowNs() - ts);
+        if (sent <= 0) {
+            std::unique_lock<std::mutex> lock(state.mtx);
+            state.inFlight[bufferId] = false;
+        } else {
+            sentFrames++;
+        }
+    }
+    uint64_t elapsed = nowNs() - start;
+
+    // Let the last releases arrive before tearing down
+    {
+        std::unique_lock<std::mutex> lock(state.mtx);
+        state.cv.wait_for(lock, std::chrono::milliseconds(500), [&] {
+            for (bool busy : state.inFlight) {
+                if (busy) {
+                    return false;
+                }
+            }
+            return true;
+        });
+    }
+    publisher.stop();
+
+    Samples oneWay{};
+    uint64_t latency = 0;
+    while (read(pipeFds[0], &latency, sizeof(latency)) == static_cast<ssize_t>(sizeof(latency))) {
+        oneWay.addNs(latency);
+    }
+    close(pipeFds[0]);
+    waitpid(child, nullptr, 0);
+
+    // Reference: what a shared memory copy of every frame would cost
+    Samples copyCost{};
+    std::vector<uint8_t> staging(frameSize);
+    for (uint32_t i = 0; i < 20U; i++) {
+        uint64_t copyStart = nowNs();
+        memcpy(staging.data(), buffers[i % buffers.size()].ptr, frameSize);
+        copyCost.addNs(nowNs() - copyStart);
+    }
+
+    writeReport(opts.output, "frame_channel", [&](JsonWriter &json) {
+        json.value("width", static_cast<uint64_t>(width));
+        json.value("height", static_cast<uint64_t>(height));
+        json.value("frame_bytes", static_cast<uint64_t>(frameSize));
+        json.value("buffers", static_cast<uint64_t>(opts.buffers));
+        json.value("credits", static_cast<uint64_t>(opts.credits));
+        json.value("frames_requested", static_cast<uint64_t>(opts.frames));
+        json.value("frames_sent", sentFrames);
+        json.value("frames_dropped", publisher.droppedFrames());
+        json.value("frames_per_second", (elapsed > 0U) ? static_cast<double>(sentFrames) * 1e9 / static_cast<double>(elapsed) : 0.0);
+        json.stats("publish_us", publishCost);
+        json.stats("one_way_us", oneWay);
+        json.stats("round_trip_us", state.roundTrip);
+        json.stats("frame_copy_us", copyCost);
+    });
+
+    fprintf(stderr,
+            "frames %llu, publish p50 %.1f us, one-way p50 %.1f us, round trip p50 %.1f us, copy p50 %.1f us\n",
+            static_cast<unsigned long long>(sentFrames),
+            publishCost.percentile(0.50),
+            oneWay.percentile(0.50),
+            state.roundTrip.percentile(0.50),
+            copyCost.percentile(0.50));
+
+    freeBuffers(buffers);
+    return 0;
+}
@@ -0,0 +1,235 @@
+#include "BenchUtil.h"
+#include "DrmDevice.h"
+#include "DrmFrameScheduler.h"
+#include "FastCopy.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Just-in-time rendering benchmark.
+ *
+ * Simulates a camera delivering frames at --fps and renders every frame
+ * into the DrmDevice swapchain, once starting as soon as the frame arrives
+ * (the plain render loop) and once at the time DrmFrameScheduler picks for
+ * the next vblank. Reports the latency from the capture of the frame that
+ * was rendered to the flip event that showed it, and the frames that missed
+ * the vblank they were scheduled for. The render time of a frame is drawn
+ * from the same seeded sequence for both runs:
+ *
+ *   render = --render-us + uniform(-jitter, +jitter)
+ *
+ * A camera not locked to the display, e.g. 29.97 fps on 60 Hz, arrives at
+ * every phase of the vblank over a few hundred frames. Runs on vkms:
+ *
+ *   modprobe vkms && ./FrameSchedulerBench --card 0 --frames 600 --output frame_scheduler.json
+ */
+
+using namespace evs::early;
+using namespace evs::early::drm;
+using namespace evs::early::bench;
+
+namespace {
+
+typedef struct {
+    int card;
+    uint32_t frames;
+    double fps;
+    uint32_t renderUs;
+    uint32_t jitterUs;
+    uint32_t marginUs;
+    uint32_t seed;
+    std::string output;
+} Options;
+
+typedef struct {
+    const char *name;
+    bool scheduled;
+    bool available;
+    Samples latency;
+    Samples wait;
+    uint32_t missed;
+    uint32_t failures;
+} Result;
+
+static bool parseOptions(int argc, char **argv, Options &opts) {
+    OptionParser parser(opts.output);
+    std::string margin = "scheduler margin before the vblank (default " + std::to_string(DrmFrameScheduler::DEFAULT_MARGIN_US) + ")";
+    parser.add("--card <n>", "DRM card index (default 0)", opts.card);
+    parser.add("--frames <n>", "camera frames per run (default 600)", opts.frames);
+    parser.add("--fps <f>", "camera frame rate (default 29.97)", opts.fps);
+    parser.add("--render-us <n>", "mean render time (default 4000)", opts.renderUs);
+    parser.add("--jitter-us <n>", "uniform render jitter (default 1000)", opts.jitterUs);
+    parser.add("--margin-us <n>", margin.c_str(), opts.marginUs);
+    parser.add("--seed <n>", "render time sequence seed (default 1)", opts.seed);
+    if ((parser.parse(argc, argv) == false) || (opts.frames == 0U) || (opts.fps <= 0.0)) {
+        parser.usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+static inline uint64_t nowUs() {
+    return nowNs() / 1000U;
+}
+
+static void sleepUntilUs(uint64_t deadlineUs) {
+    // Sleep most of the way, spin the rest for sub-scheduler-tick accuracy
+    uint64_t now = nowUs();
+    if (deadlineUs > now + 1000U) {
+        std::this_thread::sleep_for(std::chrono::microseconds(deadlineUs - now - 1000U));
+    }
+    while (nowUs() < deadlineUs) {
+    }
+}
+
+static void runMode(DrmDevice &device, DrmFrameScheduler &scheduler, const Options &opts, const std::vector<uint64_t> &renderUs, Result &result) {
+    uint64_t cameraPeriodUs = static_cast<uint64_t>(1000000.0 / opts.fps);
+    uint64_t periodUs = scheduler.periodUs();
+    uint64_t firstCapture = nowUs() + cameraPeriodUs;
+    uint64_t lastFrame = 0;
+    bool rendered = false;
+
+    for (uint32_t i = 0; i < opts.frames; i++) {
+        // Wait for a camera frame newer than the last one rendered
+        uint64_t frame = rendered ? lastFrame + 1U : 0U;
+        uint64_t ready = firstCapture + frame * cameraPeriodUs;
+        sleepUntilUs(ready);
+
+        uint64_t start = ready;
+        uint64_t target = 0;
+        if (result.scheduled == true) {
+            start = scheduler.nextStartUs(ready);
+            target = scheduler.predictVblankUs(start + scheduler.budgetUs() - 1U);
+            sleepUntilUs(start);
+        }
+        // The freshest frame at the start is the one rendered
+        uint64_t begin = nowUs();
+        frame = (begin - firstCapture) / cameraPeriodUs;
+        uint64_t captured = firstCapture + frame * cameraPeriodUs;
+        lastFrame = frame;
+        rendered = true;
+        result.wait.add(static_cast<double>(begin - ready));
+
+        int index = device.acquireBuffer(1000);
+        DrmBuffer *buffer = device.buffer(index);
+        if (buffer == nullptr) {
+            result.failures++;
+            continue;
+        }
+        std::future<DrmEventLoop::Event> flip = device.eventLoop()->nextFlip(device.crtcId());
+        FastCopy::fill(buffer->ptr, buffer->size, 0xff000000U | static_cast<uint32_t>(frame & 0xffU));
+        sleepUntilUs(begin + renderUs[i]);
+        scheduler.addRenderTime(nowUs() - begin);
+
+        if ((device.queueBuffer(index, true) == false)
+            || (flip.wait_for(std::chrono::milliseconds(1000)) != std::future_status::ready)) {
+            result.failures++;
+            continue;
+        }
+        DrmEventLoop::Event event = flip.get();
+        result.latency.add(static_cast<double>(event.timeUs - captured));
+        if ((target != 0U) && (event.timeUs > target + periodUs / 2U)) {
+            result.missed++;
+        }
+    }
+    result.available = true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opts = {};
+    opts.card = 0;
+    opts.frames = 600U;
+    opts.fps = 29.97;
+    opts.renderUs = 4000U;
+    opts.jitterUs = 1000U;
+    opts.marginUs = DrmFrameScheduler::DEFAULT_MARGIN_US;
+    opts.seed = 1U;
+    opts.output = "frame_scheduler_bench.json";
+
+    if (parseOptions(argc, argv, opts) == false) {
+        return 1;
+    }
+
+    DrmDevice device(opts.card);
+    const DrmConnectorInfo *connector = openDisplay(device, opts.card);
+    if (connector == nullptr) {
+        return 1;
+    }
+    if (device.initDisplay(*connector, 32U) == false) {
+        fprintf(stderr, "Failed to initialize the display on card %d\n", opts.card);
+        device.close();
+        return 1;
+    }
+
+    DrmFrameScheduler scheduler(device);
+    scheduler.setMarginUs(opts.marginUs);
+    if (scheduler.start() == false) {
+        device.deInitDisplay();
+        device.close();
+        return 1;
+    }
+
+    // One render time sequence shared by both runs
+    std::mt19937 rng(opts.seed);
+    std::uniform_int_distribution<int64_t> jitter(-static_cast<int64_t>(opts.jitterUs), static_cast<int64_t>(opts.jitterUs));
+    std::vector<uint64_t> renderUs(opts.frames);
+    for (auto &us : renderUs) {
+        us = static_cast<uint64_t>(std::max<int64_t>(0, static_cast<int64_t>(opts.renderUs) + jitter(rng)));
+    }
+
+    Result results[] = {
+        {"immediate", false, false, {}, {}, 0U, 0U},
+        {"scheduled", true, false, {}, {}, 0U, 0U},
+    };
+    for (auto &result : results) {
+        runMode(device, scheduler, opts, renderUs, result);
+    }
+    double immediate = results[0].latency.mean();
+    double reduction = (immediate > 0.0) ? (immediate - results[1].latency.mean()) / immediate : 0.0;
+
+    writeReport(opts.output, "frame_scheduler", [&](JsonWriter &json) {
+        writeDevice(json, device);
+        json.value("frames", static_cast<uint64_t>(opts.frames));
+        json.value("camera_fps", opts.fps);
+        json.value("vblank_us", static_cast<double>(scheduler.periodUs()));
+        json.value("render_us", static_cast<uint64_t>(opts.renderUs));
+        json.value("jitter_us", static_cast<uint64_t>(opts.jitterUs));
+        json.value("margin_us", static_cast<uint64_t>(opts.marginUs));
+        json.value("mean_latency_reduction", reduction);
+        json.beginArray("results");
+        for (const auto &result : results) {
+            json.beginObject();
+            json.value("mode", result.name);
+            json.value("available", result.available);
+            json.value("missed_vblanks", static_cast<uint64_t>(result.missed));
+            json.value("failures", static_cast<uint64_t>(result.failures));
+            json.stats("latency_us", result.latency);
+            json.stats("start_delay_us", result.wait);
+            json.endObject();
+            fprintf(stderr,
+                    "%-10s latency mean %8.1f us, p50 %8.1f us, p99 %8.1f us, missed %u, failures %u\n",
+                    result.name,
+                    result.latency.mean(),
+                    result.latency.percentile(0.50),
+                    result.latency.percentile(0.99),
+                    result.missed,
+                    result.failures);
+        }
+        json.endArray();
+    });
+    fprintf(stderr, "mean latency reduction %.1f%%\n", reduction * 100.0);
+
+    scheduler.stop();
+    device.deInitDisplay();
+    device.close();
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include "BenchUtil.h"
+#include "DrmDevice.h"
+#include "FastCopy.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <string>
+
+/**
+ * Boot handoff benchmark.
+ *
+ * Measures the time to first frame, from initDisplay() to the flip event of
+ * the first frame rendered after it, with a full modeset and with the CRTC
+ * adopted as left running (DrmHandoff::REUSE, and COPY with --copy 1). Runs
+ * alternate, every run leaves the CRTC lit for the next one the way a
+ * bootloader splash would. Runs on vkms:
+ *
+ *   modprobe vkms && ./HandoffBench --card 0 --runs 20 --output handoff.json
+ */
+
+using namespace evs::early;
+using namespace evs::early::drm;
+using namespace evs::early::bench;
+
+namespace {
+
+typedef struct {
+    int card;
+    uint32_t runs;
+    bool copy;
+    std::string output;
+} Options;
+
+typedef struct {
+    const char *name;
+    DrmHandoff handoff;
+    uint32_t adopted;
+    uint32_t failures;
+    Samples init;
+    Samples firstFrame;
+} Result;
+
+static bool parseOptions(int argc, char **argv, Options &opts) {
+    OptionParser parser(opts.output);
+    parser.add("--card <n>", "DRM card index (default 0)", opts.card);
+    parser.add("--runs <n>", "runs per mode (default 20)", opts.runs);
+    parser.add("--copy <0|1>", "also measure copying the splash into the buffers (default 0)", opts.copy);
+    if ((parser.parse(argc, argv) == false) || (opts.runs == 0U)) {
+        parser.usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+static void runOnce(DrmDevice &device, const DrmConnectorInfo &connector, uint32_t run, Result &result) {
+    device.setHandoff(result.handoff);
+    uint64_t start = nowNs();
+    if (device.initDisplay(connector, 32U) == false) {
+        result.failures++;
+        return;
+    }
+    uint64_t initialized = nowNs();
+    result.init.addNs(initialized - start);
+    if (device.isHandedOff() == true) {
+        result.adopted++;
+    }
+
+    // The first camera frame
+    int index = device.acquireBuffer(1000);
+    DrmBuffer *buffer = device.buffer(index);
+    std::future<DrmEventLoop::Event> flip = device.eventLoop()->nextFlip(device.crtcId());
+    bool shown = (buffer != nullptr);
+    if (shown == true) {
+        FastCopy::fill(buffer->ptr, buffer->size, 0xff000000U | ((run * 0x30U) & 0xffU));
+        shown = (device.queueBuffer(index, true) == true)
+                && (flip.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    }
+    if (shown == false) {
+        result.failures++;
+    } else {
+        // Flip events are stamped with CLOCK_MONOTONIC, like nowNs()
+        uint64_t flipNs = flip.get().timeUs * 1000U;
+        result.firstFrame.addNs((flipNs > start) ? (flipNs - start) : 0U);
+    }
+    device.deInitDisplay();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opts = {};
+    opts.card = 0;
+    opts.runs = 20U;
+    opts.copy = false;
+    opts.output = "handoff_bench.json";
+
+    if (parseOptions(argc, argv, opts) == false) {
+        return 1;
+    }
+
+    DrmDevice device(opts.card);
+    const DrmConnectorInfo *connector = openDisplay(device, opts.card);
+    if (connector == nullptr) {
+        return 1;
+    }
+
+    Result results[] = {
+        {"modeset", DrmHandoff::NONE, 0U, 0U, {}, {}},
+        {"handoff", DrmHandoff::REUSE, 0U, 0U, {}, {}},
+        {"handoff_copy", DrmHandoff::COPY, 0U, 0U, {}, {}},
+    };
+    size_t modes = opts.copy ? 3U : 2U;
+    for (uint32_t run = 0; run < opts.runs; run++) {
+        for (size_t mode = 0; mode < modes; mode++) {
+            runOnce(device, *connector, run, results[mode]);
+        }
+    }
+
+    writeReport(opts.output, "handoff", [&](JsonWriter &json) {
+        writeDevice(json, device);
+        json.value("runs", static_cast<uint64_t>(opts.runs));
+        json.beginArray("results");
+        for (size_t mode = 0; mode < modes; mode++) {
+            const Result &result = results[mode];
+            json.beginObject();
+            json.value("mode", result.name);
+            json.value("adopted", static_cast<uint64_t>(result.adopted));
+            json.value("failures", static_cast<uint64_t>(result.failures));
+            json.stats("init_us", result.init);
+            json.stats("first_frame_us", result.firstFrame);
+            json.endObject();
+            fprintf(stderr,
+                    "%-12s adopted %u/%u, init p50 %9.1f us, first frame p50 %9.1f us, p99 %9.1f us, failures %u\n",
+                    result.name,
+                    result.adopted,
+                    opts.runs,
+                    result.init.percentile(0.50),
+                    result.firstFrame.percentile(0.50),
+                    result.firstFrame.percentile(0.99),
+                    result.failures);
+        }
+        json.endArray();
+    });
+
+    device.close();
+    return 0;
+}
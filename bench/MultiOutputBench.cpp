@@ -0,0 +1,168 @@
+#include "BenchUtil.h"
+#include "DrmDevice.h"
+#include "DrmOutputGroup.h"
+#include "FastCopy.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * Multi-output commit benchmark.
+ *
+ * Drives every connected connector through one DrmOutputGroup and compares
+ * one atomic commit for all outputs with one commit per output. For each
+ * it reports the CPU cost of commit() and the interval between frames that
+ * landed on all displays. Needs a device with two or more outputs, e.g. a
+ * vkms device with several connectors created through configfs:
+ *
+ *   ./MultiOutputBench --card 1 --frames 300 --output multi_output.json
+ */
+
+using namespace evs::early;
+using namespace evs::early::drm;
+using namespace evs::early::bench;
+
+namespace {
+
+typedef struct {
+    int card;
+    uint32_t frames;
+    bool mirror;
+    std::string output;
+} Options;
+
+typedef struct {
+    const char *name;
+    bool available;
+    uint64_t commits;
+    Samples submit;
+    Samples interval;
+    uint32_t failures;
+} Result;
+
+static bool parseOptions(int argc, char **argv, Options &opts) {
+    OptionParser parser(opts.output);
+    parser.add("--card <n>", "DRM card index (default 0)", opts.card);
+    parser.add("--frames <n>", "frames per commit mode (default 300)", opts.frames);
+    parser.add("--mirror <0|1>", "one shared swapchain instead of one per output (default 0)", opts.mirror);
+    if ((parser.parse(argc, argv) == false) || (opts.frames == 0U)) {
+        parser.usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+static void runMode(DrmOutputGroup &group, bool combined, uint32_t frames, Result &result) {
+    group.setCombinedEnabled(combined);
+    if (group.isCombined() != combined) {
+        return;
+    }
+    result.available = true;
+
+    // Outputs sharing a swapchain take one buffer per frame
+    size_t sources = (group.content() == DrmOutputGroup::Content::MIRRORED) ? 1U : group.outputCount();
+    uint64_t commits = group.commits();
+    uint64_t last = 0;
+    for (uint32_t i = 0; i < frames; i++) {
+        bool ok = true;
+        for (size_t output = 0; output < sources; output++) {
+            int index = group.acquireBuffer(output, 1000);
+            DrmBuffer *buffer = group.buffer(output, index);
+            if (buffer == nullptr) {
+                ok = false;
+                break;
+            }
+            FastCopy::fill(buffer->ptr, buffer->size, 0xff000000U | ((i * 8U + static_cast<uint32_t>(output) * 0x40U) & 0xffU));
+            ok = ok && group.queueBuffer(output, index);
+        }
+
+        uint64_t start = nowNs();
+        ok = ok && group.commit(true);
+        result.submit.addNs(nowNs() - start);
+        if (ok == false) {
+            result.failures++;
+            continue;
+        }
+        // Measure frames shown on every display, not submissions
+        group.waitIdle(1000);
+        uint64_t now = nowNs();
+        if (last != 0U) {
+            result.interval.addNs(now - last);
+        }
+        last = now;
+    }
+    result.commits = group.commits() - commits;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opts = {};
+    opts.card = 0;
+    opts.frames = 300U;
+    opts.mirror = false;
+    opts.output = "multi_output_bench.json";
+
+    if (parseOptions(argc, argv, opts) == false) {
+        return 1;
+    }
+
+    DrmDevice device(opts.card);
+    if (openDisplay(device, opts.card, false) == nullptr) {
+        return 1;
+    }
+
+    std::vector<uint32_t> connectors{};
+    for (const DrmConnectorInfo *connector : findDisplays(device, false)) {
+        if (connectors.size() < DrmOutputGroup::MAX_OUTPUTS) {
+            connectors.push_back(connector->id);
+        }
+    }
+    DrmOutputGroup group(device);
+    DrmOutputGroup::Content content = opts.mirror ? DrmOutputGroup::Content::MIRRORED : DrmOutputGroup::Content::INDEPENDENT;
+    if ((connectors.size() < 2U) || (group.init(connectors, content) == false)) {
+        fprintf(stderr, "Need two or more usable outputs on card %d, found %zu connected\n", opts.card, connectors.size());
+        device.close();
+        return 1;
+    }
+
+    Result results[] = {
+        {"combined", false, 0U, {}, {}, 0U},
+        {"per_output", false, 0U, {}, {}, 0U},
+    };
+    runMode(group, true, opts.frames, results[0]);
+    runMode(group, false, opts.frames, results[1]);
+
+    writeReport(opts.output, "multi_output", [&](JsonWriter &json) {
+        writeDevice(json, device);
+        json.value("mirrored", opts.mirror);
+        json.value("outputs", static_cast<uint64_t>(group.outputCount()));
+        json.value("frames", static_cast<uint64_t>(opts.frames));
+        json.beginArray("results");
+        for (const auto &result : results) {
+            json.beginObject();
+            json.value("mode", result.name);
+            json.value("available", result.available);
+            json.value("commits", result.commits);
+            json.value("failures", static_cast<uint64_t>(result.failures));
+            json.stats("submit_us", result.submit);
+            json.stats("frame_interval_us", result.interval);
+            json.endObject();
+            fprintf(stderr,
+                    "%-10s %llu commits, submit p50 %8.1f us, frame p50 %8.1f us, p99 %8.1f us, failures %u\n",
+                    result.name,
+                    static_cast<unsigned long long>(result.commits),
+                    result.submit.percentile(0.50),
+                    result.interval.percentile(0.50),
+                    result.interval.percentile(0.99),
+                    result.failures);
+        }
+        json.endArray();
+    });
+
+    group.deInit();
+    device.close();
+    return 0;
+}
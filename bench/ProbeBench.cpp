@@ -0,0 +1,151 @@
+#include "BenchUtil.h"
+#include "DrmDevice.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+/**
+ * Resource query benchmark.
+ *
+ * Times DrmDevice::queryAllDeviceInfo(), the startup resource snapshot,
+ * probing every connector (DrmProbe::FORCE), reading what the kernel knows
+ * (DrmProbe::CURRENT) and with the connector cache file of the previous
+ * run. Reports the DRM calls of each snapshot next to the calls the per
+ * object queries used to make (every CRTC read up to three times, two
+ * resource reads). Probing cost depends on the sinks, run it on the target:
+ *
+ *   ./ProbeBench --card 0 --runs 50 --output probe.json
+ */
+
+using namespace evs::early;
+using namespace evs::early::drm;
+using namespace evs::early::bench;
+
+namespace {
+
+typedef struct {
+    int card;
+    uint32_t runs;
+    std::string cache;
+    std::string output;
+} Options;
+
+typedef struct {
+    const char *name;
+    DrmProbe probe;
+    bool cached;
+    uint32_t calls;
+    uint32_t probed;
+    uint32_t fromCache;
+    uint32_t failures;
+    Samples time;
+} Result;
+
+static bool parseOptions(int argc, char **argv, Options &opts) {
+    OptionParser parser(opts.output);
+    parser.add("--card <n>", "DRM card index (default 0)", opts.card);
+    parser.add("--runs <n>", "snapshots per mode (default 50)", opts.runs);
+    parser.add("--cache <file>", "connector cache file (default /tmp/probe_bench.cache)", opts.cache);
+    if ((parser.parse(argc, argv) == false) || (opts.runs == 0U) || (opts.cache.empty() == true)) {
+        parser.usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+// Calls of the former per-object queries for the same resources
+static uint32_t previousCalls(const DrmResourceSnapshot &snapshot) {
+    uint32_t connected = 0;
+    for (const auto &entry : snapshot.connectors()) {
+        connected += entry.second.connected ? 1U : 0U;
+    }
+    return 1U + 2U + static_cast<uint32_t>(snapshot.connectors().size()) + connected * 2U
+           + static_cast<uint32_t>(snapshot.encoders().size()) * 2U + static_cast<uint32_t>(snapshot.crtcs().size())
+           + 1U + static_cast<uint32_t>(snapshot.planes().size());
+}
+
+static void runMode(DrmDevice &device, const Options &opts, Result &result) {
+    device.setProbe(result.probe);
+    device.setSnapshotCache(result.cached ? opts.cache : std::string());
+    for (uint32_t run = 0; run < opts.runs; run++) {
+        device.resetDeviceInfo();
+        uint64_t start = nowNs();
+        device.queryAllDeviceInfo();
+        uint64_t end = nowNs();
+        DrmSnapshotPtr snapshot = device.snapshot();
+        if (snapshot == nullptr) {
+            result.failures++;
+            continue;
+        }
+        result.time.addNs(end - start);
+        result.calls = snapshot->calls();
+        result.probed = snapshot->probedConnectors();
+        result.fromCache = snapshot->cachedConnectors();
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opts = {};
+    opts.card = 0;
+    opts.runs = 50U;
+    opts.cache = "/tmp/probe_bench.cache";
+    opts.output = "probe_bench.json";
+
+    if (parseOptions(argc, argv, opts) == false) {
+        return 1;
+    }
+
+    DrmDevice device(opts.card);
+    if (device.open() == false) {
+        fprintf(stderr, "Failed to open card %d\n", opts.card);
+        return 1;
+    }
+
+    // The forced probe writes the cache read by the last mode
+    unlink(opts.cache.c_str());
+    Result results[] = {
+        {"probe", DrmProbe::FORCE, true, 0U, 0U, 0U, 0U, {}},
+        {"current", DrmProbe::CURRENT, false, 0U, 0U, 0U, 0U, {}},
+        {"current_cached", DrmProbe::CURRENT, true, 0U, 0U, 0U, 0U, {}},
+    };
+    for (auto &result : results) {
+        runMode(device, opts, result);
+    }
+    DrmSnapshotPtr snapshot = device.snapshot();
+    uint32_t previous = (snapshot != nullptr) ? previousCalls(*snapshot) : 0U;
+
+    writeReport(opts.output, "probe", [&](JsonWriter &json) {
+        writeDevice(json, device);
+        json.value("device", (snapshot != nullptr) ? snapshot->card().deviceId : std::string());
+        json.value("runs", static_cast<uint64_t>(opts.runs));
+        json.value("previous_calls", static_cast<uint64_t>(previous));
+        json.beginArray("results");
+        for (const auto &result : results) {
+            json.beginObject();
+            json.value("mode", result.name);
+            json.value("calls", static_cast<uint64_t>(result.calls));
+            json.value("probed_connectors", static_cast<uint64_t>(result.probed));
+            json.value("cached_connectors", static_cast<uint64_t>(result.fromCache));
+            json.value("failures", static_cast<uint64_t>(result.failures));
+            json.stats("query_us", result.time);
+            json.endObject();
+            fprintf(stderr,
+                    "%-15s %3u calls (was %u), %u probed, %u cached, p50 %9.1f us, p99 %9.1f us\n",
+                    result.name,
+                    result.calls,
+                    previous,
+                    result.probed,
+                    result.fromCache,
+                    result.time.percentile(0.50),
+                    result.time.percentile(0.99));
+        }
+        json.endArray();
+    });
+
+    device.close();
+    return 0;
+}
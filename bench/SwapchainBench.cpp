@@ -0,0 +1,355 @@
+#include "BenchUtil.h"
+#include "DrmDevice.h"
+#include "FastCopy.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Swapchain depth benchmark.
+ *
+ * Renders frames into the DrmDevice swapchain with simulated render jitter
+ * and counts the vblanks that repeated the previous frame, once per buffer
+ * count. The render time of a frame is drawn from the same seeded sequence
+ * for every buffer count:
+ *
+ *   render = period * (load + uniform(-jitter, +jitter)), plus one extra
+ *   period with probability spikes
+ *
+ * where period is the vblank interval measured before the run. Queued
+ * frames are committed from the device event thread as soon as the previous
+ * flip lands.
+ *
+ * Before the runs it checks that a queued frame whose flip fails does not
+ * stall the swapchain: with 4 buffers, one frame in flight and 2 queued, the
+ * framebuffer of the first queued frame (then of both) is swapped for an
+ * invalid one. The queue must drain and the failed buffers must come back
+ * free; the exit code is 1 otherwise. Runs on vkms:
+ *
+ *   modprobe vkms && ./SwapchainBench --card 0 --frames 600 --output swapchain.json
+ */
+
+using namespace evs::early;
+using namespace evs::early::drm;
+using namespace evs::early::bench;
+
+namespace {
+
+typedef struct {
+    int card;
+    uint32_t frames;
+    double load;
+    double jitter;
+    double spikes;
+    uint32_t seed;
+    std::vector<int> counts;
+    std::string output;
+} Options;
+
+typedef struct {
+    const char *name;
+    uint32_t broken; // queued frames with an invalid framebuffer
+    bool reached;    // both frames were queued behind the flip in flight
+    bool passed;
+} FailedFlip;
+
+typedef struct {
+    int buffers;
+    bool available;
+    uint64_t flips;
+    uint64_t missed;
+    Samples acquire;
+    Samples interval;
+} Result;
+
+static std::vector<int> parseCounts(const char *value) {
+    std::vector<int> counts{};
+    std::string list = value;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        end = (end == std::string::npos) ? list.size() : end;
+        int count = atoi(list.substr(pos, end - pos).c_str());
+        if ((count >= DrmDevice::MIN_BUFFER_COUNT) && (count <= DrmDevice::MAX_BUFFER_COUNT)) {
+            counts.push_back(count);
+        }
+        pos = end + 1;
+    }
+    return counts;
+}
+
+static bool parseOptions(int argc, char **argv, Options &opts) {
+    OptionParser parser(opts.output);
+    parser.add("--card <n>", "DRM card index (default 0)", opts.card);
+    parser.add("--frames <n>", "frames per buffer count (default 600)", opts.frames);
+    parser.add("--load <f>", "mean render time, fraction of a vblank (default 0.80)", opts.load);
+    parser.add("--jitter <f>", "uniform render jitter, fraction of a vblank (default 0.30)", opts.jitter);
+    parser.add("--spikes <f>", "probability of a frame taking one extra vblank (default 0.05)", opts.spikes);
+    parser.add("--seed <n>", "jitter sequence seed (default 1)", opts.seed);
+    parser.add("--counts <list>", "buffer counts to compare (default 2,3)", [&opts](const char *value) {
+        opts.counts = parseCounts(value);
+        return true;
+    });
+    if ((parser.parse(argc, argv) == false) || (opts.frames == 0U) || (opts.counts.empty() == true)) {
+        parser.usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+static bool initDisplay(DrmDevice &device, const DrmConnectorInfo &connector, int buffers) {
+    if (device.isInitialized() == true) {
+        device.deInitDisplay();
+    }
+    device.setBufferCount(buffers);
+    if (device.initDisplay(connector, 32U) == false) {
+        return false;
+    }
+    for (int i = 0; i < device.bufferCount(); i++) {
+        DrmBuffer *buffer = device.buffer(i);
+        FastCopy::fill(buffer->ptr, buffer->size, 0xff203040U + static_cast<uint32_t>(i) * 0x00101010U);
+    }
+    return true;
+}
+
+static void waitIdle(DrmDevice &device) {
+    DrmDevice::FlipEventObj &obj = device.getFlipEventObj();
+    std::unique_lock<std::mutex> lock(obj.mtx);
+    obj.cv.wait_for(lock, std::chrono::milliseconds(500), [&obj]() { return (obj.flags <= 0) && (obj.queued == 0); });
+}
+
+// Median interval of back to back flips, the vblank period
+static uint64_t measurePeriodNs(DrmDevice &device) {
+    Samples intervals{};
+    uint64_t last = 0;
+    for (int i = 0; i < 30; i++) {
+        int index = device.acquireBuffer(1000);
+        if ((index < 0) || (device.queueBuffer(index) == false)) {
+            break;
+        }
+        device.waitFlipEvent();
+        uint64_t now = nowNs();
+        if (last != 0U) {
+            intervals.addNs(now - last);
+        }
+        last = now;
+    }
+    return static_cast<uint64_t>(intervals.percentile(0.50) * 1000.0);
+}
+
+static void checkFailedFlip(DrmDevice &device, const DrmConnectorInfo &connector, FailedFlip &check) {
+    static constexpr uint32_t INVALID_FB_ID = 0xfffffff0U;
+    check.reached = false;
+    check.passed = false;
+    if (initDisplay(device, connector, DrmDevice::MAX_BUFFER_COUNT) == false) {
+        return;
+    }
+
+    int indices[3] = {-1, -1, -1};
+    uint32_t fbIds[3] = {};
+    bool queued = true;
+    for (int i = 0; (i < 3) && (queued == true); i++) {
+        indices[i] = device.acquireBuffer(1000);
+        DrmBuffer *buffer = device.buffer(indices[i]);
+        queued = (buffer != nullptr);
+        if (queued == true) {
+            // The framebuffer is only looked at when the frame is submitted
+            fbIds[i] = buffer->fbId;
+            if ((i >= 1) && (static_cast<uint32_t>(i) <= check.broken)) {
+                buffer->fbId = INVALID_FB_ID;
+            }
+            queued = device.queueBuffer(indices[i], true);
+        }
+    }
+    DrmDevice::FlipEventObj &obj = device.getFlipEventObj();
+    {
+        std::unique_lock<std::mutex> lock(obj.mtx);
+        check.reached = (queued == true) && (obj.queued == 2);
+    }
+
+    waitIdle(device);
+    {
+        std::unique_lock<std::mutex> lock(obj.mtx);
+        bool drained = (obj.flags <= 0) && (obj.queued == 0);
+        bool freed = true;
+        for (int i = 1; i <= static_cast<int>(check.broken); i++) {
+            freed = freed && (obj.states[indices[i]] == DrmDevice::BufferState::FREE);
+        }
+        // The valid frame behind a failed one still made it to the screen
+        bool shown = (check.broken == 2U) || (obj.scanout == indices[2]);
+        check.passed = (check.reached == true) && drained && freed && shown;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        DrmBuffer *buffer = device.buffer(indices[i]);
+        if ((buffer != nullptr) && (fbIds[i] != 0U)) {
+            buffer->fbId = fbIds[i];
+        }
+    }
+}
+
+static void sleepUntil(uint64_t deadlineNs) {
+    // Sleep most of the way, spin the rest for sub-scheduler-tick accuracy
+    uint64_t now = nowNs();
+    if (deadlineNs > now + 1000000U) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(deadlineNs - now - 1000000U));
+    }
+    while (nowNs() < deadlineNs) {
+    }
+}
+
+static void runCount(DrmDevice &device, const Options &opts, const std::vector<uint64_t> &renderNs, Result &result) {
+    DrmDevice::FlipEventObj &obj = device.getFlipEventObj();
+    uint64_t flips = 0;
+    uint64_t missed = 0;
+    {
+        std::unique_lock<std::mutex> lock(obj.mtx);
+        flips = obj.flips;
+        missed = obj.missedVblanks;
+    }
+
+    uint64_t last = 0;
+    for (uint32_t i = 0; i < opts.frames; i++) {
+        uint64_t start = nowNs();
+        int index = device.acquireBuffer(1000);
+        uint64_t acquired = nowNs();
+        if (index < 0) {
+            continue;
+        }
+        result.acquire.addNs(acquired - start);
+        if (last != 0U) {
+            result.interval.addNs(acquired - last);
+        }
+        last = acquired;
+
+        sleepUntil(acquired + renderNs[i]);
+        device.queueBuffer(index, true);
+    }
+    waitIdle(device);
+
+    {
+        std::unique_lock<std::mutex> lock(obj.mtx);
+        result.flips = obj.flips - flips;
+        result.missed = obj.missedVblanks - missed;
+    }
+    result.available = true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opts = {};
+    opts.card = 0;
+    opts.frames = 600U;
+    opts.load = 0.80;
+    opts.jitter = 0.30;
+    opts.spikes = 0.05;
+    opts.seed = 1U;
+    opts.counts = {2, 3};
+    opts.output = "swapchain_bench.json";
+
+    if (parseOptions(argc, argv, opts) == false) {
+        return 1;
+    }
+
+    DrmDevice device(opts.card);
+    const DrmConnectorInfo *connector = openDisplay(device, opts.card);
+    if (connector == nullptr) {
+        return 1;
+    }
+
+    FailedFlip checks[] = {
+        {"one_failed", 1U, false, false},
+        {"all_failed", 2U, false, false},
+    };
+    bool checksPassed = true;
+    for (FailedFlip &check : checks) {
+        checkFailedFlip(device, *connector, check);
+        checksPassed = checksPassed && check.passed;
+        fprintf(stderr,
+                "failed flip with 2 queued, %s: %s\n",
+                check.name,
+                check.passed ? "pass" : (check.reached ? "FAIL" : "FAIL (frames not queued)"));
+    }
+    if (initDisplay(device, *connector, DrmDevice::MIN_BUFFER_COUNT) == false) {
+        fprintf(stderr, "Failed to initialize the display on card %d\n", opts.card);
+        device.close();
+        return 1;
+    }
+
+    uint64_t periodNs = measurePeriodNs(device);
+    if (periodNs == 0U) {
+        fprintf(stderr, "Failed to measure the vblank period\n");
+        device.deInitDisplay();
+        device.close();
+        return 1;
+    }
+
+    // One jitter sequence shared by all buffer counts
+    std::mt19937 rng(opts.seed);
+    std::uniform_real_distribution<double> jitter(-opts.jitter, opts.jitter);
+    std::uniform_real_distribution<double> spike(0.0, 1.0);
+    std::vector<uint64_t> renderNs(opts.frames);
+    for (auto &ns : renderNs) {
+        double fraction = std::max(0.0, opts.load + jitter(rng)) + ((spike(rng) < opts.spikes) ? 1.0 : 0.0);
+        ns = static_cast<uint64_t>(fraction * static_cast<double>(periodNs));
+    }
+
+    std::vector<Result> results{};
+    for (int count : opts.counts) {
+        Result result = {count, false, 0U, 0U, {}, {}};
+        if (initDisplay(device, *connector, count) == true) {
+            runCount(device, opts, renderNs, result);
+        }
+        results.push_back(std::move(result));
+    }
+
+    writeReport(opts.output, "swapchain", [&](JsonWriter &json) {
+        writeDevice(json, device);
+        json.value("frames", static_cast<uint64_t>(opts.frames));
+        json.value("vblank_us", static_cast<double>(periodNs) / 1000.0);
+        json.value("load", opts.load);
+        json.value("jitter", opts.jitter);
+        json.value("spikes", opts.spikes);
+        json.beginArray("failed_flip");
+        for (const auto &check : checks) {
+            json.beginObject();
+            json.value("case", check.name);
+            json.value("queued", check.reached);
+            json.value("passed", check.passed);
+            json.endObject();
+        }
+        json.endArray();
+        json.beginArray("results");
+        for (const auto &result : results) {
+            uint64_t vblanks = result.flips + result.missed;
+            double missedRate = (vblanks > 0U) ? static_cast<double>(result.missed) / static_cast<double>(vblanks) : 0.0;
+            json.beginObject();
+            json.value("buffers", static_cast<uint64_t>(result.buffers));
+            json.value("available", result.available);
+            json.value("flips", result.flips);
+            json.value("missed_vblanks", result.missed);
+            json.value("missed_rate", missedRate);
+            json.stats("acquire_us", result.acquire);
+            json.stats("frame_interval_us", result.interval);
+            json.endObject();
+            fprintf(stderr,
+                    "%d buffers: %llu flips, %llu missed vblanks (%.1f%%), acquire p50 %8.1f us, p99 %8.1f us\n",
+                    result.buffers,
+                    static_cast<unsigned long long>(result.flips),
+                    static_cast<unsigned long long>(result.missed),
+                    missedRate * 100.0,
+                    result.acquire.percentile(0.50),
+                    result.acquire.percentile(0.99));
+        }
+        json.endArray();
+    });
+
+    device.deInitDisplay();
+    device.close();
+    return checksPassed ? 0 : 1;
+}
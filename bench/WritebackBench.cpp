@@ -0,0 +1,299 @@
+#include "BenchUtil.h"
+#include "DrmDevice.h"
+#include "FastCopy.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <poll.h>
+#include <string>
+#include <unistd.h>
+
+/**
+ * Writeback capture benchmark.
+ *
+ * Flips a filled buffer per frame, without and with a capture through the
+ * writeback connector, and measures the queue to flip event latency of both
+ * and the queue to writeback fence latency of the captures. Every capture is
+ * checked against the fill colour. With --hold the receiver keeps that many
+ * captures before giving one back, to see frames dropped when it keeps up
+ * badly. Also checks that another buffer count is refused while capturing
+ * and that a capture held across deInitDisplay() stays valid until it is
+ * released. Runs on vkms:
+ *
+ *   modprobe vkms enable_writeback=1 && ./WritebackBench --card 0 --frames 300 --output writeback.json
+ */
+
+using namespace evs::early;
+using namespace evs::early::drm;
+using namespace evs::early::bench;
+
+namespace {
+
+typedef struct {
+    int card;
+    uint32_t frames;
+    uint32_t buffers;
+    uint32_t hold;
+    std::string output;
+} Options;
+
+typedef struct {
+    const char *name;
+    bool capture;
+    uint32_t failures;
+    uint64_t captured;
+    uint64_t dropped;
+    uint64_t mismatched;
+    Samples flip;
+    Samples writeback;
+} Result;
+
+static bool parseOptions(int argc, char **argv, Options &opts) {
+    OptionParser parser(opts.output);
+    parser.add("--card <n>", "DRM card index (default 0)", opts.card);
+    parser.add("--frames <n>", "frames per mode (default 300)", opts.frames);
+    parser.add("--buffers <n>", "writeback buffers (default 3)", opts.buffers);
+    parser.add("--hold <n>", "captures the receiver keeps before releasing one (default 0)", opts.hold);
+    if ((parser.parse(argc, argv) == false) || (opts.frames == 0U) || (opts.buffers == 0U)) {
+        parser.usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Captures handed over by the device, from the thread that submitted
+ *        or from the event loop.
+ */
+class CaptureQueue
+{
+public:
+    void push(const DrmCapture &capture) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_captures.push_back(capture);
+        m_cond.notify_one();
+    }
+
+    bool pop(DrmCapture &capture, int timeoutMs) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if (m_cond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() { return m_captures.empty() == false; }) == false) {
+            return false;
+        }
+        capture = m_captures.front();
+        m_captures.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex m_mtx;
+    std::condition_variable m_cond;
+    std::deque<DrmCapture> m_captures{};
+};
+
+static bool waitFence(int fence, int timeoutMs) {
+    if (fence < 0) {
+        return true;
+    }
+    struct pollfd pfd = {};
+    pfd.fd = fence;
+    pfd.events = POLLIN;
+    bool signalled = (poll(&pfd, 1, timeoutMs) > 0);
+    close(fence);
+    return signalled;
+}
+
+static void runMode(DrmDevice &device, const Options &opts, CaptureQueue &queue, Result &result) {
+    DrmWriteback *writeback = device.writeback();
+    uint64_t capturedBefore = (writeback != nullptr) ? writeback->captured() : 0U;
+    uint64_t droppedBefore = (writeback != nullptr) ? writeback->dropped() : 0U;
+    if (result.capture == true) {
+        if (device.startCapture([&queue](const DrmCapture &capture) { queue.push(capture); }, DrmWriteback::CONTINUOUS, opts.buffers) == false) {
+            fprintf(stderr, "No writeback connector, is vkms loaded with enable_writeback=1?\n");
+            result.failures = opts.frames;
+            return;
+        }
+        writeback = device.writeback();
+    }
+
+    std::deque<const DrmBuffer *> held{};
+    uint64_t popped = capturedBefore;
+    for (uint32_t frame = 0; frame < opts.frames; frame++) {
+        int index = device.acquireBuffer(1000);
+        DrmBuffer *buffer = device.buffer(index);
+        if (buffer == nullptr) {
+            result.failures++;
+            continue;
+        }
+        uint32_t color = 0xff000000U | ((frame * 0x010305U) & 0x00ffffffU);
+        FastCopy::fill(buffer->ptr, buffer->size, color);
+
+        std::future<DrmEventLoop::Event> flip = device.eventLoop()->nextFlip(device.crtcId());
+        uint64_t queued = nowNs();
+        if ((device.queueBuffer(index, true) == false)
+            || (flip.wait_for(std::chrono::milliseconds(1000)) != std::future_status::ready)) {
+            result.failures++;
+            continue;
+        }
+        result.flip.addNs(nowNs() - queued);
+
+        // A frame committed with a capture hands it over right after the flip
+        DrmCapture capture = {};
+        if ((writeback == nullptr) || (writeback->captured() == popped) || (queue.pop(capture, 1000) == false)) {
+            continue;
+        }
+        popped++;
+        if (waitFence(capture.fence, 1000) == false) {
+            result.failures++;
+            device.releaseCapture(capture.buffer);
+            continue;
+        }
+        result.writeback.addNs(nowNs() - queued);
+        // The alpha channel is not kept by an XRGB capture
+        const uint32_t *pixels = static_cast<const uint32_t *>(capture.buffer->ptr);
+        if ((pixels != nullptr) && (writeback->format() == DRM_FORMAT_XRGB8888)
+            && ((pixels[0] & 0x00ffffffU) != (color & 0x00ffffffU))) {
+            result.mismatched++;
+        }
+        held.push_back(capture.buffer);
+        while (held.size() > opts.hold) {
+            device.releaseCapture(held.front());
+            held.pop_front();
+        }
+    }
+
+    if (result.capture == true) {
+        device.stopCapture();
+        device.waitFlipEvent();
+        DrmCapture capture = {};
+        while (queue.pop(capture, 100) == true) {
+            waitFence(capture.fence, 1000);
+            device.releaseCapture(capture.buffer);
+        }
+        for (const DrmBuffer *buffer : held) {
+            device.releaseCapture(buffer);
+        }
+    }
+    if (writeback != nullptr) {
+        result.captured = writeback->captured() - capturedBefore;
+        result.dropped = writeback->dropped() - droppedBefore;
+    }
+}
+
+/**
+ * @brief Capture one frame and hold it across deInitDisplay(): the
+ *        writeback is kept until the capture is released, then dropped.
+ */
+static bool checkTeardown(DrmDevice &device, const Options &opts, CaptureQueue &queue, bool &countRefused) {
+    auto receiver = [&queue](const DrmCapture &capture) { queue.push(capture); };
+    if (device.startCapture(receiver, DrmWriteback::CONTINUOUS, opts.buffers) == false) {
+        return false;
+    }
+    countRefused = (device.startCapture(receiver, DrmWriteback::CONTINUOUS, opts.buffers + 1U) == false);
+
+    int index = device.acquireBuffer(1000);
+    DrmCapture capture = {};
+    if ((index < 0) || (device.queueBuffer(index, true) == false)) {
+        return false;
+    }
+    device.waitFlipEvent();
+    if (queue.pop(capture, 1000) == false) {
+        return false;
+    }
+    waitFence(capture.fence, 1000);
+
+    device.deInitDisplay();
+    bool kept = (device.writeback() != nullptr);
+    bool released = device.releaseCapture(capture.buffer);
+    bool dropped = (device.writeback() == nullptr);
+    // Captures queued by the last flips were handed over by deInitDisplay()
+    while (queue.pop(capture, 0) == true) {
+        waitFence(capture.fence, 0);
+        device.releaseCapture(capture.buffer);
+    }
+    return kept && released && dropped;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opts = {};
+    opts.card = 0;
+    opts.frames = 300U;
+    opts.buffers = DrmWriteback::DEFAULT_BUFFER_COUNT;
+    opts.hold = 0U;
+    opts.output = "writeback_bench.json";
+
+    if (parseOptions(argc, argv, opts) == false) {
+        return 1;
+    }
+
+    DrmDevice device(opts.card);
+    const DrmConnectorInfo *connector = openDisplay(device, opts.card, false);
+    if (connector == nullptr) {
+        return 1;
+    }
+    if (device.initDisplay(*connector, 32U) == false) {
+        fprintf(stderr, "No display to capture on card %d\n", opts.card);
+        device.close();
+        return 1;
+    }
+
+    CaptureQueue queue;
+    Result results[] = {
+        {"display", false, 0U, 0U, 0U, 0U, {}, {}},
+        {"writeback", true, 0U, 0U, 0U, 0U, {}, {}},
+    };
+    for (Result &result : results) {
+        runMode(device, opts, queue, result);
+    }
+    uint32_t format = (device.writeback() != nullptr) ? device.writeback()->format() : 0U;
+    bool countRefused = false;
+    bool teardown = checkTeardown(device, opts, queue, countRefused);
+    fprintf(stderr, "other buffer count while capturing: %s\n", countRefused ? "refused" : "FAIL");
+    fprintf(stderr, "capture held across deInitDisplay(): %s\n", teardown ? "pass" : "FAIL");
+
+    writeReport(opts.output, "writeback", [&](JsonWriter &json) {
+        writeDevice(json, device);
+        json.value("frames", static_cast<uint64_t>(opts.frames));
+        json.value("buffers", static_cast<uint64_t>(opts.buffers));
+        json.value("hold", static_cast<uint64_t>(opts.hold));
+        json.value("writeback_format", static_cast<uint64_t>(format));
+        json.value("count_check", countRefused);
+        json.value("teardown_check", teardown);
+        json.beginArray("results");
+        for (const Result &result : results) {
+            json.beginObject();
+            json.value("mode", result.name);
+            json.value("failures", static_cast<uint64_t>(result.failures));
+            json.value("captured", result.captured);
+            json.value("dropped", result.dropped);
+            json.value("mismatched", result.mismatched);
+            json.stats("flip_us", result.flip);
+            json.stats("writeback_us", result.writeback);
+            json.endObject();
+            fprintf(stderr,
+                    "%-10s flip p50 %9.1f us, p99 %9.1f us, writeback p50 %9.1f us, captured %llu, dropped %llu, mismatched %llu, failures %u\n",
+                    result.name,
+                    result.flip.percentile(0.50),
+                    result.flip.percentile(0.99),
+                    result.writeback.percentile(0.50),
+                    static_cast<unsigned long long>(result.captured),
+                    static_cast<unsigned long long>(result.dropped),
+                    static_cast<unsigned long long>(result.mismatched),
+                    result.failures);
+        }
+        json.endArray();
+    });
+
+    // Already done by a teardown check that got that far
+    if (device.isInitialized() == true) {
+        device.deInitDisplay();
+    }
+    device.close();
+    return (countRefused && teardown) ? 0 : 1;
+}
@@ -7,8 +7,12 @@
 #include "BlitToScreen.h"
 #include "DrawImage.h"
 #include "DrawGuidelines.h"
+#include "ColorCorrection.h"
 #include "QualcommCamera.h"
 #include "DrmDevice.h"
+#include "DrmFrameScheduler.h"
+#include "DrmDirectScanout.h"
+#include "DmaBufFence.h"
 
 #include <stdio.h>
 #include <fcntl.h>
@@ -59,6 +63,11 @@ class RVCController : public RendererAbstraction
 
 public:
     ~RVCController() override {
+        {
+            // Frames still on screen go back to the camera here
+            std::unique_lock<std::mutex> lock(m_frameMutex);
+            m_directScanout.reset();
+        }
         camera.stopPreview();
         camera.deInitCamera();
         camera.exitFrameCaptureWorker();
@@ -86,22 +95,89 @@ public:
 
         m_uploadTexture = std::make_shared<UploadTexture>();
         m_blitTexture = std::make_shared<BlitToScreen>();
+        m_colorCorrection = std::make_shared<ColorCorrection>();
         this->addRenderJob(m_uploadTexture);
         this->addRenderJob(std::make_shared<DrawImage>());
         this->addRenderJob(std::make_shared<DrawGuidelines>());
+        this->addRenderJob(m_colorCorrection);
         this->addRenderJob(m_blitTexture);
     }
 
     bool initRederer() override {
+        if (m_drmDevice != nullptr) {
+            m_blitTexture->setBufferCount(m_drmDevice->bufferCount());
+        }
         RendererAbstraction::initRederer();
         initDisplay(m_drmDevice);
+        if ((m_drmDevice != nullptr) && (m_drmDevice->isInitialized() == true)) {
+            m_scheduler = std::make_unique<DrmFrameScheduler>(*m_drmDevice);
+            if (m_scheduler->start() == false) {
+                m_scheduler.reset();
+            }
+        }
+        if ((m_directEnabled == true) && (m_drmDevice != nullptr) && (m_drmDevice->planeAssigner() != nullptr)) {
+            std::unique_lock<std::mutex> lock(m_frameMutex);
+            m_directScanout = std::make_unique<DrmDirectScanout>(*m_drmDevice, [this](void *userData) {
+                camera.releaseFrame(static_cast<CameraFrame *>(userData));
+            });
+        }
         return true;
     }
 
+    /**
+     * @brief Show camera frames with a dma-buf straight on a display plane,
+     *        skipping the GPU passes (guidelines included) while a plane
+     *        takes them. Set before startRendering().
+     */
+    void setDirectScanout(bool enabled) {
+        m_directEnabled = enabled;
+    }
+
+    /**
+     * @brief Colour correction, e.g. night-mode dimming. Done by the CRTC
+     *        when it can, by the ColorCorrection pass otherwise.
+     */
+    void setColorState(const ColorState &state, uint32_t transitionMs = 0U) {
+        if ((m_drmDevice != nullptr) && (m_drmDevice->supportsColorState(state) == true)
+            && (m_drmDevice->setColorState(state, transitionMs) == true)) {
+            m_colorCorrection->setColorState(ColorLut::identity(), 0U);
+            return;
+        }
+        m_colorCorrection->setColorState(state, transitionMs);
+    }
+
+    uint64_t renderStartUs(uint64_t readyUs) override {
+        return (m_scheduler != nullptr) ? m_scheduler->nextStartUs(readyUs) : readyUs;
+    }
+
+    void onFrameRendered(uint64_t durationUs) override {
+        if (m_scheduler != nullptr) {
+            m_scheduler->addRenderTime(durationUs);
+        }
+    }
+
     bool rendering() override {
+        // Render into a buffer that is neither on screen nor waiting for it
+        int idx = m_drmDevice->acquireBuffer(100);
+        if (idx < 0) {
+            printf("No free display buffer\n");
+            return false;
+        }
+        m_blitTexture->setTargetBuffer(idx);
         RendererAbstraction::rendering();
-        int idx = m_blitTexture->bufferIdx();
-        return m_drmDevice->setModeCrtc(m_drmDevice->buffer(idx));
+        DrmBuffer *buffer = m_drmDevice->buffer(idx);
+
+        // Let the display wait for the GPU through the dma-buf instead of glFinish
+        int fence = takeRenderFence();
+        if ((fence >= 0) && (buffer != nullptr)) {
+            int dmaFd = ::drm::DrmAllocator::exposeHandleToFd(m_drmDevice->fd(), buffer);
+            if (DmaBufFence::attachOrWait(dmaFd, fence, DmaBufFence::ACCESS_WRITE, 100) != 0) {
+                printf("Render fence of buffer %d did not signal\n", idx);
+            }
+        }
+        // Initial modeset happened in initDisplay(), from here on only flips.
+        // The damage lets the display update only what the passes changed
+        return m_drmDevice->queueBuffer(idx, true, &frameDamage());
     }
 
     void setDrmDisplay(::drm::DrmDevice *drmDevice) {
@@ -111,15 +187,18 @@ public:
     bool initDisplay(DrmDevice *drmDevice) {
         bool success = false;
         if (drmDevice->isOpen()) {
-            int dmaFd[2];
-            dmaFd[0] = ::drm::HeapDMAAllocator::exposeHandleToFd(drmDevice->fd(), drmDevice->buffer0());
-            dmaFd[1] = ::drm::HeapDMAAllocator::exposeHandleToFd(drmDevice->fd(), drmDevice->buffer1());
-            if (dmaFd[0] < 0 || dmaFd[1] < 0) {
+            int dmaFd[DrmDevice::MAX_BUFFER_COUNT] = {-1, -1, -1, -1};
+            bool exposed = true;
+            for (int i = 0; i < drmDevice->bufferCount(); i++) {
+                dmaFd[i] = ::drm::DrmAllocator::exposeHandleToFd(drmDevice->fd(), drmDevice->buffer(i));
+                exposed = exposed && (dmaFd[i] >= 0);
+            }
+            if (exposed == false) {
                 printf("Failed to expose DMA buffer.\n");
                 drmDevice->deInitDisplay();
                 drmDevice->close();
             } else {
-                for (int i = 0; i < 2; i++) {
+                for (int i = 0; i < drmDevice->bufferCount(); i++) {
                     // FrameBuffer &fb = m_blitTexture->getMapBuf()[i];
                     printf("Create EGLImage: fd=%d w=%d h=%d stride=%d format=%x\n",
                            dmaFd[i],
@@ -238,7 +317,7 @@ public:
                 }
                 m_drmDevice = drmDevice;
                 success = true;
-                printf("DRM device initialized successfully with DMA buffer %d, %d.\n", dmaFd[0], dmaFd[1]);
+                printf("DRM device initialized successfully with %d DMA buffers, first %d.\n", drmDevice->bufferCount(), dmaFd[0]);
             }
         }
         return success;
@@ -276,8 +355,23 @@ public:
         }
 
         std::unique_lock<std::mutex> lock(m_frameMutex);
+        if (presentDirect(grabFrame) == true) {
+            return true;
+        }
         CameraBuffer &buffer = grabFrame->getBuffer();
         m_uploadTexture->setImageData(buffer.data, buffer.width, buffer.height);
+        if (buffer.fd >= 0) {
+            // The GPU reads the camera buffer itself, the pixels are the fallback
+            FrameLayout layout = {};
+            layout.width = static_cast<uint32_t>(buffer.width);
+            layout.height = static_cast<uint32_t>(buffer.height);
+            layout.format = static_cast<uint32_t>(buffer.format);
+            layout.planes = 1U;
+            layout.strides[0] = static_cast<uint32_t>(buffer.stride);
+            layout.modifier = DRM_FORMAT_MOD_INVALID;
+            layout.size = buffer.size;
+            m_uploadTexture->setImageDmaBuf(layout, buffer.fd);
+        }
         m_state = 0;
         m_frameCV.notify_all();
         return true;
@@ -292,13 +386,42 @@ public:
 
         if (success) {
             m_state += 1;
-        } else {
+        } else if (m_direct == false) {
             printf("No new frame received in the last 1000ms\n");
         }
         return success;
     }
 
 private:
+    /**
+     * @brief Hand @p frame to the display plane, with m_frameMutex held.
+     * @return False if the GPU passes render it instead.
+     */
+    bool presentDirect(CameraFrame *frame) {
+        const CameraBuffer &buffer = frame->getBuffer();
+        if ((m_directScanout == nullptr) || (buffer.fd < 0)) {
+            m_direct = false;
+            return false;
+        }
+        DrmDirectScanout::Frame direct = {};
+        direct.dmaFd = buffer.fd;
+        direct.info.width = static_cast<uint32_t>(buffer.width);
+        direct.info.height = static_cast<uint32_t>(buffer.height);
+        direct.info.format = buffer.format; // DRM fourcc of the camera, e.g. NV12
+        direct.info.pitch = buffer.stride;
+        direct.modifier = DrmImportCache::MODIFIER_NONE;
+        direct.encoding = DrmColorEncoding::BT601;
+        direct.range = DrmColorRange::LIMITED;
+        direct.userData = frame;
+        DrmDirectScanout::Path path = m_directScanout->present(direct);
+        if (path == DrmDirectScanout::Path::BUSY) {
+            // Not shown, the frame on screen stays until the next one
+            camera.releaseFrame(frame);
+        }
+        m_direct = (path != DrmDirectScanout::Path::COMPOSE);
+        return m_direct;
+    }
+
     static void camera_frame_callback(CameraAbstraction *, CameraFrame *frame, void *param) {
         RVCController *renderer = static_cast<RVCController *>(param);
         if (renderer != nullptr) {
@@ -312,8 +435,13 @@ private:
     std::condition_variable m_frameCV;
     std::shared_ptr<UploadTexture> m_uploadTexture = nullptr;
     std::shared_ptr<BlitToScreen> m_blitTexture = nullptr;
+    std::shared_ptr<ColorCorrection> m_colorCorrection = nullptr;
     std::atomic<int> m_state{0};
     std::unique_ptr<RenderLoop> m_renderLoop;
+    std::unique_ptr<DrmFrameScheduler> m_scheduler{};
+    std::unique_ptr<DrmDirectScanout> m_directScanout{};
+    bool m_directEnabled{false};
+    std::atomic<bool> m_direct{false}; // the last camera frame went to a plane
     ::drm::DrmDevice *m_drmDevice;
 };
 
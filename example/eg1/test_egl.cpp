@@ -63,7 +63,15 @@ int main() {
     }
 
     DrmConnectorInfo connectorInfo = drmDevice.getConnectors().begin()->second;
-    if (!drmDevice.initDisplay(connectorInfo, 32, DRM_FORMAT_ARGB8888, DRM_MODE_FLAG_PVSYNC)) {
+    // Native size at a refresh matching the camera, e.g. 30 or 60 Hz for 30 fps
+    DrmModePolicy policy = {0U, 0U, static_cast<uint32_t>(CameraConfig{}.framerate)};
+    int modeIndex = DrmDevice::selectMode(connectorInfo.modes, policy);
+    // Keep the boot splash mode when it matches, the camera needs one flip
+    drmDevice.setHandoff(DrmHandoff::REUSE);
+    bool initialized = (modeIndex >= 0)
+                           ? drmDevice.initDisplay(connectorInfo, connectorInfo.modes[modeIndex], 32, DRM_FORMAT_ARGB8888, DRM_MODE_FLAG_PVSYNC)
+                           : drmDevice.initDisplay(connectorInfo, 32, DRM_FORMAT_ARGB8888, DRM_MODE_FLAG_PVSYNC);
+    if (!initialized) {
         printf("Failed to initialize display.\n");
         drmDevice.close();
         return -1;
@@ -75,6 +83,8 @@ int main() {
     std::unique_ptr<RenderContext> renderContext = std::unique_ptr<RenderContext>(new RenderContext(width, height, nullptr, (void *)nullptr, EGL_NO_CONTEXT));
     auto renderer = std::make_shared<RVCController>(renderContext.get());
     renderer->setDrmDisplay(&drmDevice);
+    // Camera frames with a dma-buf go straight to a plane when one takes them
+    renderer->setDirectScanout(true);
     renderer->startRendering();
     renderer->startPreview();
 
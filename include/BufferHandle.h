@@ -1,11 +1,16 @@
 #ifndef BUFFER_HANDLE_H
 #define BUFFER_HANDLE_H
 
+#include "MemoryAccounting.h"
+#include "DamageRegion.h"
+#include "DmaBufFence.h"
+
 #include <string>
 #include <memory>
 #include <cstddef>
 #include <cstdint>
 #include <mutex>
+#include <cerrno>
 
 namespace evs {
 namespace early {
@@ -13,16 +18,36 @@ namespace early {
 struct BufferHandle {
     using BeginAccessFnc = int (*)(const BufferHandle *, bool, int);
     using EndAccessFnc = int (*)(const BufferHandle *, bool, int);
+    using SyncRangeFnc = int (*)(const BufferHandle *, bool, int, size_t, size_t);
+
+    // Access flags, same values as DMA_BUF_SYNC_READ / DMA_BUF_SYNC_WRITE
+    static constexpr int ACCESS_READ = 1 << 0;
+    static constexpr int ACCESS_WRITE = 1 << 1;
+    static constexpr int ACCESS_RW = ACCESS_READ | ACCESS_WRITE;
+    static_assert(ACCESS_RW == DmaBufFence::ACCESS_RW, "access flags must match DmaBufFence");
 
     int fd{-1};
     int handle{-1};
     void *virt{nullptr};
     uintptr_t phys{0U};
     size_t length{0U};
+    MemoryTag tag{MemoryTag::OTHER};
     BeginAccessFnc beginAccessFnc{nullptr};
     EndAccessFnc endAccessFnc{nullptr};
+    SyncRangeFnc syncRangeFnc{nullptr}; // partial cache maintenance, -EOPNOTSUPP if the heap lacks it
     std::mutex mtx;
 
+    // Pixel layout, needed to turn damage rects into byte ranges
+    uint32_t width{0U};
+    uint32_t height{0U};
+    uint32_t stride{0U};
+    uint32_t bytesPerPixel{0U};
+
+    DamageRegion pendingDamage{}; // written since the last flushDamage()
+    DamageRegion frameDamage{};   // flushed, not yet taken by the display
+    bool fullAccess{false};       // a whole buffer SYNC_START is open
+    int accessFlags{0};           // flags of the open accesses
+
     explicit BufferHandle(int _fd, int _handle, void *_virt, uintptr_t _phys, size_t _length)
         : fd(_fd)
         , handle(_handle)
@@ -51,6 +76,104 @@ struct BufferHandle {
         }
         return -1;
     }
+
+    /**
+     * @brief Wait for GPU/display fences before a CPU access with @p flag.
+     * Cheaper than a blocking beginAccess() when the buffer is still busy,
+     * and can be polled with @p timeoutMs 0.
+     * @return 0 when ready, -ETIME on timeout.
+     */
+    int waitIdle(int flag, int timeoutMs = -1) const { return DmaBufFence::wait(fd, flag, timeoutMs); }
+
+    /**
+     * @brief Sync_file of the fences an access with @p flag has to wait for.
+     */
+    int exportFence(int flag) const { return DmaBufFence::exportSyncFile(fd, flag); }
+
+    /**
+     * @brief Attach a producer fence, e.g. of a GPU pass writing the buffer.
+     */
+    int importFence(int syncFd, int flag = ACCESS_WRITE) const { return DmaBufFence::importSyncFile(fd, syncFd, flag); }
+
+    void setLayout(uint32_t _width, uint32_t _height, uint32_t _stride, uint32_t _bytesPerPixel) {
+        width = _width;
+        height = _height;
+        stride = _stride;
+        bytesPerPixel = _bytesPerPixel;
+        pendingDamage.setBounds(_width, _height);
+        frameDamage.setBounds(_width, _height);
+    }
+
+    /**
+     * @brief Start CPU access to @p rect and record it as damage.
+     * Only the bytes of the rect are synced when the heap supports partial
+     * cache maintenance. Otherwise the first call of a frame opens one whole
+     * buffer access and later calls only record damage, so several overlay
+     * writes cost one sync. The caller holds mtx, as for beginAccess().
+     */
+    int beginAccess(const DamageRect &rect, int flag = ACCESS_WRITE) {
+        pendingDamage.add(rect);
+        accessFlags |= flag;
+        if (fullAccess == true) {
+            return 0;
+        }
+        if (syncRangeFnc && (stride > 0U) && (bytesPerPixel > 0U)) {
+            DamageRegion region(width, height);
+            region.add(rect);
+            if (region.empty() == true) {
+                return 0;
+            }
+            ByteRange range[DamageRegion::MAX_RECTS];
+            if (region.byteRanges(stride, bytesPerPixel, length, range) == 1U) {
+                int ret = syncRangeFnc(this, true, flag, range[0].offset, range[0].length);
+                if (ret != -EOPNOTSUPP) {
+                    return ret;
+                }
+                syncRangeFnc = nullptr;
+            }
+        }
+        fullAccess = true;
+        return beginAccess(flag);
+    }
+
+    /**
+     * @brief Record damage written without beginAccess(rect), e.g. by the GPU.
+     */
+    void addDamage(const DamageRect &rect) { pendingDamage.add(rect); }
+    void addDamage() { pendingDamage.addFull(); }
+
+    /**
+     * @brief End the CPU accesses of this frame with one coalesced flush.
+     * The pending damage moves to frameDamage for the display.
+     * @return 0 if nothing was pending or the flush succeeded.
+     */
+    int flushDamage() {
+        int ret = 0;
+        if (fullAccess == true) {
+            ret = endAccess(accessFlags);
+        } else if (syncRangeFnc && (pendingDamage.empty() == false)) {
+            ByteRange ranges[DamageRegion::MAX_RECTS];
+            size_t count = pendingDamage.byteRanges(stride, bytesPerPixel, length, ranges);
+            for (size_t i = 0; i < count; i++) {
+                int rangeRet = syncRangeFnc(this, false, accessFlags, ranges[i].offset, ranges[i].length);
+                ret = (rangeRet < 0) ? rangeRet : ret;
+            }
+        }
+        frameDamage.add(pendingDamage);
+        pendingDamage.clear();
+        fullAccess = false;
+        accessFlags = 0;
+        return ret;
+    }
+
+    /**
+     * @brief Damage accumulated since the last call, for FB_DAMAGE_CLIPS.
+     */
+    DamageRegion takeFrameDamage() {
+        DamageRegion damage = frameDamage;
+        frameDamage.clear();
+        return damage;
+    }
 };
 
 using BufferHandlePtr = std::shared_ptr<BufferHandle>;
@@ -72,6 +72,8 @@ typedef struct CameraBuffer_t {
     int width = 0;        ///< Width of the frame in pixels
     int height = 0;       ///< Height of the frame in pixels
     int format = 0;       ///< Pixel format identifier
+    int fd = -1;          ///< dma-buf fd of the frame, -1 if only data is mapped
+    int stride = 0;       ///< Line pitch of the first plane in bytes, 0 if packed
     // Add other buffer-related fields as needed
 } CameraBuffer;
 
@@ -151,6 +153,14 @@ public:
 
     virtual CameraFrame *getFrame() = 0;
 
+    /**
+     * @brief Give a frame of getFrame() back to the camera once nothing reads
+     *        it anymore, e.g. after the display flip that replaced it.
+     *        Cameras owning a buffer ring requeue the buffer here.
+     * @param frame The frame to return.
+     */
+    virtual void releaseFrame(CameraFrame *frame) {}
+
     virtual int setConfig(const CameraConfig &config) = 0;
 
     virtual CameraConfig getConfig() const = 0;
@@ -0,0 +1,261 @@
+#ifndef DAMAGE_REGION_H
+#define DAMAGE_REGION_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace evs {
+namespace early {
+
+/**
+ * @struct DamageRect
+ * @brief Damaged rectangle, [x1, x2) x [y1, y2) in pixels.
+ * Same layout as struct drm_mode_rect, so an array of rects can be used as
+ * FB_DAMAGE_CLIPS blob as is. drmModeDirtyFB() takes 16 bit clips.
+ */
+typedef struct {
+    int32_t x1;
+    int32_t y1;
+    int32_t x2;
+    int32_t y2;
+} DamageRect;
+
+/**
+ * @struct ByteRange
+ * @brief Contiguous byte range of a buffer, used for cache maintenance.
+ */
+typedef struct {
+    size_t offset;
+    size_t length;
+} ByteRange;
+
+/**
+ * @brief Small set of damage rectangles with coalescing.
+ * Overlapping or touching rects are merged. When more than MAX_RECTS are
+ * added the two rects whose bounding box wastes the least area are merged,
+ * so the set stays small enough for a per-frame flush and a damage clip
+ * list. Once the whole surface is damaged the region collapses to one rect.
+ */
+class DamageRegion
+{
+public:
+    static constexpr size_t MAX_RECTS = 8U;
+
+    DamageRegion() = default;
+    DamageRegion(uint32_t width, uint32_t height)
+        : m_width(width)
+        , m_height(height) {
+    }
+
+    void setBounds(uint32_t width, uint32_t height) {
+        m_width = width;
+        m_height = height;
+    }
+
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+
+    void clear() {
+        m_count = 0U;
+        m_full = false;
+    }
+
+    bool empty() const { return (m_count == 0U) && (m_full == false); }
+    bool isFull() const { return m_full; }
+    size_t count() const { return m_full ? 1U : m_count; }
+
+    /**
+     * @brief Damage rects, valid until the next modification.
+     *        A full damage is reported as one rect covering the bounds.
+     */
+    const DamageRect *rects() const {
+        if (m_full == true) {
+            m_fullRect = {0, 0, static_cast<int32_t>(m_width), static_cast<int32_t>(m_height)};
+            return &m_fullRect;
+        }
+        return m_rects;
+    }
+
+    void addFull() {
+        m_full = true;
+        m_count = 0U;
+    }
+
+    void add(const DamageRect &rect) {
+        if (m_full == true) {
+            return;
+        }
+        DamageRect clipped = rect;
+        if ((m_width > 0U) && (m_height > 0U)) {
+            clipped.x1 = clamp(clipped.x1, 0, static_cast<int32_t>(m_width));
+            clipped.x2 = clamp(clipped.x2, 0, static_cast<int32_t>(m_width));
+            clipped.y1 = clamp(clipped.y1, 0, static_cast<int32_t>(m_height));
+            clipped.y2 = clamp(clipped.y2, 0, static_cast<int32_t>(m_height));
+        }
+        if ((clipped.x2 <= clipped.x1) || (clipped.y2 <= clipped.y1)) {
+            return;
+        }
+
+        // Merge with every rect it touches until nothing overlaps any more
+        bool merged = true;
+        while (merged == true) {
+            merged = false;
+            for (size_t i = 0; i < m_count; i++) {
+                if (touches(m_rects[i], clipped)) {
+                    clipped = unite(m_rects[i], clipped);
+                    m_rects[i] = m_rects[m_count - 1U];
+                    m_count--;
+                    merged = true;
+                    break;
+                }
+            }
+        }
+
+        if (m_count == MAX_RECTS) {
+            mergeCheapest(clipped);
+        } else {
+            m_rects[m_count++] = clipped;
+        }
+
+        if ((m_count == 1U) && (m_width > 0U) && (m_height > 0U)
+            && (m_rects[0].x1 == 0) && (m_rects[0].y1 == 0)
+            && (m_rects[0].x2 == static_cast<int32_t>(m_width))
+            && (m_rects[0].y2 == static_cast<int32_t>(m_height))) {
+            addFull();
+        }
+    }
+
+    void add(const DamageRegion &other) {
+        if (other.isFull() == true) {
+            addFull();
+            return;
+        }
+        for (size_t i = 0; i < other.m_count; i++) {
+            add(other.m_rects[i]);
+        }
+    }
+
+    DamageRect bounds() const {
+        if (m_full == true) {
+            return {0, 0, static_cast<int32_t>(m_width), static_cast<int32_t>(m_height)};
+        }
+        if (m_count == 0U) {
+            return {0, 0, 0, 0};
+        }
+        DamageRect box = m_rects[0];
+        for (size_t i = 1; i < m_count; i++) {
+            box = unite(box, m_rects[i]);
+        }
+        return box;
+    }
+
+    /**
+     * @brief Byte ranges covered by the damage in a linear buffer.
+     * Ranges of neighbouring rows are contiguous (stride apart), so every
+     * rect becomes one range from its first to its last pixel; overlapping
+     * ranges are merged.
+     * @return Number of ranges written to @p ranges, 0 if the layout is unknown.
+     */
+    size_t byteRanges(uint32_t stride, uint32_t bytesPerPixel, size_t bufferSize, ByteRange ranges[MAX_RECTS]) const {
+        if ((stride == 0U) || (bytesPerPixel == 0U) || empty()) {
+            return 0U;
+        }
+        size_t count = 0U;
+        const DamageRect *list = rects();
+        for (size_t i = 0; i < this->count(); i++) {
+            const DamageRect &rect = list[i];
+            size_t start = static_cast<size_t>(rect.y1) * stride + static_cast<size_t>(rect.x1) * bytesPerPixel;
+            size_t end = static_cast<size_t>(rect.y2 - 1) * stride + static_cast<size_t>(rect.x2) * bytesPerPixel;
+            if ((bufferSize > 0U) && (end > bufferSize)) {
+                end = bufferSize;
+            }
+            if (end <= start) {
+                continue;
+            }
+            ranges[count++] = {start, end - start};
+        }
+
+        // Sort by offset and merge overlapping ranges
+        for (size_t i = 1; i < count; i++) {
+            for (size_t j = i; (j > 0U) && (ranges[j].offset < ranges[j - 1U].offset); j--) {
+                ByteRange tmp = ranges[j];
+                ranges[j] = ranges[j - 1U];
+                ranges[j - 1U] = tmp;
+            }
+        }
+        size_t merged = 0U;
+        for (size_t i = 0; i < count; i++) {
+            if ((merged > 0U) && (ranges[i].offset <= ranges[merged - 1U].offset + ranges[merged - 1U].length)) {
+                size_t end = ranges[i].offset + ranges[i].length;
+                size_t prevEnd = ranges[merged - 1U].offset + ranges[merged - 1U].length;
+                ranges[merged - 1U].length = ((end > prevEnd) ? end : prevEnd) - ranges[merged - 1U].offset;
+            } else {
+                ranges[merged++] = ranges[i];
+            }
+        }
+        return merged;
+    }
+
+private:
+    static int32_t clamp(int32_t value, int32_t low, int32_t high) {
+        return (value < low) ? low : ((value > high) ? high : value);
+    }
+
+    static bool touches(const DamageRect &a, const DamageRect &b) {
+        return (a.x1 <= b.x2) && (b.x1 <= a.x2) && (a.y1 <= b.y2) && (b.y1 <= a.y2);
+    }
+
+    static DamageRect unite(const DamageRect &a, const DamageRect &b) {
+        return {(a.x1 < b.x1) ? a.x1 : b.x1,
+                (a.y1 < b.y1) ? a.y1 : b.y1,
+                (a.x2 > b.x2) ? a.x2 : b.x2,
+                (a.y2 > b.y2) ? a.y2 : b.y2};
+    }
+
+    static int64_t area(const DamageRect &rect) {
+        return static_cast<int64_t>(rect.x2 - rect.x1) * static_cast<int64_t>(rect.y2 - rect.y1);
+    }
+
+    void mergeCheapest(const DamageRect &rect) {
+        // Candidates are the stored rects plus the new one at index m_count
+        DamageRect all[MAX_RECTS + 1U];
+        for (size_t i = 0; i < m_count; i++) {
+            all[i] = m_rects[i];
+        }
+        all[m_count] = rect;
+        size_t total = m_count + 1U;
+
+        size_t bestA = 0U;
+        size_t bestB = 1U;
+        int64_t bestWaste = -1;
+        for (size_t a = 0; a < total; a++) {
+            for (size_t b = a + 1U; b < total; b++) {
+                int64_t waste = area(unite(all[a], all[b])) - area(all[a]) - area(all[b]);
+                if ((bestWaste < 0) || (waste < bestWaste)) {
+                    bestWaste = waste;
+                    bestA = a;
+                    bestB = b;
+                }
+            }
+        }
+
+        all[bestA] = unite(all[bestA], all[bestB]);
+        all[bestB] = all[total - 1U];
+        m_count = total - 1U;
+        for (size_t i = 0; i < m_count; i++) {
+            m_rects[i] = all[i];
+        }
+    }
+
+    uint32_t m_width{0};
+    uint32_t m_height{0};
+    bool m_full{false};
+    size_t m_count{0};
+    DamageRect m_rects[MAX_RECTS]{};
+    mutable DamageRect m_fullRect{};
+};
+
+} // namespace early
+} // namespace evs
+
+#endif // DAMAGE_REGION_H
@@ -0,0 +1,108 @@
+#ifndef DRMBUFFERPOOL_H
+#define DRMBUFFERPOOL_H
+
+#include "DrmAllocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace evs {
+namespace early {
+namespace drm {
+
+/**
+ * @brief Pool of parked scanout buffers.
+ * Display teardown parks its buffers here instead of freeing them, and the
+ * next acquire() of a compatible layout gets them back without allocation,
+ * mapping and clearing. A parked buffer is compatible when allocator,
+ * memory tag, format and bpp match and its storage holds the new size at
+ * its pitch; if only width/height changed, just the framebuffer object is
+ * re-created. Multi-planar buffers are only reused for the exact same size.
+ *
+ * Parked buffers stay accounted under their tag (DISPLAY, or RECORDER for
+ * writeback captures) and the pool registers an evictor for both tags with
+ * MemoryAccounting, so an allocation hitting the budget of a tag drops the
+ * parked buffers of that tag first. Otherwise they live until trim() or
+ * the pool is destroyed. The pool must be destroyed before the DRM fd is
+ * closed.
+ */
+class DrmBufferPool
+{
+    DrmBufferPool(const DrmBufferPool &) = delete;
+    DrmBufferPool &operator=(const DrmBufferPool &) = delete;
+    DrmBufferPool(DrmBufferPool &&) = delete;
+    DrmBufferPool &operator=(DrmBufferPool &&) = delete;
+
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 4U;
+
+    explicit DrmBufferPool(int drmFd, size_t capacity = DEFAULT_CAPACITY);
+    ~DrmBufferPool();
+
+    /**
+     * @brief Take a parked buffer that fits @p info or allocate a new one.
+     * Release the buffer with park() (or DrmAllocator::release()).
+     */
+    DrmBuffer *acquire(AllocatorType type, const BufferInfo &info);
+
+    /**
+     * @brief Return a buffer of acquire() to the pool. Buffers the pool
+     *        does not know, and the oldest ones above capacity, are freed.
+     */
+    void park(DrmBuffer *buffer);
+
+    /**
+     * @brief Free parked buffers, oldest first, until @p bytes are released.
+     * @return Bytes freed.
+     */
+    size_t trim(size_t bytes = SIZE_MAX);
+
+    size_t parkedCount() const;
+    size_t parkedBytes() const;
+    size_t hits() const { return m_hits; }
+    size_t misses() const { return m_misses; }
+    size_t reshapes() const { return m_reshapes; }
+
+private:
+    typedef struct {
+        AllocatorType type;
+        uint32_t width;
+        uint32_t height;
+        uint8_t bpp;
+        uint8_t depth;
+        int format;
+        MemoryTag tag;
+    } Layout;
+
+    typedef struct {
+        DrmBuffer *buffer;
+        Layout layout;
+        uint64_t parkedAt;
+    } Entry;
+
+    static size_t evict(MemoryTag tag, size_t bytes, void *param);
+    // trim() of the buffers of @p tag only, unless @p anyTag
+    size_t trimTagged(size_t bytes, bool anyTag, MemoryTag tag);
+
+    bool fits(const Entry &entry, AllocatorType type, const BufferInfo &info) const;
+    bool reshape(Entry &entry, const BufferInfo &info);
+
+    int m_drmFd{-1};
+    size_t m_capacity{DEFAULT_CAPACITY};
+    uint64_t m_clock{0};
+    size_t m_hits{0};
+    size_t m_misses{0};
+    size_t m_reshapes{0};
+    mutable std::mutex m_mtx;
+    std::vector<Entry> m_parked{};
+    std::unordered_map<const DrmBuffer *, Layout> m_inUse{};
+};
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMBUFFERPOOL_H
@@ -0,0 +1,108 @@
+#ifndef DRMCOLORPIPELINE_H
+#define DRMCOLORPIPELINE_H
+
+#include "DrmAtomic.h"
+#include "ColorLut.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace evs {
+namespace early {
+namespace drm {
+
+/**
+ * @brief Colour correction by the CRTC: DEGAMMA_LUT, CTM and GAMMA_LUT.
+ *
+ * The three blobs of a state go into the next atomic flip together, so a
+ * frame never shows half of a change. A transition is a table of
+ * ColorLut::TRANSITION_STEPS blob sets made when it starts; each flip only
+ * picks the set of the step due and adds the properties when the step
+ * changed. Stages that do not change share one blob. Going back to the
+ * previous state after a finished transition (e.g. night mode off) reuses
+ * its table in reverse, no blob is made.
+ */
+class DrmColorPipeline
+{
+    DrmColorPipeline(const DrmColorPipeline &) = delete;
+    DrmColorPipeline &operator=(const DrmColorPipeline &) = delete;
+    DrmColorPipeline(DrmColorPipeline &&) = delete;
+    DrmColorPipeline &operator=(DrmColorPipeline &&) = delete;
+
+public:
+    DrmColorPipeline(int drmFd, DrmPropertyCache &props);
+    ~DrmColorPipeline();
+
+    /**
+     * @return false if the CRTC has no GAMMA_LUT, draw the correction with
+     *         the ColorCorrection render pass instead.
+     */
+    bool init(uint32_t crtcId);
+    void reset();
+
+    /**
+     * @brief Whether the CRTC has every stage @p state uses.
+     */
+    bool supports(const ColorState &state) const;
+
+    uint32_t degammaSize() const { return m_degammaSize; }
+    uint32_t gammaSize() const { return m_gammaSize; }
+
+    /**
+     * @brief Go from the state on screen to @p state in @p durationUs,
+     *        starting at @p nowUs.
+     */
+    bool setState(const ColorState &state, uint64_t durationUs, uint64_t nowUs);
+
+    /**
+     * @brief Add the blobs of the step due at @p nowUs if it is not the one
+     *        on screen.
+     * @return true if properties were added.
+     */
+    bool addToRequest(DrmAtomicRequest &req, uint64_t nowUs);
+
+    /**
+     * @brief The request of the last addToRequest() was committed.
+     */
+    void commitDone();
+
+    /**
+     * @brief A transition is running or a step was not committed yet.
+     */
+    bool pending(uint64_t nowUs) const;
+
+private:
+    typedef struct {
+        uint32_t degamma; // 0 for bypass
+        uint32_t ctm;
+        uint32_t gamma;
+    } Blobs;
+
+    uint32_t createLut(const std::vector<ColorLutEntry> &lut);
+    uint32_t createCtm(const ColorState &state);
+    bool buildTable(const ColorState &from, const ColorState &to, bool transition);
+    void destroyTable();
+    uint32_t currentStep(uint64_t nowUs) const;
+
+    int m_drmFd{-1};
+    DrmPropertyCache &m_props;
+    uint32_t m_crtcId{0};
+    bool m_hasDegamma{false};
+    bool m_hasCtm{false};
+    uint32_t m_degammaSize{0};
+    uint32_t m_gammaSize{0};
+    ColorState m_from{};              // state at step 0 of m_table
+    ColorState m_to{};                // state at its last step
+    std::vector<Blobs> m_table{};     // one set per step, one for no transition
+    uint64_t m_startUs{0};
+    uint64_t m_durationUs{0};
+    int m_committed{-1};              // step of m_table on screen, -1 for none
+    int m_added{-1};                  // step of the last addToRequest()
+};
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMCOLORPIPELINE_H
@@ -12,6 +12,20 @@ namespace evs {
 namespace early {
 namespace drm {
 
+/**
+ * @brief Presentation from CPU rendering on the DrmDevice swapchain, for
+ *        boards without a usable GPU early in boot.
+ *
+ * drawFrame() takes a free back buffer, which the caller then owns and
+ * draws into (drawBuffer(), blitFrame(), fillRect()) until swapFrame()
+ * hands it to the display. From then on the display owns it: it is queued,
+ * flipped and scanned out, and only becomes free again when the flip of a
+ * later frame completes. With N buffers up to N - 1 frames are ahead of
+ * the screen; drawFrame() blocks while all of them are queued or shown.
+ * The mapping of drawBuffer() must not be touched after swapFrame().
+ * blitFrame() and fillRect() record what they change, swapFrame() sends it
+ * as damage; a frame drawn only through drawBuffer() is a full update.
+ */
 class DrmController
 {
     DrmController(const DrmController &) = delete;
@@ -23,11 +37,30 @@ public:
     DrmController(int cardId = 0);
     ~DrmController();
 
+    /**
+     * @brief Open the card and light the first connected connector with a
+     *        bound CRTC, in its mode of @p width x @p height.
+     * @p stride is a minimum, the pitch of the buffers is that of the
+     * allocator (see pitch()).
+     */
     bool init(size_t width, size_t height, uint8_t bpp, size_t stride, int format = 0, int flags = 0);
     bool deInit();
 
+    /**
+     * @brief Change the buffer layout without closing the device.
+     * The buffers are parked in the device pool and reused when they still
+     * fit, so a mode change costs framebuffer creation only.
+     */
+    bool reconfigure(size_t width, size_t height, uint8_t bpp, size_t stride, int format = 0, int flags = 0);
+
     bool isInit() const { return m_device.isOpen(); }
 
+    /**
+     * @brief Number of buffers in the ring (2-4), applied by the next init().
+     */
+    void setBufferCount(size_t count);
+    size_t bufferCount() const { return m_bufferCount; }
+
     size_t width() const { return m_width; }
     size_t height() const { return m_height; }
     int bpp() const { return m_bpp; }
@@ -40,12 +73,47 @@ public:
 
     const DrmDevice &device() const { return m_device; }
 
-    void drawFrame();
+    /**
+     * @brief Take a free back buffer to draw into, the oldest first.
+     * Waits up to @p timeoutMs (-1 forever) for a flip to release one. A
+     * buffer taken and not swapped yet is kept, drawing continues into it.
+     */
+    bool drawFrame(int timeoutMs = -1);
+
+    /**
+     * @brief Buffer taken by drawFrame(), nullptr before or after swapFrame().
+     */
+    DrmBuffer *drawBuffer() const { return m_device.buffer(m_drawIndex); }
+
+    /**
+     * @brief Copy a linear frame into the current draw buffer.
+     * Rows are copied one by one when @p srcStride differs from the buffer
+     * pitch. The buffer is usually write-combined, so large frames use
+     * streaming stores (see FastCopy).
+     */
+    bool blitFrame(const void *src, size_t srcStride);
+
+    /**
+     * @brief Fill a rectangle of the current draw buffer, clipped to the frame.
+     */
+    bool fillRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color);
+
+    /**
+     * @brief Block until every swapped frame reached the screen.
+     */
     void syncFrame();
-    void swapFrame();
+
+    /**
+     * @brief Hand the buffer of drawFrame() to the display, shown on the
+     *        next vblank after the frames queued before it.
+     */
+    bool swapFrame(bool useVSync = true);
 
 private:
-    static constexpr size_t MAX_BUFFER_COUNT = 2U;  // Maximum number of buffers in the ring
+    bool setupDisplay();
+
+    static constexpr size_t MIN_BUFFER_COUNT = DrmDevice::MIN_BUFFER_COUNT; // Minimum number of buffers in the ring
+    static constexpr size_t MAX_BUFFER_COUNT = DrmDevice::MAX_BUFFER_COUNT; // Maximum number of buffers in the ring
     static constexpr size_t DEFAULT_WIDTH = 1920U;  // Default width for buffers
     static constexpr size_t DEFAULT_HEIGHT = 1080U; // Default height for buffers
     static constexpr int DEFAULT_BPP = 32;          // Default bits per pixel
@@ -57,7 +125,6 @@ private:
     static constexpr int DEFAULT_PITCH = 0;         // Default pitch in bytes
     static constexpr int DEFAULT_CARD_ID = 0;       // Default card ID
     static constexpr int INVALID_BUFFER_INDEX = -1; // Invalid buffer index
-    static constexpr int INVALID_BUFFER_ID = -1;    // Invalid buffer ID
     static constexpr int INVALID_FORMAT = -1;       // Invalid format
     static constexpr int INVALID_FLAGS = -1;        // Invalid flags for buffer creation
     static constexpr size_t INVALID_STRIDE = 0U;    // Invalid stride in bytes
@@ -66,10 +133,9 @@ private:
     static constexpr int INVALID_PITCH = 0;         // Invalid pitch in bytes
     static constexpr int INVALID_CARD_ID = -1;      // Invalid card ID
     DrmDevice m_device;
-    std::vector<DrmBuffer *> m_buffers;     // Vector of buffers
-    size_t m_currentBufferId = INVALID_BUFFER_ID; // Current buffer ID
-    size_t m_bufferCount = 0;
-    size_t m_currentBufferIndex = 0;
+    size_t m_bufferCount = MIN_BUFFER_COUNT;
+    int m_drawIndex = INVALID_BUFFER_INDEX; // Buffer owned by the caller, between drawFrame() and swapFrame()
+    DamageRegion m_damage{};                // Drawn into m_drawIndex since drawFrame()
     size_t m_width;
     size_t m_height;
     int m_bpp = 32;                        // bits per pixel
@@ -0,0 +1,111 @@
+#ifndef DRMDIRECTSCANOUT_H
+#define DRMDIRECTSCANOUT_H
+
+#include "DrmDevice.h"
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+namespace evs {
+namespace early {
+namespace drm {
+
+/**
+ * @brief Shows camera frames straight from their dma-buf, bypassing the GPU.
+ * Every frame is imported through the import cache of the device (once per
+ * camera buffer) and offered to DrmDevice::setLayers() as the bottom layer,
+ * below the swapchain when an overlay is drawn. When a plane takes it, the
+ * frame is flipped with DrmDevice::commitLayers(); otherwise present()
+ * returns COMPOSE and the caller renders the frame on the GPU as before.
+ * The choice is made per frame, so a format the planes cannot show or an
+ * overlay the driver cannot stack falls back without a mode switch.
+ *
+ * Frames shown directly are returned through the release callback once the
+ * flip that replaced them completed, on the device event thread. A frame
+ * whose dma-buf is still on screen or pending is refused with BUSY, as
+ * showing it again would lose the release of the earlier frame. The object
+ * installs the layer release callback of the device, one per device.
+ */
+class DrmDirectScanout
+{
+    DrmDirectScanout(const DrmDirectScanout &) = delete;
+    DrmDirectScanout &operator=(const DrmDirectScanout &) = delete;
+    DrmDirectScanout(DrmDirectScanout &&) = delete;
+    DrmDirectScanout &operator=(DrmDirectScanout &&) = delete;
+
+public:
+    typedef enum class __Path {
+        DIRECT,  // on a plane, returned through the release callback
+        COMPOSE, // not shown, the caller composes it and keeps the frame
+        DROPPED, // the commit failed, already returned through the release callback
+        BUSY,    // the dma-buf is still on screen or waiting for its flip, not shown, the caller keeps the frame
+    } Path;
+
+    typedef struct {
+        int dmaFd;                 // one dma-buf holding all planes, e.g. camera NV12
+        BufferInfo info;           // width, height, format and pitch or per-plane layout
+        uint64_t modifier;         // DrmImportCache::MODIFIER_NONE for linear
+        DrmColorEncoding encoding; // YCbCr matrix of the camera
+        DrmColorRange range;       // YCbCr range of the camera
+        void *userData;            // handed to the release callback
+    } Frame;
+
+    using ReleaseCallback = std::function<void(void *userData)>;
+
+    DrmDirectScanout(DrmDevice &device, ReleaseCallback release);
+
+    /**
+     * @brief Frames still on screen are returned right away, destroy after
+     *        DrmDevice::deInitDisplay() or once the swapchain is shown again.
+     */
+    ~DrmDirectScanout();
+
+    /**
+     * @brief Whether GPU content (e.g. guidelines) is shown above the camera,
+     *        which then needs its own plane for the camera to go direct.
+     * The swapchain must then have an alpha format (e.g. ARGB8888) and be
+     * transparent where the camera shows.
+     */
+    void setOverlay(bool enabled);
+
+    /**
+     * @brief Rectangle of the camera on the CRTC, the whole display when
+     *        its size is 0.
+     */
+    void setDestination(const DrmRect &dst);
+
+    Path present(const Frame &frame, bool useVSync = true);
+
+    /**
+     * @brief Go back to the swapchain alone; the camera plane is switched off
+     *        by the next swapchain flip.
+     */
+    void stop();
+
+    uint64_t directFrames() const { return m_direct; }
+    uint64_t composedFrames() const { return m_composed; }
+    uint64_t droppedFrames() const { return m_dropped; }
+    uint64_t busyFrames() const { return m_busy; }
+
+private:
+    void onLayerReleased(const DrmBuffer *buffer);
+
+    DrmDevice &m_device;
+    ReleaseCallback m_release{};
+    bool m_overlay{false};
+    DrmRect m_dst{};
+    std::mutex m_mtx;
+    std::unordered_map<const DrmBuffer *, void *> m_frames{}; // imported frames handed to the device
+    uint64_t m_direct{0};
+    uint64_t m_composed{0};
+    uint64_t m_dropped{0};
+    uint64_t m_busy{0};
+};
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMDIRECTSCANOUT_H
@@ -0,0 +1,39 @@
+#ifndef DRMFRAMELAYOUT_H
+#define DRMFRAMELAYOUT_H
+
+#include "DrmAllocator.h"
+#include "FrameChannel.h"
+
+#include <cstdint>
+
+namespace evs {
+namespace early {
+namespace drm {
+
+/**
+ * @brief Describe @p buf for a FramePublisher, the fd to send is the one
+ *        returned by DrmAllocator::exposeHandleToFd().
+ */
+inline FrameLayout frameLayout(const DrmBuffer &buf, uint32_t width, uint32_t height) {
+    FrameLayout layout = {};
+    layout.width = width;
+    layout.height = height;
+    layout.format = buf.format;
+    layout.planes = (buf.planeCount > 0U) ? buf.planeCount : 1U;
+    for (uint32_t plane = 0U; plane < DRM_MAX_PLANES && plane < FRAME_CHANNEL_MAX_PLANES; plane++) {
+        layout.strides[plane] = buf.strides[plane];
+        layout.offsets[plane] = buf.offsets[plane];
+    }
+    if (buf.planeCount == 0U) {
+        layout.strides[0] = buf.stride;
+    }
+    layout.modifier = buf.modifier;
+    layout.size = buf.size;
+    return layout;
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMFRAMELAYOUT_H
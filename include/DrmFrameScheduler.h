@@ -0,0 +1,97 @@
+#ifndef DRMFRAMESCHEDULER_H
+#define DRMFRAMESCHEDULER_H
+
+#include "DrmDevice.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace evs {
+namespace early {
+namespace drm {
+
+/**
+ * @brief Tells a render loop when to start a frame so that it lands on the
+ * next vblank it can still reach, instead of rendering as soon as a camera
+ * frame arrives and then waiting up to a refresh period for the flip.
+ *
+ * The vblank phase comes from the page flip events of the display CRTC,
+ * seeded with drmCrtcGetSequence() before the first flip, and the period
+ * from the programmed mode, refined by the flip timestamps. The render time
+ * is the slowest of the recent frames reported by addRenderTime(), plus a
+ * margin for the commit. Starting that late picks the freshest camera frame
+ * and keeps latency at about one render time.
+ *
+ * With VRR active the panel waits for the flip, frames start right away.
+ * Times are CLOCK_MONOTONIC microseconds, the clock of the flip events and
+ * of std::chrono::steady_clock.
+ */
+class DrmFrameScheduler
+{
+    DrmFrameScheduler(const DrmFrameScheduler &) = delete;
+    DrmFrameScheduler &operator=(const DrmFrameScheduler &) = delete;
+    DrmFrameScheduler(DrmFrameScheduler &&) = delete;
+    DrmFrameScheduler &operator=(DrmFrameScheduler &&) = delete;
+
+public:
+    static constexpr size_t RENDER_HISTORY = 16U;
+    static constexpr uint32_t DEFAULT_MARGIN_US = 1500U;
+
+    explicit DrmFrameScheduler(DrmDevice &device);
+    ~DrmFrameScheduler();
+
+    /**
+     * @brief Follow the flips of the display set up by initDisplay().
+     */
+    bool start();
+    void stop();
+
+    /**
+     * @brief Time left between the end of rendering and the vblank, covers
+     *        the commit and render time outliers.
+     */
+    void setMarginUs(uint32_t marginUs) { m_marginUs = marginUs; }
+
+    /**
+     * @brief Time to start a frame that is ready at @p readyUs, the latest
+     *        one that still makes the first vblank after it. Never earlier
+     *        than @p readyUs, and @p readyUs until a render time is known.
+     */
+    uint64_t nextStartUs(uint64_t readyUs);
+
+    /**
+     * @brief First vblank after @p afterUs, 0 before the phase is known.
+     */
+    uint64_t predictVblankUs(uint64_t afterUs);
+
+    /**
+     * @brief Time from the start of a frame to its commit.
+     */
+    void addRenderTime(uint64_t durationUs);
+
+    uint64_t periodUs();
+    uint64_t budgetUs();
+
+private:
+    void onFlipEvent(const DrmEventLoop::Event &event);
+    uint64_t budgetLocked() const;
+    uint64_t predictLocked(uint64_t afterUs) const;
+
+    DrmDevice &m_device;
+    uint32_t m_crtcId{0};
+    uint32_t m_listenerId{0};
+    uint32_t m_marginUs{DEFAULT_MARGIN_US};
+    std::mutex m_mtx;
+    uint64_t m_periodNs{0};       // vblank period, refined by the flip events
+    uint64_t m_vblankUs{0};       // last vblank seen, 0 while unknown
+    uint64_t m_sequence{0};       // vblank counter of m_vblankUs
+    uint64_t m_renderUs[RENDER_HISTORY]{};
+    size_t m_renderCount{0};
+};
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMFRAMESCHEDULER_H
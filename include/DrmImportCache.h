@@ -0,0 +1,118 @@
+#ifndef DRMIMPORTCACHE_H
+#define DRMIMPORTCACHE_H
+
+#include "DrmAllocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <sys/types.h>
+
+namespace evs {
+namespace early {
+namespace drm {
+
+/**
+ * @brief Cache of imported dma-bufs and their framebuffers.
+ * Entries are keyed by the dma-buf identity (st_dev/st_ino of the fd) plus
+ * the framebuffer layout, so a camera ring of 4-8 buffers is imported once
+ * and every later frame only costs an fstat() lookup. GEM handles are shared
+ * between entries of the same dma-buf, as the kernel returns the same handle
+ * for every import on one DRM fd, and counted in PrimeHandles so imports of
+ * PrimeImportAllocator keep theirs. Multi-planar layouts are supported as long
+ * as all planes live in the one dma-buf (e.g. camera NV12).
+ *
+ * acquire()/release() reference count an entry. Unreferenced entries stay
+ * cached until the exporter closes the buffer and calls evict(), purge() is
+ * called, or the cache grows beyond its capacity. The returned buffers are
+ * owned by the cache and must not be passed to DrmAllocator::release().
+ */
+class DrmImportCache
+{
+    DrmImportCache(const DrmImportCache &) = delete;
+    DrmImportCache &operator=(const DrmImportCache &) = delete;
+    DrmImportCache(DrmImportCache &&) = delete;
+    DrmImportCache &operator=(DrmImportCache &&) = delete;
+
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 32U;
+    static constexpr uint64_t MODIFIER_NONE = 0x00ffffffffffffffULL; // DRM_FORMAT_MOD_INVALID
+
+    explicit DrmImportCache(int drmFd, size_t capacity = DEFAULT_CAPACITY);
+    ~DrmImportCache();
+
+    const DrmBuffer *acquire(int dmaFd, const BufferInfo &info, uint64_t modifier = MODIFIER_NONE);
+    void release(const DrmBuffer *buffer);
+
+    void evict(int dmaFd);
+    void purge();
+
+    size_t size() const;
+    size_t hits() const { return m_hits; }
+    size_t misses() const { return m_misses; }
+
+private:
+    typedef struct {
+        dev_t dev;
+        ino_t ino;
+    } BufferId;
+
+    typedef struct {
+        BufferId id;
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;
+        uint32_t planes;
+        uint32_t pitches[DRM_MAX_PLANES];
+        uint32_t offsets[DRM_MAX_PLANES];
+        uint64_t modifier;
+    } Key;
+
+    typedef struct {
+        uint32_t handle;
+        int fd;
+        uint32_t refs;
+    } HandleRef;
+
+    typedef struct {
+        Key key;
+        DrmBuffer *buffer;
+        uint32_t refs;
+        bool evictPending;
+        uint64_t lastUse;
+    } Entry;
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const;
+    };
+    struct KeyEqual {
+        bool operator()(const Key &a, const Key &b) const;
+    };
+    struct IdHash {
+        size_t operator()(const BufferId &id) const;
+    };
+    struct IdEqual {
+        bool operator()(const BufferId &a, const BufferId &b) const;
+    };
+
+    DrmBuffer *importLocked(int dmaFd, const Key &key, const BufferInfo &info);
+    void destroyLocked(Entry &entry);
+    void trimLocked();
+
+    int m_drmFd{-1};
+    size_t m_capacity{DEFAULT_CAPACITY};
+    uint64_t m_clock{0};
+    size_t m_hits{0};
+    size_t m_misses{0};
+    mutable std::mutex m_mtx;
+    std::unordered_map<Key, Entry, KeyHash, KeyEqual> m_entries{};
+    std::unordered_map<BufferId, HandleRef, IdHash, IdEqual> m_handles{};
+    std::unordered_map<const DrmBuffer *, Key> m_byBuffer{};
+};
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMIMPORTCACHE_H
@@ -0,0 +1,157 @@
+#ifndef DRMOUTPUTGROUP_H
+#define DRMOUTPUTGROUP_H
+
+#include "DrmDevice.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace evs {
+namespace early {
+namespace drm {
+
+/**
+ * @brief Several displays of one DrmDevice, e.g. cluster and centre display.
+ * Every connector is routed to its own CRTC through the possible_crtcs of
+ * its encoders, keeping the CRTC it is already bound to when possible, and
+ * runs its preferred mode on the primary plane of that CRTC.
+ *
+ * INDEPENDENT outputs have a swapchain each. MIRRORED outputs share one
+ * swapchain of the first output's size, scaled by the plane of every other
+ * output. The buffers queued for all outputs go out in one atomic commit,
+ * so the displays flip on the same call and a frame waits for one flip
+ * round instead of one per display. Drivers rejecting the combined commit,
+ * and legacy KMS, commit the outputs one by one.
+ *
+ * The group drives its CRTCs next to DrmDevice::initDisplay(), which must
+ * not use the same CRTCs. Flip events come from the device event thread.
+ */
+class DrmOutputGroup
+{
+    DrmOutputGroup(const DrmOutputGroup &) = delete;
+    DrmOutputGroup &operator=(const DrmOutputGroup &) = delete;
+    DrmOutputGroup(DrmOutputGroup &&) = delete;
+    DrmOutputGroup &operator=(DrmOutputGroup &&) = delete;
+
+public:
+    static constexpr size_t MAX_OUTPUTS = 4U;
+
+    typedef enum class __Content {
+        INDEPENDENT,
+        MIRRORED,
+    } Content;
+
+    typedef struct {
+        uint32_t connectorId;
+        uint32_t crtcId;
+        int crtcIndex;
+        uint32_t planeId;     // primary plane, 0 on legacy KMS
+        uint32_t width;       // mode size
+        uint32_t height;
+        uint32_t refreshRate;
+    } Output;
+
+    explicit DrmOutputGroup(DrmDevice &device);
+    ~DrmOutputGroup();
+
+    /**
+     * @brief Route @p connectorIds to CRTCs, set their modes and allocate
+     *        @p bufferCount buffers per swapchain.
+     * @param format DRM fourcc of the buffers, 0 for the legacy 32 bpp layout.
+     */
+    bool init(const std::vector<uint32_t> &connectorIds,
+              Content content,
+              int bufferCount = DrmDevice::MIN_BUFFER_COUNT,
+              uint32_t format = 0U);
+    void deInit();
+
+    bool isInitialized() const { return m_initialized; }
+    Content content() const { return m_content; }
+    size_t outputCount() const { return m_outputs.size(); }
+    const Output &output(size_t index) const { return m_outputs[index].info; }
+
+    /**
+     * @brief Whether all outputs go out in one atomic commit. Can be turned
+     *        off, e.g. to compare with one commit per output.
+     */
+    bool isCombined() const { return m_combined; }
+    void setCombinedEnabled(bool enable) { m_combined = enable && m_combinedSupported; }
+
+    /**
+     * @brief Take a FREE buffer of the swapchain of @p output, the shared
+     *        one when mirrored. Waits up to @p timeoutMs (-1 forever).
+     * @return Buffer index, -1 on timeout.
+     */
+    int acquireBuffer(size_t output, int timeoutMs = -1);
+    DrmBuffer *buffer(size_t output, int index) const;
+
+    /**
+     * @brief Mark a rendered buffer for the next commit(). A buffer queued
+     *        before and not committed yet goes back to FREE.
+     */
+    bool queueBuffer(size_t output, int index);
+
+    /**
+     * @brief Show the queued buffers of all outputs. Waits for the flips of
+     *        the previous commit first.
+     * Without @p useVSync the flips are asynchronous where the driver
+     * supports it. The buffers replaced are freed by the flip events.
+     */
+    bool commit(bool useVSync = true);
+
+    /**
+     * @brief Wait until every flip of the last commit landed.
+     */
+    bool waitIdle(int timeoutMs = -1);
+
+    uint64_t commits() const { return m_commits; }
+    uint64_t frames() const { return m_frames; }
+
+private:
+    typedef struct {
+        DrmBuffer *buffers[DrmDevice::MAX_BUFFER_COUNT];
+        DrmDevice::BufferState states[DrmDevice::MAX_BUFFER_COUNT];
+        int count;
+        int last;    // last acquired
+        int queued;  // waiting for commit(), -1 if none
+        int pending; // in the commit in flight, -1 if none
+        int scanout; // on screen, -1 if none
+    } Swapchain;
+
+    typedef struct {
+        Output info;
+        uint32_t modeBlobId;
+        size_t chain;    // index in m_chains
+        bool flipPending;
+    } OutputState;
+
+    bool route(const std::vector<uint32_t> &masks, const std::vector<int> &preferred, std::vector<int> &crtcIndices) const;
+    bool allocateChain(Swapchain &chain, uint32_t width, uint32_t height, uint32_t format, int count);
+    bool addOutput(DrmAtomicRequest &req, const OutputState &output, const DrmBuffer *buffer, bool modeset);
+    void completeLocked();
+    void onFlipEvent(const DrmEventLoop::Event &event);
+
+    DrmDevice &m_device;
+    std::vector<OutputState> m_outputs{};
+    std::vector<Swapchain> m_chains{};
+    Content m_content{Content::INDEPENDENT};
+    bool m_initialized{false};
+    bool m_atomic{false};
+    bool m_combinedSupported{false};
+    bool m_combined{false};
+    uint32_t m_listenerId{0};
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    int m_pendingFlips{0};     // flip events still expected for the commit in flight
+    uint64_t m_commits{0};     // drmModeAtomicCommit()/drmModePageFlip() calls
+    uint64_t m_frames{0};      // commit() calls that completed
+};
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMOUTPUTGROUP_H
@@ -0,0 +1,161 @@
+#ifndef DRMPLANEASSIGNER_H
+#define DRMPLANEASSIGNER_H
+
+#include "DrmAllocator.h"
+#include "DrmAtomic.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+namespace evs {
+namespace early {
+namespace drm {
+
+typedef struct {
+    int32_t x;
+    int32_t y;
+    uint32_t width;
+    uint32_t height;
+} DrmRect;
+
+/**
+ * @brief YCbCr to RGB conversion of a YUV layer, the plane COLOR_ENCODING
+ *        and COLOR_RANGE properties. DEFAULT leaves the driver's choice,
+ *        usually BT.601 limited range.
+ */
+typedef enum class __DrmColorEncoding {
+    DEFAULT,
+    BT601,
+    BT709,
+    BT2020,
+} DrmColorEncoding;
+
+typedef enum class __DrmColorRange {
+    DEFAULT,
+    LIMITED,
+    FULL,
+} DrmColorRange;
+
+/**
+ * @brief One layer of the display, layers are given bottom to top.
+ * A layer without buffer stands for the GPU composition target, the
+ * swapchain of DrmDevice; layers that get no plane are drawn into it.
+ */
+typedef struct {
+    const DrmBuffer *buffer; // nullptr for the GPU composition layer
+    uint32_t format;         // DRM fourcc of the buffer
+    DrmRect src;             // source rectangle in buffer pixels
+    DrmRect dst;             // destination rectangle on the CRTC
+    uint32_t planeId;        // set by assign(), 0 if the GPU composes the layer
+    DrmColorEncoding encoding; // YUV formats only
+    DrmColorRange range;       // YUV formats only
+} DrmLayer;
+
+/**
+ * @brief Maps display layers onto the hardware planes of a CRTC.
+ * Planes are stacked primary first, then overlays by zpos. Each layer gets
+ * the next plane that supports its format, the GPU composition layer
+ * included. When the driver rejects a mapping (TEST_ONLY), e.g. for
+ * scaling or bandwidth limits, the layers next to the GPU composition
+ * layer are folded into it one by one until a mapping passes, down to
+ * plain GPU composition on the primary plane. The result of a layer
+ * configuration (formats and rectangles) is kept, so per-frame buffer
+ * changes do not run the search again.
+ */
+class DrmPlaneAssigner
+{
+    DrmPlaneAssigner(const DrmPlaneAssigner &) = delete;
+    DrmPlaneAssigner &operator=(const DrmPlaneAssigner &) = delete;
+    DrmPlaneAssigner(DrmPlaneAssigner &&) = delete;
+    DrmPlaneAssigner &operator=(DrmPlaneAssigner &&) = delete;
+
+public:
+    DrmPlaneAssigner(int drmFd, DrmPropertyCache &props);
+    ~DrmPlaneAssigner() = default;
+
+    /**
+     * @brief Collect the planes usable on the CRTC, cursor planes excluded.
+     */
+    bool init(uint32_t crtcId, int crtcIndex, uint32_t primaryPlaneId);
+    void reset();
+
+    size_t planeCount() const { return m_planes.size(); }
+
+    /**
+     * @brief Assign planes to @p layers, filling DrmLayer::planeId.
+     * @param clientFbId Framebuffer shown by the GPU composition layer
+     *                   during the TEST_ONLY commits.
+     * @return Number of layers with a buffer that got a plane. 0 also when
+     *         no mapping passed; without a GPU composition layer the caller
+     *         must then compose everything itself.
+     */
+    size_t assign(std::vector<DrmLayer> &layers, uint32_t clientFbId);
+
+    /**
+     * @brief Add the plane state of the assigned @p layers to @p req and
+     *        disable the planes used before but not by @p layers.
+     * @param clientFbId Framebuffer of the GPU composition layer.
+     */
+    bool addToRequest(DrmAtomicRequest &req, const std::vector<DrmLayer> &layers, uint32_t clientFbId);
+
+    /**
+     * @brief Remember the planes of a committed request as in use.
+     */
+    void commitDone(const std::vector<DrmLayer> &layers);
+
+    /**
+     * @brief Forget the cached mapping, e.g. after a commit was rejected.
+     */
+    void invalidate() { m_cacheValid = false; }
+
+    uint64_t tests() const { return m_tests; }
+    uint64_t cacheHits() const { return m_cacheHits; }
+
+private:
+    typedef struct {
+        uint32_t id;
+        uint64_t type;
+        std::vector<uint32_t> formats;
+        DrmFormatModifiers modifiers; // IN_FORMATS, empty if the driver has none
+        bool zposMutable;
+        uint64_t zposMin;
+        uint64_t zposMax;
+    } Plane;
+
+    typedef struct {
+        uint32_t format;
+        uint64_t modifier;
+        bool client;
+        DrmRect src;
+        DrmRect dst;
+        DrmColorEncoding encoding;
+        DrmColorRange range;
+        uint32_t planeId;
+    } CachedLayer;
+
+    bool supports(const Plane &plane, const DrmLayer &layer) const;
+    bool mapPlanes(std::vector<DrmLayer> &layers, size_t lo, size_t hi, int client) const;
+    bool test(const std::vector<DrmLayer> &layers, uint32_t clientFbId);
+    bool addLayer(DrmAtomicRequest &req, const DrmLayer &layer, uint32_t fbId, uint64_t zpos);
+    bool addDisable(DrmAtomicRequest &req, uint32_t planeId);
+    bool matchesCache(const std::vector<DrmLayer> &layers) const;
+    void storeCache(const std::vector<DrmLayer> &layers);
+
+    int m_drmFd{-1};
+    DrmPropertyCache &m_props;
+    uint32_t m_crtcId{0};
+    std::vector<Plane> m_planes{};              // stacking order, primary first
+    std::unordered_set<uint32_t> m_active{};   // planes enabled by the last commit
+    std::vector<CachedLayer> m_cache{};
+    bool m_cacheValid{false};
+    uint64_t m_tests{0};
+    uint64_t m_cacheHits{0};
+};
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMPLANEASSIGNER_H
@@ -0,0 +1,181 @@
+#ifndef DRMRESOURCESNAPSHOT_H
+#define DRMRESOURCESNAPSHOT_H
+
+#include "DrmFormat.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace evs {
+namespace early {
+namespace drm {
+
+typedef enum class __ConnectorType {
+    Unknown,
+    VGA,
+    HDMI,
+    DVI,
+    DisplayPort,
+    Composite,
+    SVIDEO,
+} ConnectorType;
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t refreshRate;    // Hz, rounded as reported by the driver
+    std::string name;
+    uint32_t refreshMilliHz; // from the timings, e.g. 59940 for 59.94 Hz
+    uint32_t clock;          // pixel clock in kHz, the scanout bandwidth
+    uint16_t hsyncStart;
+    uint16_t hsyncEnd;
+    uint16_t htotal;
+    uint16_t hskew;
+    uint16_t vsyncStart;
+    uint16_t vsyncEnd;
+    uint16_t vtotal;
+    uint16_t vscan;
+    uint32_t flags;          // DRM_MODE_FLAG_*
+    uint32_t type;           // DRM_MODE_TYPE_*
+    bool preferred;          // native mode of the panel
+} DrmModeInfo;
+
+typedef struct {
+    uint32_t id;
+    uint32_t bufferId;
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+    bool enabled;
+} DrmCrtcInfo;
+
+typedef struct {
+    uint32_t id;
+    DrmCrtcInfo crtc;
+    uint32_t possibleCrtcs;
+} DrmEncoderInfo;
+
+typedef struct {
+    uint32_t id;
+    ConnectorType type;
+    uint32_t typeId;
+    bool connected;
+    std::string name;
+    DrmEncoderInfo encoder;
+    std::vector<DrmModeInfo> modes;
+    bool vrrCapable;
+} DrmConnectorInfo;
+
+typedef struct {
+    uint32_t id;
+    uint32_t crtcId;
+    uint32_t possibleCrtcs;
+    std::vector<uint32_t> formats;
+    DrmFormatModifiers modifiers; // IN_FORMATS, empty if the driver has none (linear only)
+} DrmPlaneInfo;
+
+typedef struct {
+    std::string driverName;
+    std::string cardName;
+    std::string busInfo;
+    std::string deviceId; // bus location of the GPU (or its node), keys the snapshot cache
+} DrmCardInfo;
+
+/**
+ * @brief How connectors are read when a snapshot is taken.
+ */
+typedef enum class __DrmProbe {
+    CURRENT, // drmModeGetConnectorCurrent(), what the kernel knows; a connector it
+             // never probed comes from the cache file, or is probed on its own
+    FORCE,   // drmModeGetConnector() on every connector, reads EDID/DDC
+} DrmProbe;
+
+class DrmResourceSnapshot;
+using DrmSnapshotPtr = std::shared_ptr<const DrmResourceSnapshot>;
+
+/**
+ * @brief The KMS resources of a device at one point in time: card, every
+ * connector (connected or not), encoders, CRTCs and planes.
+ *
+ * DrmDevice builds it in one pass, one call per object: the encoder and
+ * CRTC of a connector are looked up in the snapshot rather than queried
+ * again. It is never modified once published, a hotplug produces a new
+ * snapshot that shares nothing mutable with the old one, so readers can
+ * keep theirs as long as they like.
+ *
+ * The probed connector state (status and modes) can be saved to a cache
+ * file and read back on the next boot, so connectors the kernel did not
+ * probe yet need no EDID read.
+ */
+class DrmResourceSnapshot
+{
+    friend class DrmDevice; // builds it in one pass
+
+public:
+    DrmResourceSnapshot() = default;
+
+    const DrmCardInfo &card() const { return m_card; }
+    const std::unordered_map<uint32_t, DrmConnectorInfo> &connectors() const { return m_connectors; }
+    const std::unordered_map<uint32_t, DrmEncoderInfo> &encoders() const { return m_encoders; }
+    const std::unordered_map<uint32_t, DrmCrtcInfo> &crtcs() const { return m_crtcs; }
+    const std::unordered_map<uint32_t, DrmPlaneInfo> &planes() const { return m_planes; }
+
+    /**
+     * @brief DRM calls made to build the snapshot.
+     */
+    uint32_t calls() const { return m_calls; }
+
+    /**
+     * @brief Connectors probed with drmModeGetConnector(), and connectors
+     *        whose state came from the cache file.
+     */
+    uint32_t probedConnectors() const { return m_probed; }
+    uint32_t cachedConnectors() const { return m_cached; }
+
+    /**
+     * @brief The snapshot after re-probing some connectors, e.g. on a
+     *        hotplug: a copy with @p probed replaced and @p removed dropped.
+     * The encoder of a probed connector replaces the one of the snapshot,
+     * its CRTC (encoder.crtc.id) is looked up in the snapshot. @p calls are
+     * the DRM calls of the re-probe.
+     */
+    DrmSnapshotPtr updated(const std::vector<DrmConnectorInfo> &probed,
+                           const std::vector<uint32_t> &removed,
+                           uint32_t calls) const;
+
+    /**
+     * @brief Write the connector state for the next boot, atomically
+     *        through a temporary file.
+     */
+    bool save(const std::string &path) const;
+
+    /**
+     * @brief Connector state saved by save() for the same driver and
+     *        DrmCardInfo::deviceId.
+     *        Only id, type, typeId, name, connected, modes and vrrCapable
+     *        are filled.
+     */
+    static bool load(const std::string &path,
+                     const DrmCardInfo &card,
+                     std::unordered_map<uint32_t, DrmConnectorInfo> &connectors);
+
+private:
+    DrmCardInfo m_card{};
+    std::unordered_map<uint32_t, DrmConnectorInfo> m_connectors{};
+    std::unordered_map<uint32_t, DrmEncoderInfo> m_encoders{};
+    std::unordered_map<uint32_t, DrmCrtcInfo> m_crtcs{};
+    std::unordered_map<uint32_t, DrmPlaneInfo> m_planes{};
+    uint32_t m_calls{0};
+    uint32_t m_probed{0};
+    uint32_t m_cached{0};
+};
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMRESOURCESNAPSHOT_H
@@ -0,0 +1,143 @@
+#ifndef DRMWRITEBACK_H
+#define DRMWRITEBACK_H
+
+#include "DrmAllocator.h"
+#include "DrmAtomic.h"
+#include "DrmBufferPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace evs {
+namespace early {
+namespace drm {
+
+/**
+ * @brief A composed frame written back by the display engine.
+ */
+typedef struct {
+    const DrmBuffer *buffer; // pool buffer, hand back with DrmDevice::releaseCapture()
+    int fence;               // sync_file signalled once written, -1 if already done; owned by the receiver
+    uint64_t frame;          // capture sequence number
+} DrmCapture;
+
+/**
+ * @brief Capture of the CRTC output through a writeback connector.
+ *
+ * The connector is routed to the CRTC once with a modeset (attach()).
+ * From then on a commit that should be captured carries WRITEBACK_FB_ID,
+ * a free buffer of the pool, and WRITEBACK_OUT_FENCE_PTR; the kernel
+ * returns a fence that signals when the engine wrote the frame, so the
+ * capture never stalls the commit or the CPU. A frame is dropped when the
+ * receiver still holds every buffer. Needs DRM_CLIENT_CAP_WRITEBACK_CONNECTORS.
+ *
+ * Buffers the receiver holds outlive reset() and a new init(): they go
+ * back to the pool on release(). Only destruction parks them regardless.
+ */
+class DrmWriteback
+{
+    DrmWriteback(const DrmWriteback &) = delete;
+    DrmWriteback &operator=(const DrmWriteback &) = delete;
+    DrmWriteback(DrmWriteback &&) = delete;
+    DrmWriteback &operator=(DrmWriteback &&) = delete;
+
+public:
+    static constexpr uint32_t CONTINUOUS = UINT32_MAX;
+    static constexpr uint32_t DEFAULT_BUFFER_COUNT = 3U;
+
+    DrmWriteback(int drmFd, DrmPropertyCache &props, DrmBufferPool &pool);
+    ~DrmWriteback();
+
+    /**
+     * @brief Find a writeback connector of CRTC @p crtcId and allocate
+     *        @p bufferCount capture buffers of the mode size, in
+     *        @p preferredFormat if the connector writes it, else XRGB8888.
+     */
+    bool init(uint32_t crtcId,
+              int crtcIndex,
+              uint32_t width,
+              uint32_t height,
+              uint32_t preferredFormat,
+              AllocatorType allocatorType,
+              uint32_t bufferCount = DEFAULT_BUFFER_COUNT);
+
+    /**
+     * @brief Detach and give the free buffers back to the pool, held ones
+     *        follow on release().
+     */
+    void reset();
+
+    /**
+     * @brief Route the connector to the CRTC, a blocking modeset. No flip
+     *        may be in flight.
+     */
+    bool attach();
+    void detach();
+
+    uint32_t connectorId() const { return m_connectorId; }
+    uint32_t format() const { return m_format; }
+    uint32_t bufferCount() const;
+
+    /**
+     * @brief Buffers held by the receiver, including those of an earlier init().
+     */
+    uint32_t held() const;
+
+    /**
+     * @brief Frames to capture from the next commit on, CONTINUOUS until
+     *        set to 0.
+     */
+    void setFrames(uint32_t frames) { m_frames = frames; }
+    uint32_t frames() const { return m_frames; }
+
+    /**
+     * @brief Add a free buffer and the out fence to the next commit.
+     * @return false if nothing is captured or every buffer is held.
+     */
+    bool addToRequest(DrmAtomicRequest &req);
+
+    /**
+     * @brief The request of the last addToRequest() was committed.
+     */
+    void commitDone(DrmCapture &capture);
+    void commitFailed();
+
+    /**
+     * @brief Give back a buffer of a DrmCapture.
+     */
+    bool release(const DrmBuffer *buffer);
+
+    uint64_t captured() const { return m_captured; }
+    uint64_t dropped() const { return m_dropped; }
+
+private:
+    typedef struct {
+        DrmBuffer *buffer;
+        int32_t outFence; // written by the kernel on commit
+        bool held;        // by the receiver or the commit in progress
+        bool retired;     // of an earlier init(), parked once released
+    } Slot;
+
+    bool findConnector(uint32_t crtcIndexMask);
+    bool pickFormat(uint32_t preferredFormat);
+
+    int m_drmFd{-1};
+    DrmPropertyCache &m_props;
+    DrmBufferPool &m_pool;
+    uint32_t m_connectorId{0};
+    uint32_t m_crtcId{0};
+    uint32_t m_format{0};
+    bool m_attached{false};
+    std::vector<Slot> m_slots{};
+    int m_added{-1};               // slot of the last addToRequest()
+    uint32_t m_frames{0};
+    uint64_t m_captured{0};
+    uint64_t m_dropped{0};
+};
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMWRITEBACK_H
@@ -0,0 +1,76 @@
+#ifndef FAST_COPY_H
+#define FAST_COPY_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace evs {
+namespace early {
+
+/**
+ * @brief Copy and fill kernels for scanout memory.
+ *
+ * Dumb buffers and uncached heap buffers are mapped write-combined: reads
+ * are uncached and partial writes flush the combining buffer early, so
+ * memcpy/memset byte loops can be an order of magnitude slower than on
+ * cached memory. The STREAMING kernels write aligned 64 byte bursts with
+ * non-temporal stores (SSE2 movntdq on x86, stnp on AArch64, NEON stores
+ * on ARMv7) and never read the destination. AUTO uses them for large
+ * transfers and the libc routines for small ones.
+ */
+class FastCopy
+{
+public:
+    enum class Mode {
+        AUTO,      ///< Streaming above STREAMING_THRESHOLD bytes, cached below
+        CACHED,    ///< libc memcpy/memset
+        STREAMING, ///< Non-temporal stores, for write-combined destinations
+    };
+
+    static constexpr size_t STREAMING_THRESHOLD = 16U * 1024U;
+
+    /**
+     * @brief Name of the streaming backend compiled in ("sse2", "neon-stnp", "neon", "generic").
+     */
+    static const char *backend();
+
+    static void copy(void *dst, const void *src, size_t size, Mode mode = Mode::AUTO);
+
+    /**
+     * @brief Copy @p rows rows of @p widthBytes bytes between buffers with
+     *        different strides, e.g. a tightly packed frame into a DrmBuffer
+     *        whose pitch was aligned by the kernel.
+     */
+    static void copy2D(void *dst,
+                       size_t dstStride,
+                       const void *src,
+                       size_t srcStride,
+                       size_t widthBytes,
+                       size_t rows,
+                       Mode mode = Mode::AUTO);
+
+    /**
+     * @brief Fill @p size bytes with a repeated 32 bit pattern, starting with
+     *        the lowest byte of @p pattern at @p dst.
+     */
+    static void fill(void *dst, size_t size, uint32_t pattern, Mode mode = Mode::AUTO);
+
+    /**
+     * @brief Fill a rectangle of a linear buffer with @p color.
+     * @param bytesPerPixel 1, 2, 3 or 4; the low bytes of @p color are used.
+     */
+    static void fillRect(void *dst,
+                         size_t dstStride,
+                         uint32_t x,
+                         uint32_t y,
+                         uint32_t width,
+                         uint32_t height,
+                         uint32_t bytesPerPixel,
+                         uint32_t color,
+                         Mode mode = Mode::AUTO);
+};
+
+} // namespace early
+} // namespace evs
+
+#endif // FAST_COPY_H
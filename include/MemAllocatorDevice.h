@@ -25,8 +25,9 @@ namespace early {
 class MemAllocatorDevice
 {
 public:
-    explicit MemAllocatorDevice(const std::string &devicePath = "")
-        : m_device(devicePath)
+    explicit MemAllocatorDevice(const std::string &devicePath = "",
+                                MemoryTag tag = MemoryTag::OTHER)
+        : m_device(devicePath, tag)
         , m_buffers{} {
     }
     ~MemAllocatorDevice() {}
@@ -39,10 +40,17 @@ public:
         m_device.close();
     }
 
-    void createBuffer(size_t count, size_t size) {
+    size_t createBuffer(size_t count, size_t size) {
+        size_t created = 0;
         for (size_t i = 0; i < count; i++) {
-            m_buffers.emplace_back(m_device.allocate(size));
+            BufferHandlePtr buf = m_device.allocate(size);
+            if (buf == nullptr) {
+                break;
+            }
+            m_buffers.emplace_back(std::move(buf));
+            created++;
         }
+        return created;
     }
 
     void destroyBuffer() {
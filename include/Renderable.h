@@ -3,6 +3,7 @@
 
 #include "RenderContext.h"
 #include "FrameBuffer.h"
+#include "DamageRegion.h"
 
 #include <GLES2/gl2.h>
 #include <string>
@@ -18,6 +19,8 @@ class Renderable
 public:
     bool init(int width, int height, RenderContext *ctx) {
         ctxPtr = ctx;
+        damage.setBounds(static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+        damage.addFull();
         return onInit(width, height);
     }
 
@@ -25,6 +28,18 @@ public:
         onRender();
     }
 
+    /**
+     * @brief Pixels the pass changed with the last execute() or setEnabled(),
+     *        in output coordinates. Cleared by the renderer once collected.
+     */
+    const DamageRegion &getDamage() const {
+        return damage;
+    }
+
+    void clearDamage() {
+        damage.clear();
+    }
+
     void destroy() {
         onDestroy();
     }
@@ -41,6 +56,22 @@ public:
         return outputFB;
     }
 
+    /**
+     * @brief Disabled passes are skipped, their input is handed to the next
+     *        pass, e.g. while their layer is shown on a hardware plane.
+     */
+    void setEnabled(bool value) {
+        if (value != enabled) {
+            // What the pass drew appears or disappears
+            damage.addFull();
+        }
+        enabled = value;
+    }
+
+    bool isEnabled() const {
+        return enabled;
+    }
+
     explicit Renderable(const std::string &n)
         : inputFB{}
         , outputFB{}
@@ -52,6 +83,14 @@ protected:
     virtual void onRender() = 0;
     virtual void onDestroy() = 0;
 
+    void addDamage(const DamageRect &rect) {
+        damage.add(rect);
+    }
+
+    void addFullDamage() {
+        damage.addFull();
+    }
+
     GLuint compileShader(GLenum type, const char *src) {
         GLuint shader = glCreateShader(type);
         glShaderSource(shader, 1, &src, nullptr);
@@ -72,6 +111,8 @@ protected:
     FrameBuffer outputFB{};
     std::string name{""};
     RenderContext *ctxPtr = nullptr;
+    bool enabled = true;
+    DamageRegion damage{};
 };
 
 } // namespace early
@@ -3,6 +3,8 @@
 
 #include "Renderable.h"
 #include "RenderContext.h"
+#include <EGL/eglext.h>
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <mutex>
@@ -27,12 +29,53 @@ public:
     
     virtual bool addFrame(void *) = 0;
     virtual bool nextFrameReady() = 0;
+
+    /**
+     * @brief When the render loop starts rendering() a frame that was ready
+     *        at @p readyUs, in steady_clock microseconds. Frames arriving
+     *        meanwhile replace it. The default renders right away.
+     */
+    virtual uint64_t renderStartUs(uint64_t readyUs) { return readyUs; }
+
+    /**
+     * @brief Called by the render loop after every rendering().
+     */
+    virtual void onFrameRendered(uint64_t durationUs) {}
+
+    /**
+     * @brief Native fence fd of the last rendering() pass, owned by the caller.
+     * Signals when the GPU finished the pass; import it into the output
+     * dma-buf (DmaBufFence::attachOrWait) instead of stalling in glFinish().
+     * @return -1 when the pass already finished on the CPU (no
+     *         EGL_ANDROID_native_fence_sync) or the fence was taken.
+     */
+    int takeRenderFence();
+
+    /**
+     * @brief Pixels of the last rendering() that differ from the frame
+     *        before, the union of what the enabled passes changed. Full for
+     *        the first frame. Pass it with the frame to DrmDevice::queueBuffer().
+     */
+    const DamageRegion &frameDamage() const { return m_frameDamage; }
+
 protected:
+    /**
+     * @brief End the GPU pass: flush with a native fence when supported,
+     *        glFinish() otherwise.
+     */
+    void finishPass();
+    void releaseRenderFence();
+
     RenderContext *m_context{nullptr};
     std::vector<std::shared_ptr<Renderable>> m_renderJobs{};
     std::mutex m_mtx;
     int m_state = 0;
     bool m_init{false};
+    int m_renderFence{-1};
+    DamageRegion m_frameDamage{};
+    PFNEGLCREATESYNCKHRPROC m_eglCreateSyncKHR{nullptr};
+    PFNEGLDESTROYSYNCKHRPROC m_eglDestroySyncKHR{nullptr};
+    PFNEGLDUPNATIVEFENCEFDANDROIDPROC m_eglDupNativeFenceFD{nullptr};
 
 };
 
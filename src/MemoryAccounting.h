@@ -0,0 +1,314 @@
+#ifndef MEMORYACCOUNTING_H
+#define MEMORYACCOUNTING_H
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace evs {
+namespace early {
+
+/**
+ * @enum MemoryTag
+ * @brief Owner of a buffer allocation, used to group the accounted bytes.
+ */
+enum class MemoryTag {
+    OTHER,    ///< Untagged allocations
+    CAMERA,   ///< Camera capture buffers
+    DISPLAY,  ///< Scanout buffers
+    RENDER,   ///< GPU textures and render targets
+    RECORDER, ///< Recording / capture buffers
+    MAX
+};
+
+/**
+ * @struct MemoryTagStats
+ * @brief Accounted bytes of one tag.
+ */
+typedef struct {
+    size_t current;     ///< Bytes currently held
+    size_t peak;        ///< Highest value of current since the last resetPeak()
+    size_t budget;      ///< Budget in bytes, 0 means unlimited
+    size_t allocations; ///< Number of live allocations
+    size_t failures;    ///< Number of reservations refused by the budget
+} MemoryTagStats;
+
+/**
+ * @struct MemorySnapshot
+ * @brief Point in time copy of all accounted tags.
+ */
+typedef struct {
+    std::array<MemoryTagStats, static_cast<size_t>(MemoryTag::MAX)> tags;
+    size_t current;     ///< Sum of current bytes over all tags
+    size_t peak;        ///< Highest process wide total since the last resetPeak()
+    size_t totalBudget; ///< Process wide budget, 0 means unlimited
+} MemorySnapshot;
+
+/**
+ * @brief Process wide accounting of dma-buf, dumb buffer and texture memory.
+ *
+ * Allocators call reserve() before committing memory and release() when the
+ * memory is returned. A reservation that would exceed the tag budget or the
+ * total budget first asks the registered evictors of that tag to give memory
+ * back (e.g. pools dropping parked buffers) and fails if that is not enough,
+ * so the caller can bail out before the kernel runs out of memory.
+ */
+class MemoryAccounting
+{
+    MemoryAccounting(const MemoryAccounting &) = delete;
+    MemoryAccounting &operator=(const MemoryAccounting &) = delete;
+    MemoryAccounting(MemoryAccounting &&) = delete;
+    MemoryAccounting &operator=(MemoryAccounting &&) = delete;
+
+public:
+    /**
+     * @brief Evictor callback, asked to free at least @p bytes of @p tag.
+     *        Returns the number of bytes actually freed. The evictor releases
+     *        the memory through the normal release() path. Called without
+     *        the accounting lock, it must not unregister itself.
+     */
+    using EvictFnc = size_t (*)(MemoryTag tag, size_t bytes, void *param);
+
+    static MemoryAccounting &instance() {
+        static MemoryAccounting accounting;
+        return accounting;
+    }
+
+    static const char *tagName(MemoryTag tag) {
+        static const char *names[] = {"other", "camera", "display", "render", "recorder"};
+        size_t idx = static_cast<size_t>(tag);
+        return (idx < static_cast<size_t>(MemoryTag::MAX)) ? names[idx] : "invalid";
+    }
+
+    void setBudget(MemoryTag tag, size_t bytes) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_tags[index(tag)].budget = bytes;
+    }
+
+    void setTotalBudget(size_t bytes) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_totalBudget = bytes;
+    }
+
+    /**
+     * @brief Account @p bytes for @p tag if the budgets allow it.
+     * @return true if the bytes are accounted, false if the caller must not allocate.
+     */
+    bool reserve(MemoryTag tag, size_t bytes) {
+        std::vector<Evictor> evictors{};
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            if (fits(tag, bytes)) {
+                commit(tag, bytes);
+                return true;
+            }
+            for (const auto &evictor : m_evictors) {
+                if (evictor.tag == tag) {
+                    evictors.push_back(evictor);
+                }
+            }
+        }
+
+        for (const auto &evictor : evictors) {
+            size_t needed = overshoot(tag, bytes);
+            if (needed == 0) {
+                break;
+            }
+            {
+                // Skip evictors unregistered since the copy, and make
+                // unregisterEvictor() wait for this call
+                std::unique_lock<std::mutex> lock(m_mtx);
+                if (registered(evictor.id) == false) {
+                    continue;
+                }
+                m_calls.push_back(evictor.id);
+            }
+            evictor.fnc(tag, needed, evictor.param);
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_calls.erase(std::find(m_calls.begin(), m_calls.end(), evictor.id));
+            }
+            m_callsDone.notify_all();
+        }
+
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if (fits(tag, bytes)) {
+            commit(tag, bytes);
+            return true;
+        }
+        m_tags[index(tag)].failures += 1;
+        return false;
+    }
+
+    /**
+     * @brief Change a reservation of @p reserved bytes to @p bytes, e.g. to
+     *        the size the kernel actually allocated. Growing is subject to
+     *        the budgets, evictors are not called.
+     * @return false if the reservation cannot grow, it is left unchanged.
+     */
+    bool adjust(MemoryTag tag, size_t reserved, size_t bytes) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        MemoryTagStats &stats = m_tags[index(tag)];
+        if (bytes > reserved) {
+            if (fits(tag, bytes - reserved) == false) {
+                stats.failures += 1;
+                return false;
+            }
+            stats.current += bytes - reserved;
+            m_current += bytes - reserved;
+            stats.peak = (stats.current > stats.peak) ? stats.current : stats.peak;
+            m_peak = (m_current > m_peak) ? m_current : m_peak;
+        } else {
+            size_t freed = reserved - bytes;
+            stats.current = (stats.current > freed) ? (stats.current - freed) : 0U;
+            m_current = (m_current > freed) ? (m_current - freed) : 0U;
+        }
+        return true;
+    }
+
+    void release(MemoryTag tag, size_t bytes) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        MemoryTagStats &stats = m_tags[index(tag)];
+        stats.current = (stats.current > bytes) ? (stats.current - bytes) : 0U;
+        stats.allocations = (stats.allocations > 0) ? (stats.allocations - 1) : 0U;
+        m_current = (m_current > bytes) ? (m_current - bytes) : 0U;
+    }
+
+    int registerEvictor(MemoryTag tag, EvictFnc fnc, void *param) {
+        if (fnc == nullptr) {
+            return -1;
+        }
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_evictors.push_back(Evictor{tag, fnc, param, ++m_evictorIds});
+        return 0;
+    }
+
+    /**
+     * @brief Remove an evictor. Returns once no reserve() is still calling
+     *        it, so @p param can be destroyed right after.
+     */
+    void unregisterEvictor(EvictFnc fnc, void *param) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        std::vector<uint64_t> ids{};
+        for (auto it = m_evictors.begin(); it != m_evictors.end();) {
+            if ((it->fnc == fnc) && (it->param == param)) {
+                ids.push_back(it->id);
+                it = m_evictors.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        m_callsDone.wait(lock, [this, &ids]() {
+            for (uint64_t id : ids) {
+                if (std::find(m_calls.begin(), m_calls.end(), id) != m_calls.end()) {
+                    return false;
+                }
+            }
+            return true;
+        });
+    }
+
+    MemoryTagStats stats(MemoryTag tag) const {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        return m_tags[index(tag)];
+    }
+
+    MemorySnapshot snapshot() const {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        MemorySnapshot snap{};
+        snap.tags = m_tags;
+        snap.current = m_current;
+        snap.peak = m_peak;
+        snap.totalBudget = m_totalBudget;
+        return snap;
+    }
+
+    void resetPeak() {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        for (auto &stats : m_tags) {
+            stats.peak = stats.current;
+        }
+        m_peak = m_current;
+    }
+
+private:
+    typedef struct {
+        MemoryTag tag;
+        EvictFnc fnc;
+        void *param;
+        uint64_t id; // unique per registration
+    } Evictor;
+
+    MemoryAccounting() = default;
+
+    static size_t index(MemoryTag tag) {
+        size_t idx = static_cast<size_t>(tag);
+        return (idx < static_cast<size_t>(MemoryTag::MAX)) ? idx : static_cast<size_t>(MemoryTag::OTHER);
+    }
+
+    bool registered(uint64_t id) const {
+        for (const auto &evictor : m_evictors) {
+            if (evictor.id == id) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool fits(MemoryTag tag, size_t bytes) const {
+        const MemoryTagStats &stats = m_tags[index(tag)];
+        if ((stats.budget != 0) && (stats.current + bytes > stats.budget)) {
+            return false;
+        }
+        if ((m_totalBudget != 0) && (m_current + bytes > m_totalBudget)) {
+            return false;
+        }
+        return true;
+    }
+
+    size_t overshoot(MemoryTag tag, size_t bytes) const {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        const MemoryTagStats &stats = m_tags[index(tag)];
+        size_t needed = 0;
+        if ((stats.budget != 0) && (stats.current + bytes > stats.budget)) {
+            needed = stats.current + bytes - stats.budget;
+        }
+        if ((m_totalBudget != 0) && (m_current + bytes > m_totalBudget)) {
+            size_t total = m_current + bytes - m_totalBudget;
+            needed = (total > needed) ? total : needed;
+        }
+        return needed;
+    }
+
+    void commit(MemoryTag tag, size_t bytes) {
+        MemoryTagStats &stats = m_tags[index(tag)];
+        stats.current += bytes;
+        stats.allocations += 1;
+        if (stats.current > stats.peak) {
+            stats.peak = stats.current;
+        }
+        m_current += bytes;
+        if (m_current > m_peak) {
+            m_peak = m_current;
+        }
+    }
+
+    mutable std::mutex m_mtx;
+    std::array<MemoryTagStats, static_cast<size_t>(MemoryTag::MAX)> m_tags{};
+    std::vector<Evictor> m_evictors{};
+    uint64_t m_evictorIds{0};
+    std::vector<uint64_t> m_calls{};       // ids of the evictors being called
+    std::condition_variable m_callsDone{};
+    size_t m_current{0};
+    size_t m_peak{0};
+    size_t m_totalBudget{0};
+};
+
+} // namespace early
+} // namespace evs
+
+#endif // MEMORYACCOUNTING_H
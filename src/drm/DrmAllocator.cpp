@@ -0,0 +1,208 @@
+#include "DrmAllocator.h"
+#include "CommonUtil.h"
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <cstring>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay DrmAllocator"
+#endif
+
+namespace evs {
+namespace early {
+namespace drm {
+
+size_t resolvePlaneLayout(const BufferInfo &info,
+                          uint32_t &planes,
+                          uint32_t pitches[DRM_MAX_PLANES],
+                          uint32_t offsets[DRM_MAX_PLANES]) {
+    uint32_t base = (info.offset > 0) ? static_cast<uint32_t>(info.offset) : 0U;
+    const DrmFormatInfo *fmt = DrmFormat::info(static_cast<uint32_t>(info.format));
+    size_t size = 0U;
+
+    for (uint32_t plane = 0U; plane < DRM_MAX_PLANES; plane++) {
+        pitches[plane] = 0U;
+        offsets[plane] = 0U;
+    }
+
+    if ((info.planes > 0U) && (info.pitches[0] > 0U)) {
+        planes = (info.planes < DRM_MAX_PLANES) ? info.planes : DRM_MAX_PLANES;
+        for (uint32_t plane = 0U; plane < planes; plane++) {
+            pitches[plane] = info.pitches[plane];
+            offsets[plane] = info.offsets[plane];
+            uint32_t rows = (fmt != nullptr) ? DrmFormat::planeHeight(*fmt, plane, info.height) : info.height;
+            size_t end = offsets[plane] + static_cast<size_t>(pitches[plane]) * rows;
+            size = (end > size) ? end : size;
+        }
+        return size;
+    }
+
+    if (fmt != nullptr) {
+        uint32_t pitch0 = (info.pitch > 0) ? static_cast<uint32_t>(info.pitch) : 0U;
+        planes = fmt->planes;
+        size = DrmFormat::layout(fmt->format, info.width, info.height, pitch0, pitches, offsets);
+        for (uint32_t plane = 0U; plane < planes; plane++) {
+            offsets[plane] += base;
+        }
+        return size + base;
+    }
+
+    planes = 1U;
+    pitches[0] = (info.pitch > 0) ? static_cast<uint32_t>(info.pitch) : info.width * (info.bpp / 8);
+    offsets[0] = base;
+    return base + static_cast<size_t>(pitches[0]) * info.height;
+}
+
+int addFramebuffer(int fd,
+                   const BufferInfo &info,
+                   const uint32_t handles[DRM_MAX_PLANES],
+                   const uint32_t pitches[DRM_MAX_PLANES],
+                   const uint32_t offsets[DRM_MAX_PLANES],
+                   uint32_t &fbId) {
+    int ret = 0;
+    fbId = 0;
+    if ((info.format > 0) && (DrmFormat::hasModifier(info.modifier) == true)) {
+        uint64_t modifiers[DRM_MAX_PLANES] = {};
+        for (uint32_t plane = 0U; plane < DRM_MAX_PLANES; plane++) {
+            modifiers[plane] = (handles[plane] != 0U) ? info.modifier : 0U;
+        }
+        ret = drmModeAddFB2WithModifiers(fd,
+                                         info.width,
+                                         info.height,
+                                         static_cast<uint32_t>(info.format),
+                                         handles,
+                                         pitches,
+                                         offsets,
+                                         modifiers,
+                                         &fbId,
+                                         DRM_MODE_FB_MODIFIERS);
+        if (ret != 0) {
+            EARLY_ERROR("Failed to add framebuffer %ux%u with format 0x%x modifier 0x%llx: %s\n",
+                        info.width,
+                        info.height,
+                        info.format,
+                        static_cast<unsigned long long>(info.modifier),
+                        strerror(errno));
+        }
+    } else if (info.format > 0) {
+        ret = drmModeAddFB2(fd, info.width, info.height, static_cast<uint32_t>(info.format), handles, pitches, offsets, &fbId, 0);
+        if (ret != 0) {
+            EARLY_ERROR("Failed to add framebuffer %ux%u with format 0x%x: %s\n", info.width, info.height, info.format, strerror(errno));
+        }
+    } else {
+        ret = drmModeAddFB(fd, info.width, info.height, info.depth, info.bpp, pitches[0], handles[0], &fbId);
+        if (ret != 0) {
+            EARLY_ERROR("Failed to add framebuffer %ux%u without format: %s\n", info.width, info.height, strerror(errno));
+        }
+    }
+    return ret;
+}
+
+DrmBuffer *DrmAllocator::allocate(AllocatorType type, int fd, const BufferInfo &info) {
+    DrmBuffer *buf = nullptr;
+    // The CPU writes these buffers row by row, a tiled layout would be garbage on screen
+    BufferInfo linear = info;
+    if (DrmFormat::hasModifier(info.modifier) == true) {
+        EARLY_WARN("Allocated buffers are linear, modifier 0x%llx ignored\n", static_cast<unsigned long long>(info.modifier));
+    }
+    linear.modifier = DRM_FORMAT_MOD_LINEAR;
+    switch (type) {
+    case AllocatorType::DRM_ALLOCATOR_MMAP:
+        buf = MMapAllocator::allocate(fd, linear);
+        break;
+    case AllocatorType::DRM_ALLOCATOR_HEAP_DMA:
+        buf = HeapDMAAllocator::allocate(fd, linear);
+        break;
+#ifdef SUPPORT_ION_ALLOCATOR
+    case AllocatorType::DRM_ALLOCATOR_ION:
+        buf = IonAllocator::allocate(fd, linear);
+        break;
+#endif // SUPPORT_ION_ALLOCATOR
+    case AllocatorType::DRM_ALLOCATOR_IMPORT:
+        EARLY_ERROR("Import allocator cannot allocate, use DrmAllocator::import()\n");
+        break;
+    default:
+        EARLY_ERROR("Unsupported allocator type %d\n", static_cast<int>(type));
+        break;
+    }
+    return buf;
+}
+
+DrmBuffer *DrmAllocator::import(int fd, int dmaFd, const BufferInfo &info, bool map) {
+    return PrimeImportAllocator::import(fd, dmaFd, info, map);
+}
+
+DrmBuffer *DrmAllocator::import(int fd, const int dmaFds[DRM_MAX_PLANES], const BufferInfo &info, bool map) {
+    return PrimeImportAllocator::import(fd, dmaFds, info, map);
+}
+
+DrmBuffer *DrmAllocator::import(int fd, const BufferHandle &handle, const BufferInfo &info) {
+    BufferInfo importInfo = info;
+    if (importInfo.size == 0) {
+        importInfo.size = handle.length;
+    }
+    if (importInfo.tag == MemoryTag::OTHER) {
+        importInfo.tag = handle.tag;
+    }
+    return PrimeImportAllocator::import(fd, handle.fd, importInfo, (handle.virt != nullptr));
+}
+
+void DrmAllocator::release(int fd, DrmBuffer *buf) {
+    if (buf == nullptr) {
+        EARLY_ERROR("Buffer is null, nothing to release\n");
+        return;
+    }
+    switch (buf->allocator) {
+    case AllocatorType::DRM_ALLOCATOR_MMAP:
+        MMapAllocator::release(fd, buf);
+        break;
+    case AllocatorType::DRM_ALLOCATOR_HEAP_DMA:
+        HeapDMAAllocator::release(fd, buf);
+        break;
+#ifdef SUPPORT_ION_ALLOCATOR
+    case AllocatorType::DRM_ALLOCATOR_ION:
+        IonAllocator::release(fd, buf);
+        break;
+#endif // SUPPORT_ION_ALLOCATOR
+    case AllocatorType::DRM_ALLOCATOR_IMPORT:
+        PrimeImportAllocator::release(fd, buf);
+        break;
+    default:
+        EARLY_ERROR("Unsupported allocator type %d, leaking buffer fbId=%u\n", static_cast<int>(buf->allocator), buf->fbId);
+        break;
+    }
+}
+
+int DrmAllocator::exposeHandleToFd(int fd, DrmBuffer *buf) {
+    int dmaFd = -1;
+    if (buf == nullptr) {
+        EARLY_ERROR("Invalid buffer\n");
+        return dmaFd;
+    }
+    switch (buf->allocator) {
+    case AllocatorType::DRM_ALLOCATOR_MMAP:
+        dmaFd = MMapAllocator::exposeHandleToFd(fd, buf);
+        break;
+    case AllocatorType::DRM_ALLOCATOR_HEAP_DMA:
+        dmaFd = HeapDMAAllocator::exposeHandleToFd(fd, buf);
+        break;
+#ifdef SUPPORT_ION_ALLOCATOR
+    case AllocatorType::DRM_ALLOCATOR_ION:
+        dmaFd = IonAllocator::exposeHandleToFd(fd, buf);
+        break;
+#endif // SUPPORT_ION_ALLOCATOR
+    case AllocatorType::DRM_ALLOCATOR_IMPORT:
+        dmaFd = PrimeImportAllocator::exposeHandleToFd(fd, buf);
+        break;
+    default:
+        EARLY_ERROR("Unsupported allocator type %d\n", static_cast<int>(buf->allocator));
+        break;
+    }
+    return dmaFd;
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
@@ -1,6 +1,10 @@
 #ifndef BUFFERALLOCATOR_H
 #define BUFFERALLOCATOR_H
 
+#include "MemoryAccounting.h"
+#include "BufferHandle.h"
+#include "DrmFormat.h"
+
 #include <cstdint>
 #include <cstddef>
 
@@ -8,6 +12,24 @@ namespace evs {
 namespace early {
 namespace drm {
 
+typedef enum {
+    DRM_ALLOCATOR_MMAP,
+    DRM_ALLOCATOR_HEAP_DMA,
+#ifdef SUPPORT_ION_ALLOCATOR
+    DRM_ALLOCATOR_ION,
+#endif // SUPPORT_ION_ALLOCATOR
+    DRM_ALLOCATOR_IMPORT,
+    DRM_ALLOCATOR_UNKNOWN
+} AllocatorType;
+
+/**
+ * @brief A buffer usable by the display, the GPU and the CPU.
+ * The dma-buf fd, the GEM handle, the framebuffer id and the CPU mapping
+ * are owned by the buffer and released together by DrmAllocator::release().
+ * handle/stride describe the first plane and are kept for single plane
+ * users; multi-planar formats (NV12, YUV420, P010, ...) use the per-plane
+ * arrays. ptr maps the memory of the first plane's dma-buf.
+ */
 typedef struct {
     uint32_t fbId;
     uint32_t handle;
@@ -15,8 +37,24 @@ typedef struct {
     uint32_t offset;
     size_t size;
     void *ptr;
+    MemoryTag tag;
+    int fd;                  // dma-buf fd owned by the buffer, -1 until exported
+    AllocatorType allocator; // allocator which created the buffer
+    uint32_t format;                   // DRM fourcc, 0 for legacy depth/bpp framebuffers
+    uint32_t planeCount;               // number of planes, at least 1
+    uint32_t handles[DRM_MAX_PLANES];  // GEM handle of each plane
+    uint32_t strides[DRM_MAX_PLANES];  // pitch of each plane in bytes
+    uint32_t offsets[DRM_MAX_PLANES];  // offset of each plane in its dma-buf
+    int planeFds[DRM_MAX_PLANES];      // dma-buf fd owned per plane, -1 if the plane lives in fd
+    uint64_t modifier;                 // layout of the framebuffer, DRM_FORMAT_MOD_LINEAR unless tiled/compressed
 } DrmBuffer;
 
+/**
+ * @brief Requested buffer layout.
+ * pitch/offset describe the first plane. For imports of multi-planar
+ * buffers pitches/offsets give the layout of each plane; when planes is 0
+ * the layout is derived from the format as a contiguous linear buffer.
+ */
 typedef struct {
     uint32_t width;
     uint32_t height;
@@ -27,16 +65,36 @@ typedef struct {
     int offset;
     int pitch;
     size_t size;
+    MemoryTag tag;
+    uint32_t planes;
+    uint32_t pitches[DRM_MAX_PLANES];
+    uint32_t offsets[DRM_MAX_PLANES];
+    uint64_t modifier; // tiled/compressed layout of imports, 0 (DRM_FORMAT_MOD_LINEAR) otherwise
 } BufferInfo;
 
-typedef enum {
-    DRM_ALLOCATOR_MMAP,
-    DRM_ALLOCATOR_HEAP_DMA,
-#ifdef SUPPORT_ION_ALLOCATOR
-    DRM_ALLOCATOR_ION,
-#endif // SUPPORT_ION_ALLOCATOR
-    DRM_ALLOCATOR_UNKNOWN
-} AllocatorType;
+/**
+ * @brief Resolve the plane layout of @p info.
+ * Explicit per-plane pitches win, then the plane 0 pitch, then the packed
+ * layout of the format. Legacy buffers without a format are single plane.
+ * @return Total size in bytes of a contiguous buffer with this layout.
+ */
+size_t resolvePlaneLayout(const BufferInfo &info,
+                          uint32_t &planes,
+                          uint32_t pitches[DRM_MAX_PLANES],
+                          uint32_t offsets[DRM_MAX_PLANES]);
+
+/**
+ * @brief Wrap the planes in a framebuffer, drmModeAddFB2WithModifiers for
+ *        a tiled or compressed info.modifier, drmModeAddFB2 when a format
+ *        is given, legacy drmModeAddFB otherwise.
+ * @return 0 on success, the drmModeAddFB/AddFB2 error otherwise.
+ */
+int addFramebuffer(int fd,
+                   const BufferInfo &info,
+                   const uint32_t handles[DRM_MAX_PLANES],
+                   const uint32_t pitches[DRM_MAX_PLANES],
+                   const uint32_t offsets[DRM_MAX_PLANES],
+                   uint32_t &fbId);
 
 /**
  * @brief Allocator for mmap buffers.
@@ -55,7 +113,7 @@ class MMapAllocator
 public:
     static DrmBuffer *allocate(int fd, const BufferInfo &info);
     static void release(int fd, DrmBuffer *buf);
-    static int exposeHandleToFd(int fd, const DrmBuffer *buf);
+    static int exposeHandleToFd(int fd, DrmBuffer *buf);
 };
 
 /**
@@ -74,7 +132,7 @@ class HeapDMAAllocator
 public:
     static DrmBuffer *allocate(int fd, const BufferInfo &info);
     static void release(int fd, DrmBuffer *buf);
-    static int exposeHandleToFd(int fd, const DrmBuffer *buf);
+    static int exposeHandleToFd(int fd, DrmBuffer *buf);
 };
 
 #ifdef SUPPORT_ION_ALLOCATOR
@@ -91,12 +149,75 @@ class IonAllocator
 {
 public:
     static DrmBuffer *allocate(int fd, const BufferInfo &info);
-    static void release(int fd, DrmBuffer &buf);
-    static int exposeHandleToFd(int fd, const DrmBuffer *buf);
+    static void release(int fd, DrmBuffer *buf);
+    static int exposeHandleToFd(int fd, DrmBuffer *buf);
 };
 
 #endif // SUPPORT_ION_ALLOCATOR
 
+/**
+ * @brief GEM handles of imported dma-bufs, reference counted per DRM fd.
+ * The kernel returns the same handle for every import of a dma-buf on one
+ * DRM fd and a single DRM_IOCTL_GEM_CLOSE drops it for all of them, so
+ * every importer (PrimeImportAllocator, DrmImportCache) goes through here
+ * and the handle is only closed by the last release.
+ */
+class PrimeHandles
+{
+public:
+    /**
+     * @brief DRM_IOCTL_PRIME_FD_TO_HANDLE, taking one reference.
+     * @return 0 on success, -errno otherwise.
+     */
+    static int import(int drmFd, int dmaFd, uint32_t &handle);
+    /**
+     * @brief Drop a reference of import(), DRM_IOCTL_GEM_CLOSE on the last.
+     */
+    static void release(int drmFd, uint32_t handle);
+};
+
+/**
+ * @brief Importer for dma-bufs allocated outside of this process or module
+ * (camera, GPU, other processes).
+ * The dma-buf is converted to a GEM handle with DRM_IOCTL_PRIME_FD_TO_HANDLE
+ * and wrapped in a framebuffer. The buffer keeps a duplicate of the fd, so the
+ * exporter may close its own fd at any time. No pixel data is copied.
+ */
+class PrimeImportAllocator
+{
+public:
+    static DrmBuffer *import(int fd, int dmaFd, const BufferInfo &info, bool map = true);
+    /**
+     * @brief Import a buffer whose planes live in separate dma-bufs.
+     * @p dmaFds holds one fd per plane; planes sharing a dma-buf may repeat
+     * the fd. Only the first plane's dma-buf is mapped.
+     */
+    static DrmBuffer *import(int fd, const int dmaFds[DRM_MAX_PLANES], const BufferInfo &info, bool map = true);
+    static void release(int fd, DrmBuffer *buf);
+    static int exposeHandleToFd(int fd, DrmBuffer *buf);
+};
+
+/**
+ * @brief Single entry point for every DrmBuffer allocator.
+ * Buffers remember the allocator which created them, so release() always
+ * frees a buffer the way it was allocated. exposeHandleToFd() returns the
+ * dma-buf fd owned by the buffer; it is exported at most once and must not
+ * be closed by the caller (dup() it to keep it beyond the buffer lifetime).
+ * Allocated buffers are CPU mapped and always linear; tiled or compressed
+ * buffers come from their producer (GPU, camera) through import() with
+ * BufferInfo::modifier set.
+ */
+class DrmAllocator
+{
+public:
+    static DrmBuffer *allocate(AllocatorType type, int fd, const BufferInfo &info);
+    static DrmBuffer *import(int fd, int dmaFd, const BufferInfo &info, bool map = true);
+    static DrmBuffer *import(int fd, const int dmaFds[DRM_MAX_PLANES], const BufferInfo &info, bool map = true);
+    static DrmBuffer *import(int fd, const BufferHandle &handle, const BufferInfo &info);
+    static void release(int fd, DrmBuffer *buf);
+    static int exposeHandleToFd(int fd, DrmBuffer *buf);
+};
+
 } // namespace drm
 } // namespace early
 } // namespace evs
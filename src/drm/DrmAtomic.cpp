@@ -0,0 +1,220 @@
+#include "DrmAtomic.h"
+#include "CommonUtil.h"
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <cerrno>
+#include <cstring>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay DrmAtomic"
+#endif
+
+namespace evs {
+namespace early {
+namespace drm {
+
+const DrmPropertyCache::PropertyMap *DrmPropertyCache::load(uint32_t objectId, uint32_t objectType) {
+    auto iter = m_objects.find(objectId);
+    if (iter != m_objects.end()) {
+        return &iter->second;
+    }
+
+    drmModeObjectProperties *props = drmModeObjectGetProperties(m_drmFd, objectId, objectType);
+    m_ioctls++;
+    if (props == nullptr) {
+        EARLY_ERROR("Failed to get properties of object %u: %s\n", objectId, strerror(errno));
+        return nullptr;
+    }
+
+    PropertyMap map{};
+    for (uint32_t i = 0; i < props->count_props; ++i) {
+        drmModePropertyRes *prop = drmModeGetProperty(m_drmFd, props->props[i]);
+        m_ioctls++;
+        if (prop == nullptr) {
+            continue;
+        }
+        m_names[prop->prop_id] = std::string(prop->name);
+        Property property = {prop->prop_id, props->prop_values[i], {}};
+        if ((prop->flags & DRM_MODE_PROP_ENUM) != 0U) {
+            for (int e = 0; e < prop->count_enums; ++e) {
+                property.enums[std::string(prop->enums[e].name)] = prop->enums[e].value;
+            }
+        }
+        map[std::string(prop->name)] = std::move(property);
+        drmModeFreeProperty(prop);
+    }
+    drmModeFreeObjectProperties(props);
+
+    auto inserted = m_objects.emplace(objectId, std::move(map));
+    return &inserted.first->second;
+}
+
+uint32_t DrmPropertyCache::id(uint32_t objectId, uint32_t objectType, const char *name) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    const PropertyMap *map = load(objectId, objectType);
+    if (map == nullptr) {
+        return 0U;
+    }
+    auto iter = map->find(name);
+    return (iter != map->end()) ? iter->second.id : 0U;
+}
+
+bool DrmPropertyCache::value(uint32_t objectId, uint32_t objectType, const char *name, uint64_t &value) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    const PropertyMap *map = load(objectId, objectType);
+    if (map == nullptr) {
+        return false;
+    }
+    auto iter = map->find(name);
+    if (iter == map->end()) {
+        return false;
+    }
+    value = iter->second.value;
+    return true;
+}
+
+bool DrmPropertyCache::enumValue(uint32_t objectId, uint32_t objectType, const char *name, const char *entry, uint64_t &value) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    const PropertyMap *map = load(objectId, objectType);
+    if (map == nullptr) {
+        return false;
+    }
+    auto iter = map->find(name);
+    if (iter == map->end()) {
+        return false;
+    }
+    auto found = iter->second.enums.find(entry);
+    if (found == iter->second.enums.end()) {
+        return false;
+    }
+    value = found->second;
+    return true;
+}
+
+bool DrmPropertyCache::formatModifiers(uint32_t planeId, DrmFormatModifiers &modifiers) {
+    modifiers.clear();
+    uint64_t blobId = 0U;
+    if ((value(planeId, DRM_MODE_OBJECT_PLANE, "IN_FORMATS", blobId) == false) || (blobId == 0U)) {
+        return false;
+    }
+    drmModePropertyBlobRes *blob = drmModeGetPropertyBlob(m_drmFd, static_cast<uint32_t>(blobId));
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_ioctls++;
+    }
+    if (blob == nullptr) {
+        EARLY_ERROR("Failed to get IN_FORMATS blob %llu of plane %u: %s\n",
+                    static_cast<unsigned long long>(blobId),
+                    planeId,
+                    strerror(errno));
+        return false;
+    }
+
+    // drm_format_modifier_blob: a format table, then modifiers with a
+    // bitmask of the formats (from entry offset on) they apply to
+    const uint8_t *data = static_cast<const uint8_t *>(blob->data);
+    const struct drm_format_modifier_blob *header = reinterpret_cast<const struct drm_format_modifier_blob *>(data);
+    bool valid = (blob->length >= sizeof(*header)) && (header->version == FORMAT_BLOB_CURRENT)
+                 && (header->formats_offset + header->count_formats * sizeof(uint32_t) <= blob->length)
+                 && (header->modifiers_offset + header->count_modifiers * sizeof(struct drm_format_modifier) <= blob->length);
+    if (valid == true) {
+        const uint32_t *formats = reinterpret_cast<const uint32_t *>(data + header->formats_offset);
+        const struct drm_format_modifier *mods = reinterpret_cast<const struct drm_format_modifier *>(data + header->modifiers_offset);
+        for (uint32_t m = 0; m < header->count_modifiers; ++m) {
+            for (uint32_t bit = 0; bit < 64U; ++bit) {
+                uint32_t index = mods[m].offset + bit;
+                if (((mods[m].formats & (1ULL << bit)) != 0U) && (index < header->count_formats)) {
+                    modifiers[formats[index]].push_back(mods[m].modifier);
+                }
+            }
+        }
+    } else {
+        EARLY_ERROR("IN_FORMATS blob of plane %u is malformed\n", planeId);
+    }
+    drmModeFreePropertyBlob(blob);
+    return valid;
+}
+
+bool DrmPropertyCache::findValue(const uint32_t *props, const uint64_t *values, uint32_t count, const char *name, uint64_t &value) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    for (uint32_t i = 0; i < count; ++i) {
+        auto iter = m_names.find(props[i]);
+        if (iter == m_names.end()) {
+            drmModePropertyRes *prop = drmModeGetProperty(m_drmFd, props[i]);
+            m_ioctls++;
+            if (prop == nullptr) {
+                continue;
+            }
+            iter = m_names.emplace(props[i], std::string(prop->name)).first;
+            drmModeFreeProperty(prop);
+        }
+        if (iter->second == name) {
+            value = values[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t DrmPropertyCache::ioctls() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    return m_ioctls;
+}
+
+void DrmPropertyCache::refresh(uint32_t objectId) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_objects.erase(objectId);
+}
+
+void DrmPropertyCache::clear() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_objects.clear();
+    m_names.clear();
+}
+
+DrmAtomicRequest::DrmAtomicRequest(DrmPropertyCache &props)
+    : m_props(props)
+    , m_req(drmModeAtomicAlloc()) {
+}
+
+DrmAtomicRequest::~DrmAtomicRequest() {
+    if (m_req != nullptr) {
+        drmModeAtomicFree(m_req);
+        m_req = nullptr;
+    }
+}
+
+bool DrmAtomicRequest::add(uint32_t objectId, uint32_t objectType, const char *name, uint64_t value) {
+    if (m_req == nullptr) {
+        return false;
+    }
+    uint32_t propId = m_props.id(objectId, objectType, name);
+    if (propId == 0U) {
+        return false;
+    }
+    return drmModeAtomicAddProperty(m_req, objectId, propId, value) >= 0;
+}
+
+int DrmAtomicRequest::cursor() const {
+    return (m_req != nullptr) ? drmModeAtomicGetCursor(m_req) : 0;
+}
+
+void DrmAtomicRequest::rollback(int cursor) {
+    if (m_req != nullptr) {
+        drmModeAtomicSetCursor(m_req, cursor);
+    }
+}
+
+int DrmAtomicRequest::commit(int drmFd, uint32_t flags, void *userData) {
+    if (m_req == nullptr) {
+        return -ENOMEM;
+    }
+    int ret = drmModeAtomicCommit(drmFd, m_req, flags, userData);
+    return (ret == 0) ? 0 : -errno;
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
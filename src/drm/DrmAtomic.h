@@ -0,0 +1,141 @@
+#ifndef DRMATOMIC_H
+#define DRMATOMIC_H
+
+#include "DrmFormat.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct _drmModeAtomicReq;
+
+namespace evs {
+namespace early {
+namespace drm {
+
+/**
+ * @brief Cache of KMS property IDs (and values at discovery time).
+ * Property IDs never change for the lifetime of a DRM fd, so every object
+ * is queried once with drmModeObjectGetProperties()/drmModeGetProperty()
+ * and later lookups are a map access, cheap enough for per-frame commits.
+ * Values are those read on discovery; only use them for immutable
+ * properties such as a plane "type", or call refresh() first.
+ */
+class DrmPropertyCache
+{
+    DrmPropertyCache(const DrmPropertyCache &) = delete;
+    DrmPropertyCache &operator=(const DrmPropertyCache &) = delete;
+    DrmPropertyCache(DrmPropertyCache &&) = delete;
+    DrmPropertyCache &operator=(DrmPropertyCache &&) = delete;
+
+public:
+    explicit DrmPropertyCache(int drmFd)
+        : m_drmFd(drmFd) {
+    }
+    ~DrmPropertyCache() = default;
+
+    /**
+     * @brief ID of property @p name of an object, 0 if it has none.
+     */
+    uint32_t id(uint32_t objectId, uint32_t objectType, const char *name);
+
+    /**
+     * @brief Value of property @p name when it was discovered.
+     */
+    bool value(uint32_t objectId, uint32_t objectType, const char *name, uint64_t &value);
+
+    /**
+     * @brief Value of entry @p entry of enum property @p name, e.g. the
+     *        "ITU-R BT.709 YCbCr" entry of a plane "COLOR_ENCODING".
+     */
+    bool enumValue(uint32_t objectId, uint32_t objectType, const char *name, const char *entry, uint64_t &value);
+
+    /**
+     * @brief Formats and modifiers plane @p planeId scans out, parsed from
+     *        its IN_FORMATS blob.
+     * @return false if the driver does not expose IN_FORMATS.
+     */
+    bool formatModifiers(uint32_t planeId, DrmFormatModifiers &modifiers);
+
+    /**
+     * @brief Value of property @p name among @p props / @p values, the
+     *        properties of an object fetched with it, e.g. a
+     *        drmModeConnector. Only unknown property IDs are queried.
+     */
+    bool findValue(const uint32_t *props, const uint64_t *values, uint32_t count, const char *name, uint64_t &value);
+
+    /**
+     * @brief Ioctls issued so far, to account for the lookups.
+     */
+    uint64_t ioctls();
+
+    /**
+     * @brief Drop the cached properties of @p objectId, they are queried
+     *        again on the next lookup.
+     */
+    void refresh(uint32_t objectId);
+    void clear();
+
+private:
+    typedef struct {
+        uint32_t id;
+        uint64_t value;
+        std::unordered_map<std::string, uint64_t> enums; // entries of enum properties
+    } Property;
+
+    using PropertyMap = std::unordered_map<std::string, Property>;
+
+    const PropertyMap *load(uint32_t objectId, uint32_t objectType);
+
+    int m_drmFd{-1};
+    std::mutex m_mtx;
+    uint64_t m_ioctls{0};
+    std::unordered_map<uint32_t, PropertyMap> m_objects{};
+    std::unordered_map<uint32_t, std::string> m_names{}; // property ID to name
+};
+
+/**
+ * @brief RAII wrapper of a drmModeAtomicReq.
+ * Properties are addressed by name through a DrmPropertyCache; add()
+ * fails when the object lacks the property, so optional properties can
+ * be probed without a separate lookup.
+ */
+class DrmAtomicRequest
+{
+    DrmAtomicRequest(const DrmAtomicRequest &) = delete;
+    DrmAtomicRequest &operator=(const DrmAtomicRequest &) = delete;
+    DrmAtomicRequest(DrmAtomicRequest &&) = delete;
+    DrmAtomicRequest &operator=(DrmAtomicRequest &&) = delete;
+
+public:
+    explicit DrmAtomicRequest(DrmPropertyCache &props);
+    ~DrmAtomicRequest();
+
+    bool isValid() const { return m_req != nullptr; }
+
+    bool add(uint32_t objectId, uint32_t objectType, const char *name, uint64_t value);
+
+    /**
+     * @brief Number of properties added, restore with rollback() to drop
+     *        what was added after it.
+     */
+    int cursor() const;
+    void rollback(int cursor);
+
+    /**
+     * @return 0 or -errno of drmModeAtomicCommit().
+     */
+    int commit(int drmFd, uint32_t flags, void *userData = nullptr);
+
+private:
+    DrmPropertyCache &m_props;
+    struct _drmModeAtomicReq *m_req{nullptr};
+};
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMATOMIC_H
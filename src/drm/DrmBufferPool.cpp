@@ -0,0 +1,199 @@
+#include "DrmBufferPool.h"
+#include "CommonUtil.h"
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <cstring>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay DrmBufferPool"
+#endif
+
+namespace evs {
+namespace early {
+namespace drm {
+
+DrmBufferPool::DrmBufferPool(int drmFd, size_t capacity)
+    : m_drmFd(drmFd)
+    , m_capacity(capacity) {
+    MemoryAccounting::instance().registerEvictor(MemoryTag::DISPLAY, DrmBufferPool::evict, this);
+    MemoryAccounting::instance().registerEvictor(MemoryTag::RECORDER, DrmBufferPool::evict, this);
+}
+
+DrmBufferPool::~DrmBufferPool() {
+    MemoryAccounting::instance().unregisterEvictor(DrmBufferPool::evict, this);
+    trim();
+}
+
+size_t DrmBufferPool::evict(MemoryTag tag, size_t bytes, void *param) {
+    DrmBufferPool *pool = static_cast<DrmBufferPool *>(param);
+    return (pool != nullptr) ? pool->trimTagged(bytes, false, tag) : 0U;
+}
+
+bool DrmBufferPool::fits(const Entry &entry, AllocatorType type, const BufferInfo &info) const {
+    const Layout &layout = entry.layout;
+    const DrmBuffer *buf = entry.buffer;
+    // Another tag would hand out, and account, e.g. capture buffers as display buffers
+    if ((layout.type != type) || (layout.tag != info.tag) || (layout.format != info.format) || (layout.bpp != info.bpp)) {
+        return false;
+    }
+    if ((layout.width == info.width) && (layout.height == info.height)) {
+        return true;
+    }
+    if ((buf->planeCount > 1U) || (info.planes > 1U)) {
+        return false;
+    }
+
+    // Same storage, other size: the rows must fit the pitch of the buffer
+    uint32_t cpp = info.bpp / 8U;
+    if ((info.pitch > 0) && (static_cast<uint32_t>(info.pitch) != buf->stride)) {
+        return false;
+    }
+    return (static_cast<size_t>(info.width) * cpp <= buf->stride)
+           && (static_cast<size_t>(buf->stride) * info.height + buf->offset <= buf->size);
+}
+
+bool DrmBufferPool::reshape(Entry &entry, const BufferInfo &info) {
+    DrmBuffer *buf = entry.buffer;
+    BufferInfo fbInfo = info;
+    fbInfo.depth = entry.layout.depth;
+
+    uint32_t handles[DRM_MAX_PLANES] = {buf->handle};
+    uint32_t pitches[DRM_MAX_PLANES] = {buf->stride};
+    uint32_t offsets[DRM_MAX_PLANES] = {buf->offset};
+    uint32_t fbId = 0U;
+    if (addFramebuffer(m_drmFd, fbInfo, handles, pitches, offsets, fbId) != 0) {
+        return false;
+    }
+    if (buf->fbId != 0U) {
+        drmModeRmFB(m_drmFd, buf->fbId);
+    }
+    buf->fbId = fbId;
+    entry.layout.width = info.width;
+    entry.layout.height = info.height;
+    return true;
+}
+
+DrmBuffer *DrmBufferPool::acquire(AllocatorType type, const BufferInfo &info) {
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        // Prefer an exact match, then the smallest buffer that holds the layout
+        size_t best = m_parked.size();
+        for (size_t i = 0; i < m_parked.size(); i++) {
+            const Entry &entry = m_parked[i];
+            if (fits(entry, type, info) == false) {
+                continue;
+            }
+            bool exact = (entry.layout.width == info.width) && (entry.layout.height == info.height);
+            if (exact == true) {
+                best = i;
+                break;
+            }
+            if ((best == m_parked.size()) || (entry.buffer->size < m_parked[best].buffer->size)) {
+                best = i;
+            }
+        }
+
+        if (best < m_parked.size()) {
+            Entry entry = m_parked[best];
+            bool exact = (entry.layout.width == info.width) && (entry.layout.height == info.height);
+            if ((exact == true) || (reshape(entry, info) == true)) {
+                m_parked.erase(m_parked.begin() + static_cast<std::ptrdiff_t>(best));
+                m_inUse[entry.buffer] = entry.layout;
+                m_hits++;
+                m_reshapes += (exact == true) ? 0U : 1U;
+                EARLY_DEBUG("Reused parked buffer fbId=%u for %ux%u%s\n",
+                            entry.buffer->fbId,
+                            info.width,
+                            info.height,
+                            (exact == true) ? "" : " (new framebuffer)");
+                return entry.buffer;
+            }
+        }
+        m_misses++;
+    }
+
+    // Allocate without the lock, the allocation may call back into evict()
+    DrmBuffer *buf = DrmAllocator::allocate(type, m_drmFd, info);
+    if (buf != nullptr) {
+        Layout layout = {type, info.width, info.height, info.bpp, info.depth, info.format, info.tag};
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_inUse[buf] = layout;
+    }
+    return buf;
+}
+
+void DrmBufferPool::park(DrmBuffer *buffer) {
+    if (buffer == nullptr) {
+        return;
+    }
+
+    std::vector<DrmBuffer *> victims{};
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        auto iter = m_inUse.find(buffer);
+        if (iter == m_inUse.end()) {
+            victims.push_back(buffer);
+        } else {
+            m_parked.push_back(Entry{buffer, iter->second, ++m_clock});
+            m_inUse.erase(iter);
+            while (m_parked.size() > m_capacity) {
+                victims.push_back(m_parked.front().buffer);
+                m_parked.erase(m_parked.begin());
+            }
+        }
+    }
+
+    for (DrmBuffer *victim : victims) {
+        DrmAllocator::release(m_drmFd, victim);
+    }
+}
+
+size_t DrmBufferPool::trim(size_t bytes) {
+    return trimTagged(bytes, true, MemoryTag::OTHER);
+}
+
+size_t DrmBufferPool::trimTagged(size_t bytes, bool anyTag, MemoryTag tag) {
+    std::vector<DrmBuffer *> victims{};
+    size_t freed = 0U;
+    {
+        // m_parked is ordered by park time, oldest first
+        std::unique_lock<std::mutex> lock(m_mtx);
+        for (auto iter = m_parked.begin(); (iter != m_parked.end()) && (freed < bytes);) {
+            if ((anyTag == false) && (iter->layout.tag != tag)) {
+                ++iter;
+                continue;
+            }
+            freed += iter->buffer->size;
+            victims.push_back(iter->buffer);
+            iter = m_parked.erase(iter);
+        }
+    }
+
+    for (DrmBuffer *victim : victims) {
+        DrmAllocator::release(m_drmFd, victim);
+    }
+    if (victims.empty() == false) {
+        EARLY_DEBUG("Trimmed %zu parked buffers, %zu bytes\n", victims.size(), freed);
+    }
+    return freed;
+}
+
+size_t DrmBufferPool::parkedCount() const {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    return m_parked.size();
+}
+
+size_t DrmBufferPool::parkedBytes() const {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    size_t bytes = 0U;
+    for (const auto &entry : m_parked) {
+        bytes += entry.buffer->size;
+    }
+    return bytes;
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
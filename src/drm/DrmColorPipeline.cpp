@@ -0,0 +1,244 @@
+#include "DrmColorPipeline.h"
+#include "CommonUtil.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay DrmColorPipeline"
+#endif
+
+namespace evs {
+namespace early {
+namespace drm {
+
+DrmColorPipeline::DrmColorPipeline(int drmFd, DrmPropertyCache &props)
+    : m_drmFd(drmFd)
+    , m_props(props) {
+}
+
+DrmColorPipeline::~DrmColorPipeline() {
+    destroyTable();
+}
+
+bool DrmColorPipeline::init(uint32_t crtcId) {
+    reset();
+    uint64_t size = 0U;
+    if ((m_props.id(crtcId, DRM_MODE_OBJECT_CRTC, "GAMMA_LUT") == 0U)
+        || (m_props.value(crtcId, DRM_MODE_OBJECT_CRTC, "GAMMA_LUT_SIZE", size) == false) || (size == 0U)) {
+        EARLY_INFO("CRTC %u has no GAMMA_LUT, colour correction needs the render pass\n", crtcId);
+        return false;
+    }
+    m_crtcId = crtcId;
+    m_gammaSize = static_cast<uint32_t>(size);
+    size = 0U;
+    m_hasDegamma = (m_props.id(crtcId, DRM_MODE_OBJECT_CRTC, "DEGAMMA_LUT") != 0U)
+                   && (m_props.value(crtcId, DRM_MODE_OBJECT_CRTC, "DEGAMMA_LUT_SIZE", size) == true) && (size > 0U);
+    m_degammaSize = m_hasDegamma ? static_cast<uint32_t>(size) : 0U;
+    m_hasCtm = (m_props.id(crtcId, DRM_MODE_OBJECT_CRTC, "CTM") != 0U);
+    m_from = ColorLut::identity();
+    m_to = ColorLut::identity();
+    EARLY_DEBUG("CRTC %u colour pipeline: degamma %u, ctm %d, gamma %u entries\n",
+                crtcId,
+                m_degammaSize,
+                m_hasCtm ? 1 : 0,
+                m_gammaSize);
+    return true;
+}
+
+void DrmColorPipeline::reset() {
+    destroyTable();
+    m_crtcId = 0U;
+    m_hasDegamma = false;
+    m_hasCtm = false;
+    m_degammaSize = 0U;
+    m_gammaSize = 0U;
+    m_startUs = 0U;
+    m_durationUs = 0U;
+}
+
+bool DrmColorPipeline::supports(const ColorState &state) const {
+    return (m_crtcId != 0U) && ((state.degamma.empty() == true) || (m_hasDegamma == true))
+           && ((state.ctmEnabled == false) || (m_hasCtm == true));
+}
+
+bool DrmColorPipeline::setState(const ColorState &state, uint64_t durationUs, uint64_t nowUs) {
+    if (supports(state) == false) {
+        return false;
+    }
+
+    // Tables at the sizes of the CRTC, as they are compared and committed
+    ColorState target = {};
+    ColorLut::mix(state, state, 1.0f, m_degammaSize, m_gammaSize, target);
+
+    int last = static_cast<int>(m_table.size()) - 1;
+    bool settled = (m_table.empty() == false) && (m_committed == last);
+    if ((settled == true) && (ColorLut::equal(target, m_to) == true)) {
+        return true;
+    }
+    if ((settled == true) && (m_table.size() == ColorLut::TRANSITION_STEPS + 1U) && (ColorLut::equal(target, m_from) == true)) {
+        // Back to where the last transition started, its blobs are still there
+        std::reverse(m_table.begin(), m_table.end());
+        std::swap(m_from, m_to);
+        m_committed = 0;
+        m_added = -1;
+        m_startUs = nowUs;
+        m_durationUs = durationUs;
+        return true;
+    }
+
+    // A running transition continues from the step on screen
+    ColorState current = ColorLut::identity();
+    if (m_table.empty() == false) {
+        float t = (m_table.size() > 1U) ? static_cast<float>(std::max(m_committed, 0)) / ColorLut::TRANSITION_STEPS : 1.0f;
+        ColorLut::mix(m_from, m_to, t, m_degammaSize, m_gammaSize, current);
+    }
+    if (buildTable(current, target, durationUs > 0U) == false) {
+        return false;
+    }
+    m_startUs = nowUs;
+    m_durationUs = durationUs;
+    return true;
+}
+
+bool DrmColorPipeline::addToRequest(DrmAtomicRequest &req, uint64_t nowUs) {
+    if (m_table.empty() == true) {
+        return false;
+    }
+    int step = static_cast<int>(currentStep(nowUs));
+    if (step == m_committed) {
+        return false;
+    }
+
+    const Blobs &blobs = m_table[static_cast<size_t>(step)];
+    int cursor = req.cursor();
+    bool added = req.add(m_crtcId, DRM_MODE_OBJECT_CRTC, "GAMMA_LUT", blobs.gamma);
+    if (m_hasDegamma == true) {
+        added = added && req.add(m_crtcId, DRM_MODE_OBJECT_CRTC, "DEGAMMA_LUT", blobs.degamma);
+    }
+    if (m_hasCtm == true) {
+        added = added && req.add(m_crtcId, DRM_MODE_OBJECT_CRTC, "CTM", blobs.ctm);
+    }
+    if (added == false) {
+        req.rollback(cursor);
+        return false;
+    }
+    m_added = step;
+    return true;
+}
+
+void DrmColorPipeline::commitDone() {
+    if (m_added >= 0) {
+        m_committed = m_added;
+        m_added = -1;
+    }
+}
+
+bool DrmColorPipeline::pending(uint64_t nowUs) const {
+    return (m_table.empty() == false) && (static_cast<int>(currentStep(nowUs)) != m_committed);
+}
+
+uint32_t DrmColorPipeline::currentStep(uint64_t nowUs) const {
+    return (m_table.size() > 1U) ? ColorLut::step(m_startUs, m_durationUs, nowUs) : 0U;
+}
+
+uint32_t DrmColorPipeline::createLut(const std::vector<ColorLutEntry> &lut) {
+    uint32_t blobId = 0U;
+    if (lut.empty() == true) {
+        return 0U;
+    }
+    // ColorLutEntry has the layout of struct drm_color_lut
+    if (drmModeCreatePropertyBlob(m_drmFd, lut.data(), lut.size() * sizeof(ColorLutEntry), &blobId) != 0) {
+        EARLY_ERROR("Failed to create LUT blob of %zu entries: %s\n", lut.size(), strerror(errno));
+        return 0U;
+    }
+    return blobId;
+}
+
+uint32_t DrmColorPipeline::createCtm(const ColorState &state) {
+    uint32_t blobId = 0U;
+    if (state.ctmEnabled == false) {
+        return 0U;
+    }
+    // S31.32 sign-magnitude
+    struct drm_color_ctm ctm = {};
+    for (size_t i = 0; i < 9U; i++) {
+        double value = static_cast<double>(state.ctm[i]);
+        ctm.matrix[i] = static_cast<uint64_t>(std::llround(std::fabs(value) * 4294967296.0));
+        if (value < 0.0) {
+            ctm.matrix[i] |= (1ULL << 63);
+        }
+    }
+    if (drmModeCreatePropertyBlob(m_drmFd, &ctm, sizeof(ctm), &blobId) != 0) {
+        EARLY_ERROR("Failed to create CTM blob: %s\n", strerror(errno));
+        return 0U;
+    }
+    return blobId;
+}
+
+bool DrmColorPipeline::buildTable(const ColorState &from, const ColorState &to, bool transition) {
+    destroyTable();
+    // Blob IDs of the old table may be handed out again
+    m_committed = -1;
+    m_added = -1;
+    m_from = from;
+    m_to = to;
+
+    bool success = true;
+    size_t steps = transition ? ColorLut::TRANSITION_STEPS + 1U : 1U;
+    ColorState previous = {};
+    for (size_t i = 0; (i < steps) && (success == true); i++) {
+        float t = transition ? static_cast<float>(i) / ColorLut::TRANSITION_STEPS : 1.0f;
+        ColorState state = {};
+        ColorLut::mix(from, to, t, m_degammaSize, m_gammaSize, state);
+
+        // Stages that did not change since the step before keep their blob
+        Blobs blobs = {};
+        bool shared = (i > 0U);
+        blobs.degamma = (shared && ColorLut::equal(state.degamma, previous.degamma)) ? m_table.back().degamma : createLut(state.degamma);
+        blobs.ctm = (shared && ColorLut::equalCtm(state, previous)) ? m_table.back().ctm : createCtm(state);
+        blobs.gamma = (shared && ColorLut::equal(state.gamma, previous.gamma)) ? m_table.back().gamma : createLut(state.gamma);
+        m_table.push_back(blobs);
+        success = ((blobs.degamma != 0U) || (state.degamma.empty() == true))
+                  && ((blobs.ctm != 0U) || (state.ctmEnabled == false))
+                  && ((blobs.gamma != 0U) || (state.gamma.empty() == true));
+        previous = state;
+    }
+
+    if (success == false) {
+        destroyTable();
+        m_from = ColorLut::identity();
+        m_to = ColorLut::identity();
+    }
+    return success;
+}
+
+void DrmColorPipeline::destroyTable() {
+    // Steps share blobs, each one is destroyed once. The CRTC keeps its own
+    // reference to the blobs on screen.
+    std::vector<uint32_t> blobIds{};
+    for (const Blobs &blobs : m_table) {
+        blobIds.push_back(blobs.degamma);
+        blobIds.push_back(blobs.ctm);
+        blobIds.push_back(blobs.gamma);
+    }
+    std::sort(blobIds.begin(), blobIds.end());
+    blobIds.erase(std::unique(blobIds.begin(), blobIds.end()), blobIds.end());
+    for (uint32_t blobId : blobIds) {
+        if ((blobId != 0U) && (m_drmFd >= 0)) {
+            drmModeDestroyPropertyBlob(m_drmFd, blobId);
+        }
+    }
+    m_table.clear();
+    m_committed = -1;
+    m_added = -1;
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
@@ -1,5 +1,6 @@
 #include "DrmController.h"
 #include "CommonUtil.h"
+#include "FastCopy.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -10,7 +11,9 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <sys/mman.h>
+#include <linux/dma-buf.h>
 #include <deque>
+#include <algorithm>
 
 #ifdef DEBUG_TAG
 #undef DEBUG_TAG
@@ -20,8 +23,17 @@
 #define USE_HEAPDMA_ALLOCATOR
 
 namespace evs::early::drm {
+
+#if defined(USE_HEAPDMA_ALLOCATOR)
+static constexpr AllocatorType CONTROLLER_ALLOCATOR = AllocatorType::DRM_ALLOCATOR_HEAP_DMA;
+#elif defined(USE_ION_ALLOCATOR)
+static constexpr AllocatorType CONTROLLER_ALLOCATOR = AllocatorType::DRM_ALLOCATOR_ION;
+#else
+static constexpr AllocatorType CONTROLLER_ALLOCATOR = AllocatorType::DRM_ALLOCATOR_MMAP;
+#endif
+
 DrmController::DrmController(int cardId)
-    : m_device(cardId)
+    : m_device(cardId, CONTROLLER_ALLOCATOR)
     , m_width(DEFAULT_WIDTH)
     , m_height(DEFAULT_HEIGHT)
     , m_bpp(DEFAULT_BPP)
@@ -34,6 +46,21 @@ DrmController::DrmController(int cardId)
 }
 
 DrmController::~DrmController() {
+    if (isInit()) {
+        deInit();
+    }
+}
+
+// Cache maintenance of CPU writes to a cached heap buffer, dumb buffers have no fd
+static void syncCpuAccess(const DrmBuffer *buffer, bool start) {
+    if ((buffer == nullptr) || (buffer->fd < 0)) {
+        return;
+    }
+    struct dma_buf_sync sync = {};
+    sync.flags = DMA_BUF_SYNC_WRITE | (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END);
+    if (drmIoctl(buffer->fd, DMA_BUF_IOCTL_SYNC, &sync) != 0) {
+        EARLY_WARN("DMA_BUF_IOCTL_SYNC on buffer fd %d failed: %s\n", buffer->fd, strerror(errno));
+    }
 }
 
 bool DrmController::init(size_t width, size_t height, uint8_t bpp, size_t stride, int format, int flags) {
@@ -69,11 +96,15 @@ bool DrmController::init(size_t width, size_t height, uint8_t bpp, size_t stride
         }
         m_device.queryAllDeviceInfo();
         for (auto &connector : m_device.getConnectors()) {
-            if (connector.second.connected == true) {
+            if ((connector.second.connected == true) && (connector.second.encoder.crtc.id != 0U)) {
                 m_connectedConnector = connector.second;
                 break;
             }
         }
+        if (m_connectedConnector.id == 0U) {
+            EARLY_ERROR("No connected connector with a CRTC.\n");
+            break;
+        }
 
         EARLY_DEBUG("DRM device initialized successfully: width=%zu, height=%zu, bpp=%u, stride=%zu, format=%d, flags=%d\n",
                     m_width,
@@ -83,43 +114,7 @@ bool DrmController::init(size_t width, size_t height, uint8_t bpp, size_t stride
                     m_format,
                     m_flags);
 
-        BufferInfo info = {
-            static_cast<uint32_t>(m_width),
-            static_cast<uint32_t>(m_height),
-            static_cast<uint8_t>(m_bpp),
-            0,
-            m_format,
-            m_flags,
-            static_cast<int>(m_offset),
-            static_cast<int>(m_stride),
-            m_size};
-        int fd = m_device.fd();
-
-        for (uint32_t i = 0; i < MAX_BUFFER_COUNT; ++i) {
-            DrmBuffer *buffer = nullptr;
-#if defined(USE_HEAPDMA_ALLOCATOR)
-            buffer = HeapDMAAllocator::allocate(fd, info);
-#elif defined(USE_ION_ALLOCATOR)
-            buffer = IonAllocator::allocate(fd, info);
-#else
-            buffer = MMapAllocator::allocate(fd, info);
-#endif
-            if (buffer == nullptr) {
-                EARLY_ERROR("Failed to allocate buffer using MMapAllocator\n");
-                break;
-            }
-
-            m_buffers.emplace_back(buffer);
-            EARLY_DEBUG("Allocated buffer %u: fbId=%u, handle=0x%x, size=%zu, stride=%u, offset=%u\n",
-                        i,
-                        buffer->fbId,
-                        buffer->handle,
-                        buffer->size,
-                        buffer->stride,
-                        buffer->offset);
-        }
-        if (m_buffers.empty()) {
-            EARLY_ERROR("Failed to allocate any buffers.\n");
+        if (setupDisplay() == false) {
             break;
         }
         success = true;
@@ -139,6 +134,62 @@ bool DrmController::init(size_t width, size_t height, uint8_t bpp, size_t stride
     return success;
 }
 
+bool DrmController::setupDisplay() {
+    bool success = false;
+
+    do {
+        if (m_device.setBufferCount(static_cast<int>(m_bufferCount)) == false) {
+            EARLY_ERROR("Failed to set %zu display buffers.\n", m_bufferCount);
+            break;
+        }
+
+        // The connector mode of that size, else the CRTC keeps the one it runs
+        DrmModePolicy policy = {static_cast<uint32_t>(m_width), static_cast<uint32_t>(m_height), 0U};
+        int mode = DrmDevice::selectMode(m_connectedConnector.modes, policy);
+        bool initialized = (mode >= 0)
+                               ? m_device.initDisplay(m_connectedConnector,
+                                                      m_connectedConnector.modes[static_cast<size_t>(mode)],
+                                                      static_cast<uint32_t>(m_bpp),
+                                                      static_cast<uint32_t>(m_format),
+                                                      static_cast<uint32_t>(m_flags))
+                               : m_device.initDisplay(m_connectedConnector.id,
+                                                      m_connectedConnector.encoder.crtc.id,
+                                                      static_cast<uint32_t>(m_width),
+                                                      static_cast<uint32_t>(m_height),
+                                                      static_cast<uint32_t>(m_bpp),
+                                                      static_cast<uint32_t>(m_format),
+                                                      static_cast<uint32_t>(m_flags));
+        if (initialized == false) {
+            EARLY_ERROR("Failed to initialize display %zux%zu on connector %u.\n", m_width, m_height, m_connectedConnector.id);
+            break;
+        }
+        // Without a mode of the requested size the display runs another one
+        m_width = m_device.width();
+        m_height = m_device.height();
+
+        const DrmBuffer *buffer = m_device.buffer0();
+        m_stride = buffer->stride;
+        m_pitch = static_cast<int>(buffer->stride);
+        m_offset = buffer->offset;
+        m_size = buffer->size;
+        m_drawIndex = INVALID_BUFFER_INDEX;
+        EARLY_DEBUG("Swapchain of %d buffers: fbId=%u, handle=0x%x, size=%zu, stride=%u, offset=%u\n",
+                    m_device.bufferCount(),
+                    buffer->fbId,
+                    buffer->handle,
+                    buffer->size,
+                    buffer->stride,
+                    buffer->offset);
+        success = true;
+    } while (false);
+
+    return success;
+}
+
+void DrmController::setBufferCount(size_t count) {
+    m_bufferCount = std::min(std::max(count, MIN_BUFFER_COUNT), MAX_BUFFER_COUNT);
+}
+
 bool DrmController::deInit() {
     bool success = false;
 
@@ -154,12 +205,13 @@ bool DrmController::deInit() {
     m_pitch = DEFAULT_PITCH;
 
     if (m_device.isOpen()) {
-        for (auto buffer : m_buffers) {
-            if (buffer) {
-                MMapAllocator::release(m_device.fd(), buffer);
-            }
+        if (m_device.isInitialized()) {
+            syncCpuAccess(drawBuffer(), false);
+            m_device.waitFlipEvent();
+            m_device.deInitDisplay();
         }
-        m_buffers.clear();
+        m_drawIndex = INVALID_BUFFER_INDEX;
+        // Closing the device frees the parked buffers, use reconfigure() to keep them
         m_device.close();
         success = true;
     } else {
@@ -169,46 +221,178 @@ bool DrmController::deInit() {
     return success;
 }
 
-void DrmController::drawFrame() {
-    m_currentBufferId = (m_currentBufferId ^ 1);
-    m_currentBufferIndex = m_currentBufferId % m_buffers.size();
-    auto &currentBuffer = m_buffers[m_currentBufferIndex];
+bool DrmController::reconfigure(size_t width, size_t height, uint8_t bpp, size_t stride, int format, int flags) {
+    bool success = false;
 
-    if (currentBuffer == nullptr) {
-        EARLY_ERROR("Current buffer is null, cannot draw frame.\n");
-        return;
-    }
+    do {
+        if (!isInit()) {
+            EARLY_ERROR("Display controller is not initialized, cannot reconfigure.\n");
+            break;
+        }
+
+        size_t rowBytes = width * (bpp / 8U);
+        if ((rowBytes == 0) || (height == 0)) {
+            EARLY_ERROR("Invalid buffer size: width=%zu, height=%zu, bpp=%u\n", width, height, bpp);
+            break;
+        }
+
+        // Park first, so the new layout can take the same buffers back
+        if (m_device.isInitialized()) {
+            syncCpuAccess(drawBuffer(), false);
+            m_device.waitFlipEvent();
+            m_device.deInitDisplay();
+        }
+        m_drawIndex = INVALID_BUFFER_INDEX;
+
+        m_width = width;
+        m_height = height;
+        m_bpp = bpp;
+        m_format = format;
+        m_flags = flags;
+        m_stride = (stride == 0) ? rowBytes : stride;
+        m_size = rowBytes * height;
+        m_pitch = static_cast<int>(stride);
+        success = setupDisplay();
+    } while (false);
+
+    return success;
+}
+
+bool DrmController::drawFrame(int timeoutMs) {
+    bool success = false;
 
-    EARLY_DEBUG("Drawing frame on buffer %zu with fbId=%u, handle=0x%x, size=%zu, stride=%u, offset=%u\n",
-                m_currentBufferIndex,
-                currentBuffer->fbId,
-                currentBuffer->handle,
-                currentBuffer->size,
-                currentBuffer->stride,
-                currentBuffer->offset);
+    do {
+        if (m_device.isInitialized() == false) {
+            EARLY_ERROR("Display controller is not initialized, cannot draw frame.\n");
+            break;
+        }
+        if (m_drawIndex != INVALID_BUFFER_INDEX) {
+            // Not swapped yet, still ours
+            success = true;
+            break;
+        }
+
+        int index = m_device.acquireBuffer(timeoutMs);
+        DrmBuffer *buffer = m_device.buffer(index);
+        if (buffer == nullptr) {
+            EARLY_ERROR("No free display buffer within %d ms.\n", timeoutMs);
+            break;
+        }
+        m_drawIndex = index;
+        m_damage.setBounds(static_cast<uint32_t>(m_width), static_cast<uint32_t>(m_height));
+        m_damage.clear();
+        syncCpuAccess(buffer, true);
+
+        EARLY_DEBUG("Drawing frame on buffer %d with fbId=%u, handle=0x%x, size=%zu, stride=%u, offset=%u\n",
+                    m_drawIndex,
+                    buffer->fbId,
+                    buffer->handle,
+                    buffer->size,
+                    buffer->stride,
+                    buffer->offset);
+        success = true;
+    } while (false);
+
+    return success;
+}
+
+bool DrmController::blitFrame(const void *src, size_t srcStride) {
+    bool success = false;
+
+    do {
+        DrmBuffer *buffer = drawBuffer();
+        if ((buffer == nullptr) || (src == nullptr)) {
+            EARLY_ERROR("No draw buffer or source, cannot blit frame.\n");
+            break;
+        }
+
+        size_t rowBytes = m_width * (m_bpp / 8);
+        if (srcStride == 0) {
+            srcStride = rowBytes;
+        }
+        if ((buffer->ptr == nullptr) || (buffer->stride < rowBytes) || (srcStride < rowBytes)) {
+            EARLY_ERROR("Invalid blit: ptr=%p, stride=%u, srcStride=%zu, row=%zu\n", buffer->ptr, buffer->stride, srcStride, rowBytes);
+            break;
+        }
+
+        FastCopy::copy2D(static_cast<uint8_t *>(buffer->ptr) + buffer->offset, buffer->stride, src, srcStride, rowBytes, m_height);
+        m_damage.addFull();
+        success = true;
+    } while (false);
+
+    return success;
+}
 
-    // Implement frame drawing logic here
-    EARLY_DEBUG("Drawing frame on DRM display controller.\n");
+bool DrmController::fillRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color) {
+    bool success = false;
+
+    do {
+        DrmBuffer *buffer = drawBuffer();
+        if (buffer == nullptr) {
+            EARLY_ERROR("No draw buffer, cannot fill rect.\n");
+            break;
+        }
+
+        if ((buffer->ptr == nullptr) || (x >= m_width) || (y >= m_height)) {
+            break;
+        }
+        if (width > m_width - x) {
+            width = static_cast<uint32_t>(m_width - x);
+        }
+        if (height > m_height - y) {
+            height = static_cast<uint32_t>(m_height - y);
+        }
+
+        FastCopy::fillRect(static_cast<uint8_t *>(buffer->ptr) + buffer->offset,
+                           buffer->stride,
+                           x,
+                           y,
+                           width,
+                           height,
+                           static_cast<uint32_t>(m_bpp / 8),
+                           color);
+        m_damage.add({static_cast<int32_t>(x), static_cast<int32_t>(y), static_cast<int32_t>(x + width), static_cast<int32_t>(y + height)});
+        success = true;
+    } while (false);
+
+    return success;
 }
 
 void DrmController::syncFrame() {
-    if (!isInit()) {
+    if (!m_device.isInitialized()) {
         EARLY_ERROR("Display controller is not initialized, cannot sync frame.\n");
         return;
     }
 
-    // Implement frame synchronization logic here
-    EARLY_DEBUG("Synchronizing frame on DRM display controller.\n");
+    m_device.waitFlipEvent();
 }
 
-void DrmController::swapFrame() {
-    if (!isInit()) {
-        EARLY_ERROR("Display controller is not initialized, cannot swap frame.\n");
-        return;
-    }
+bool DrmController::swapFrame(bool useVSync) {
+    bool success = false;
 
-    // Implement frame swapping logic here
-    EARLY_DEBUG("Swapping frame on DRM display controller.\n");
+    do {
+        if (!m_device.isInitialized()) {
+            EARLY_ERROR("Display controller is not initialized, cannot swap frame.\n");
+            break;
+        }
+        DrmBuffer *buffer = drawBuffer();
+        if (buffer == nullptr) {
+            EARLY_ERROR("No frame drawn, call drawFrame() first.\n");
+            break;
+        }
+
+        // The display owns the buffer from here, a failed flip frees it
+        syncCpuAccess(buffer, false);
+        int index = m_drawIndex;
+        m_drawIndex = INVALID_BUFFER_INDEX;
+        if (m_device.queueBuffer(index, useVSync, &m_damage) == false) {
+            EARLY_ERROR("Failed to queue buffer %d for display.\n", index);
+            break;
+        }
+        success = true;
+    } while (false);
+
+    return success;
 }
 
 } // namespace evs::early::drm
\ No newline at end of file
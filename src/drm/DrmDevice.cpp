@@ -1,14 +1,19 @@
 #include "DrmDevice.h"
 #include "CommonUtil.h"
+#include "FastCopy.h"
 
 #include <unordered_map>
+#include <algorithm>
 #include <memory>
 #include <fcntl.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
 #include <thread>
+#include <chrono>
 #include <iostream>
 
 #ifdef DEBUG_TAG
@@ -22,10 +27,180 @@
 #define QUERY_PLANES      (8U)
 #define QUERY_ALL         (QUERY_CONNCECTORS | QUERY_ENCODERS | QUERY_CRTCS | QUERY_PLANES)
 
+#define MAX_TESTED_FBS    (16U) // framebuffers remembered as TEST_ONLY validated
+#define DISPATCH_RETRY_MS (2)   // wait slice while another thread dispatches events
+
 namespace evs {
 namespace early {
 namespace drm {
 
+static void toModeInfo(const drmModeModeInfo &mode, DrmModeInfo &info) {
+    info.width = mode.hdisplay;
+    info.height = mode.vdisplay;
+    info.refreshRate = mode.vrefresh;
+    info.name = std::string(mode.name, strnlen(mode.name, DRM_DISPLAY_MODE_LEN));
+    info.clock = mode.clock;
+    info.hsyncStart = mode.hsync_start;
+    info.hsyncEnd = mode.hsync_end;
+    info.htotal = mode.htotal;
+    info.hskew = mode.hskew;
+    info.vsyncStart = mode.vsync_start;
+    info.vsyncEnd = mode.vsync_end;
+    info.vtotal = mode.vtotal;
+    info.vscan = mode.vscan;
+    info.flags = mode.flags;
+    info.type = mode.type;
+    info.preferred = ((mode.type & DRM_MODE_TYPE_PREFERRED) != 0U);
+
+    // vrefresh is rounded, 59.94 Hz and 60 Hz modes both report 60
+    uint64_t pixels = static_cast<uint64_t>(mode.htotal) * mode.vtotal;
+    info.refreshMilliHz = (pixels != 0U) ? static_cast<uint32_t>((static_cast<uint64_t>(mode.clock) * 1000000U + pixels / 2U) / pixels)
+                                         : mode.vrefresh * 1000U;
+}
+
+static void fromModeInfo(const DrmModeInfo &info, drmModeModeInfo &mode) {
+    memset(&mode, 0, sizeof(mode));
+    mode.clock = info.clock;
+    mode.hdisplay = static_cast<uint16_t>(info.width);
+    mode.hsync_start = info.hsyncStart;
+    mode.hsync_end = info.hsyncEnd;
+    mode.htotal = info.htotal;
+    mode.hskew = info.hskew;
+    mode.vdisplay = static_cast<uint16_t>(info.height);
+    mode.vsync_start = info.vsyncStart;
+    mode.vsync_end = info.vsyncEnd;
+    mode.vtotal = info.vtotal;
+    mode.vscan = info.vscan;
+    mode.vrefresh = info.refreshRate;
+    mode.flags = info.flags;
+    mode.type = info.type;
+    strncpy(mode.name, info.name.c_str(), DRM_DISPLAY_MODE_LEN - 1);
+}
+
+/**
+ * @brief Whether @p a and @p b have the same timings, names and types aside.
+ */
+static bool sameTimings(const drmModeModeInfo &a, const drmModeModeInfo &b) {
+    return (a.clock == b.clock) && (a.hdisplay == b.hdisplay) && (a.hsync_start == b.hsync_start)
+           && (a.hsync_end == b.hsync_end) && (a.htotal == b.htotal) && (a.hskew == b.hskew)
+           && (a.vdisplay == b.vdisplay) && (a.vsync_start == b.vsync_start) && (a.vsync_end == b.vsync_end)
+           && (a.vtotal == b.vtotal) && (a.vscan == b.vscan) && (a.flags == b.flags);
+}
+
+/**
+ * @brief Vblanks per content frame when the refresh is a whole multiple of
+ *        @p fps within 0.5%, 0 otherwise.
+ */
+static uint32_t cadenceOf(uint32_t refreshMilliHz, uint32_t fps) {
+    uint64_t frameMilliHz = static_cast<uint64_t>(fps) * 1000U;
+    if (frameMilliHz == 0U) {
+        return 0U;
+    }
+    uint64_t multiple = (refreshMilliHz + frameMilliHz / 2U) / frameMilliHz;
+    if (multiple == 0U) {
+        return 0U;
+    }
+    uint64_t target = multiple * frameMilliHz;
+    uint64_t error = (refreshMilliHz > target) ? (refreshMilliHz - target) : (target - refreshMilliHz);
+    return (error * 200U <= target) ? static_cast<uint32_t>(multiple) : 0U;
+}
+
+/**
+ * @brief Whether @p a is a better pick than @p b, both of the selected size.
+ * Scanout bandwidth goes with the refresh and the pixel clock, the lower wins.
+ */
+static bool betterMode(const DrmModeInfo &a, const DrmModeInfo &b, uint32_t fps) {
+    if (fps != 0U) {
+        uint32_t cadenceA = cadenceOf(a.refreshMilliHz, fps);
+        uint32_t cadenceB = cadenceOf(b.refreshMilliHz, fps);
+        if ((cadenceA != 0U) != (cadenceB != 0U)) {
+            return (cadenceA != 0U);
+        }
+        if ((cadenceA == 0U) && (cadenceB == 0U)) {
+            // No mode matches, one slower than the content drops frames
+            uint64_t frameMilliHz = static_cast<uint64_t>(fps) * 1000U;
+            bool keepsUpA = (a.refreshMilliHz >= frameMilliHz);
+            bool keepsUpB = (b.refreshMilliHz >= frameMilliHz);
+            if (keepsUpA != keepsUpB) {
+                return keepsUpA;
+            }
+        }
+    }
+    if (a.refreshMilliHz != b.refreshMilliHz) {
+        return (a.refreshMilliHz < b.refreshMilliHz);
+    }
+    if (a.clock != b.clock) {
+        return (a.clock < b.clock);
+    }
+    return (a.preferred == true) && (b.preferred == false);
+}
+
+static inline uint64_t getTimeUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+/**
+ * @brief Where the GPU sits, e.g. "pci:0000:03:00.0" or
+ *        "platform:ae00000.display-controller", the device node otherwise.
+ * Card indexes and driver names repeat across boots and boards, this does not.
+ */
+static std::string deviceIdentity(int fd) {
+    std::string identity{};
+    drmDevicePtr device = nullptr;
+    if (drmGetDevice2(fd, 0, &device) == 0) {
+        char text[64] = {};
+        if ((device->bustype == DRM_BUS_PCI) && (device->businfo.pci != nullptr)) {
+            snprintf(text,
+                     sizeof(text),
+                     "pci:%04x:%02x:%02x.%u",
+                     device->businfo.pci->domain,
+                     device->businfo.pci->bus,
+                     device->businfo.pci->dev,
+                     static_cast<unsigned int>(device->businfo.pci->func));
+            identity = text;
+        } else if ((device->bustype == DRM_BUS_PLATFORM) && (device->businfo.platform != nullptr)) {
+            identity = std::string("platform:") + device->businfo.platform->fullname;
+        } else if ((device->available_nodes & (1 << DRM_NODE_PRIMARY)) != 0) {
+            identity = device->nodes[DRM_NODE_PRIMARY];
+        }
+        drmFreeDevice(&device);
+    }
+    if (identity.empty() == true) {
+        char *busid = drmGetBusid(fd);
+        if ((busid != nullptr) && (busid[0] != '\0')) {
+            identity = busid;
+        }
+        drmFreeBusid(busid);
+    }
+    if (identity.empty() == true) {
+        char node[256] = {};
+        std::string link = "/proc/self/fd/" + std::to_string(fd);
+        ssize_t length = readlink(link.c_str(), node, sizeof(node) - 1U);
+        identity = (length > 0) ? std::string(node, static_cast<size_t>(length)) : std::string();
+    }
+    // The snapshot cache stores it as one word
+    std::replace(identity.begin(), identity.end(), ' ', '_');
+    return identity;
+}
+
+int DrmDevice::crtcIndexOf(int fd, uint32_t crtcId) {
+    drmModeRes *resources = drmModeGetResources(fd);
+    if (resources == nullptr) {
+        return -1;
+    }
+    int crtcIndex = -1;
+    for (int i = 0; i < resources->count_crtcs; ++i) {
+        if (resources->crtcs[i] == crtcId) {
+            crtcIndex = i;
+            break;
+        }
+    }
+    drmModeFreeResources(resources);
+    return crtcIndex;
+}
+
 static std::string connectorTypeToString(uint32_t type) {
     static const std::unordered_map<uint32_t, const char *> g_connectors = {
         {DRM_MODE_CONNECTOR_VGA, "VGA"},
@@ -63,12 +238,44 @@ bool DrmDevice::open() {
             EARLY_ERROR("Failed to open DRM device at %s: %s\n", path.c_str(), strerror(errno));
             break;
         }
+        m_importCache = std::make_unique<DrmImportCache>(m_fd);
+        m_bufferPool = std::make_unique<DrmBufferPool>(m_fd);
+        m_props = std::make_unique<DrmPropertyCache>(m_fd);
+        m_eventLoop = std::make_unique<DrmEventLoop>(m_fd);
+        m_eventLoop->addFlipListener([this](const DrmEventLoop::Event &event) { onFlipEvent(event); });
+        if (m_eventLoop->start() != 0) {
+            EARLY_WARN("No DRM event thread, events are handled by the waiting caller\n");
+        }
+
+        // Atomic implies universal planes, the primary plane becomes visible
+        m_atomicSupported = (drmSetClientCap(m_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) == 0)
+                            && (drmSetClientCap(m_fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0);
+        m_atomic = m_atomicSupported;
+        // Flips without vsync, which still send their page flip event
+        uint64_t cap = 0U;
+        m_asyncFlip = (drmGetCap(m_fd, DRM_CAP_ASYNC_PAGE_FLIP, &cap) == 0) && (cap != 0U);
+#ifdef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+        cap = 0U;
+        m_atomicAsyncFlip = (drmGetCap(m_fd, DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP, &cap) == 0) && (cap != 0U);
+#endif
+        EARLY_INFO("DRM device %s opened, atomic modesetting %s\n", path.c_str(), m_atomic ? "enabled" : "not supported");
         success = true;
     } while (false);
     return success;
 }
 
 void DrmDevice::close() {
+    // Stop reading events before the objects they refer to go away
+    m_eventLoop.reset();
+    // Captures still held after deInitDisplay() are invalid from here on
+    m_writeback.reset();
+    m_importCache.reset();
+    m_bufferPool.reset();
+    m_props.reset();
+    m_atomicSupported = false;
+    m_atomic = false;
+    m_asyncFlip = false;
+    m_atomicAsyncFlip = false;
     if (m_fd >= 0) {
         ::close(m_fd);
         m_fd = -1;
@@ -90,32 +297,6 @@ bool DrmDevice::initDisplay(uint32_t connectorId,
             success = false;
             break;
         }
-        for (uint8_t i = 0U; i < 2U; ++i) {
-            if (m_allocatorType == AllocatorType::DRM_ALLOCATOR_MMAP) {
-                m_buffers[i] = DrmDevice::createBuffer<MMapAllocator>(m_fd, width, height, bpp, 0U, flags, format);
-            } else if (m_allocatorType == AllocatorType::DRM_ALLOCATOR_HEAP_DMA) {
-                m_buffers[i] = DrmDevice::createBuffer<HeapDMAAllocator>(m_fd, width, height, bpp, 0U, flags, format);
-#ifdef SUPPORT_ION_ALLOCATOR
-            } else if (m_allocatorType == AllocatorType::DRM_ALLOCATOR_ION) {
-                m_buffers[i] = DrmDevice::createBuffer<IonAllocator>(m_fd, width, height, bpp, 0U, stride, flags, format);
-#endif
-            } else {
-                EARLY_ERROR("Unsupported allocator type %d for display initialization.\n", static_cast<int>(m_allocatorType));
-                success = false;
-                break;
-            }
-            if (m_buffers[i] == nullptr) {
-                EARLY_ERROR("Failed to allocate buffer %u for display initialization.\n", i);
-                success = false;
-                break;
-            }
-        }
-
-        if (success == false) {
-            deInitDisplay();
-            break;
-        }
-
         auto iter = m_connectors.find(connectorId);
         if (iter == m_connectors.end()) {
             success = false;
@@ -131,37 +312,118 @@ bool DrmDevice::initDisplay(uint32_t connectorId,
             break;
         }
 
-        if (crtc->mode_valid == 0) {
-            drmModeFreeCrtc(crtc);
-            EARLY_ERROR("CRTC %u has no valid mode.\n", crtcId);
-            success = false;
-            break;
+        DrmConnectorInfo connectorInfo{};
+        auto conn = drmModeGetConnectorCurrent(m_fd, connectorId);
+        if (conn != nullptr) {
+            getConnectorInfo(conn, connectorInfo);
+            drmModeFreeConnector(conn);
         }
-
-        if (m_modelPtr != nullptr) {
-            if (memcmp(m_modelPtr, &crtc->mode, sizeof(drmModeModeInfo)) != 0) {
-                delete static_cast<drmModeModeInfo *>(m_modelPtr);
+        DrmSnapshotPtr resources = snapshot();
+        if ((connectorInfo.modes.empty() == true) && (resources != nullptr)) {
+            // Not probed by the kernel, the snapshot probed it or has it cached
+            auto known = resources->connectors().find(connectorId);
+            if (known != resources->connectors().end()) {
+                connectorInfo.modes = known->second.modes;
+                connectorInfo.vrrCapable = known->second.vrrCapable;
             }
+        }
+
+        // A requested mode, else the running one when it has the requested
+        // size, else the best connector mode of that size. Without a size
+        // (0x0) the running mode, else the native one.
+        drmModeModeInfo mode = {};
+        bool anySize = (width == 0U) || (height == 0U);
+        bool runningFits = (crtc->mode_valid != 0)
+                           && ((anySize == true) || ((crtc->mode.hdisplay == width) && (crtc->mode.vdisplay == height)));
+        if (m_modeRequested == true) {
+            fromModeInfo(m_requestedMode, mode);
+        } else if (runningFits == true) {
+            mode = crtc->mode;
         } else {
-            m_modelPtr = new drmModeModeInfo;
-            memcpy(m_modelPtr, &crtc->mode, sizeof(drmModeModeInfo));
+            DrmModePolicy policy = {width, height, 0U};
+            int index = selectMode(connectorInfo.modes, policy);
+            if (index >= 0) {
+                fromModeInfo(connectorInfo.modes[static_cast<size_t>(index)], mode);
+            } else if (crtc->mode_valid != 0) {
+                EARLY_WARN("Connector %u has no %ux%u mode, keeping the running %ux%u\n",
+                           connectorId, width, height, crtc->mode.hdisplay, crtc->mode.vdisplay);
+                mode = crtc->mode;
+            } else {
+                policy.width = 0U;
+                policy.height = 0U;
+                index = selectMode(connectorInfo.modes, policy);
+                if (index < 0) {
+                    drmModeFreeCrtc(crtc);
+                    EARLY_ERROR("CRTC %u has no valid mode and connector %u no usable one.\n", crtcId, connectorId);
+                    success = false;
+                    break;
+                }
+                EARLY_WARN("Connector %u has no %ux%u mode, using the native one\n", connectorId, width, height);
+                fromModeInfo(connectorInfo.modes[static_cast<size_t>(index)], mode);
+            }
+        }
+        // The bootloader left the connector lit in this mode, no modeset needed
+        uint32_t splashFbId = 0U;
+        if ((m_handoff != DrmHandoff::NONE) && (crtc->mode_valid != 0) && (crtc->buffer_id != 0U)
+            && (connectorInfo.encoder.crtc.id == crtcId) && (sameTimings(crtc->mode, mode) == true)) {
+            splashFbId = crtc->buffer_id;
         }
         drmModeFreeCrtc(crtc);
 
-        DrmConnectorInfo connectorInfo{};
-        auto conn = drmModeGetConnectorCurrent(m_fd, connectorId);
-        getConnectorInfo(conn, connectorInfo);
-        drmModeFreeConnector(conn);
+        // The swapchain has the size of the mode, whatever was asked for
+        BufferInfo info = {};
+        info.width = mode.hdisplay;
+        info.height = mode.vdisplay;
+        info.bpp = static_cast<uint8_t>(bpp);
+        info.depth = 24U;
+        info.format = static_cast<int>(format);
+        info.flags = static_cast<int>(flags);
+        info.tag = MemoryTag::DISPLAY;
+        for (int i = 0; i < m_bufferCount; ++i) {
+            m_buffers[i] = m_bufferPool->acquire(m_allocatorType, info);
+            if (m_buffers[i] == nullptr) {
+                EARLY_ERROR("Failed to allocate buffer %d for display initialization.\n", i);
+                success = false;
+                break;
+            }
+        }
+        if (success == false) {
+            deInitDisplay();
+            break;
+        }
+
+        if (m_modelPtr == nullptr) {
+            m_modelPtr = new drmModeModeInfo;
+        }
+        memcpy(m_modelPtr, &mode, sizeof(drmModeModeInfo));
+        toModeInfo(mode, m_mode);
+        m_vrrActive = false;
+        EARLY_INFO("Mode %s, %ux%u@%u.%03u Hz, %u kHz\n",
+                   m_mode.name.c_str(),
+                   m_mode.width,
+                   m_mode.height,
+                   m_mode.refreshMilliHz / 1000U,
+                   m_mode.refreshMilliHz % 1000U,
+                   m_mode.clock);
 
-        if (drmModeSetCrtc(m_fd,
-                           crtcId,
-                           m_buffers[0]->fbId,
-                           0,
-                           0,
-                           &connector,
-                           1,
-                           static_cast<drmModeModeInfo *>(m_modelPtr))
-            != 0) {
+        m_handoffFbId = 0U;
+        if ((splashFbId != 0U) && (adoptCrtc(crtcId, m_buffers[0]) == true)) {
+            m_handoffFbId = splashFbId;
+            EARLY_INFO("Adopted CRTC %u showing framebuffer %u, no modeset\n", crtcId, splashFbId);
+            if ((m_handoff == DrmHandoff::COPY) && (copySplash(splashFbId, mode.hdisplay, mode.vdisplay, bpp) == false)) {
+                EARLY_WARN("Splash framebuffer %u not copied, display buffers keep their content\n", splashFbId);
+            }
+        } else if ((m_atomic == true) && (atomicModeset(connectorId, crtcId, m_buffers[0]) == true)) {
+            EARLY_DEBUG("Atomic modeset on CRTC %u, plane %u\n", crtcId, m_planeId);
+        } else if (drmModeSetCrtc(m_fd,
+                                  crtcId,
+                                  m_buffers[0]->fbId,
+                                  0,
+                                  0,
+                                  &connector,
+                                  1,
+                                  static_cast<drmModeModeInfo *>(m_modelPtr))
+                   != 0) {
             EARLY_ERROR("Failed to set to fd %d with CRTC %u with connector %u, fbid %u, %s\n",
                         m_fd,
                         crtcId,
@@ -174,13 +436,56 @@ bool DrmDevice::initDisplay(uint32_t connectorId,
 
         m_connectorId = connectorId;
         m_crtcId = crtcId;
-        m_width = width;
-        m_height = height;
+        m_crtcIndex = crtcIndexOf(m_fd, crtcId);
+        if (m_planeId != 0U) {
+            m_planeAssigner = std::make_unique<DrmPlaneAssigner>(m_fd, *m_props);
+            if (m_planeAssigner->init(crtcId, m_crtcIndex, m_planeId) == false) {
+                m_planeAssigner.reset();
+            }
+        }
+        if (m_atomic == true) {
+            std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+            m_colorPipeline = std::make_unique<DrmColorPipeline>(m_fd, *m_props);
+            if (m_colorPipeline->init(crtcId) == false) {
+                m_colorPipeline.reset();
+            }
+        }
+        if (m_planeAssigner != nullptr) {
+            // Plane state of plain swapchain flips, as set by the modeset
+            const drmModeModeInfo *mode = static_cast<const drmModeModeInfo *>(m_modelPtr);
+            DrmLayer client = {};
+            client.format = format;
+            client.src = DrmRect{0, 0, mode->hdisplay, mode->vdisplay};
+            client.dst = client.src;
+            client.planeId = m_planeId;
+            m_clientLayers.assign(1U, client);
+        }
+        m_width = mode.hdisplay;
+        m_height = mode.vdisplay;
         m_bpp = bpp;
         m_format = format;
         m_flags = flags;
-        m_flipEventObj.idx = 0;
-        m_flipEventObj.flags = 0;
+        {
+            // The modeset put buffer 0 on screen, drawing starts with buffer 1.
+            // After a handoff the splash is on screen and every buffer is free.
+            bool handedOff = (m_handoffFbId != 0U);
+            std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+            for (int i = 0; i < MAX_BUFFER_COUNT; ++i) {
+                m_flipEventObj.states[i] = BufferState::FREE;
+            }
+            if (handedOff == false) {
+                m_flipEventObj.states[0] = BufferState::SCANOUT;
+            }
+            m_flipEventObj.scanout = handedOff ? -1 : 0;
+            m_flipEventObj.pending = -1;
+            m_flipEventObj.queued = 0;
+            m_flipEventObj.idx = handedOff ? 0 : 1;
+            m_flipEventObj.flags = 0;
+            m_flipEventObj.lastSequence = 0U;
+            m_flipEventObj.flips = 0U;
+            m_flipEventObj.missedVblanks = 0U;
+        }
+        m_lastAcquired = (m_handoffFbId != 0U) ? (m_bufferCount - 1) : 0;
         m_initialized = true;
         m_bkConnector = connectorInfo;
     } while (false);
@@ -220,6 +525,62 @@ bool DrmDevice::initDisplay(const DrmConnectorInfo &connectorInfo,
     return success;
 }
 
+bool DrmDevice::initDisplay(const DrmConnectorInfo &connectorInfo,
+                            const DrmModeInfo &mode,
+                            uint32_t bpp,
+                            uint32_t format,
+                            uint32_t flags) {
+    m_requestedMode = mode;
+    m_modeRequested = true;
+    bool success = initDisplay(connectorInfo.id,
+                               connectorInfo.encoder.crtc.id,
+                               mode.width,
+                               mode.height,
+                               bpp,
+                               format,
+                               flags);
+    m_modeRequested = false;
+    return success;
+}
+
+int DrmDevice::selectMode(const std::vector<DrmModeInfo> &modes, const DrmModePolicy &policy) {
+    uint32_t width = policy.width;
+    uint32_t height = policy.height;
+    if ((width == 0U) || (height == 0U)) {
+        // Native size, that of the preferred mode or else the largest one
+        const DrmModeInfo *native = nullptr;
+        for (const auto &mode : modes) {
+            if ((mode.flags & DRM_MODE_FLAG_INTERLACE) != 0U) {
+                continue;
+            }
+            if (mode.preferred == true) {
+                native = &mode;
+                break;
+            }
+            if ((native == nullptr) || (mode.width * mode.height > native->width * native->height)) {
+                native = &mode;
+            }
+        }
+        if (native == nullptr) {
+            return -1;
+        }
+        width = native->width;
+        height = native->height;
+    }
+
+    int best = -1;
+    for (size_t i = 0; i < modes.size(); ++i) {
+        const DrmModeInfo &mode = modes[i];
+        if (((mode.flags & DRM_MODE_FLAG_INTERLACE) != 0U) || (mode.width != width) || (mode.height != height)) {
+            continue;
+        }
+        if ((best < 0) || (betterMode(mode, modes[static_cast<size_t>(best)], policy.contentFps) == true)) {
+            best = static_cast<int>(i);
+        }
+    }
+    return best;
+}
+
 bool DrmDevice::deInitDisplay() {
     bool success = true;
     do {
@@ -228,24 +589,64 @@ bool DrmDevice::deInitDisplay() {
             break;
         }
 
-        for (uint8_t i = 0U; i < 2U; ++i) {
+        if (m_planeAssigner != nullptr) {
+            // Planes would keep scanning out layer buffers of the caller: put
+            // the swapchain back on the primary plane and switch off the rest
+            waitFlipEvent();
+            int shown = (m_flipEventObj.scanout >= 0) ? m_flipEventObj.scanout : 0;
+            // Nothing flipped since a handoff, the splash is still shown
+            uint32_t fbId = ((m_flipEventObj.scanout < 0) && (m_handoffFbId != 0U)) ? m_handoffFbId : m_buffers[shown]->fbId;
+            DrmAtomicRequest req(*m_props);
+            if ((m_planeAssigner->addToRequest(req, m_clientLayers, fbId) == true)
+                && (req.commit(m_fd, 0U) == 0)) {
+                m_planeAssigner->commitDone(m_clientLayers);
+            }
+            m_planeAssigner.reset();
+        }
+        if (m_writeback != nullptr) {
+            // Detaching the connector is a modeset, no flip may be in flight
+            waitFlipEvent();
+        }
+        std::vector<DrmCapture> captures{};
+        CaptureCallback captureCallback{};
+        {
+            std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+            // The CRTC keeps the correction on screen until the next master sets its own
+            m_colorPipeline.reset();
+            // Buffers the receiver holds stay out of the pool until releaseCapture()
+            if (m_writeback != nullptr) {
+                m_writeback->reset();
+                if (m_writeback->held() == 0U) {
+                    m_writeback.reset();
+                }
+            }
+            captures.swap(m_captures);
+            captureCallback = std::move(m_captureCallback);
+            m_captureCallback = nullptr;
+            std::vector<const DrmBuffer *> staged{};
+            placedBuffers(m_layers, staged);
+            for (const DrmBuffer *buffer : m_shownLayerBuffers) {
+                if (containsBuffer(staged, buffer) == false) {
+                    staged.push_back(buffer);
+                }
+            }
+            m_releasedLayerBuffers.insert(m_releasedLayerBuffers.end(), staged.begin(), staged.end());
+            m_shownLayerBuffers.clear();
+            m_pendingLayerBuffers.clear();
+            m_layers.clear();
+            m_clientLayers.clear();
+        }
+        // Captures of the last flips still reach the receiver
+        deliverCaptures(captures, captureCallback);
+        releaseLayerBuffers();
+
+        for (int i = 0; i < MAX_BUFFER_COUNT; ++i) {
             DrmBuffer *buffer = m_buffers[i];
             if (buffer == nullptr) {
                 continue;
             }
-            if (m_allocatorType == AllocatorType::DRM_ALLOCATOR_MMAP) {
-                DrmDevice::removeBuffer<MMapAllocator>(m_fd, buffer);
-            } else if (m_allocatorType == AllocatorType::DRM_ALLOCATOR_HEAP_DMA) {
-                DrmDevice::removeBuffer<HeapDMAAllocator>(m_fd, buffer);
-#ifdef SUPPORT_ION_ALLOCATOR
-            } else if (m_allocatorType == AllocatorType::DRM_ALLOCATOR_ION) {
-                DrmDevice::removeBuffer<IonAllocator>(m_fd, buffer);
-#endif
-            } else {
-                success = false;
-                EARLY_ERROR("Unsupported allocator type %d for display de-initialization.\n", static_cast<int>(m_allocatorType));
-                break;
-            }
+            // Parked until the next initDisplay() or trimBufferPool()
+            m_bufferPool->park(buffer);
             m_buffers[i] = nullptr;
         }
 
@@ -253,24 +654,69 @@ bool DrmDevice::deInitDisplay() {
             delete static_cast<drmModeModeInfo *>(m_modelPtr);
             m_modelPtr = nullptr;
         }
+        if (m_modeBlobId != 0U) {
+            drmModeDestroyPropertyBlob(m_fd, m_modeBlobId);
+            m_modeBlobId = 0U;
+        }
+        m_planeId = 0U;
+        m_testedFbs.clear();
+        m_handoffFbId = 0U;
 
         m_crtcId = 0U;
+        m_crtcIndex = -1;
         m_connectorId = 0U;
         m_width = 0U;
         m_height = 0U;
         m_bpp = 0U;
         m_format = 0U;
         m_flags = 0U;
-        m_buffers[0U] = nullptr;
-        m_buffers[1U] = nullptr;
-        m_flipEventObj.flags = -1;
-        m_flipEventObj.idx = -1;
+        {
+            std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+            m_flipEventObj.flags = -1;
+            m_flipEventObj.idx = -1;
+            m_flipEventObj.queued = 0;
+            m_flipEventObj.pending = -1;
+            m_flipEventObj.scanout = -1;
+        }
         m_initialized = false;
         success = true;
     } while (false);
     return success;
 }
 
+bool DrmDevice::reconfigure(uint32_t connectorId,
+                            uint32_t crtcId,
+                            uint32_t width,
+                            uint32_t height,
+                            uint32_t bpp,
+                            uint32_t format,
+                            uint32_t flags) {
+    bool success = false;
+    do {
+        if (m_fd < 0) {
+            EARLY_ERROR("DRM device is not open, cannot reconfigure display.\n");
+            break;
+        }
+
+        uint64_t start = getTimeUs();
+        size_t hits = m_bufferPool->hits();
+        if (m_initialized == true) {
+            deInitDisplay();
+        }
+        if (initDisplay(connectorId, crtcId, width, height, bpp, format, flags) == false) {
+            break;
+        }
+        EARLY_INFO("Display reconfigured to %ux%u on CRTC %u in %llu us, %zu buffers reused\n",
+                   width,
+                   height,
+                   crtcId,
+                   static_cast<unsigned long long>(getTimeUs() - start),
+                   m_bufferPool->hits() - hits);
+        success = true;
+    } while (false);
+    return success;
+}
+
 uint8_t *DrmDevice::getDrawBuffer() {
     DrmBuffer *buffer = activeBuffer();
     return static_cast<uint8_t *>(buffer ? buffer->ptr : nullptr);
@@ -280,155 +726,917 @@ bool DrmDevice::setModeCrtc(const DrmBuffer *buffer) {
     return (drmModeSetCrtc(m_fd, m_crtcId, buffer->fbId, 0, 0, &m_connectorId, 1, static_cast<drmModeModeInfo *>(m_modelPtr)) == 0);
 }
 
-bool DrmDevice::flipBuffer(bool useVSync) {
-    bool success = true;
-    DrmBuffer *buffer = activeBuffer();
+bool DrmDevice::supportsModifier(uint32_t format, uint64_t modifier) const {
+    auto iter = m_planes.find(m_planeId);
+    if ((m_planeId == 0U) || (iter == m_planes.end())) {
+        return (DrmFormat::hasModifier(modifier) == false);
+    }
+    return DrmFormat::supportsModifier(iter->second.modifiers, format, modifier);
+}
+
+uint32_t DrmDevice::primaryPlaneOf(int fd, DrmPropertyCache &props, uint32_t crtcId) {
+    uint32_t planeId = 0U;
+    int crtcIndex = crtcIndexOf(fd, crtcId);
+    if (crtcIndex < 0) {
+        return 0U;
+    }
+
+    drmModePlaneRes *planeRes = drmModeGetPlaneResources(fd);
+    if (planeRes == nullptr) {
+        return 0U;
+    }
+    for (uint32_t i = 0; i < planeRes->count_planes; ++i) {
+        drmModePlane *plane = drmModeGetPlane(fd, planeRes->planes[i]);
+        if (plane == nullptr) {
+            continue;
+        }
+        uint64_t type = 0;
+        bool usable = ((plane->possible_crtcs & (1U << crtcIndex)) != 0U)
+                      && props.value(plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", type)
+                      && (type == DRM_PLANE_TYPE_PRIMARY);
+        // Prefer the primary plane already bound to this CRTC
+        if (usable && ((planeId == 0U) || (plane->crtc_id == crtcId))) {
+            planeId = plane->plane_id;
+        }
+        drmModeFreePlane(plane);
+    }
+    drmModeFreePlaneResources(planeRes);
+    return planeId;
+}
+
+bool DrmDevice::findPrimaryPlane(uint32_t crtcId) {
+    m_planeId = primaryPlaneOf(m_fd, *m_props, crtcId);
+    return (m_planeId != 0U);
+}
+
+bool DrmDevice::atomicModeset(uint32_t connectorId, uint32_t crtcId, const DrmBuffer *buffer) {
+    bool success = false;
     do {
-        if (buffer == nullptr) {
-            success = false;
+        if (findPrimaryPlane(crtcId) == false) {
+            EARLY_WARN("No primary plane for CRTC %u, using legacy modeset\n", crtcId);
             break;
         }
-        if (buffer->fbId == 0) {
-            success = false;
+        if (m_modeBlobId != 0U) {
+            drmModeDestroyPropertyBlob(m_fd, m_modeBlobId);
+            m_modeBlobId = 0U;
+        }
+        if (drmModeCreatePropertyBlob(m_fd, m_modelPtr, sizeof(drmModeModeInfo), &m_modeBlobId) != 0) {
+            EARLY_ERROR("Failed to create mode blob: %s\n", strerror(errno));
             break;
         }
 
-        {
-            std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
-            m_flipEventObj.flags = 1;
-        }
-        int ret = drmModePageFlip(m_fd, m_crtcId, buffer->fbId, useVSync ? DRM_MODE_PAGE_FLIP_EVENT : 0, this);
-        if (ret < 0) {
-            EARLY_ERROR("Failed to flip buffer %u on CRTC %u: %s\n", buffer->fbId, m_crtcId, strerror(errno));
-            success = false;
+        const drmModeModeInfo *mode = static_cast<const drmModeModeInfo *>(m_modelPtr);
+        uint64_t srcW = static_cast<uint64_t>(mode->hdisplay) << 16;
+        uint64_t srcH = static_cast<uint64_t>(mode->vdisplay) << 16;
+        DrmAtomicRequest req(*m_props);
+        bool added = req.add(connectorId, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", crtcId)
+                     && req.add(crtcId, DRM_MODE_OBJECT_CRTC, "MODE_ID", m_modeBlobId)
+                     && req.add(crtcId, DRM_MODE_OBJECT_CRTC, "ACTIVE", 1U)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "FB_ID", buffer->fbId)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "CRTC_ID", crtcId)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "SRC_X", 0U)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "SRC_Y", 0U)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "SRC_W", srcW)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "SRC_H", srcH)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "CRTC_X", 0U)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "CRTC_Y", 0U)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "CRTC_W", mode->hdisplay)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "CRTC_H", mode->vdisplay);
+        if (added == false) {
+            EARLY_ERROR("Missing atomic properties on connector %u / CRTC %u / plane %u\n", connectorId, crtcId, m_planeId);
             break;
         }
 
-        m_flipEventObj.idx ^= 1;
+        // Let the panel refresh follow the flips, e.g. the camera cadence,
+        // where the sink supports it. VRR_ENABLED outlives this process, so
+        // it is cleared as well.
+        uint64_t vrrCapable = 0U;
+        m_props->refresh(connectorId);
+        bool vrr = (m_vrrEnabled == true)
+                   && (m_props->value(connectorId, DRM_MODE_OBJECT_CONNECTOR, "vrr_capable", vrrCapable) == true)
+                   && (vrrCapable != 0U);
+        bool hasVrr = (m_props->id(crtcId, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED") != 0U);
+        int cursor = req.cursor();
+        if (hasVrr == true) {
+            req.add(crtcId, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED", vrr ? 1U : 0U);
+        }
+
+        int ret = req.commit(m_fd, DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET);
+        if ((ret != 0) && (hasVrr == true) && (vrr == true)) {
+            EARLY_WARN("VRR rejected on CRTC %u, using a fixed refresh: %s\n", crtcId, strerror(-ret));
+            req.rollback(cursor);
+            req.add(crtcId, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED", 0U);
+            vrr = false;
+            ret = req.commit(m_fd, DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET);
+        }
+        if (ret != 0) {
+            EARLY_ERROR("Atomic modeset rejected by TEST_ONLY: %s\n", strerror(-ret));
+            break;
+        }
+        // The one blocking commit, every later frame only flips FB_ID
+        ret = req.commit(m_fd, DRM_MODE_ATOMIC_ALLOW_MODESET);
+        if (ret != 0) {
+            EARLY_ERROR("Atomic modeset failed: %s\n", strerror(-ret));
+            break;
+        }
+        m_testedFbs.clear();
+        m_testedFbs.push_back(buffer->fbId);
+        m_vrrActive = (hasVrr == true) && (vrr == true);
+        success = true;
     } while (false);
 
+    if (success == false) {
+        if (m_modeBlobId != 0U) {
+            drmModeDestroyPropertyBlob(m_fd, m_modeBlobId);
+            m_modeBlobId = 0U;
+        }
+        m_planeId = 0U;
+    }
     return success;
 }
 
-void DrmDevice::pageFlipHandler(int fd,
-                                unsigned int sequence,
-                                unsigned int tv_sec,
-                                unsigned int tv_usec,
-                                void *user_data) {
-    // EARLY_DEBUG("Page flip event: sequence=%u, sec=%u, usec=%u, %u\n", sequence, tv_sec, tv_usec, getppid());
-    // std::thread::id tid = std::this_thread::get_id();
-    // EARLY_DEBUG("Page flip event handled in thread id: %lu\n", static_cast<unsigned long>(tid));
-    // std::cout << "Page flip event: sequence=" << sequence
-    //           << ", sec=" << tv_sec
-    //           << ", usec=" << tv_usec
-    //           << ", thread id: " << tid << std::endl;
-    DrmDevice *device = static_cast<DrmDevice *>(user_data);
-    FlipEventObj &flipEventObj = device->getFlipEventObj();
-
-    // Get current time in microseconds
-    uint64_t currentTimeUs = static_cast<uint64_t>(tv_sec) * 1000000 + tv_usec;
-    {
-        std::unique_lock<std::mutex> lock(flipEventObj.mtx);
+bool DrmDevice::adoptCrtc(uint32_t crtcId, const DrmBuffer *buffer) {
+    if (m_atomic == false) {
+        // Checked by the first drmModePageFlip(), see submitLocked()
+        return true;
+    }
+    bool success = false;
+    do {
+        if (findPrimaryPlane(crtcId) == false) {
+            break;
+        }
 
-        // Calculate FPS
-        if (flipEventObj.lastFlipTimeUs != 0) {
-            uint64_t deltaUs = currentTimeUs - flipEventObj.lastFlipTimeUs;
-            if (deltaUs > 0) {
-                float fps = 1.0e6f / deltaUs;
-                // EARLY_DEBUG("Estimated FPS: %.2f\n", fps);
-                flipEventObj.fps = fps;
-            }
+        // The plane state of the first flip, without ALLOW_MODESET
+        const drmModeModeInfo *mode = static_cast<const drmModeModeInfo *>(m_modelPtr);
+        DrmAtomicRequest req(*m_props);
+        bool added = req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "FB_ID", buffer->fbId)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "CRTC_ID", crtcId)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "SRC_X", 0U)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "SRC_Y", 0U)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "SRC_W", static_cast<uint64_t>(mode->hdisplay) << 16)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "SRC_H", static_cast<uint64_t>(mode->vdisplay) << 16)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "CRTC_X", 0U)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "CRTC_Y", 0U)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "CRTC_W", mode->hdisplay)
+                     && req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "CRTC_H", mode->vdisplay);
+        if (added == false) {
+            break;
+        }
+        int ret = req.commit(m_fd, DRM_MODE_ATOMIC_TEST_ONLY);
+        if (ret != 0) {
+            EARLY_WARN("CRTC %u cannot flip to the display buffers without a modeset: %s\n", crtcId, strerror(-ret));
+            break;
         }
+        m_testedFbs.clear();
+        m_testedFbs.push_back(buffer->fbId);
+
+        // Keep whatever the bootloader set, VRR included
+        uint64_t vrr = 0U;
+        m_props->refresh(crtcId);
+        m_vrrActive = (m_props->value(crtcId, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED", vrr) == true) && (vrr != 0U);
+        success = true;
+    } while (false);
 
-        // Update flip tracking
-        flipEventObj.lastFlipTimeUs = currentTimeUs;
-        flipEventObj.flags = 0;
-        flipEventObj.idx ^= 1;
-        flipEventObj.cv.notify_all();
+    if (success == false) {
+        m_planeId = 0U;
     }
+    return success;
 }
 
-void DrmDevice::waitFlipEvent() {
-    drmEventContext evctx = {};
-    evctx.version = DRM_EVENT_CONTEXT_VERSION;
-    evctx.page_flip_handler = DrmDevice::pageFlipHandler;
+bool DrmDevice::copySplash(uint32_t fbId, uint32_t width, uint32_t height, uint32_t bpp) {
+    bool success = false;
+    drmModeFB *fb = drmModeGetFB(m_fd, fbId);
+    do {
+        // The GEM handle is only handed to the DRM master
+        if ((fb == nullptr) || (fb->handle == 0U) || (fb->bpp != bpp)) {
+            break;
+        }
 
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(m_fd, &fds);
+        struct drm_mode_map_dumb mreq = {};
+        mreq.handle = fb->handle;
+        if (drmIoctl(m_fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) != 0) {
+            EARLY_DEBUG("Splash framebuffer %u is not a dumb buffer: %s\n", fbId, strerror(errno));
+            break;
+        }
+        size_t size = static_cast<size_t>(fb->pitch) * fb->height;
+        void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, m_fd, static_cast<off_t>(mreq.offset));
+        if (map == MAP_FAILED) {
+            EARLY_ERROR("Failed to map splash framebuffer %u: %s\n", fbId, strerror(errno));
+            break;
+        }
 
-    while (m_flipEventObj.flags > 0) {
-        if (select(m_fd + 1, &fds, nullptr, nullptr, nullptr) > 0) {
-            if (FD_ISSET(m_fd, &fds)) {
-                drmHandleEvent(m_fd, &evctx);
+        // The display buffers are sized for the new mode, m_width/m_height
+        // are not set yet
+        uint32_t rows = std::min(fb->height, height);
+        size_t pixels = static_cast<size_t>(std::min(fb->width, width)) * bpp / 8U;
+        for (int i = 0; i < m_bufferCount; ++i) {
+            DrmBuffer *buffer = m_buffers[i];
+            if ((buffer == nullptr) || (buffer->ptr == nullptr)) {
+                continue;
             }
+            size_t rowBytes = std::min<size_t>(pixels, std::min(fb->pitch, buffer->stride));
+            FastCopy::copy2D(static_cast<uint8_t *>(buffer->ptr) + buffer->offset,
+                             buffer->stride,
+                             static_cast<const uint8_t *>(map),
+                             fb->pitch,
+                             rowBytes,
+                             rows);
         }
-    }
+        munmap(map, size);
+        success = true;
+    } while (false);
 
-    std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
-    if (m_flipEventObj.flags) {
-        m_flipEventObj.cv.wait(lock, [this]() { return m_flipEventObj.flags == 0; });
+    if (fb != nullptr) {
+        if (fb->handle != 0U) {
+            struct drm_gem_close req = {};
+            req.handle = fb->handle;
+            drmIoctl(m_fd, DRM_IOCTL_GEM_CLOSE, &req);
+        }
+        drmModeFreeFB(fb);
     }
+    return success;
 }
 
-void DrmDevice::queryDeviceName() {
-    drmVersion *version = drmGetVersion(m_fd);
-    m_cardInfo = {};
-    if (version) {
-        m_cardInfo.driverName = std::string(version->name, version->name_len);
-        m_cardInfo.cardName = std::string(version->desc, version->desc_len);
-        m_cardInfo.busInfo = std::string(version->date, version->date_len);
-        drmFreeVersion(version);
+bool DrmDevice::atomicFlip(const DrmBuffer *buffer, bool useVSync, const DamageRegion *damage) {
+    DrmAtomicRequest req(*m_props);
+    // With plane assignment the full plane state is committed, so a plane
+    // that showed a layer before is restored or switched off
+    bool layered = (m_planeAssigner != nullptr) && (m_layers.empty() == false);
+    const std::vector<DrmLayer> &layers = layered ? m_layers : m_clientLayers;
+    bool added = (m_planeAssigner != nullptr) ? m_planeAssigner->addToRequest(req, layers, buffer->fbId)
+                                              : req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "FB_ID", buffer->fbId);
+    if (added == false) {
+        return false;
     }
-}
+    // Colour steps go with the frame they are due for
+    bool colorAdded = (m_colorPipeline != nullptr) && m_colorPipeline->addToRequest(req, getTimeUs());
 
-void DrmDevice::queryDeviceConnectors() {
-    queryDeviceInfo(QUERY_CONNCECTORS);
-}
+    // Layer mappings were validated by setLayers()
+    bool tested = layered;
+    for (uint32_t fbId : m_testedFbs) {
+        tested = tested || (fbId == buffer->fbId);
+    }
+    if (tested == false) {
+        int ret = req.commit(m_fd, DRM_MODE_ATOMIC_TEST_ONLY);
+        if (ret != 0) {
+            EARLY_ERROR("Framebuffer %u rejected by TEST_ONLY: %s\n", buffer->fbId, strerror(-ret));
+            return false;
+        }
+        // Imported camera buffers come and go, keep the list short
+        if (m_testedFbs.size() >= MAX_TESTED_FBS) {
+            m_testedFbs.erase(m_testedFbs.begin());
+        }
+        m_testedFbs.push_back(buffer->fbId);
+    }
 
-void DrmDevice::queryDeviceEncoders() {
-    queryDeviceInfo(QUERY_ENCODERS);
+    // Clips only apply to the commit they come with, a blob is made for
+    // partial updates of the primary plane alone
+    uint32_t damageBlobId = 0U;
+    if ((layered == false) && (damage != nullptr) && (damage->empty() == false) && (damage->isFull() == false)
+        && (m_props->id(m_planeId, DRM_MODE_OBJECT_PLANE, "FB_DAMAGE_CLIPS") != 0U)) {
+        // DamageRect has the layout of struct drm_mode_rect
+        if (drmModeCreatePropertyBlob(m_fd, damage->rects(), damage->count() * sizeof(DamageRect), &damageBlobId) != 0) {
+            EARLY_WARN("Failed to create FB_DAMAGE_CLIPS blob, full update: %s\n", strerror(errno));
+            damageBlobId = 0U;
+        } else {
+            req.add(m_planeId, DRM_MODE_OBJECT_PLANE, "FB_DAMAGE_CLIPS", damageBlobId);
+        }
+    }
+
+    // Not part of TEST_ONLY, which returns no out fence
+    bool captureAdded = (m_writeback != nullptr) && m_writeback->addToRequest(req);
+
+    // The event frees the buffer on screen, also for flips without vsync.
+    // Async commits may change FB_ID of the primary plane alone.
+    uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+    bool async = (useVSync == false) && (m_atomicAsyncFlip == true) && (m_planeAssigner == nullptr)
+                 && (colorAdded == false) && (damageBlobId == 0U) && (captureAdded == false);
+    int ret = req.commit(m_fd, flags | (async ? DRM_MODE_PAGE_FLIP_ASYNC : 0U), this);
+    if ((ret == -EINVAL) && (async == true)) {
+        // e.g. a format or modifier the driver does not flip asynchronously
+        ret = req.commit(m_fd, flags, this);
+    }
+    // The committed plane state holds its own reference to the blob
+    if (damageBlobId != 0U) {
+        drmModeDestroyPropertyBlob(m_fd, damageBlobId);
+    }
+    if (ret != 0) {
+        EARLY_ERROR("Atomic flip of framebuffer %u failed: %s\n", buffer->fbId, strerror(-ret));
+        if (layered == true) {
+            m_planeAssigner->invalidate();
+        }
+        if (captureAdded == true) {
+            m_writeback->commitFailed();
+        }
+        return false;
+    }
+    if (captureAdded == true) {
+        DrmCapture capture = {};
+        m_writeback->commitDone(capture);
+        m_captures.push_back(capture);
+    }
+    if (m_planeAssigner != nullptr) {
+        m_planeAssigner->commitDone(layers);
+    }
+    if (colorAdded == true) {
+        m_colorPipeline->commitDone();
+    }
+    placedBuffers(layered ? m_layers : std::vector<DrmLayer>{}, m_pendingLayerBuffers);
+    return true;
 }
 
-void DrmDevice::queryCrtcs() {
-    queryDeviceInfo(QUERY_CRTCS);
+size_t DrmDevice::setLayers(std::vector<DrmLayer> &layers) {
+    for (auto &layer : layers) {
+        layer.planeId = 0U;
+    }
+
+    DrmLayer *client = nullptr;
+    for (auto &layer : layers) {
+        client = (layer.buffer == nullptr) ? &layer : client;
+    }
+    size_t placed = 0U;
+    {
+        std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+        std::vector<const DrmBuffer *> staged{};
+        placedBuffers(m_layers, staged);
+        m_layers.clear();
+
+        if ((m_initialized == true) && (m_planeAssigner != nullptr)) {
+            int shown = (m_flipEventObj.scanout >= 0) ? m_flipEventObj.scanout : 0;
+            placed = m_planeAssigner->assign(layers, m_buffers[shown]->fbId);
+            if ((client != nullptr) && (client->planeId == 0U)) {
+                // Nothing passed: plain GPU composition, other planes are switched off
+                client->planeId = m_planeId;
+            }
+            // Without a composition layer only a full offload can be shown
+            if ((client != nullptr) || (placed > 0U)) {
+                m_layers = layers;
+            }
+        }
+
+        // Staged buffers replaced before any commit showed them
+        std::vector<const DrmBuffer *> current{};
+        placedBuffers(m_layers, current);
+        for (const DrmBuffer *buffer : staged) {
+            if ((containsBuffer(current, buffer) == false) && (containsBuffer(m_pendingLayerBuffers, buffer) == false)
+                && (containsBuffer(m_shownLayerBuffers, buffer) == false)) {
+                m_releasedLayerBuffers.push_back(buffer);
+            }
+        }
+    }
+    releaseLayerBuffers();
+    return placed;
 }
 
-void DrmDevice::queryPlanes() {
-    drmModePlaneRes *planeRes = drmModeGetPlaneResources(m_fd);
-    if (planeRes == nullptr) {
-        return;
+bool DrmDevice::commitLayers(bool useVSync) {
+    bool success = false;
+    do {
+        if ((m_initialized == false) || (m_planeAssigner == nullptr)) {
+            break;
+        }
+
+        // One flip in flight at a time, as for foreign buffers
+        waitFlipEvent();
+        std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+        if (m_layers.empty() == true) {
+            EARLY_ERROR("No layers to commit\n");
+            break;
+        }
+
+        const DrmBuffer *first = nullptr;
+        bool client = false;
+        for (const DrmLayer &layer : m_layers) {
+            client = client || (layer.buffer == nullptr);
+            first = ((first == nullptr) && (layer.planeId != 0U)) ? layer.buffer : first;
+        }
+        if (client == true) {
+            // The composition layer keeps showing the swapchain buffer on screen
+            int index = m_flipEventObj.scanout;
+            if (index < 0) {
+                EARLY_ERROR("No swapchain buffer on screen for the composition layer, queue one first\n");
+            } else {
+                success = submitLocked(m_buffers[index], index, useVSync, nullptr);
+                if (success == false) {
+                    m_flipEventObj.states[index] = BufferState::SCANOUT;
+                }
+            }
+        } else if (first != nullptr) {
+            // Full offload, the swapchain buffer leaves the screen with this flip
+            success = submitLocked(first, -1, useVSync, nullptr);
+        }
+
+        if (success == false) {
+            std::vector<const DrmBuffer *> staged{};
+            placedBuffers(m_layers, staged);
+            for (const DrmBuffer *buffer : staged) {
+                if ((containsBuffer(m_pendingLayerBuffers, buffer) == false)
+                    && (containsBuffer(m_shownLayerBuffers, buffer) == false)) {
+                    m_releasedLayerBuffers.push_back(buffer);
+                }
+            }
+            m_layers.clear();
+        }
+    } while (false);
+    releaseLayerBuffers();
+    return success;
+}
+
+bool DrmDevice::supportsColorState(const ColorState &state) {
+    std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+    return (m_colorPipeline != nullptr) && m_colorPipeline->supports(state);
+}
+
+bool DrmDevice::setColorState(const ColorState &state, uint32_t transitionMs) {
+    std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+    if ((m_colorPipeline == nullptr) || (m_colorPipeline->setState(state, static_cast<uint64_t>(transitionMs) * 1000U, getTimeUs()) == false)) {
+        EARLY_WARN("Colour state not supported by CRTC %u\n", m_crtcId);
+        return false;
     }
+    return true;
+}
 
-    for (uint32_t i = 0; i < planeRes->count_planes; ++i) {
-        drmModePlane *plane = drmModeGetPlane(m_fd, planeRes->planes[i]);
-        if (plane == nullptr) {
+bool DrmDevice::startCapture(CaptureCallback callback, uint32_t frames, uint32_t bufferCount) {
+    bool success = false;
+    do {
+        if ((m_initialized == false) || (m_atomic == false) || (m_planeId == 0U)) {
+            EARLY_ERROR("Writeback needs an initialized display on the atomic path\n");
+            break;
+        }
+        if ((m_writeback != nullptr) && (m_writeback->connectorId() != 0U)) {
+            // The buffers were allocated by the first call
+            if (m_writeback->bufferCount() != bufferCount) {
+                EARLY_ERROR("Writeback runs with %u buffers, not %u; stop and deInitDisplay() first\n",
+                            m_writeback->bufferCount(),
+                            bufferCount);
+                break;
+            }
+        } else {
+            // Writeback connectors are hidden from clients without the cap
+            if (drmSetClientCap(m_fd, DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1) != 0) {
+                EARLY_ERROR("Driver has no writeback connectors: %s\n", strerror(errno));
+                break;
+            }
+            waitFlipEvent();
+            std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+            // Kept by deInitDisplay() for the captures still held
+            if (m_writeback == nullptr) {
+                m_writeback = std::make_unique<DrmWriteback>(m_fd, *m_props, *m_bufferPool);
+            }
+            if ((m_writeback->init(m_crtcId, m_crtcIndex, m_width, m_height, m_format, m_allocatorType, bufferCount) == false)
+                || (m_writeback->attach() == false)) {
+                m_writeback->reset();
+                if (m_writeback->held() == 0U) {
+                    m_writeback.reset();
+                }
+                break;
+            }
+        }
+        std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+        m_captureCallback = std::move(callback);
+        m_writeback->setFrames(frames);
+        success = true;
+    } while (false);
+    return success;
+}
+
+void DrmDevice::stopCapture() {
+    std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+    // The connector stays routed, a restart needs no modeset
+    if (m_writeback != nullptr) {
+        m_writeback->setFrames(0U);
+    }
+}
+
+bool DrmDevice::releaseCapture(const DrmBuffer *buffer) {
+    std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+    bool released = (m_writeback != nullptr) && m_writeback->release(buffer);
+    // The last capture held past deInitDisplay()
+    if ((released == true) && (m_writeback->connectorId() == 0U) && (m_writeback->held() == 0U)) {
+        m_writeback.reset();
+    }
+    return released;
+}
+
+void DrmDevice::setLayerReleaseCallback(LayerReleaseCallback callback) {
+    std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+    m_layerRelease = std::move(callback);
+}
+
+void DrmDevice::placedBuffers(const std::vector<DrmLayer> &layers, std::vector<const DrmBuffer *> &buffers) {
+    buffers.clear();
+    for (const DrmLayer &layer : layers) {
+        if ((layer.buffer != nullptr) && (layer.planeId != 0U)) {
+            buffers.push_back(layer.buffer);
+        }
+    }
+}
+
+bool DrmDevice::containsBuffer(const std::vector<const DrmBuffer *> &buffers, const DrmBuffer *buffer) {
+    return std::find(buffers.begin(), buffers.end(), buffer) != buffers.end();
+}
+
+void DrmDevice::releaseLayerBuffers() {
+    std::vector<const DrmBuffer *> released{};
+    LayerReleaseCallback callback{};
+    std::vector<DrmCapture> captures{};
+    CaptureCallback captureCallback{};
+    {
+        std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+        released.swap(m_releasedLayerBuffers);
+        callback = m_layerRelease;
+        // Captures of the last commits go out with the layer buffers
+        captures.swap(m_captures);
+        captureCallback = m_captureCallback;
+    }
+    if (callback) {
+        for (const DrmBuffer *buffer : released) {
+            callback(buffer);
+        }
+    }
+    deliverCaptures(captures, captureCallback);
+}
+
+void DrmDevice::deliverCaptures(const std::vector<DrmCapture> &captures, const CaptureCallback &captureCallback) {
+    for (const DrmCapture &capture : captures) {
+        if (captureCallback) {
+            captureCallback(capture);
             continue;
         }
+        if (capture.fence >= 0) {
+            ::close(capture.fence);
+        }
+        releaseCapture(capture.buffer);
+    }
+}
 
-        DrmPlaneInfo info;
-        info.id = plane->plane_id;
-        info.crtcId = plane->crtc_id;
-        info.possibleCrtcs = plane->possible_crtcs;
-        for (uint32_t j = 0; j < plane->count_formats; ++j) {
-            info.formats.push_back(plane->formats[j]);
+int DrmDevice::indexOf(const DrmBuffer *buffer) const {
+    for (int i = 0; i < m_bufferCount; ++i) {
+        if ((buffer != nullptr) && (m_buffers[i] == buffer)) {
+            return i;
         }
-        m_planes[plane->plane_id] = info;
-        drmModeFreePlane(plane);
     }
+    return -1;
+}
 
-    drmModeFreePlaneResources(planeRes);
+void DrmDevice::dirtyFramebuffer(const DrmBuffer *buffer, const DamageRegion &damage) {
+    if ((m_dirtyFbSupported == false) || (damage.empty() == true) || (damage.isFull() == true)) {
+        return;
+    }
+    // drmModeClip is 16 bit, unlike the atomic clips
+    drmModeClip clips[DamageRegion::MAX_RECTS] = {};
+    const DamageRect *rects = damage.rects();
+    uint32_t count = static_cast<uint32_t>(damage.count());
+    for (uint32_t i = 0U; i < count; i++) {
+        clips[i].x1 = static_cast<unsigned short>(rects[i].x1);
+        clips[i].y1 = static_cast<unsigned short>(rects[i].y1);
+        clips[i].x2 = static_cast<unsigned short>(rects[i].x2);
+        clips[i].y2 = static_cast<unsigned short>(rects[i].y2);
+    }
+    int ret = drmModeDirtyFB(m_fd, buffer->fbId, clips, count);
+    if ((ret == -ENOSYS) || (ret == -EOPNOTSUPP)) {
+        // Scanout reads memory directly, nothing to flush
+        EARLY_DEBUG("Driver has no DIRTYFB, damage is not sent\n");
+        m_dirtyFbSupported = false;
+    } else if (ret != 0) {
+        EARLY_WARN("drmModeDirtyFB of framebuffer %u failed: %s\n", buffer->fbId, strerror(-ret));
+    }
 }
 
-void DrmDevice::queryAllDeviceInfo() {
-    queryDeviceName();
-    drmModeRes *resources = drmModeGetResources(m_fd);
-    if (resources == nullptr) {
-        EARLY_ERROR("Failed to get DRM resources: %s\n", strerror(errno));
+bool DrmDevice::submitLocked(const DrmBuffer *buffer, int index, bool useVSync, const DamageRegion *damage) {
+    bool success = false;
+    bool immediate = false;
+    if ((m_atomic == true) && (m_planeId != 0U)) {
+        success = atomicFlip(buffer, useVSync, damage);
+    } else {
+        // Drivers with a manual update display (e.g. SPI panels, USB) then
+        // transfer only the dirty rects of the new framebuffer
+        if (damage != nullptr) {
+            dirtyFramebuffer(buffer, *damage);
+        }
+        // The event frees the buffer on screen, also for flips without vsync
+        bool async = (useVSync == false) && (m_asyncFlip == true);
+        uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT | (async ? DRM_MODE_PAGE_FLIP_ASYNC : 0U);
+        success = (drmModePageFlip(m_fd, m_crtcId, buffer->fbId, flags, this) == 0);
+        if ((success == false) && (errno == EINVAL) && (async == true)) {
+            success = (drmModePageFlip(m_fd, m_crtcId, buffer->fbId, DRM_MODE_PAGE_FLIP_EVENT, this) == 0);
+        }
+        if ((success == false) && (m_handoffFbId != 0U) && (m_flipEventObj.flips == 0U)) {
+            // The adopted CRTC cannot flip from the splash (e.g. another
+            // format), fall back to the modeset the handoff saved
+            EARLY_WARN("Flip from the splash framebuffer failed, modeset instead: %s\n", strerror(errno));
+            success = setModeCrtc(buffer);
+            immediate = success;
+        }
+        if (success == false) {
+            EARLY_ERROR("Failed to flip buffer %u on CRTC %u: %s\n", buffer->fbId, m_crtcId, strerror(errno));
+        }
+    }
+
+    if (success == false) {
+        if (index >= 0) {
+            m_flipEventObj.states[index] = BufferState::FREE;
+        }
+        return false;
+    }
+    if (index >= 0) {
+        m_flipEventObj.states[index] = BufferState::PENDING;
+    }
+    m_flipEventObj.pending = index;
+    m_flipEventObj.flags = 1;
+    if (immediate == true) {
+        // The modeset returned with the buffer on screen, no event will come
+        completeFlipLocked();
+    }
+    return true;
+}
+
+void DrmDevice::completeFlipLocked() {
+    FlipEventObj &obj = m_flipEventObj;
+    // Layer buffers the landed flip replaced are no longer read
+    for (const DrmBuffer *buffer : m_shownLayerBuffers) {
+        if (containsBuffer(m_pendingLayerBuffers, buffer) == false) {
+            m_releasedLayerBuffers.push_back(buffer);
+        }
+    }
+    m_shownLayerBuffers.swap(m_pendingLayerBuffers);
+    m_pendingLayerBuffers.clear();
+    if ((obj.scanout >= 0) && (obj.scanout != obj.pending)) {
+        obj.states[obj.scanout] = BufferState::FREE;
+    }
+    obj.scanout = obj.pending;
+    if (obj.scanout >= 0) {
+        obj.states[obj.scanout] = BufferState::SCANOUT;
+    }
+    obj.pending = -1;
+    obj.flags = 0;
+    obj.flips++;
+
+    // The next queued frame goes out right away so it makes the next vblank.
+    // A frame that fails is dropped (submitLocked() frees it) and the one
+    // after it goes instead, else no event would ever drain the queue.
+    while (obj.queued > 0) {
+        int index = obj.queue[0];
+        obj.queued--;
+        for (int i = 0; i < obj.queued; ++i) {
+            obj.queue[i] = obj.queue[i + 1];
+        }
+        if (submitLocked(m_buffers[index], index, obj.vsync[index], &obj.damage[index]) == true) {
+            break;
+        }
+    }
+    obj.cv.notify_all();
+}
+
+bool DrmDevice::setBufferCount(int count) {
+    if (m_initialized == true) {
+        EARLY_ERROR("Buffer count can only be changed before initDisplay()\n");
+        return false;
+    }
+    m_bufferCount = std::min(std::max(count, MIN_BUFFER_COUNT), MAX_BUFFER_COUNT);
+    if (m_bufferCount != count) {
+        EARLY_WARN("Buffer count %d clamped to %d\n", count, m_bufferCount);
+    }
+    return true;
+}
+
+DrmDevice::BufferState DrmDevice::bufferState(int index) {
+    std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+    return ((index >= 0) && (index < m_bufferCount)) ? m_flipEventObj.states[index] : BufferState::FREE;
+}
+
+int DrmDevice::dispatchEvents(int timeoutMs) {
+    return (m_eventLoop != nullptr) ? m_eventLoop->dispatch(timeoutMs) : -EBADF;
+}
+
+bool DrmDevice::waitSwapchain(const std::function<bool()> &ready, int timeoutMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (true) {
+        int remaining = -1;
+        {
+            std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+            if (ready() == true) {
+                return true;
+            }
+            if ((m_flipEventObj.flags <= 0) && (m_flipEventObj.queued == 0)) {
+                // Nothing in flight, no event can change the state
+                return false;
+            }
+            if (timeoutMs >= 0) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                if (left.count() <= 0) {
+                    return false;
+                }
+                remaining = static_cast<int>(left.count());
+            }
+
+            if ((m_eventLoop == nullptr) || (m_eventLoop->isRunning() == true)) {
+                // The event thread reads the events, its flip listener notifies us
+                if (timeoutMs < 0) {
+                    m_flipEventObj.cv.wait(lock, ready);
+                    return true;
+                }
+                return m_flipEventObj.cv.wait_until(lock, deadline, ready);
+            }
+        }
+
+        int ret = m_eventLoop->tryDispatch(remaining);
+        if (ret == -EBUSY) {
+            // Another caller is reading the fd, it may stop before our event comes
+            std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+            m_flipEventObj.cv.wait_for(lock, std::chrono::milliseconds(DISPATCH_RETRY_MS), ready);
+        } else if (ret < 0) {
+            return false;
+        }
+    }
+}
+
+int DrmDevice::acquireBuffer(int timeoutMs) {
+    if (m_initialized == false) {
+        return -1;
+    }
+
+    int index = -1;
+    auto findFree = [this, &index]() {
+        for (int n = 1; n <= m_bufferCount; ++n) {
+            int i = (m_lastAcquired + n) % m_bufferCount;
+            if (m_flipEventObj.states[i] == BufferState::FREE) {
+                index = i;
+                return true;
+            }
+        }
+        return false;
+    };
+    if (waitSwapchain(findFree, timeoutMs) == false) {
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+    if (m_flipEventObj.states[index] != BufferState::FREE) {
+        // Raced with another acquirer, try again
+        lock.unlock();
+        return acquireBuffer(timeoutMs);
+    }
+    m_flipEventObj.states[index] = BufferState::ACQUIRED;
+    m_lastAcquired = index;
+    return index;
+}
+
+bool DrmDevice::queueBuffer(int index, bool useVSync, const DamageRegion *damage) {
+    if ((m_initialized == false) || (buffer(index) == nullptr) || (m_buffers[index]->fbId == 0U)) {
+        return false;
+    }
+
+    // Without the event thread, pick up a flip that already landed so the
+    // frame does not wait in the queue
+    if ((m_flipEventObj.flags > 0) && (m_eventLoop->isRunning() == false)) {
+        m_eventLoop->tryDispatch(0);
+    }
+
+    std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+    FlipEventObj &obj = m_flipEventObj;
+    if ((obj.states[index] != BufferState::FREE) && (obj.states[index] != BufferState::ACQUIRED)) {
+        EARLY_ERROR("Buffer %d is already queued or on screen\n", index);
+        return false;
+    }
+    obj.vsync[index] = useVSync;
+    if ((obj.flags > 0) || (obj.queued > 0)) {
+        obj.states[index] = BufferState::QUEUED;
+        obj.queue[obj.queued++] = index;
+        // The rects are against the frame before it, which is still to come
+        obj.damage[index].clear();
+        if (damage != nullptr) {
+            obj.damage[index].add(*damage);
+        }
+        return true;
+    }
+    bool success = submitLocked(m_buffers[index], index, useVSync, damage);
+    lock.unlock();
+    releaseLayerBuffers();
+    return success;
+}
+
+bool DrmDevice::commitBuffer(const DrmBuffer *buffer, bool useVSync, const DamageRegion *damage) {
+    bool success = false;
+    do {
+        if ((m_initialized == false) || (buffer == nullptr) || (buffer->fbId == 0U)) {
+            break;
+        }
+
+        int index = indexOf(buffer);
+        if (index >= 0) {
+            success = queueBuffer(index, useVSync, damage);
+            break;
+        }
+
+        // Not ours: one flip in flight at a time, wait for the swapchain to drain
+        waitFlipEvent();
+        std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+        success = submitLocked(buffer, -1, useVSync, damage);
+        lock.unlock();
+        releaseLayerBuffers();
+    } while (false);
+    return success;
+}
+
+bool DrmDevice::flipBuffer(bool useVSync) {
+    bool success = false;
+    int index = m_flipEventObj.idx;
+    do {
+        if ((m_initialized == false) || (buffer(index) == nullptr)) {
+            break;
+        }
+        std::unique_lock<std::mutex> lock(m_flipEventObj.mtx);
+        FlipEventObj &obj = m_flipEventObj;
+        if ((obj.states[index] == BufferState::SCANOUT) && (obj.flags <= 0) && (obj.queued == 0)) {
+            // Flipping to the buffer on screen, as the 2 buffer flip always
+            // could; the flip lands on the same buffer
+            success = submitLocked(m_buffers[index], index, useVSync, nullptr);
+            lock.unlock();
+            releaseLayerBuffers();
+        } else {
+            lock.unlock();
+            success = queueBuffer(index, useVSync);
+        }
+        if (success == false) {
+            break;
+        }
+        m_flipEventObj.idx = (index + 1) % m_bufferCount;
+    } while (false);
+
+    return success;
+}
+
+void DrmDevice::onFlipEvent(const DrmEventLoop::Event &event) {
+    if (event.userData != this) {
         return;
     }
+
+    FlipEventObj &flipEventObj = m_flipEventObj;
+    {
+        std::unique_lock<std::mutex> lock(flipEventObj.mtx);
+
+        // Calculate FPS
+        if (flipEventObj.lastFlipTimeUs != 0) {
+            uint64_t deltaUs = event.timeUs - flipEventObj.lastFlipTimeUs;
+            if (deltaUs > 0) {
+                float fps = 1.0e6f / deltaUs;
+                // EARLY_DEBUG("Estimated FPS: %.2f\n", fps);
+                flipEventObj.fps = fps;
+            }
+        }
+        if ((flipEventObj.lastSequence != 0U) && (event.sequence - flipEventObj.lastSequence > 1U)) {
+            flipEventObj.missedVblanks += event.sequence - flipEventObj.lastSequence - 1U;
+        }
+
+        // Update flip tracking, the draw index is owned by flipBuffer()
+        flipEventObj.lastFlipTimeUs = event.timeUs;
+        flipEventObj.lastSequence = event.sequence;
+        completeFlipLocked();
+    }
+    releaseLayerBuffers();
+}
+
+void DrmDevice::waitFlipEvent() {
+    waitSwapchain([this]() { return (m_flipEventObj.flags <= 0) && (m_flipEventObj.queued == 0); }, -1);
+}
+
+int DrmDevice::requestVblank(DrmEventLoop::Callback callback) {
+    if ((m_initialized == false) || (m_crtcIndex < 0)) {
+        return -EINVAL;
+    }
+    return m_eventLoop->requestVblank(m_crtcIndex, std::move(callback));
+}
+
+void DrmDevice::queryDeviceName() {
+    drmVersion *version = drmGetVersion(m_fd);
+    m_cardInfo = {};
+    if (version) {
+        m_cardInfo.driverName = std::string(version->name, version->name_len);
+        m_cardInfo.cardName = std::string(version->desc, version->desc_len);
+        m_cardInfo.busInfo = std::string(version->date, version->date_len);
+        drmFreeVersion(version);
+    }
+    m_cardInfo.deviceId = deviceIdentity(m_fd);
+}
+
+void DrmDevice::queryDeviceConnectors() {
+    queryDeviceInfo(QUERY_CONNCECTORS);
+}
+
+void DrmDevice::queryDeviceEncoders() {
+    queryDeviceInfo(QUERY_ENCODERS);
+}
+
+void DrmDevice::queryCrtcs() {
+    queryDeviceInfo(QUERY_CRTCS);
+}
+
+void DrmDevice::queryPlanes() {
+    queryDeviceInfo(QUERY_PLANES);
+}
+
+void DrmDevice::queryAllDeviceInfo() {
     queryDeviceInfo(QUERY_ALL);
-    drmModeFreeResources(resources);
 }
 
 void DrmDevice::resetDeviceInfo() {
@@ -437,107 +1645,285 @@ void DrmDevice::resetDeviceInfo() {
     m_crtcs.clear();
     m_planes.clear();
     m_cardInfo = {};
+    std::atomic_store(&m_snapshot, DrmSnapshotPtr{});
 }
 
 void DrmDevice::queryDeviceInfo(uint32_t flags) {
-
-    drmModeRes *resources = drmModeGetResources(m_fd);
-    if (resources == nullptr) {
+    DrmSnapshotPtr snapshot = captureSnapshot();
+    if (snapshot == nullptr) {
         return;
     }
-    if (flags & QUERY_CONNCECTORS) {
-        getConnectedConnectors(resources);
+    std::atomic_store(&m_snapshot, snapshot);
+    applySnapshot(*snapshot, flags);
+}
+
+bool DrmDevice::refreshConnector(uint32_t connectorId) {
+    DrmSnapshotPtr current = snapshot();
+    if (current == nullptr) {
+        queryAllDeviceInfo();
+        return (snapshot() != nullptr);
     }
-    if (flags & QUERY_ENCODERS) {
-        queryDeviceEncoders(resources);
+
+    uint32_t calls = 0U;
+    uint64_t propIoctls = (m_props != nullptr) ? m_props->ioctls() : 0U;
+    std::vector<uint32_t> ids{};
+    if (connectorId != 0U) {
+        ids.push_back(connectorId);
+    } else {
+        // Every connector, including those added since (e.g. DP MST)
+        drmModeRes *res = drmModeGetResources(m_fd);
+        calls++;
+        if (res == nullptr) {
+            EARLY_ERROR("Failed to get DRM resources: %s\n", strerror(errno));
+            return false;
+        }
+        ids.assign(res->connectors, res->connectors + res->count_connectors);
+        drmModeFreeResources(res);
     }
-    if (flags & QUERY_CRTCS) {
-        queryCrtcs(resources);
+
+    std::vector<DrmConnectorInfo> probed{};
+    std::vector<uint32_t> removed{};
+    for (uint32_t id : ids) {
+        // A hotplug changed what is behind the connector, probe it
+        drmModeConnector *conn = drmModeGetConnector(m_fd, id);
+        calls++;
+        if ((conn == nullptr) || (conn->connector_type == DRM_MODE_CONNECTOR_WRITEBACK)) {
+            drmModeFreeConnector(conn);
+            removed.push_back(id);
+            continue;
+        }
+
+        DrmConnectorInfo info{};
+        fillConnectorInfo(conn, info);
+        if (conn->encoder_id != 0U) {
+            drmModeEncoder *enc = drmModeGetEncoder(m_fd, conn->encoder_id);
+            calls++;
+            if (enc != nullptr) {
+                info.encoder.id = enc->encoder_id;
+                info.encoder.possibleCrtcs = enc->possible_crtcs;
+                info.encoder.crtc.id = enc->crtc_id;
+                drmModeFreeEncoder(enc);
+            }
+        }
+        probed.push_back(info);
+        drmModeFreeConnector(conn);
     }
-    if (flags & QUERY_PLANES) {
-        queryPlanes();
+    if (m_props != nullptr) {
+        calls += static_cast<uint32_t>(m_props->ioctls() - propIoctls);
     }
-    drmModeFreeResources(resources);
+
+    DrmSnapshotPtr next = current->updated(probed, removed, calls);
+    if ((m_snapshotCache.empty() == false) && (next->save(m_snapshotCache) == false)) {
+        EARLY_WARN("Failed to write the connector cache %s\n", m_snapshotCache.c_str());
+    }
+    std::atomic_store(&m_snapshot, next);
+    applySnapshot(*next, QUERY_CONNCECTORS | QUERY_ENCODERS);
+    return true;
 }
 
-void DrmDevice::queryDeviceEncoders(void *res) {
-    drmModeRes *resources = static_cast<drmModeRes *>(res);
+DrmSnapshotPtr DrmDevice::captureSnapshot() {
+    auto snapshot = std::make_shared<DrmResourceSnapshot>();
+    uint32_t &calls = snapshot->m_calls;
+    // Property lookups (connector VRR, plane IN_FORMATS) count what they issue
+    uint64_t propIoctls = (m_props != nullptr) ? m_props->ioctls() : 0U;
 
-    m_encoders.clear();
-    for (int i = 0; i < resources->count_encoders; ++i) {
-        drmModeEncoder *enc = drmModeGetEncoder(m_fd, resources->encoders[i]);
-        if (enc == nullptr) {
+    drmVersion *version = drmGetVersion(m_fd);
+    calls++;
+    if (version != nullptr) {
+        snapshot->m_card.driverName = std::string(version->name, version->name_len);
+        snapshot->m_card.cardName = std::string(version->desc, version->desc_len);
+        snapshot->m_card.busInfo = std::string(version->date, version->date_len);
+        drmFreeVersion(version);
+    }
+    snapshot->m_card.deviceId = deviceIdentity(m_fd);
+
+    drmModeRes *res = drmModeGetResources(m_fd);
+    calls++;
+    if (res == nullptr) {
+        EARLY_ERROR("Failed to get DRM resources: %s\n", strerror(errno));
+        return nullptr;
+    }
+
+    // Every object once: CRTCs first, encoders and connectors refer to them
+    for (int i = 0; i < res->count_crtcs; ++i) {
+        drmModeCrtc *drmCrtc = drmModeGetCrtc(m_fd, res->crtcs[i]);
+        calls++;
+        if (drmCrtc == nullptr) {
             continue;
         }
+        DrmCrtcInfo crtc{};
+        crtc.id = drmCrtc->crtc_id;
+        crtc.bufferId = drmCrtc->buffer_id;
+        crtc.x = drmCrtc->x;
+        crtc.y = drmCrtc->y;
+        crtc.width = drmCrtc->width;
+        crtc.height = drmCrtc->height;
+        crtc.enabled = (drmCrtc->mode_valid != 0);
+        snapshot->m_crtcs[crtc.id] = crtc;
+        drmModeFreeCrtc(drmCrtc);
+    }
 
-        DrmEncoderInfo encoder;
-        encoder.id = enc->encoder_id;
-        drmModeCrtc *crtc = drmModeGetCrtc(m_fd, enc->crtc_id);
-        if (crtc != nullptr) {
-            encoder.crtc.width = crtc->width;
-            encoder.crtc.height = crtc->height;
-            encoder.crtc.x = crtc->x;
-            encoder.crtc.y = crtc->y;
-            encoder.crtc.enabled = (crtc->mode_valid != 0);
-            encoder.crtc.bufferId = crtc->buffer_id;
-            drmModeFreeCrtc(crtc);
+    for (int i = 0; i < res->count_encoders; ++i) {
+        drmModeEncoder *enc = drmModeGetEncoder(m_fd, res->encoders[i]);
+        calls++;
+        if (enc == nullptr) {
+            continue;
         }
+        DrmEncoderInfo encoder{};
+        encoder.id = enc->encoder_id;
         encoder.possibleCrtcs = enc->possible_crtcs;
-        m_encoders[enc->encoder_id] = encoder;
+        auto crtc = snapshot->m_crtcs.find(enc->crtc_id);
+        if (crtc != snapshot->m_crtcs.end()) {
+            encoder.crtc = crtc->second;
+        }
+        snapshot->m_encoders[encoder.id] = encoder;
         drmModeFreeEncoder(enc);
     }
-}
 
-void DrmDevice::queryCrtcs(void *res) {
-    drmModeRes *resources = static_cast<drmModeRes *>(res);
-    m_crtcs.clear();
-    for (int i = 0; i < resources->count_crtcs; ++i) {
-        DrmCrtcInfo crtc{};
-        drmModeCrtc *drmCrtc = drmModeGetCrtc(m_fd, resources->crtcs[i]);
-        if (drmCrtc != nullptr) {
-            crtc.id = drmCrtc->crtc_id;
-            crtc.bufferId = drmCrtc->buffer_id;
-            crtc.x = drmCrtc->x;
-            crtc.y = drmCrtc->y;
-            crtc.width = drmCrtc->width;
-            crtc.height = drmCrtc->height;
-            crtc.enabled = (drmCrtc->mode_valid != 0);
-            m_crtcs[drmCrtc->crtc_id] = crtc;
-            drmModeFreeCrtc(drmCrtc);
-        }
+    std::unordered_map<uint32_t, DrmConnectorInfo> cached{};
+    if ((m_probe == DrmProbe::CURRENT) && (m_snapshotCache.empty() == false)) {
+        DrmResourceSnapshot::load(m_snapshotCache, snapshot->m_card, cached);
     }
-}
-
-void DrmDevice::getConnectedConnectors(void *resources) {
-    drmModeRes *res = static_cast<drmModeRes *>(resources);
     for (int i = 0; i < res->count_connectors; ++i) {
-        drmModeConnector *connector = drmModeGetConnector(m_fd, res->connectors[i]);
-        if (connector == nullptr) {
+        bool force = (m_probe == DrmProbe::FORCE);
+        drmModeConnector *conn = force ? drmModeGetConnector(m_fd, res->connectors[i])
+                                       : drmModeGetConnectorCurrent(m_fd, res->connectors[i]);
+        calls++;
+        if (conn == nullptr) {
             continue;
         }
+        // Listed once startCapture() set the client cap, but no display
+        if (conn->connector_type == DRM_MODE_CONNECTOR_WRITEBACK) {
+            drmModeFreeConnector(conn);
+            continue;
+        }
+
+        DrmConnectorInfo info{};
+        if ((force == false) && (conn->count_modes == 0) && (conn->connection != DRM_MODE_DISCONNECTED)) {
+            // Not probed by the kernel yet: last boot's state, else probe it
+            auto hit = cached.find(conn->connector_id);
+            if ((hit != cached.end()) && (hit->second.type == static_cast<ConnectorType>(conn->connector_type))
+                && (hit->second.typeId == conn->connector_type_id)) {
+                info = hit->second;
+                snapshot->m_cached++;
+            } else {
+                drmModeFreeConnector(conn);
+                conn = drmModeGetConnector(m_fd, res->connectors[i]);
+                calls++;
+                force = true;
+                if (conn == nullptr) {
+                    continue;
+                }
+            }
+        }
+        if (force == true) {
+            snapshot->m_probed++;
+        }
+        if (info.id == 0U) {
+            fillConnectorInfo(conn, info);
+        }
+        auto encoder = snapshot->m_encoders.find(conn->encoder_id);
+        if (encoder != snapshot->m_encoders.end()) {
+            info.encoder = encoder->second;
+        }
 
-        EARLY_DEBUG("Connector %d: type=%s, status=%d, encoder_id=%d\n",
-                    connector->connector_id,
-                    connectorTypeToString(connector->connector_type).c_str(),
-                    connector->connection,
-                    connector->encoder_id);
+        EARLY_DEBUG("Connector %u: type=%s, connected=%d, modes=%zu, encoder_id=%u\n",
+                    info.id,
+                    info.name.c_str(),
+                    info.connected ? 1 : 0,
+                    info.modes.size(),
+                    conn->encoder_id);
+        snapshot->m_connectors[info.id] = info;
+        drmModeFreeConnector(conn);
+    }
+    drmModeFreeResources(res);
 
-        if (connector->connection == DRM_MODE_CONNECTED) {
-            DrmConnectorInfo connectorInfo{};
-            getConnectorInfo(connector, connectorInfo);
-            m_connectors[connector->connector_id] = connectorInfo;
+    drmModePlaneRes *planeRes = drmModeGetPlaneResources(m_fd);
+    calls++;
+    if (planeRes != nullptr) {
+        for (uint32_t i = 0; i < planeRes->count_planes; ++i) {
+            drmModePlane *plane = drmModeGetPlane(m_fd, planeRes->planes[i]);
+            calls++;
+            if (plane == nullptr) {
+                continue;
+            }
+            DrmPlaneInfo info{};
+            info.id = plane->plane_id;
+            info.crtcId = plane->crtc_id;
+            info.possibleCrtcs = plane->possible_crtcs;
+            info.formats.assign(plane->formats, plane->formats + plane->count_formats);
+            // Plane properties stay in the property cache for the atomic commits
+            if (m_props != nullptr) {
+                m_props->formatModifiers(info.id, info.modifiers);
+            }
+            snapshot->m_planes[info.id] = info;
+            drmModeFreePlane(plane);
         }
-        drmModeFreeConnector(connector);
+        drmModeFreePlaneResources(planeRes);
+    }
+
+    if (m_props != nullptr) {
+        calls += static_cast<uint32_t>(m_props->ioctls() - propIoctls);
+    }
+
+    if ((snapshot->m_probed > 0U) && (m_snapshotCache.empty() == false) && (snapshot->save(m_snapshotCache) == false)) {
+        EARLY_WARN("Failed to write the connector cache %s\n", m_snapshotCache.c_str());
     }
+    EARLY_DEBUG("Resource snapshot: %u calls, %u connectors probed, %u from the cache\n",
+                snapshot->m_calls,
+                snapshot->m_probed,
+                snapshot->m_cached);
+    return snapshot;
 }
 
-void DrmDevice::getConnectorInfo(void *conn, DrmConnectorInfo &connectorInfo) {
-    drmModeConnector *connector = static_cast<drmModeConnector *>(conn);
+void DrmDevice::applySnapshot(const DrmResourceSnapshot &snapshot, uint32_t flags) {
+    m_cardInfo = snapshot.card();
+    if (flags & QUERY_CONNCECTORS) {
+        m_connectors.clear();
+        for (const auto &entry : snapshot.connectors()) {
+            if (entry.second.connected == true) {
+                m_connectors[entry.first] = entry.second;
+            }
+        }
+    }
+    if (flags & QUERY_ENCODERS) {
+        m_encoders = snapshot.encoders();
+    }
+    if (flags & QUERY_CRTCS) {
+        m_crtcs = snapshot.crtcs();
+    }
+    if (flags & QUERY_PLANES) {
+        m_planes = snapshot.planes();
+    }
+}
+
+void DrmDevice::fillConnectorInfo(const void *conn, DrmConnectorInfo &connectorInfo) {
+    const drmModeConnector *connector = static_cast<const drmModeConnector *>(conn);
     connectorInfo.id = connector->connector_id;
     connectorInfo.type = static_cast<ConnectorType>(connector->connector_type);
     connectorInfo.typeId = connector->connector_type_id;
     connectorInfo.name = connectorTypeToString(connector->connector_type);
-    connectorInfo.connected = true;
+    connectorInfo.connected = (connector->connection == DRM_MODE_CONNECTED);
+    connectorInfo.modes.clear();
+    for (int i = 0; i < connector->count_modes; ++i) {
+        DrmModeInfo mode = {};
+        toModeInfo(connector->modes[i], mode);
+        connectorInfo.modes.push_back(mode);
+    }
+
+    // The value comes with the connector, only unknown property names are
+    // queried (most property IDs are shared by all connectors)
+    connectorInfo.vrrCapable = false;
+    uint64_t vrrCapable = 0U;
+    if ((connectorInfo.connected == true) && (m_props != nullptr)
+        && (m_props->findValue(connector->props, connector->prop_values, static_cast<uint32_t>(connector->count_props), "vrr_capable", vrrCapable) == true)) {
+        connectorInfo.vrrCapable = (vrrCapable != 0U);
+    }
+}
+
+void DrmDevice::getConnectorInfo(void *conn, DrmConnectorInfo &connectorInfo) {
+    drmModeConnector *connector = static_cast<drmModeConnector *>(conn);
+    fillConnectorInfo(connector, connectorInfo);
 
     drmModeEncoder *encoder = drmModeGetEncoder(m_fd, connector->encoder_id);
     if (encoder != nullptr) {
@@ -2,84 +2,85 @@
 #define DRMDEVICE_H
 
 #include "DrmAllocator.h"
-
+#include "DrmImportCache.h"
+#include "DrmBufferPool.h"
+#include "DrmAtomic.h"
+#include "DrmEventLoop.h"
+#include "DrmPlaneAssigner.h"
+#include "DrmResourceSnapshot.h"
+#include "DrmColorPipeline.h"
+#include "DrmWriteback.h"
+#include "DamageRegion.h"
+
+#include <memory>
 #include <string>
 #include <vector>
 #include <cstdint>
 #include <unordered_map>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
 
 namespace evs {
 namespace early {
 namespace drm {
 
-typedef enum class __ConnectorType {
-    Unknown,
-    VGA,
-    HDMI,
-    DVI,
-    DisplayPort,
-    Composite,
-    SVIDEO,
-} ConnectorType;
-
+/**
+ * @brief What DrmDevice::selectMode() looks for in the modes of a connector.
+ */
 typedef struct {
-    uint32_t width;
+    uint32_t width;      // 0 for the native size
     uint32_t height;
-    uint32_t refreshRate;
-    std::string name;
-} DrmModeInfo;
-
-typedef struct {
-    uint32_t id;
-    uint32_t bufferId;
-    uint32_t x;
-    uint32_t y;
-    uint32_t width;
-    uint32_t height;
-    bool enabled;
-} DrmCrtcInfo;
-
-typedef struct {
-    uint32_t id;
-    DrmCrtcInfo crtc;
-    uint32_t possibleCrtcs;
-} DrmEncoderInfo;
-
-typedef struct {
-    uint32_t id;
-    ConnectorType type;
-    uint32_t typeId;
-    bool connected;
-    std::string name;
-    DrmEncoderInfo encoder;
-} DrmConnectorInfo;
-
-typedef struct {
-    uint32_t id;
-    uint32_t crtcId;
-    uint32_t possibleCrtcs;
-    std::vector<uint32_t> formats;
-} DrmPlaneInfo;
-
-typedef struct {
-    std::string driverName;
-    std::string cardName;
-    std::string busInfo;
-} DrmCardInfo;
+    uint32_t contentFps; // frame rate of the content, e.g. the camera, 0 if unknown
+} DrmModePolicy;
+
+/**
+ * @brief What initDisplay() does with a CRTC the bootloader left running.
+ */
+typedef enum class __DrmHandoff {
+    NONE,  // always modeset
+    REUSE, // keep the mode, the splash stays on screen until the first flip
+    COPY,  // as REUSE, the splash is also copied into every display buffer
+} DrmHandoff;
 
 class DrmDevice
 {
 public:
+    static constexpr int MIN_BUFFER_COUNT = 2;
+    static constexpr int MAX_BUFFER_COUNT = 4;
+
+    /**
+     * @brief State of a display buffer in the swapchain.
+     * FREE -> ACQUIRED (acquireBuffer) -> QUEUED (queueBuffer, waiting for
+     * the flip in flight) -> PENDING (committed) -> SCANOUT (flip completed)
+     * -> FREE (the next buffer reached the screen).
+     */
+    typedef enum class __BufferState {
+        FREE,
+        ACQUIRED,
+        QUEUED,
+        PENDING,
+        SCANOUT,
+    } BufferState;
+
     typedef struct {
         std::mutex mtx;
         std::condition_variable cv;
-        int flags{0};
+        int flags{0};                       // > 0 while a flip is in flight
         int fd{-1};
-        int idx{-1};
+        int idx{-1};                        // draw buffer of getDrawBuffer()/flipBuffer()
         uint64_t lastFlipTimeUs{0};
         float fps{0.0f};
+        BufferState states[MAX_BUFFER_COUNT]{};
+        bool vsync[MAX_BUFFER_COUNT]{};
+        DamageRegion damage[MAX_BUFFER_COUNT]{}; // of QUEUED buffers, empty for a full update
+        int queue[MAX_BUFFER_COUNT]{};      // QUEUED buffers, oldest first
+        int queued{0};
+        int pending{-1};                    // buffer of the flip in flight, -1 for a foreign buffer
+        int scanout{-1};                    // buffer on screen, -1 if unknown
+        unsigned int lastSequence{0};
+        uint64_t flips{0};                  // completed flips
+        uint64_t missedVblanks{0};          // vblanks that repeated the previous frame
     } FlipEventObj;
 
 public:
@@ -92,7 +93,8 @@ public:
         , m_encoders{}
         , m_crtcs{}
         , m_planes{}
-        , m_buffers{nullptr, nullptr}
+        , m_buffers{}
+        , m_bufferCount{MIN_BUFFER_COUNT}
         , m_crtcId{0}
         , m_connectorId{0}
         , m_modelPtr{nullptr}
@@ -108,6 +110,13 @@ public:
     bool open();
     void close();
 
+    /**
+     * @brief Light @p connectorId on @p crtcId in a mode of @p width x
+     *        @p height: the running one, else the best of the connector.
+     * Without a size (0x0), or when the connector has none of it, the running
+     * mode is kept, else the native one is used. The display buffers, width()
+     * and height() have the size of the mode.
+     */
     bool initDisplay(uint32_t connectorId,
                      uint32_t crtcId,
                      uint32_t width,
@@ -121,23 +130,255 @@ public:
                      uint32_t format = 0U,
                      uint32_t flags = 0U);
 
+    /**
+     * @brief Program @p mode, one of connectorInfo.modes, instead of the
+     *        mode the CRTC runs, e.g. one picked by selectMode().
+     */
+    bool initDisplay(const DrmConnectorInfo &connectorInfo,
+                     const DrmModeInfo &mode,
+                     uint32_t bpp = 32U,
+                     uint32_t format = 0U,
+                     uint32_t flags = 0U);
+
+    /**
+     * @brief Index of the best of @p modes for @p policy, -1 if none fits.
+     * Interlaced modes are never picked. Without a requested size the native
+     * size is used, that of the preferred mode. With a content frame rate,
+     * refresh rates that are a whole multiple of it win: every frame is shown
+     * for the same number of vblanks, so there is no repetition judder. When
+     * none is, refresh rates below the frame rate lose, they drop frames.
+     * Then the lowest refresh wins and the lowest pixel clock, e.g. reduced
+     * blanking timings, as both cut scanout bandwidth; the preferred mode
+     * only breaks ties.
+     */
+    static int selectMode(const std::vector<DrmModeInfo> &modes, const DrmModePolicy &policy);
+
+    /**
+     * @brief Let the panel refresh follow the flips on connectors reporting
+     *        "vrr_capable", used by the next atomic initDisplay(). On by
+     *        default.
+     */
+    inline void setVrrEnabled(bool enable) { m_vrrEnabled = enable; }
+    inline bool isVrrActive() const { return m_vrrActive; }
+
+    /**
+     * @brief Adopt an active CRTC in the next initDisplay() instead of a
+     *        modeset, when it already drives the connector in the mode and
+     *        size asked for. The first frame then takes a single page flip.
+     * Atomic drivers check the swapchain with a TEST_ONLY commit that may
+     * not modeset; legacy drivers modeset on the first flip if it fails.
+     */
+    inline void setHandoff(DrmHandoff handoff) { m_handoff = handoff; }
+
+    /**
+     * @brief Whether the last initDisplay() adopted the CRTC without a modeset.
+     */
+    inline bool isHandedOff() const { return m_handoffFbId != 0U; }
+
     bool deInitDisplay();
 
+    /**
+     * @brief Number of display buffers (2-4) allocated by the next
+     *        initDisplay(). A third buffer lets the next frame be rendered
+     *        while one waits for scanout, so a late frame no longer costs a
+     *        vblank. Fails while the display is initialized.
+     */
+    bool setBufferCount(int count);
+    inline int bufferCount() const { return m_bufferCount; }
+
+    /**
+     * @brief Switch to another connector/CRTC or size without a full teardown.
+     * The current buffers are parked and picked up again by the new
+     * configuration when they still fit, so only framebuffer objects are
+     * re-created. Use after a hotplug or mode change.
+     */
+    bool reconfigure(uint32_t connectorId,
+                     uint32_t crtcId,
+                     uint32_t width,
+                     uint32_t height,
+                     uint32_t bpp = 32U,
+                     uint32_t format = 0U,
+                     uint32_t flags = 0U);
+
+    /**
+     * @brief Free the buffers parked by deInitDisplay()/reconfigure().
+     */
+    void trimBufferPool() {
+        if (m_bufferPool != nullptr) {
+            m_bufferPool->trim();
+        }
+    }
+
     bool isInitialized() const { return m_initialized; }
 
     uint8_t *getDrawBuffer();
     
     bool setModeCrtc(const DrmBuffer *buffer);
 
+    /**
+     * @brief Show @p buffer on the next vblank.
+     * With atomic KMS only the primary plane FB_ID is committed, as a
+     * nonblocking commit with a page flip event; a framebuffer is checked
+     * with TEST_ONLY the first time it is shown. Without atomic support
+     * this is a legacy drmModePageFlip(). Without @p useVSync the flip is
+     * asynchronous (it may tear) where the driver supports it, else it
+     * waits for the vblank all the same; either way the buffer it replaces
+     * is only freed by the page flip event. A buffer of the swapchain goes
+     * through queueBuffer(); for any other buffer (e.g. an imported camera
+     * frame) the flips in flight are waited for first.
+     * @param damage Pixels that changed since the frame on screen, nullptr or
+     *        empty for a full update. Sent as FB_DAMAGE_CLIPS of the primary
+     *        plane, or with drmModeDirtyFB() on the legacy path.
+     */
+    bool commitBuffer(const DrmBuffer *buffer, bool useVSync = true, const DamageRegion *damage = nullptr);
+
+    /**
+     * @brief Take a FREE buffer to render into, oldest first.
+     * When none is free, waits up to @p timeoutMs (-1 forever) for a flip to
+     * release one; without the event thread the DRM events are handled on
+     * the calling thread meanwhile.
+     * @return Buffer index, -1 on timeout or if no flip can release one.
+     */
+    int acquireBuffer(int timeoutMs = -1);
+
+    /**
+     * @brief Hand a rendered buffer to the display.
+     * It is committed right away if no flip is in flight, otherwise queued
+     * and committed from the page flip handler when the current flip lands.
+     * @param damage As for commitBuffer(), copied with the queued buffer.
+     */
+    bool queueBuffer(int index, bool useVSync = true, const DamageRegion *damage = nullptr);
+
+    /**
+     * @brief Called on the event thread for a layer buffer that left the
+     *        screen: the flip that replaced it completed.
+     */
+    using LayerReleaseCallback = std::function<void(const DrmBuffer *buffer)>;
+
+    /**
+     * @brief Compose the display from @p layers, bottom to top, starting with
+     *        the next flip.
+     * A layer without buffer stands for the swapchain, which the GPU
+     * renders. The other layers get hardware planes when the driver accepts
+     * them (see DrmPlaneAssigner); their DrmLayer::planeId is 0 when they
+     * must be rendered into the swapchain instead. Without a swapchain layer
+     * all layers must get a plane, else none does. Buffers put on planes are
+     * handed to the LayerReleaseCallback once no longer read, including
+     * when replaced before any flip showed them; the caller keeps the others.
+     * Without atomic support every layer is left to the GPU.
+     * @return Number of layers put on planes.
+     */
+    size_t setLayers(std::vector<DrmLayer> &layers);
+
+    /**
+     * @brief Flip the layers of setLayers() without a new swapchain buffer,
+     *        e.g. for a new camera frame. Waits for the flips in flight.
+     * A swapchain layer keeps showing the swapchain buffer on screen. On
+     * failure the layers are dropped and their buffers released.
+     */
+    bool commitLayers(bool useVSync = true);
+    void setLayerReleaseCallback(LayerReleaseCallback callback);
+    inline DrmPlaneAssigner *planeAssigner() const { return m_planeAssigner.get(); }
+
+    /**
+     * @brief Whether the CRTC applies @p state itself (DEGAMMA_LUT, CTM,
+     *        GAMMA_LUT). If not, draw it with the ColorCorrection render pass.
+     */
+    bool supportsColorState(const ColorState &state);
+
+    /**
+     * @brief Colour correction of the CRTC, committed with the next flips.
+     * A transition over @p transitionMs goes in ColorLut::TRANSITION_STEPS
+     * steps, each flip shows the step due; it only advances while frames
+     * are flipped. Atomic KMS only.
+     * @return false if the CRTC lacks a stage @p state uses.
+     */
+    bool setColorState(const ColorState &state, uint32_t transitionMs = 0U);
+
+    /**
+     * @brief Called without the device lock for every captured frame. The
+     *        receiver owns DrmCapture::fence and hands the buffer back with
+     *        releaseCapture().
+     */
+    using CaptureCallback = std::function<void(const DrmCapture &capture)>;
+
+    /**
+     * @brief Capture the composed output of the next @p frames flips through
+     *        a writeback connector (DrmWriteback::CONTINUOUS for all).
+     * The first call routes the connector to the CRTC, a modeset after the
+     * flips in flight, and allocates @p bufferCount buffers; later calls
+     * must ask for as many until deInitDisplay(). Atomic KMS only.
+     * deInitDisplay() hands the captures still queued to the receiver, the
+     * buffers it holds stay valid until releaseCapture() but not past close().
+     * @return false without a writeback connector for the CRTC, or for
+     *         another @p bufferCount while capturing.
+     */
+    bool startCapture(CaptureCallback callback, uint32_t frames = DrmWriteback::CONTINUOUS, uint32_t bufferCount = DrmWriteback::DEFAULT_BUFFER_COUNT);
+    void stopCapture();
+    bool releaseCapture(const DrmBuffer *buffer);
+    inline DrmWriteback *writeback() const { return m_writeback.get(); }
+
+    /**
+     * @brief Wait up to @p timeoutMs for DRM events and handle them on the
+     *        calling thread, for use without the event thread.
+     * @return 1 if events were handled, 0 on timeout, -EBUSY while the event
+     *         thread runs, other -errno on error.
+     */
+    int dispatchEvents(int timeoutMs);
+
+    /**
+     * @brief Call @p callback once on the next vblank of the display CRTC,
+     *        on the event thread.
+     * @return 0 or -errno.
+     */
+    int requestVblank(DrmEventLoop::Callback callback);
+
+    BufferState bufferState(int index);
+
+    /**
+     * @brief Queue the draw buffer (see getDrawBuffer()) and advance the
+     *        draw buffer to the next one of the ring.
+     * A draw buffer still on screen is flipped again instead of refused
+     * when nothing is in flight, as with the plain 2 buffer flip. It fails
+     * like that flip (-EBUSY then) while the last flip has not landed.
+     */
     bool flipBuffer(bool useVSync = true);
 
+    /**
+     * @brief Block until the flip in flight and all queued buffers are on screen.
+     */
     void waitFlipEvent();
 
     inline bool isOpen() const { return (m_fd >= 0); }
+    inline bool isAtomic() const { return m_atomic; }
+    /**
+     * @brief Whether flips without vsync can be asynchronous (they may tear)
+     *        on the atomic or the legacy path. They still send their event.
+     */
+    inline bool isAsyncFlipSupported(bool atomic) const { return atomic ? m_atomicAsyncFlip : m_asyncFlip; }
+    /**
+     * @brief Switch between the atomic and the legacy path at runtime, e.g.
+     *        to compare them. Only has an effect if the driver supports atomic.
+     */
+    inline void setAtomicEnabled(bool enable) { m_atomic = enable && m_atomicSupported; }
+    inline uint32_t primaryPlaneId() const { return m_planeId; }
+
+    /**
+     * @brief Whether the primary plane scans out @p format in @p modifier
+     *        (IN_FORMATS), for a producer choosing the layout it renders in.
+     * Without atomic KMS the primary plane is unknown and only linear fits.
+     */
+    bool supportsModifier(uint32_t format, uint64_t modifier) const;
+    inline DrmPropertyCache *propertyCache() const { return m_props.get(); }
     inline int fd() const { return m_fd; }
+    inline AllocatorType allocatorType() const { return m_allocatorType; }
 
     const DrmCardInfo &getCardInfo() const { return m_cardInfo; }
     const std::unordered_map<uint32_t, DrmConnectorInfo> &getConnectors() const { return m_connectors; }
+    /**
+     * @brief Mode programmed by initDisplay().
+     */
+    const DrmModeInfo &mode() const { return m_mode; }
     const std::unordered_map<uint32_t, DrmEncoderInfo> &getEncoders() const { return m_encoders; }
     const std::unordered_map<uint32_t, DrmCrtcInfo> &getCrtcs() const { return m_crtcs; }
     const std::unordered_map<uint32_t, DrmPlaneInfo> &getPlanes() const { return m_planes; }
@@ -146,6 +387,13 @@ public:
     inline std::string getDriverName() const { return m_cardInfo.driverName; }
     inline std::string getBusInfo() const { return m_cardInfo.busInfo; }
     inline FlipEventObj &getFlipEventObj() { return m_flipEventObj; }
+    inline DrmImportCache *importCache() const { return m_importCache.get(); }
+    inline DrmBufferPool *bufferPool() const { return m_bufferPool.get(); }
+    /**
+     * @brief Event thread of the device, started by open(). Page flip events
+     *        of every commit are delivered to its flip listeners.
+     */
+    inline DrmEventLoop *eventLoop() const { return m_eventLoop.get(); }
 
     void queryDeviceName();
     void queryDeviceConnectors();
@@ -155,6 +403,33 @@ public:
     void queryAllDeviceInfo();
     void resetDeviceInfo();
 
+    /**
+     * @brief How the query*() calls read connectors, DrmProbe::CURRENT by
+     *        default so no connector is probed that the kernel knows.
+     */
+    inline void setProbe(DrmProbe probe) { m_probe = probe; }
+
+    /**
+     * @brief Cache file of the probed connector state, read by the next
+     *        query and rewritten whenever a connector was probed. Empty
+     *        (the default) for none.
+     */
+    inline void setSnapshotCache(const std::string &path) { m_snapshotCache = path; }
+
+    /**
+     * @brief Resources as of the last query*() or refreshConnector(),
+     *        nullptr before the first. Safe to call from any thread.
+     */
+    inline DrmSnapshotPtr snapshot() const { return std::atomic_load(&m_snapshot); }
+
+    /**
+     * @brief Probe @p connectorId again after a hotplug, e.g. the CONNECTOR
+     *        of the uevent, or every connector when 0. Everything else is
+     *        taken from the current snapshot; the result is published as a
+     *        new snapshot and getConnectors() follows it.
+     */
+    bool refreshConnector(uint32_t connectorId = 0U);
+
     inline int cardId() const { return m_cardId; }
     inline uint32_t crtcId() const { return m_crtcId; }
     inline uint32_t connectorId() const { return m_connectorId; }
@@ -164,19 +439,19 @@ public:
     inline uint32_t format() const { return m_format; }
     inline uint32_t flags() const { return m_flags; }
     inline int activeBufferIndex() const { return m_flipEventObj.idx; }
-    inline DrmBuffer *activeBuffer() const {
-        return (m_flipEventObj.idx >= 0 && m_flipEventObj.idx < 2) ? m_buffers[m_flipEventObj.idx] : nullptr;
-    }
+    inline DrmBuffer *activeBuffer() const { return buffer(m_flipEventObj.idx); }
     inline DrmBuffer *buffer(int index) const {
-        return (index >= 0 && index < 2) ? m_buffers[index] : nullptr;
-    }
-    inline DrmBuffer *buffer() const {
-        return (m_flipEventObj.idx >= 0 && m_flipEventObj.idx < 2) ? m_buffers[m_flipEventObj.idx] : nullptr;
+        return (index >= 0 && index < m_bufferCount) ? m_buffers[index] : nullptr;
     }
+    inline DrmBuffer *buffer() const { return buffer(m_flipEventObj.idx); }
     inline DrmBuffer *buffer0() const { return m_buffers[0U]; }
     inline DrmBuffer *buffer1() const { return m_buffers[1U]; }
 
-    inline void setBufferPtr(int index, void *ptr) { m_buffers[index]->ptr = ptr; }
+    inline void setBufferPtr(int index, void *ptr) {
+        if (buffer(index) != nullptr) {
+            m_buffers[index]->ptr = ptr;
+        }
+    }
 
     template <typename Allocator>
     static DrmBuffer *createBuffer(int fd,
@@ -193,26 +468,76 @@ public:
         info.depth = 24U;
         info.format = format;
         info.flags = flags;
+        info.tag = MemoryTag::DISPLAY;
         return Allocator::allocate(fd, info);
     }
 
+    static DrmBuffer *createBuffer(AllocatorType type,
+                                   int fd,
+                                   uint32_t width,
+                                   uint32_t height,
+                                   uint32_t bpp = 32,
+                                   uint32_t offset = 0,
+                                   uint32_t flags = 0,
+                                   uint32_t format = 0) {
+        BufferInfo info = {};
+        info.width = width;
+        info.height = height;
+        info.bpp = bpp;
+        info.depth = 24U;
+        info.format = format;
+        info.flags = flags;
+        info.tag = MemoryTag::DISPLAY;
+        return DrmAllocator::allocate(type, fd, info);
+    }
+
     template <typename Allocator>
     static void removeBuffer(int fd, DrmBuffer *buffer) {
         return Allocator::release(fd, buffer);
     }
 
+    static void removeBuffer(int fd, DrmBuffer *buffer) {
+        return DrmAllocator::release(fd, buffer);
+    }
+
+    static DrmBuffer *importBuffer(int fd, int dmaFd, const BufferInfo &info, bool map = true) {
+        return DrmAllocator::import(fd, dmaFd, info, map);
+    }
+
+    /**
+     * @brief Index of @p crtcId in the resources, as used by possible_crtcs
+     *        masks and vblank requests, -1 if unknown.
+     */
+    static int crtcIndexOf(int fd, uint32_t crtcId);
+
+    /**
+     * @brief Primary plane usable on @p crtcId, preferring the one bound to
+     *        it, 0 if none.
+     */
+    static uint32_t primaryPlaneOf(int fd, DrmPropertyCache &props, uint32_t crtcId);
+
 private:
     void queryDeviceInfo(uint32_t flags);
-    void queryDeviceEncoders(void *res);
-    void queryCrtcs(void *res);
-    void getConnectedConnectors(void *resources);
+    DrmSnapshotPtr captureSnapshot();
+    void applySnapshot(const DrmResourceSnapshot &snapshot, uint32_t flags);
+    void fillConnectorInfo(const void *conn, DrmConnectorInfo &connector);
     void getConnectorInfo(void *conn, DrmConnectorInfo &connector);
 
-    static void pageFlipHandler(int fd,
-                                unsigned int sequence,
-                                unsigned int tv_sec,
-                                unsigned int tv_usec,
-                                void *user_data);
+    bool findPrimaryPlane(uint32_t crtcId);
+    bool atomicModeset(uint32_t connectorId, uint32_t crtcId, const DrmBuffer *buffer);
+    bool adoptCrtc(uint32_t crtcId, const DrmBuffer *buffer);
+    bool copySplash(uint32_t fbId, uint32_t width, uint32_t height, uint32_t bpp);
+    bool atomicFlip(const DrmBuffer *buffer, bool useVSync, const DamageRegion *damage);
+    int indexOf(const DrmBuffer *buffer) const;
+    bool submitLocked(const DrmBuffer *buffer, int index, bool useVSync, const DamageRegion *damage);
+    void dirtyFramebuffer(const DrmBuffer *buffer, const DamageRegion &damage);
+    void completeFlipLocked();
+    bool waitSwapchain(const std::function<bool()> &ready, int timeoutMs);
+    void onFlipEvent(const DrmEventLoop::Event &event);
+    void releaseLayerBuffers();
+    void deliverCaptures(const std::vector<DrmCapture> &captures, const CaptureCallback &captureCallback);
+    static void placedBuffers(const std::vector<DrmLayer> &layers, std::vector<const DrmBuffer *> &buffers);
+    static bool containsBuffer(const std::vector<const DrmBuffer *> &buffers, const DrmBuffer *buffer);
 
     int m_fd{-1};
     AllocatorType m_allocatorType{AllocatorType::DRM_ALLOCATOR_MMAP};
@@ -222,10 +547,23 @@ private:
     std::unordered_map<uint32_t, DrmEncoderInfo> m_encoders{};
     std::unordered_map<uint32_t, DrmCrtcInfo> m_crtcs{};
     std::unordered_map<uint32_t, DrmPlaneInfo> m_planes{};
-    DrmBuffer *m_buffers[2]{nullptr, nullptr};
+    DrmSnapshotPtr m_snapshot{};          // atomic_load/atomic_store only
+    DrmProbe m_probe{DrmProbe::CURRENT};
+    std::string m_snapshotCache{};
+    DrmBuffer *m_buffers[MAX_BUFFER_COUNT]{};
+    int m_bufferCount{MIN_BUFFER_COUNT};
+    int m_lastAcquired{0};
     uint32_t m_crtcId{0};
+    int m_crtcIndex{-1};
     uint32_t m_connectorId{0};
     void *m_modelPtr{nullptr};
+    DrmModeInfo m_mode{};
+    DrmModeInfo m_requestedMode{};
+    bool m_modeRequested{false};
+    bool m_vrrEnabled{true};
+    bool m_vrrActive{false};
+    DrmHandoff m_handoff{DrmHandoff::NONE};
+    uint32_t m_handoffFbId{0};            // splash left by the bootloader, 0 without handoff
     uint32_t m_width{0};
     uint32_t m_height{0};
     uint32_t m_bpp{0};
@@ -235,6 +573,29 @@ private:
     DrmConnectorInfo m_initConnector{};
     DrmConnectorInfo m_bkConnector{};
     FlipEventObj m_flipEventObj{};
+    std::unique_ptr<DrmImportCache> m_importCache{};
+    std::unique_ptr<DrmBufferPool> m_bufferPool{};
+    std::unique_ptr<DrmPropertyCache> m_props{};
+    std::unique_ptr<DrmEventLoop> m_eventLoop{};
+    std::unique_ptr<DrmPlaneAssigner> m_planeAssigner{};  // atomic only
+    std::unique_ptr<DrmColorPipeline> m_colorPipeline{};  // atomic only, null without GAMMA_LUT
+    std::vector<DrmLayer> m_layers{};                     // layers of the next flips, empty for the swapchain only
+    std::vector<DrmLayer> m_clientLayers{};               // the swapchain alone on the primary plane
+    std::vector<const DrmBuffer *> m_pendingLayerBuffers{}; // layer buffers of the flip in flight
+    std::vector<const DrmBuffer *> m_shownLayerBuffers{};   // layer buffers on screen
+    std::vector<const DrmBuffer *> m_releasedLayerBuffers{}; // to hand to m_layerRelease
+    LayerReleaseCallback m_layerRelease{};
+    std::unique_ptr<DrmWriteback> m_writeback{};          // after startCapture()
+    std::vector<DrmCapture> m_captures{};                 // to hand to m_captureCallback
+    CaptureCallback m_captureCallback{};
+    bool m_atomicSupported{false};        // DRM_CLIENT_CAP_ATOMIC accepted
+    bool m_atomic{false};                 // atomic path in use
+    uint32_t m_planeId{0};                // primary plane of m_crtcId
+    uint32_t m_modeBlobId{0};             // MODE_ID blob of the active mode
+    bool m_dirtyFbSupported{true};        // cleared when DIRTYFB is not implemented by the driver
+    bool m_asyncFlip{false};              // DRM_CAP_ASYNC_PAGE_FLIP, legacy flips without vsync
+    bool m_atomicAsyncFlip{false};        // DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP, the same for atomic commits
+    std::vector<uint32_t> m_testedFbs{};  // framebuffers validated with TEST_ONLY
 };
 
 } // namespace drm
@@ -0,0 +1,141 @@
+#include "DrmDirectScanout.h"
+#include "CommonUtil.h"
+
+#include <vector>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay DrmDirectScanout"
+#endif
+
+namespace evs {
+namespace early {
+namespace drm {
+
+DrmDirectScanout::DrmDirectScanout(DrmDevice &device, ReleaseCallback release)
+    : m_device(device)
+    , m_release(std::move(release)) {
+    m_device.setLayerReleaseCallback([this](const DrmBuffer *buffer) { onLayerReleased(buffer); });
+}
+
+DrmDirectScanout::~DrmDirectScanout() {
+    stop();
+    m_device.setLayerReleaseCallback(nullptr);
+
+    std::unordered_map<const DrmBuffer *, void *> frames{};
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        frames.swap(m_frames);
+    }
+    for (const auto &entry : frames) {
+        if (m_device.importCache() != nullptr) {
+            m_device.importCache()->release(entry.first);
+        }
+        if (m_release) {
+            m_release(entry.second);
+        }
+    }
+}
+
+void DrmDirectScanout::setOverlay(bool enabled) {
+    m_overlay = enabled;
+}
+
+void DrmDirectScanout::setDestination(const DrmRect &dst) {
+    m_dst = dst;
+}
+
+DrmDirectScanout::Path DrmDirectScanout::present(const Frame &frame, bool useVSync) {
+    DrmImportCache *cache = m_device.importCache();
+    if ((frame.dmaFd < 0) || (cache == nullptr) || (m_device.planeAssigner() == nullptr)) {
+        m_composed++;
+        return Path::COMPOSE;
+    }
+
+    const DrmBuffer *buffer = cache->acquire(frame.dmaFd, frame.info, frame.modifier);
+    if (buffer == nullptr) {
+        m_composed++;
+        return Path::COMPOSE;
+    }
+    bool busy = false;
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        busy = (m_frames.find(buffer) != m_frames.end());
+        if (busy == false) {
+            m_frames[buffer] = frame.userData;
+        }
+    }
+    if (busy == true) {
+        // The cache hands out the entry already on screen or pending
+        cache->release(buffer);
+        EARLY_WARN("Framebuffer %u is still in use, frame not shown\n", buffer->fbId);
+        m_busy++;
+        return Path::BUSY;
+    }
+
+    DrmRect full = {0, 0, m_device.width(), m_device.height()};
+    std::vector<DrmLayer> layers{};
+    DrmLayer camera = {};
+    camera.buffer = buffer;
+    camera.format = static_cast<uint32_t>(frame.info.format);
+    camera.src = DrmRect{0, 0, frame.info.width, frame.info.height};
+    camera.dst = ((m_dst.width > 0U) && (m_dst.height > 0U)) ? m_dst : full;
+    camera.encoding = frame.encoding;
+    camera.range = frame.range;
+    layers.push_back(camera);
+    if (m_overlay == true) {
+        DrmLayer client = {};
+        client.format = m_device.format();
+        client.src = full;
+        client.dst = full;
+        layers.push_back(client);
+    }
+
+    m_device.setLayers(layers);
+    if (layers[0].planeId == 0U) {
+        // Not taken by a plane, the device does not track the buffer
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_frames.erase(buffer);
+        }
+        cache->release(buffer);
+        m_composed++;
+        return Path::COMPOSE;
+    }
+
+    if (m_device.commitLayers(useVSync) == false) {
+        EARLY_WARN("Direct scanout of framebuffer %u failed, frame dropped\n", buffer->fbId);
+        m_dropped++;
+        return Path::DROPPED;
+    }
+    m_direct++;
+    return Path::DIRECT;
+}
+
+void DrmDirectScanout::stop() {
+    std::vector<DrmLayer> none{};
+    m_device.setLayers(none);
+}
+
+void DrmDirectScanout::onLayerReleased(const DrmBuffer *buffer) {
+    void *userData = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        auto iter = m_frames.find(buffer);
+        if (iter == m_frames.end()) {
+            return;
+        }
+        userData = iter->second;
+        m_frames.erase(iter);
+    }
+    if (m_device.importCache() != nullptr) {
+        m_device.importCache()->release(buffer);
+    }
+    if (m_release) {
+        m_release(userData);
+    }
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
@@ -0,0 +1,308 @@
+#include "DrmEventLoop.h"
+#include "CommonUtil.h"
+
+#include <xf86drm.h>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay DrmEventLoop"
+#endif
+
+namespace evs {
+namespace early {
+namespace drm {
+
+// drmEventContext carries no user pointer, the loop reading the fd is
+// published here for the duration of drmHandleEvent()
+static thread_local DrmEventLoop *g_dispatchingLoop = nullptr;
+
+DrmEventLoop::DrmEventLoop(int drmFd)
+    : m_drmFd(drmFd)
+    , m_listeners(std::make_shared<const ListenerList>()) {
+}
+
+DrmEventLoop::~DrmEventLoop() {
+    stop();
+    std::unique_lock<std::mutex> lock(m_mtx);
+    for (VblankRequest *request : m_vblankRequests) {
+        delete request;
+    }
+    m_vblankRequests.clear();
+    m_flipPromises.clear();
+}
+
+int DrmEventLoop::start() {
+    int ret = 0;
+    do {
+        if (m_thread.joinable() == true) {
+            ret = -EBUSY;
+            break;
+        }
+        if (m_drmFd < 0) {
+            ret = -EBADF;
+            break;
+        }
+
+        m_epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+        m_wakeFd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if ((m_epollFd < 0) || (m_wakeFd < 0)) {
+            ret = -errno;
+            EARLY_ERROR("Failed to create epoll/eventfd: %s\n", strerror(errno));
+            break;
+        }
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = m_drmFd;
+        if (::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_drmFd, &event) < 0) {
+            ret = -errno;
+            EARLY_ERROR("Failed to watch DRM fd %d: %s\n", m_drmFd, strerror(errno));
+            break;
+        }
+        event.data.fd = m_wakeFd;
+        if (::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &event) < 0) {
+            ret = -errno;
+            EARLY_ERROR("Failed to watch eventfd: %s\n", strerror(errno));
+            break;
+        }
+
+        m_running.store(true);
+        m_thread = std::thread(&DrmEventLoop::run, this);
+    } while (false);
+
+    if ((ret != 0) && (ret != -EBUSY)) {
+        if (m_epollFd >= 0) {
+            ::close(m_epollFd);
+            m_epollFd = -1;
+        }
+        if (m_wakeFd >= 0) {
+            ::close(m_wakeFd);
+            m_wakeFd = -1;
+        }
+    }
+    return ret;
+}
+
+void DrmEventLoop::stop() {
+    if (m_thread.joinable() == false) {
+        return;
+    }
+
+    m_running.store(false);
+    uint64_t one = 1;
+    if (::write(m_wakeFd, &one, sizeof(one)) < 0) {
+        EARLY_ERROR("Failed to wake the event thread: %s\n", strerror(errno));
+    }
+    m_thread.join();
+
+    ::close(m_epollFd);
+    m_epollFd = -1;
+    ::close(m_wakeFd);
+    m_wakeFd = -1;
+}
+
+void DrmEventLoop::run() {
+    std::unique_lock<std::mutex> dispatch(m_dispatchMtx);
+    epoll_event events[2];
+
+    while (m_running.load() == true) {
+        int count = ::epoll_wait(m_epollFd, events, 2, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            EARLY_ERROR("epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.fd == m_wakeFd) {
+                uint64_t value = 0;
+                if (::read(m_wakeFd, &value, sizeof(value)) < 0) {
+                    // EAGAIN, already drained
+                }
+            } else if (events[i].data.fd == m_drmFd) {
+                handleEvents(0);
+            }
+        }
+    }
+    m_running.store(false);
+}
+
+int DrmEventLoop::handleEvents(int timeoutMs) {
+    pollfd pfd = {};
+    pfd.fd = m_drmFd;
+    pfd.events = POLLIN;
+    int ret = ::poll(&pfd, 1, timeoutMs);
+    if (ret < 0) {
+        return (errno == EINTR) ? 0 : -errno;
+    }
+    if (ret == 0) {
+        return 0;
+    }
+
+    drmEventContext evctx = {};
+    evctx.version = DRM_EVENT_CONTEXT_VERSION;
+    evctx.vblank_handler = DrmEventLoop::vblankHandler;
+    evctx.page_flip_handler2 = DrmEventLoop::pageFlipHandler;
+    g_dispatchingLoop = this;
+    ret = drmHandleEvent(m_drmFd, &evctx);
+    g_dispatchingLoop = nullptr;
+    return (ret == 0) ? 1 : -EIO;
+}
+
+int DrmEventLoop::dispatch(int timeoutMs) {
+    if ((m_drmFd < 0) || (m_running.load() == true)) {
+        return (m_drmFd < 0) ? -EBADF : -EBUSY;
+    }
+    std::unique_lock<std::mutex> dispatch(m_dispatchMtx);
+    return handleEvents(timeoutMs);
+}
+
+int DrmEventLoop::tryDispatch(int timeoutMs) {
+    if ((m_drmFd < 0) || (m_running.load() == true)) {
+        return (m_drmFd < 0) ? -EBADF : -EBUSY;
+    }
+    std::unique_lock<std::mutex> dispatch(m_dispatchMtx, std::try_to_lock);
+    if (dispatch.owns_lock() == false) {
+        return -EBUSY;
+    }
+    return handleEvents(timeoutMs);
+}
+
+void DrmEventLoop::pageFlipHandler(int fd,
+                                   unsigned int sequence,
+                                   unsigned int tv_sec,
+                                   unsigned int tv_usec,
+                                   unsigned int crtc_id,
+                                   void *user_data) {
+    DrmEventLoop *loop = g_dispatchingLoop;
+    if (loop == nullptr) {
+        return;
+    }
+    Event event = {crtc_id, sequence, static_cast<uint64_t>(tv_sec) * 1000000U + tv_usec, user_data};
+    loop->deliverFlip(event);
+}
+
+void DrmEventLoop::vblankHandler(int fd,
+                                 unsigned int sequence,
+                                 unsigned int tv_sec,
+                                 unsigned int tv_usec,
+                                 void *user_data) {
+    VblankRequest *request = static_cast<VblankRequest *>(user_data);
+    DrmEventLoop *loop = g_dispatchingLoop;
+    if ((loop == nullptr) || (request == nullptr)) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(loop->m_mtx);
+        if (loop->m_vblankRequests.erase(request) == 0U) {
+            return;
+        }
+    }
+    Event event = {0U, sequence, static_cast<uint64_t>(tv_sec) * 1000000U + tv_usec, nullptr};
+    if (request->callback) {
+        request->callback(event);
+    }
+    delete request;
+}
+
+void DrmEventLoop::deliverFlip(const Event &event) {
+    std::shared_ptr<const ListenerList> listeners{};
+    std::vector<FlipPromise> ready{};
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        listeners = m_listeners;
+        for (auto iter = m_flipPromises.begin(); iter != m_flipPromises.end();) {
+            if ((iter->crtcId == 0U) || (iter->crtcId == event.crtcId)) {
+                ready.push_back(std::move(*iter));
+                iter = m_flipPromises.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+    }
+
+    for (const Listener &listener : *listeners) {
+        listener.callback(event);
+    }
+    for (FlipPromise &pending : ready) {
+        pending.promise.set_value(event);
+    }
+}
+
+uint32_t DrmEventLoop::addFlipListener(Callback callback) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    auto listeners = std::make_shared<ListenerList>(*m_listeners);
+    uint32_t id = m_nextListenerId++;
+    listeners->push_back(Listener{id, std::move(callback)});
+    m_listeners = listeners;
+    return id;
+}
+
+void DrmEventLoop::removeFlipListener(uint32_t id) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    auto listeners = std::make_shared<ListenerList>();
+    for (const Listener &listener : *m_listeners) {
+        if (listener.id != id) {
+            listeners->push_back(listener);
+        }
+    }
+    m_listeners = listeners;
+}
+
+std::future<DrmEventLoop::Event> DrmEventLoop::nextFlip(uint32_t crtcId) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_flipPromises.push_back(FlipPromise{crtcId, std::promise<Event>()});
+    return m_flipPromises.back().promise.get_future();
+}
+
+int DrmEventLoop::requestVblank(int crtcIndex, Callback callback) {
+    if ((m_drmFd < 0) || (crtcIndex < 0)) {
+        return -EINVAL;
+    }
+
+    VblankRequest *request = new VblankRequest{this, std::move(callback)};
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_vblankRequests.insert(request);
+    }
+
+    uint32_t type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
+    if (crtcIndex == 1) {
+        type |= DRM_VBLANK_SECONDARY;
+    } else if (crtcIndex > 1) {
+        type |= (static_cast<uint32_t>(crtcIndex) << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+    }
+    drmVBlank vbl = {};
+    vbl.request.type = static_cast<drmVBlankSeqType>(type);
+    vbl.request.sequence = 1U;
+    vbl.request.signal = reinterpret_cast<unsigned long>(request);
+    if (drmWaitVBlank(m_drmFd, &vbl) != 0) {
+        int ret = -errno;
+        EARLY_ERROR("Failed to request vblank event on CRTC index %d: %s\n", crtcIndex, strerror(errno));
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_vblankRequests.erase(request);
+        delete request;
+        return ret;
+    }
+    return 0;
+}
+
+std::future<DrmEventLoop::Event> DrmEventLoop::nextVblank(int crtcIndex) {
+    // A failed request drops the promise, get() then reports broken_promise
+    auto promise = std::make_shared<std::promise<Event>>();
+    std::future<Event> future = promise->get_future();
+    requestVblank(crtcIndex, [promise](const Event &event) { promise->set_value(event); });
+    return future;
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
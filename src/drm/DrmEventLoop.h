@@ -0,0 +1,140 @@
+#ifndef DRMEVENTLOOP_H
+#define DRMEVENTLOOP_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace evs {
+namespace early {
+namespace drm {
+
+/**
+ * @brief Reactor for the events of a DRM fd.
+ * One thread waits in epoll on the DRM fd and an eventfd used to stop it,
+ * reads page flip and vblank events with drmHandleEvent() and hands them
+ * to the registered listeners, pending futures and vblank callbacks. All
+ * callbacks run on the loop thread and must not block.
+ *
+ * Without the thread (start() not called), dispatch() reads the events on
+ * the calling thread with the same delivery.
+ */
+class DrmEventLoop
+{
+    DrmEventLoop(const DrmEventLoop &) = delete;
+    DrmEventLoop &operator=(const DrmEventLoop &) = delete;
+    DrmEventLoop(DrmEventLoop &&) = delete;
+    DrmEventLoop &operator=(DrmEventLoop &&) = delete;
+
+public:
+    typedef struct {
+        uint32_t crtcId;       // 0 for vblank events
+        unsigned int sequence; // vblank counter
+        uint64_t timeUs;       // CLOCK_MONOTONIC time of the vblank
+        void *userData;        // user data of the commit, nullptr for vblank events
+    } Event;
+
+    using Callback = std::function<void(const Event &event)>;
+
+    explicit DrmEventLoop(int drmFd);
+    ~DrmEventLoop();
+
+    /**
+     * @return 0 or -errno.
+     */
+    int start();
+    void stop();
+    bool isRunning() const { return m_running.load(); }
+
+    /**
+     * @brief Wait up to @p timeoutMs for events and handle them on the
+     *        calling thread. Only one thread dispatches at a time.
+     * @return 1 if events were handled, 0 on timeout, -EBUSY while the loop
+     *         thread runs, other -errno on error.
+     */
+    int dispatch(int timeoutMs);
+
+    /**
+     * @brief Like dispatch(), but returns -EBUSY instead of waiting when
+     *        another thread is dispatching.
+     */
+    int tryDispatch(int timeoutMs);
+
+    /**
+     * @brief Call @p callback for every page flip event, in registration order.
+     * @return Listener ID for removeFlipListener().
+     */
+    uint32_t addFlipListener(Callback callback);
+    void removeFlipListener(uint32_t id);
+
+    /**
+     * @brief Future of the next page flip event of @p crtcId, 0 for any CRTC.
+     */
+    std::future<Event> nextFlip(uint32_t crtcId = 0U);
+
+    /**
+     * @brief Call @p callback once on the next vblank of the CRTC with index
+     *        @p crtcIndex in the resources.
+     * @return 0 or -errno of drmWaitVBlank().
+     */
+    int requestVblank(int crtcIndex, Callback callback);
+    std::future<Event> nextVblank(int crtcIndex);
+
+private:
+    typedef struct {
+        uint32_t id;
+        Callback callback;
+    } Listener;
+
+    typedef struct {
+        uint32_t crtcId;
+        std::promise<Event> promise;
+    } FlipPromise;
+
+    typedef struct {
+        DrmEventLoop *loop;
+        Callback callback;
+    } VblankRequest;
+
+    using ListenerList = std::vector<Listener>;
+
+    static void pageFlipHandler(int fd,
+                                unsigned int sequence,
+                                unsigned int tv_sec,
+                                unsigned int tv_usec,
+                                unsigned int crtc_id,
+                                void *user_data);
+    static void vblankHandler(int fd,
+                              unsigned int sequence,
+                              unsigned int tv_sec,
+                              unsigned int tv_usec,
+                              void *user_data);
+
+    void run();
+    int handleEvents(int timeoutMs);
+    void deliverFlip(const Event &event);
+
+    int m_drmFd{-1};
+    int m_epollFd{-1};
+    int m_wakeFd{-1};
+    std::atomic<bool> m_running{false};
+    std::thread m_thread{};
+    std::mutex m_dispatchMtx;                                   // held while reading the DRM fd
+    std::mutex m_mtx;                                           // listeners, promises, vblank requests
+    std::shared_ptr<const ListenerList> m_listeners{};          // copy-on-write, read per event
+    uint32_t m_nextListenerId{1};
+    std::vector<FlipPromise> m_flipPromises{};
+    std::unordered_set<VblankRequest *> m_vblankRequests{};
+};
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMEVENTLOOP_H
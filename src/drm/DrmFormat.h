@@ -0,0 +1,156 @@
+#ifndef DRMFORMAT_H
+#define DRMFORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <drm/drm_fourcc.h>
+#include <unordered_map>
+#include <vector>
+
+namespace evs {
+namespace early {
+namespace drm {
+
+static constexpr uint32_t DRM_MAX_PLANES = 4U;
+
+/**
+ * @brief Modifiers a plane scans out per format, from its IN_FORMATS blob.
+ */
+using DrmFormatModifiers = std::unordered_map<uint32_t, std::vector<uint64_t>>;
+
+/**
+ * @struct DrmFormatInfo
+ * @brief Memory layout of a DRM fourcc format.
+ */
+typedef struct {
+    uint32_t format;              ///< DRM fourcc code
+    uint32_t planes;              ///< Number of planes
+    uint8_t cpp[DRM_MAX_PLANES];  ///< Bytes per pixel (per sample pair for packed YUV) of each plane
+    uint8_t hsub;                 ///< Horizontal chroma subsampling of planes 1..n
+    uint8_t vsub;                 ///< Vertical chroma subsampling of planes 1..n
+} DrmFormatInfo;
+
+/**
+ * @brief Plane layout of the formats used for scanout and camera buffers.
+ * Only linear layouts are described; tiled or compressed layouts come with
+ * a modifier and are laid out by their producer.
+ */
+class DrmFormat
+{
+public:
+    static const DrmFormatInfo *info(uint32_t format) {
+        static const DrmFormatInfo formats[] = {
+            {DRM_FORMAT_XRGB8888, 1U, {4U, 0U, 0U, 0U}, 1U, 1U},
+            {DRM_FORMAT_ARGB8888, 1U, {4U, 0U, 0U, 0U}, 1U, 1U},
+            {DRM_FORMAT_XBGR8888, 1U, {4U, 0U, 0U, 0U}, 1U, 1U},
+            {DRM_FORMAT_ABGR8888, 1U, {4U, 0U, 0U, 0U}, 1U, 1U},
+            {DRM_FORMAT_XRGB2101010, 1U, {4U, 0U, 0U, 0U}, 1U, 1U},
+            {DRM_FORMAT_RGB888, 1U, {3U, 0U, 0U, 0U}, 1U, 1U},
+            {DRM_FORMAT_RGB565, 1U, {2U, 0U, 0U, 0U}, 1U, 1U},
+            {DRM_FORMAT_YUYV, 1U, {2U, 0U, 0U, 0U}, 1U, 1U},
+            {DRM_FORMAT_UYVY, 1U, {2U, 0U, 0U, 0U}, 1U, 1U},
+            {DRM_FORMAT_NV12, 2U, {1U, 2U, 0U, 0U}, 2U, 2U},
+            {DRM_FORMAT_NV21, 2U, {1U, 2U, 0U, 0U}, 2U, 2U},
+            {DRM_FORMAT_NV16, 2U, {1U, 2U, 0U, 0U}, 2U, 1U},
+            {DRM_FORMAT_P010, 2U, {2U, 4U, 0U, 0U}, 2U, 2U},
+            {DRM_FORMAT_YUV420, 3U, {1U, 1U, 1U, 0U}, 2U, 2U},
+            {DRM_FORMAT_YVU420, 3U, {1U, 1U, 1U, 0U}, 2U, 2U},
+        };
+        for (const auto &entry : formats) {
+            if (entry.format == format) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    static uint32_t planeCount(uint32_t format) {
+        const DrmFormatInfo *fmt = info(format);
+        return (fmt != nullptr) ? fmt->planes : 1U;
+    }
+
+    static bool isYuv(uint32_t format) {
+        const DrmFormatInfo *fmt = info(format);
+        return (fmt != nullptr) && ((fmt->planes > 1U) || (format == DRM_FORMAT_YUYV) || (format == DRM_FORMAT_UYVY));
+    }
+
+    /**
+     * @brief Whether @p modifier is a tiled or compressed layout, i.e. a
+     *        framebuffer needs drmModeAddFB2WithModifiers().
+     */
+    static bool hasModifier(uint64_t modifier) {
+        return (modifier != DRM_FORMAT_MOD_LINEAR) && (modifier != DRM_FORMAT_MOD_INVALID);
+    }
+
+    /**
+     * @brief Whether a plane with @p modifiers scans out @p format in
+     *        @p modifier. Without IN_FORMATS only linear buffers are assumed.
+     */
+    static bool supportsModifier(const DrmFormatModifiers &modifiers, uint32_t format, uint64_t modifier) {
+        if (modifiers.empty() == true) {
+            return (hasModifier(modifier) == false);
+        }
+        auto iter = modifiers.find(format);
+        if (iter == modifiers.end()) {
+            return false;
+        }
+        uint64_t wanted = (hasModifier(modifier) == true) ? modifier : DRM_FORMAT_MOD_LINEAR;
+        for (uint64_t supported : iter->second) {
+            if (supported == wanted) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static uint32_t planeWidth(const DrmFormatInfo &fmt, uint32_t plane, uint32_t width) {
+        return (plane == 0U) ? width : (width + fmt.hsub - 1U) / fmt.hsub;
+    }
+
+    static uint32_t planeHeight(const DrmFormatInfo &fmt, uint32_t plane, uint32_t height) {
+        return (plane == 0U) ? height : (height + fmt.vsub - 1U) / fmt.vsub;
+    }
+
+    /**
+     * @brief Compute the pitches and offsets of a contiguous linear buffer.
+     * @param pitch0 Pitch of the first plane, 0 to use the packed width. The
+     *        pitches of the other planes are derived from it, so a pitch
+     *        aligned by the kernel keeps the chroma planes aligned as well.
+     * @return Total size in bytes, 0 if the format is unknown.
+     */
+    static size_t layout(uint32_t format,
+                         uint32_t width,
+                         uint32_t height,
+                         uint32_t pitch0,
+                         uint32_t pitches[DRM_MAX_PLANES],
+                         uint32_t offsets[DRM_MAX_PLANES]) {
+        const DrmFormatInfo *fmt = info(format);
+        if (fmt == nullptr) {
+            return 0U;
+        }
+        size_t size = 0U;
+        for (uint32_t plane = 0U; plane < DRM_MAX_PLANES; plane++) {
+            pitches[plane] = 0U;
+            offsets[plane] = 0U;
+            if (plane >= fmt->planes) {
+                continue;
+            }
+            uint32_t pitch = planeWidth(*fmt, plane, width) * fmt->cpp[plane];
+            if ((pitch0 > 0U) && (plane == 0U)) {
+                pitch = pitch0;
+            } else if ((pitch0 > 0U) && (plane > 0U)) {
+                pitch = (pitch0 * fmt->cpp[plane]) / (fmt->cpp[0] * fmt->hsub);
+            }
+            pitches[plane] = pitch;
+            offsets[plane] = static_cast<uint32_t>(size);
+            size += static_cast<size_t>(pitch) * planeHeight(*fmt, plane, height);
+        }
+        return size;
+    }
+};
+
+} // namespace drm
+} // namespace early
+} // namespace evs
+
+#endif // DRMFORMAT_H
@@ -0,0 +1,152 @@
+#include "DrmFrameScheduler.h"
+#include "CommonUtil.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <xf86drm.h>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay DrmFrameScheduler"
+#endif
+
+#define DEFAULT_PERIOD_NS (16666667U) // 60 Hz, when the mode has no refresh
+#define MAX_SEQUENCE_GAP  (64U)       // flips further apart do not refine the period
+#define PERIOD_WEIGHT     (8)         // flip samples averaged into the period
+
+namespace evs {
+namespace early {
+namespace drm {
+
+DrmFrameScheduler::DrmFrameScheduler(DrmDevice &device)
+    : m_device(device) {
+}
+
+DrmFrameScheduler::~DrmFrameScheduler() {
+    stop();
+}
+
+bool DrmFrameScheduler::start() {
+    bool success = false;
+    do {
+        if ((m_device.isInitialized() == false) || (m_device.eventLoop() == nullptr)) {
+            EARLY_ERROR("Frame scheduling needs an initialized display with an event loop\n");
+            break;
+        }
+        if (m_listenerId != 0U) {
+            success = true;
+            break;
+        }
+
+        uint32_t refreshMilliHz = m_device.mode().refreshMilliHz;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_crtcId = m_device.crtcId();
+            m_periodNs = (refreshMilliHz != 0U) ? (1000000000000ULL / refreshMilliHz) : DEFAULT_PERIOD_NS;
+            m_vblankUs = 0U;
+            m_sequence = 0U;
+            m_renderCount = 0U;
+
+            // Phase before the first flip, drivers without it wait for one
+            uint64_t sequence = 0U;
+            uint64_t ns = 0U;
+            if (drmCrtcGetSequence(m_device.fd(), m_crtcId, &sequence, &ns) == 0) {
+                m_sequence = sequence;
+                m_vblankUs = ns / 1000U;
+            } else {
+                EARLY_DEBUG("No vblank sequence of CRTC %u: %s\n", m_crtcId, strerror(errno));
+            }
+        }
+        m_listenerId = m_device.eventLoop()->addFlipListener([this](const DrmEventLoop::Event &event) { onFlipEvent(event); });
+        success = true;
+    } while (false);
+    return success;
+}
+
+void DrmFrameScheduler::stop() {
+    if ((m_listenerId != 0U) && (m_device.eventLoop() != nullptr)) {
+        m_device.eventLoop()->removeFlipListener(m_listenerId);
+    }
+    m_listenerId = 0U;
+}
+
+uint64_t DrmFrameScheduler::nextStartUs(uint64_t readyUs) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    // Nothing measured yet, frames start right away
+    if ((m_vblankUs == 0U) || (m_renderCount == 0U) || (m_device.isVrrActive() == true)) {
+        return readyUs;
+    }
+    uint64_t budget = budgetLocked();
+    uint64_t vblank = predictLocked(readyUs + budget);
+    return std::max(readyUs, vblank - budget);
+}
+
+uint64_t DrmFrameScheduler::predictVblankUs(uint64_t afterUs) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    return predictLocked(afterUs);
+}
+
+void DrmFrameScheduler::addRenderTime(uint64_t durationUs) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_renderUs[m_renderCount % RENDER_HISTORY] = durationUs;
+    m_renderCount++;
+}
+
+uint64_t DrmFrameScheduler::periodUs() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    return m_periodNs / 1000U;
+}
+
+uint64_t DrmFrameScheduler::budgetUs() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    return budgetLocked();
+}
+
+void DrmFrameScheduler::onFlipEvent(const DrmEventLoop::Event &event) {
+    if (event.crtcId != m_crtcId) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_mtx);
+    // Flip events carry the low 32 bits of the vblank counter
+    uint32_t gap = event.sequence - static_cast<uint32_t>(m_sequence);
+    if ((m_vblankUs != 0U) && (event.timeUs > m_vblankUs) && (gap > 0U) && (gap <= MAX_SEQUENCE_GAP)
+        && (m_device.isVrrActive() == false)) {
+        int64_t sample = static_cast<int64_t>((event.timeUs - m_vblankUs) * 1000U / gap);
+        int64_t period = static_cast<int64_t>(m_periodNs);
+        // A dropped event or a mode change would skew the average
+        if ((sample > period / 2) && (sample < period + period / 2)) {
+            m_periodNs = static_cast<uint64_t>(period + (sample - period) / PERIOD_WEIGHT);
+        }
+    }
+    m_vblankUs = event.timeUs;
+    m_sequence = event.sequence;
+}
+
+uint64_t DrmFrameScheduler::budgetLocked() const {
+    if (m_renderCount == 0U) {
+        // Nothing measured yet, a frame may take a whole period
+        return m_periodNs / 1000U;
+    }
+    size_t count = std::min(m_renderCount, RENDER_HISTORY);
+    uint64_t slowest = 0U;
+    for (size_t i = 0; i < count; ++i) {
+        slowest = std::max(slowest, m_renderUs[i]);
+    }
+    return slowest + m_marginUs;
+}
+
+uint64_t DrmFrameScheduler::predictLocked(uint64_t afterUs) const {
+    if ((m_vblankUs == 0U) || (m_periodNs == 0U)) {
+        return 0U;
+    }
+    if (afterUs < m_vblankUs) {
+        return m_vblankUs;
+    }
+    uint64_t vblanks = (afterUs - m_vblankUs) * 1000U / m_periodNs + 1U;
+    return m_vblankUs + vblanks * m_periodNs / 1000U;
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
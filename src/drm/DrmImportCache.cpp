@@ -0,0 +1,334 @@
+#include "DrmImportCache.h"
+#include "CommonUtil.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <drm/drm.h>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay DrmImportCache"
+#endif
+
+namespace evs {
+namespace early {
+namespace drm {
+
+static inline void hashCombine(size_t &seed, uint64_t value) {
+    seed ^= std::hash<uint64_t>()(value) + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+}
+
+size_t DrmImportCache::KeyHash::operator()(const Key &key) const {
+    size_t seed = 0;
+    hashCombine(seed, static_cast<uint64_t>(key.id.dev));
+    hashCombine(seed, static_cast<uint64_t>(key.id.ino));
+    hashCombine(seed, (static_cast<uint64_t>(key.width) << 32) | key.height);
+    hashCombine(seed, (static_cast<uint64_t>(key.format) << 32) | key.planes);
+    for (uint32_t plane = 0U; plane < key.planes && plane < DRM_MAX_PLANES; plane++) {
+        hashCombine(seed, (static_cast<uint64_t>(key.pitches[plane]) << 32) | key.offsets[plane]);
+    }
+    hashCombine(seed, key.modifier);
+    return seed;
+}
+
+bool DrmImportCache::KeyEqual::operator()(const Key &a, const Key &b) const {
+    return (a.id.dev == b.id.dev)
+           && (a.id.ino == b.id.ino)
+           && (a.width == b.width)
+           && (a.height == b.height)
+           && (a.format == b.format)
+           && (a.planes == b.planes)
+           && (memcmp(a.pitches, b.pitches, sizeof(a.pitches)) == 0)
+           && (memcmp(a.offsets, b.offsets, sizeof(a.offsets)) == 0)
+           && (a.modifier == b.modifier);
+}
+
+size_t DrmImportCache::IdHash::operator()(const BufferId &id) const {
+    size_t seed = 0;
+    hashCombine(seed, static_cast<uint64_t>(id.dev));
+    hashCombine(seed, static_cast<uint64_t>(id.ino));
+    return seed;
+}
+
+bool DrmImportCache::IdEqual::operator()(const BufferId &a, const BufferId &b) const {
+    return (a.dev == b.dev) && (a.ino == b.ino);
+}
+
+DrmImportCache::DrmImportCache(int drmFd, size_t capacity)
+    : m_drmFd(drmFd)
+    , m_capacity(capacity) {
+}
+
+DrmImportCache::~DrmImportCache() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    for (auto &entry : m_entries) {
+        if (entry.second.refs > 0) {
+            EARLY_WARN("Destroying import cache with fbId=%u still referenced %u times\n",
+                       entry.second.buffer->fbId,
+                       entry.second.refs);
+        }
+        destroyLocked(entry.second);
+    }
+    m_entries.clear();
+    m_byBuffer.clear();
+}
+
+const DrmBuffer *DrmImportCache::acquire(int dmaFd, const BufferInfo &info, uint64_t modifier) {
+    struct stat st = {};
+    if (fstat(dmaFd, &st) != 0) {
+        EARLY_ERROR("fstat of dma-buf fd %d failed: %s\n", dmaFd, strerror(errno));
+        return nullptr;
+    }
+
+    Key key = {};
+    key.id.dev = st.st_dev;
+    key.id.ino = st.st_ino;
+    key.width = info.width;
+    key.height = info.height;
+    key.format = static_cast<uint32_t>(info.format);
+    // The modifier may come with the layout instead
+    key.modifier = ((modifier == MODIFIER_NONE) && (DrmFormat::hasModifier(info.modifier) == true)) ? info.modifier : modifier;
+    resolvePlaneLayout(info, key.planes, key.pitches, key.offsets);
+
+    std::unique_lock<std::mutex> lock(m_mtx);
+    auto iter = m_entries.find(key);
+    if (iter != m_entries.end()) {
+        iter->second.refs += 1;
+        iter->second.lastUse = ++m_clock;
+        iter->second.evictPending = false;
+        m_hits++;
+        return iter->second.buffer;
+    }
+
+    m_misses++;
+    DrmBuffer *buffer = importLocked(dmaFd, key, info);
+    if (buffer == nullptr) {
+        return nullptr;
+    }
+
+    Entry entry = {};
+    entry.key = key;
+    entry.buffer = buffer;
+    entry.refs = 1;
+    entry.evictPending = false;
+    entry.lastUse = ++m_clock;
+    m_entries[key] = entry;
+    m_byBuffer[buffer] = key;
+    trimLocked();
+    return buffer;
+}
+
+void DrmImportCache::release(const DrmBuffer *buffer) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    auto keyIter = m_byBuffer.find(buffer);
+    if (keyIter == m_byBuffer.end()) {
+        EARLY_ERROR("Buffer %p is not owned by the import cache\n", static_cast<const void *>(buffer));
+        return;
+    }
+    auto iter = m_entries.find(keyIter->second);
+    if (iter == m_entries.end()) {
+        return;
+    }
+    Entry &entry = iter->second;
+    if (entry.refs > 0) {
+        entry.refs -= 1;
+    }
+    if ((entry.refs == 0) && (entry.evictPending == true)) {
+        m_byBuffer.erase(keyIter);
+        destroyLocked(entry);
+        m_entries.erase(iter);
+    }
+}
+
+void DrmImportCache::evict(int dmaFd) {
+    struct stat st = {};
+    if (fstat(dmaFd, &st) != 0) {
+        EARLY_ERROR("fstat of dma-buf fd %d failed: %s\n", dmaFd, strerror(errno));
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mtx);
+    for (auto iter = m_entries.begin(); iter != m_entries.end();) {
+        Entry &entry = iter->second;
+        if ((entry.key.id.dev != st.st_dev) || (entry.key.id.ino != st.st_ino)) {
+            ++iter;
+            continue;
+        }
+        if (entry.refs > 0) {
+            // Still on screen or queued, drop it on the last release()
+            entry.evictPending = true;
+            ++iter;
+            continue;
+        }
+        m_byBuffer.erase(entry.buffer);
+        destroyLocked(entry);
+        iter = m_entries.erase(iter);
+    }
+}
+
+void DrmImportCache::purge() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    for (auto iter = m_entries.begin(); iter != m_entries.end();) {
+        if (iter->second.refs > 0) {
+            ++iter;
+            continue;
+        }
+        m_byBuffer.erase(iter->second.buffer);
+        destroyLocked(iter->second);
+        iter = m_entries.erase(iter);
+    }
+}
+
+size_t DrmImportCache::size() const {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    return m_entries.size();
+}
+
+DrmBuffer *DrmImportCache::importLocked(int dmaFd, const Key &key, const BufferInfo &info) {
+    HandleRef *handleRef = nullptr;
+    auto handleIter = m_handles.find(key.id);
+    if (handleIter != m_handles.end()) {
+        handleRef = &handleIter->second;
+    } else {
+        int ownFd = fcntl(dmaFd, F_DUPFD_CLOEXEC, 0);
+        if (ownFd < 0) {
+            EARLY_ERROR("Failed to duplicate dma-buf fd %d: %s\n", dmaFd, strerror(errno));
+            return nullptr;
+        }
+        // Shared with PrimeImportAllocator imports of the same dma-buf
+        uint32_t handle = 0U;
+        int err = PrimeHandles::import(m_drmFd, ownFd, handle);
+        if (err != 0) {
+            EARLY_ERROR("DRM_IOCTL_PRIME_FD_TO_HANDLE failed: %s\n", strerror(-err));
+            close(ownFd);
+            return nullptr;
+        }
+        HandleRef ref = {};
+        ref.handle = handle;
+        ref.fd = ownFd;
+        ref.refs = 0;
+        handleRef = &(m_handles[key.id] = ref);
+    }
+
+    uint32_t handles[DRM_MAX_PLANES] = {};
+    uint64_t modifiers[DRM_MAX_PLANES] = {};
+    for (uint32_t plane = 0U; plane < key.planes; plane++) {
+        handles[plane] = handleRef->handle;
+        modifiers[plane] = key.modifier;
+    }
+    uint32_t fbId = 0;
+    int ret = 0;
+    if (key.modifier != MODIFIER_NONE) {
+        ret = drmModeAddFB2WithModifiers(m_drmFd, key.width, key.height, key.format, handles, key.pitches, key.offsets, modifiers, &fbId, DRM_MODE_FB_MODIFIERS);
+        if (ret != 0) {
+            EARLY_ERROR("Failed to add framebuffer %ux%u format 0x%x modifier 0x%llx for dma-buf %d: %s\n",
+                        key.width,
+                        key.height,
+                        key.format,
+                        static_cast<unsigned long long>(key.modifier),
+                        dmaFd,
+                        strerror(errno));
+        }
+    } else {
+        ret = addFramebuffer(m_drmFd, info, handles, key.pitches, key.offsets, fbId);
+    }
+
+    DrmBuffer *buffer = nullptr;
+    if (ret == 0) {
+        buffer = new (std::nothrow) DrmBuffer();
+        if (buffer == nullptr) {
+            drmModeRmFB(m_drmFd, fbId);
+        }
+    }
+
+    if (buffer == nullptr) {
+        if (handleRef->refs == 0) {
+            PrimeHandles::release(m_drmFd, handleRef->handle);
+            close(handleRef->fd);
+            m_handles.erase(key.id);
+        }
+        return nullptr;
+    }
+
+    handleRef->refs += 1;
+    memset(buffer, 0, sizeof(DrmBuffer));
+    buffer->fbId = fbId;
+    buffer->handle = handleRef->handle;
+    buffer->stride = key.pitches[0];
+    buffer->offset = key.offsets[0];
+    buffer->size = info.size;
+    buffer->ptr = nullptr;
+    buffer->tag = info.tag;
+    buffer->fd = handleRef->fd;
+    buffer->allocator = AllocatorType::DRM_ALLOCATOR_IMPORT;
+    buffer->modifier = (key.modifier != MODIFIER_NONE) ? key.modifier : DRM_FORMAT_MOD_LINEAR;
+    buffer->format = key.format;
+    buffer->planeCount = key.planes;
+    for (uint32_t plane = 0U; plane < DRM_MAX_PLANES; plane++) {
+        buffer->handles[plane] = handles[plane];
+        buffer->strides[plane] = key.pitches[plane];
+        buffer->offsets[plane] = key.offsets[plane];
+        buffer->planeFds[plane] = -1;
+    }
+    EARLY_DEBUG("Imported dma-buf %d as fbId=%u, handle=0x%x, %ux%u format 0x%x\n",
+                dmaFd,
+                fbId,
+                buffer->handle,
+                key.width,
+                key.height,
+                key.format);
+    return buffer;
+}
+
+void DrmImportCache::destroyLocked(Entry &entry) {
+    if (entry.buffer == nullptr) {
+        return;
+    }
+    if (entry.buffer->fbId != 0) {
+        drmModeRmFB(m_drmFd, entry.buffer->fbId);
+    }
+    auto handleIter = m_handles.find(entry.key.id);
+    if (handleIter != m_handles.end()) {
+        HandleRef &ref = handleIter->second;
+        if (ref.refs > 0) {
+            ref.refs -= 1;
+        }
+        if (ref.refs == 0) {
+            PrimeHandles::release(m_drmFd, ref.handle);
+            close(ref.fd);
+            m_handles.erase(handleIter);
+        }
+    }
+    delete entry.buffer;
+    entry.buffer = nullptr;
+}
+
+void DrmImportCache::trimLocked() {
+    while (m_entries.size() > m_capacity) {
+        auto victim = m_entries.end();
+        for (auto iter = m_entries.begin(); iter != m_entries.end(); ++iter) {
+            if (iter->second.refs > 0) {
+                continue;
+            }
+            if ((victim == m_entries.end()) || (iter->second.lastUse < victim->second.lastUse)) {
+                victim = iter;
+            }
+        }
+        if (victim == m_entries.end()) {
+            break;
+        }
+        m_byBuffer.erase(victim->second.buffer);
+        destroyLocked(victim->second);
+        m_entries.erase(victim);
+    }
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
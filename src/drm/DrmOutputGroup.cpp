@@ -0,0 +1,568 @@
+#include "DrmOutputGroup.h"
+#include "CommonUtil.h"
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay DrmOutputGroup"
+#endif
+
+#define DISPATCH_RETRY_MS (2) // wait slice while another thread dispatches events
+
+namespace evs {
+namespace early {
+namespace drm {
+
+using BufferState = DrmDevice::BufferState;
+
+DrmOutputGroup::DrmOutputGroup(DrmDevice &device)
+    : m_device(device) {
+}
+
+DrmOutputGroup::~DrmOutputGroup() {
+    deInit();
+}
+
+bool DrmOutputGroup::route(const std::vector<uint32_t> &masks, const std::vector<int> &preferred, std::vector<int> &crtcIndices) const {
+    // Few outputs and CRTCs: a depth first search over the masks finds a
+    // routing whenever one exists, trying the bound CRTC of each output first
+    size_t output = 0U;
+    for (; output < crtcIndices.size(); ++output) {
+        if (crtcIndices[output] < 0) {
+            break;
+        }
+    }
+    if (output == crtcIndices.size()) {
+        return true;
+    }
+
+    std::vector<int> candidates{};
+    if (preferred[output] >= 0) {
+        candidates.push_back(preferred[output]);
+    }
+    for (int i = 0; i < 32; ++i) {
+        if (i != preferred[output]) {
+            candidates.push_back(i);
+        }
+    }
+    for (int crtc : candidates) {
+        bool used = std::find(crtcIndices.begin(), crtcIndices.end(), crtc) != crtcIndices.end();
+        if (((masks[output] & (1U << crtc)) == 0U) || (used == true)) {
+            continue;
+        }
+        crtcIndices[output] = crtc;
+        if (route(masks, preferred, crtcIndices) == true) {
+            return true;
+        }
+        crtcIndices[output] = -1;
+    }
+    return false;
+}
+
+bool DrmOutputGroup::allocateChain(Swapchain &chain, uint32_t width, uint32_t height, uint32_t format, int count) {
+    BufferInfo info = {};
+    info.width = width;
+    info.height = height;
+    info.bpp = 32U;
+    info.depth = 24U;
+    info.format = static_cast<int>(format);
+    info.tag = MemoryTag::DISPLAY;
+
+    chain = Swapchain{};
+    chain.count = std::min(std::max(count, DrmDevice::MIN_BUFFER_COUNT), DrmDevice::MAX_BUFFER_COUNT);
+    chain.queued = -1;
+    chain.pending = -1;
+    chain.scanout = -1;
+    for (int i = 0; i < chain.count; ++i) {
+        chain.buffers[i] = m_device.bufferPool()->acquire(m_device.allocatorType(), info);
+        if (chain.buffers[i] == nullptr) {
+            EARLY_ERROR("Failed to allocate %ux%u buffer %d\n", width, height, i);
+            return false;
+        }
+        chain.states[i] = BufferState::FREE;
+    }
+    return true;
+}
+
+bool DrmOutputGroup::addOutput(DrmAtomicRequest &req, const OutputState &output, const DrmBuffer *buffer, bool modeset) {
+    const Output &info = output.info;
+    bool added = req.add(info.planeId, DRM_MODE_OBJECT_PLANE, "FB_ID", buffer->fbId);
+    if ((added == true) && (modeset == true)) {
+        // Mirrored outputs scale the shared buffer to their own mode
+        const Output &source = m_outputs[0].info;
+        uint64_t srcW = static_cast<uint64_t>((m_content == Content::MIRRORED) ? source.width : info.width) << 16;
+        uint64_t srcH = static_cast<uint64_t>((m_content == Content::MIRRORED) ? source.height : info.height) << 16;
+        added = req.add(info.connectorId, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", info.crtcId)
+                && req.add(info.crtcId, DRM_MODE_OBJECT_CRTC, "MODE_ID", output.modeBlobId)
+                && req.add(info.crtcId, DRM_MODE_OBJECT_CRTC, "ACTIVE", 1U)
+                && req.add(info.planeId, DRM_MODE_OBJECT_PLANE, "CRTC_ID", info.crtcId)
+                && req.add(info.planeId, DRM_MODE_OBJECT_PLANE, "SRC_X", 0U)
+                && req.add(info.planeId, DRM_MODE_OBJECT_PLANE, "SRC_Y", 0U)
+                && req.add(info.planeId, DRM_MODE_OBJECT_PLANE, "SRC_W", srcW)
+                && req.add(info.planeId, DRM_MODE_OBJECT_PLANE, "SRC_H", srcH)
+                && req.add(info.planeId, DRM_MODE_OBJECT_PLANE, "CRTC_X", 0U)
+                && req.add(info.planeId, DRM_MODE_OBJECT_PLANE, "CRTC_Y", 0U)
+                && req.add(info.planeId, DRM_MODE_OBJECT_PLANE, "CRTC_W", info.width)
+                && req.add(info.planeId, DRM_MODE_OBJECT_PLANE, "CRTC_H", info.height);
+    }
+    if (added == false) {
+        EARLY_ERROR("Missing atomic properties on connector %u / CRTC %u / plane %u\n",
+                    info.connectorId,
+                    info.crtcId,
+                    info.planeId);
+    }
+    return added;
+}
+
+bool DrmOutputGroup::init(const std::vector<uint32_t> &connectorIds, Content content, int bufferCount, uint32_t format) {
+    bool success = false;
+    int fd = m_device.fd();
+    std::vector<drmModeModeInfo> modes{};
+    drmModeRes *resources = nullptr;
+
+    do {
+        if (m_initialized == true) {
+            EARLY_ERROR("Output group already initialized\n");
+            return false;
+        }
+        if ((fd < 0) || connectorIds.empty() || (connectorIds.size() > MAX_OUTPUTS)) {
+            EARLY_ERROR("Invalid output group: fd %d, %zu connectors\n", fd, connectorIds.size());
+            break;
+        }
+        resources = drmModeGetResources(fd);
+        if (resources == nullptr) {
+            EARLY_ERROR("Failed to get DRM resources: %s\n", strerror(errno));
+            break;
+        }
+
+        // Connector modes and the CRTCs its encoders can drive
+        std::vector<uint32_t> masks{};
+        std::vector<int> preferred{};
+        bool found = true;
+        for (uint32_t connectorId : connectorIds) {
+            drmModeConnector *conn = drmModeGetConnectorCurrent(fd, connectorId);
+            if ((conn == nullptr) || (conn->connection != DRM_MODE_CONNECTED) || (conn->count_modes <= 0)) {
+                EARLY_ERROR("Connector %u is not connected\n", connectorId);
+                drmModeFreeConnector(conn);
+                found = false;
+                break;
+            }
+            drmModeModeInfo mode = conn->modes[0];
+            for (int i = 0; i < conn->count_modes; ++i) {
+                if ((conn->modes[i].type & DRM_MODE_TYPE_PREFERRED) != 0U) {
+                    mode = conn->modes[i];
+                    break;
+                }
+            }
+
+            uint32_t mask = 0U;
+            int bound = -1;
+            for (int i = 0; i < conn->count_encoders; ++i) {
+                drmModeEncoder *enc = drmModeGetEncoder(fd, conn->encoders[i]);
+                if (enc == nullptr) {
+                    continue;
+                }
+                mask |= enc->possible_crtcs;
+                if ((enc->encoder_id == conn->encoder_id) && (enc->crtc_id != 0U)) {
+                    bound = DrmDevice::crtcIndexOf(fd, enc->crtc_id);
+                }
+                drmModeFreeEncoder(enc);
+            }
+            drmModeFreeConnector(conn);
+            modes.push_back(mode);
+            masks.push_back(mask);
+            preferred.push_back(bound);
+        }
+        if (found == false) {
+            break;
+        }
+
+        std::vector<int> crtcIndices(connectorIds.size(), -1);
+        if (route(masks, preferred, crtcIndices) == false) {
+            EARLY_ERROR("No CRTC routing for %zu connectors\n", connectorIds.size());
+            break;
+        }
+
+        m_atomic = m_device.isAtomic();
+        m_content = content;
+        found = true;
+        for (size_t i = 0; i < connectorIds.size(); ++i) {
+            if ((crtcIndices[i] < 0) || (crtcIndices[i] >= resources->count_crtcs)) {
+                found = false;
+                break;
+            }
+            OutputState output = {};
+            output.info.connectorId = connectorIds[i];
+            output.info.crtcId = resources->crtcs[crtcIndices[i]];
+            output.info.crtcIndex = crtcIndices[i];
+            output.info.width = modes[i].hdisplay;
+            output.info.height = modes[i].vdisplay;
+            output.info.refreshRate = modes[i].vrefresh;
+            output.chain = (content == Content::MIRRORED) ? 0U : i;
+            if (m_atomic == true) {
+                output.info.planeId = DrmDevice::primaryPlaneOf(fd, *m_device.propertyCache(), output.info.crtcId);
+                if ((output.info.planeId == 0U)
+                    || (drmModeCreatePropertyBlob(fd, &modes[i], sizeof(drmModeModeInfo), &output.modeBlobId) != 0)) {
+                    EARLY_WARN("No primary plane or mode blob for CRTC %u, using legacy KMS\n", output.info.crtcId);
+                    m_atomic = false;
+                }
+            }
+            m_outputs.push_back(output);
+            EARLY_DEBUG("Output %zu: connector %u -> CRTC %u (index %d), %ux%u@%u\n",
+                        i,
+                        output.info.connectorId,
+                        output.info.crtcId,
+                        output.info.crtcIndex,
+                        output.info.width,
+                        output.info.height,
+                        output.info.refreshRate);
+        }
+        if (found == false) {
+            break;
+        }
+
+        m_chains.resize((content == Content::MIRRORED) ? 1U : m_outputs.size());
+        bool allocated = true;
+        for (size_t i = 0; (i < m_chains.size()) && allocated; ++i) {
+            const Output &size = m_outputs[i].info;
+            allocated = allocateChain(m_chains[i], size.width, size.height, format, bufferCount);
+        }
+        if (allocated == false) {
+            break;
+        }
+
+        // Buffer 0 of every swapchain goes on screen with the modeset
+        bool modesetDone = false;
+        if (m_atomic == true) {
+            DrmAtomicRequest req(*m_device.propertyCache());
+            bool added = true;
+            for (const OutputState &output : m_outputs) {
+                added = added && addOutput(req, output, m_chains[output.chain].buffers[0], true);
+            }
+            uint32_t flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
+            if ((added == true) && (req.commit(fd, flags | DRM_MODE_ATOMIC_TEST_ONLY) == 0) && (req.commit(fd, flags) == 0)) {
+                m_combinedSupported = true;
+                modesetDone = true;
+            } else {
+                // Some drivers only take one CRTC per commit
+                EARLY_WARN("Combined modeset of %zu outputs rejected, one commit per output\n", m_outputs.size());
+                modesetDone = added;
+                for (const OutputState &output : m_outputs) {
+                    DrmAtomicRequest single(*m_device.propertyCache());
+                    modesetDone = modesetDone && addOutput(single, output, m_chains[output.chain].buffers[0], true)
+                                  && (single.commit(fd, flags) == 0);
+                }
+            }
+        } else {
+            modesetDone = true;
+            for (size_t i = 0; (i < m_outputs.size()) && modesetDone; ++i) {
+                Output &info = m_outputs[i].info;
+                info.planeId = 0U;
+                const DrmBuffer *buffer = m_chains[m_outputs[i].chain].buffers[0];
+                modesetDone = (drmModeSetCrtc(fd, info.crtcId, buffer->fbId, 0, 0, &info.connectorId, 1, &modes[i]) == 0);
+                if (modesetDone == false) {
+                    EARLY_ERROR("Failed to set CRTC %u for connector %u: %s\n", info.crtcId, info.connectorId, strerror(errno));
+                }
+            }
+        }
+        if (modesetDone == false) {
+            EARLY_ERROR("Modeset of the output group failed\n");
+            break;
+        }
+
+        for (Swapchain &chain : m_chains) {
+            chain.states[0] = BufferState::SCANOUT;
+            chain.scanout = 0;
+            chain.last = 0;
+        }
+        m_combined = m_combinedSupported;
+        m_pendingFlips = 0;
+        m_listenerId = m_device.eventLoop()->addFlipListener([this](const DrmEventLoop::Event &event) { onFlipEvent(event); });
+        m_initialized = true;
+        success = true;
+    } while (false);
+
+    if (resources != nullptr) {
+        drmModeFreeResources(resources);
+    }
+    if (success == false) {
+        deInit();
+    }
+    return success;
+}
+
+void DrmOutputGroup::deInit() {
+    if (m_initialized == true) {
+        waitIdle(-1);
+        m_device.eventLoop()->removeFlipListener(m_listenerId);
+        m_listenerId = 0U;
+    }
+    for (Swapchain &chain : m_chains) {
+        for (int i = 0; i < chain.count; ++i) {
+            if (chain.buffers[i] != nullptr) {
+                m_device.bufferPool()->park(chain.buffers[i]);
+                chain.buffers[i] = nullptr;
+            }
+        }
+    }
+    for (const OutputState &output : m_outputs) {
+        if (output.modeBlobId != 0U) {
+            drmModeDestroyPropertyBlob(m_device.fd(), output.modeBlobId);
+        }
+    }
+    m_chains.clear();
+    m_outputs.clear();
+    m_combinedSupported = false;
+    m_combined = false;
+    m_initialized = false;
+}
+
+DrmBuffer *DrmOutputGroup::buffer(size_t output, int index) const {
+    if ((output >= m_outputs.size()) || (index < 0)) {
+        return nullptr;
+    }
+    const Swapchain &chain = m_chains[m_outputs[output].chain];
+    return (index < chain.count) ? chain.buffers[index] : nullptr;
+}
+
+bool DrmOutputGroup::waitIdle(int timeoutMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    auto idle = [this]() { return (m_pendingFlips <= 0); };
+    DrmEventLoop *loop = m_device.eventLoop();
+    while (true) {
+        int remaining = -1;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            if (idle() == true) {
+                return true;
+            }
+            if (timeoutMs >= 0) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                if (left.count() <= 0) {
+                    return false;
+                }
+                remaining = static_cast<int>(left.count());
+            }
+            if (loop->isRunning() == true) {
+                if (timeoutMs < 0) {
+                    m_cv.wait(lock, idle);
+                    return true;
+                }
+                return m_cv.wait_until(lock, deadline, idle);
+            }
+        }
+
+        int ret = loop->tryDispatch(remaining);
+        if (ret == -EBUSY) {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv.wait_for(lock, std::chrono::milliseconds(DISPATCH_RETRY_MS), idle);
+        } else if (ret < 0) {
+            return false;
+        }
+    }
+}
+
+int DrmOutputGroup::acquireBuffer(size_t output, int timeoutMs) {
+    if ((m_initialized == false) || (output >= m_outputs.size())) {
+        return -1;
+    }
+    Swapchain &chain = m_chains[m_outputs[output].chain];
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            for (int n = 1; n <= chain.count; ++n) {
+                int i = (chain.last + n) % chain.count;
+                if (chain.states[i] == BufferState::FREE) {
+                    chain.states[i] = BufferState::ACQUIRED;
+                    chain.last = i;
+                    return i;
+                }
+            }
+        }
+
+        // Buffers are freed by flips, none in flight means none will be
+        int left = -1;
+        if (timeoutMs >= 0) {
+            left = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+            if (left <= 0) {
+                return -1;
+            }
+        }
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            if (m_pendingFlips <= 0) {
+                return -1;
+            }
+        }
+        if (waitIdle(left) == false) {
+            return -1;
+        }
+    }
+}
+
+bool DrmOutputGroup::queueBuffer(size_t output, int index) {
+    if ((m_initialized == false) || (buffer(output, index) == nullptr)) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(m_mtx);
+    Swapchain &chain = m_chains[m_outputs[output].chain];
+    if (chain.states[index] != BufferState::ACQUIRED) {
+        EARLY_ERROR("Buffer %d of output %zu is not acquired\n", index, output);
+        return false;
+    }
+    if ((chain.queued >= 0) && (chain.queued != index)) {
+        chain.states[chain.queued] = BufferState::FREE;
+    }
+    chain.states[index] = BufferState::QUEUED;
+    chain.queued = index;
+    return true;
+}
+
+bool DrmOutputGroup::commit(bool useVSync) {
+    if (m_initialized == false) {
+        return false;
+    }
+    waitIdle(-1);
+
+    int fd = m_device.fd();
+    std::unique_lock<std::mutex> lock(m_mtx);
+    bool queued = false;
+    for (const Swapchain &chain : m_chains) {
+        queued = queued || (chain.queued >= 0);
+    }
+    if (queued == false) {
+        return false;
+    }
+
+    // The event frees the buffer on screen, also for flips without vsync:
+    // those are asynchronous where the driver supports it, vsynced otherwise
+    bool async = (useVSync == false) && m_device.isAsyncFlipSupported(m_atomic);
+    uint32_t flipFlags = DRM_MODE_PAGE_FLIP_EVENT | (async ? DRM_MODE_PAGE_FLIP_ASYNC : 0U);
+    uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | flipFlags;
+    int flips = 0;
+    bool success = true;
+    std::vector<bool> flipped(m_chains.size(), false); // chains shown by at least one CRTC
+    if ((m_atomic == true) && (m_combined == true)) {
+        DrmAtomicRequest req(*m_device.propertyCache());
+        size_t added = 0U;
+        for (OutputState &output : m_outputs) {
+            const Swapchain &chain = m_chains[output.chain];
+            if ((chain.queued >= 0) && (addOutput(req, output, chain.buffers[chain.queued], false) == true)) {
+                output.flipPending = true;
+                flipped[output.chain] = true;
+                added++;
+            }
+        }
+        int ret = req.commit(fd, flags, this);
+        if ((ret == -EINVAL) && (async == true)) {
+            // e.g. a format the driver does not flip asynchronously
+            ret = req.commit(fd, flags & ~static_cast<uint32_t>(DRM_MODE_PAGE_FLIP_ASYNC), this);
+        }
+        m_commits++;
+        if (ret != 0) {
+            EARLY_ERROR("Combined commit of %zu outputs failed: %s\n", added, strerror(-ret));
+            success = false;
+            flipped.assign(m_chains.size(), false);
+        }
+        flips = success ? static_cast<int>(added) : 0;
+    } else {
+        // One commit per output, each CRTC flips on its own
+        for (OutputState &output : m_outputs) {
+            const Swapchain &chain = m_chains[output.chain];
+            if (chain.queued < 0) {
+                continue;
+            }
+            const DrmBuffer *buffer = chain.buffers[chain.queued];
+            int ret = 0;
+            if (m_atomic == true) {
+                DrmAtomicRequest req(*m_device.propertyCache());
+                bool added = addOutput(req, output, buffer, false);
+                ret = added ? req.commit(fd, flags, this) : -EINVAL;
+                if ((added == true) && (ret == -EINVAL) && (async == true)) {
+                    ret = req.commit(fd, flags & ~static_cast<uint32_t>(DRM_MODE_PAGE_FLIP_ASYNC), this);
+                }
+            } else {
+                ret = (drmModePageFlip(fd, output.info.crtcId, buffer->fbId, flipFlags, this) == 0) ? 0 : -errno;
+                if ((ret == -EINVAL) && (async == true)) {
+                    ret = (drmModePageFlip(fd, output.info.crtcId, buffer->fbId, DRM_MODE_PAGE_FLIP_EVENT, this) == 0) ? 0 : -errno;
+                }
+            }
+            m_commits++;
+            if (ret != 0) {
+                EARLY_ERROR("Flip of CRTC %u failed: %s\n", output.info.crtcId, strerror(-ret));
+                success = false;
+                continue;
+            }
+            output.flipPending = true;
+            flipped[output.chain] = true;
+            flips++;
+        }
+    }
+
+    // A buffer one CRTC took is read even if a mirror failed, only the
+    // chains no CRTC flipped to get theirs back
+    for (size_t i = 0; i < m_chains.size(); i++) {
+        Swapchain &chain = m_chains[i];
+        if (chain.queued < 0) {
+            continue;
+        }
+        chain.states[chain.queued] = flipped[i] ? BufferState::PENDING : BufferState::FREE;
+        chain.pending = flipped[i] ? chain.queued : -1;
+        chain.queued = -1;
+    }
+    m_pendingFlips = flips;
+    if (m_pendingFlips == 0) {
+        // Nothing flipped, no event will come: the chains whose flip failed
+        // got their buffer back, what is on screen stays there
+        completeLocked();
+    }
+    return success;
+}
+
+void DrmOutputGroup::completeLocked() {
+    for (Swapchain &chain : m_chains) {
+        if (chain.pending < 0) {
+            continue;
+        }
+        if ((chain.scanout >= 0) && (chain.scanout != chain.pending)) {
+            chain.states[chain.scanout] = BufferState::FREE;
+        }
+        chain.scanout = chain.pending;
+        chain.states[chain.scanout] = BufferState::SCANOUT;
+        chain.pending = -1;
+    }
+    for (OutputState &output : m_outputs) {
+        output.flipPending = false;
+    }
+    m_frames++;
+    m_cv.notify_all();
+}
+
+void DrmOutputGroup::onFlipEvent(const DrmEventLoop::Event &event) {
+    if (event.userData != this) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_mtx);
+    for (OutputState &output : m_outputs) {
+        if ((output.info.crtcId == event.crtcId) && (output.flipPending == true)) {
+            output.flipPending = false;
+            m_pendingFlips--;
+            break;
+        }
+    }
+    // A mirrored buffer is on screen once every display flipped to it
+    if (m_pendingFlips == 0) {
+        completeLocked();
+    }
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
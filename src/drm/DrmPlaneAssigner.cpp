@@ -0,0 +1,351 @@
+#include "DrmPlaneAssigner.h"
+#include "CommonUtil.h"
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <algorithm>
+#include <cstring>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay DrmPlaneAssigner"
+#endif
+
+namespace evs {
+namespace early {
+namespace drm {
+
+static inline bool sameRect(const DrmRect &a, const DrmRect &b) {
+    return (a.x == b.x) && (a.y == b.y) && (a.width == b.width) && (a.height == b.height);
+}
+
+static const char *colorEncodingName(DrmColorEncoding encoding) {
+    switch (encoding) {
+    case DrmColorEncoding::BT601:
+        return "ITU-R BT.601 YCbCr";
+    case DrmColorEncoding::BT709:
+        return "ITU-R BT.709 YCbCr";
+    case DrmColorEncoding::BT2020:
+        return "ITU-R BT.2020 YCbCr";
+    default:
+        return nullptr;
+    }
+}
+
+static const char *colorRangeName(DrmColorRange range) {
+    switch (range) {
+    case DrmColorRange::LIMITED:
+        return "YCbCr limited range";
+    case DrmColorRange::FULL:
+        return "YCbCr full range";
+    default:
+        return nullptr;
+    }
+}
+
+DrmPlaneAssigner::DrmPlaneAssigner(int drmFd, DrmPropertyCache &props)
+    : m_drmFd(drmFd)
+    , m_props(props) {
+}
+
+bool DrmPlaneAssigner::init(uint32_t crtcId, int crtcIndex, uint32_t primaryPlaneId) {
+    reset();
+    if ((crtcIndex < 0) || (primaryPlaneId == 0U)) {
+        return false;
+    }
+    m_crtcId = crtcId;
+
+    drmModePlaneRes *planeRes = drmModeGetPlaneResources(m_drmFd);
+    if (planeRes == nullptr) {
+        EARLY_ERROR("Failed to get plane resources: %s\n", strerror(errno));
+        return false;
+    }
+    for (uint32_t i = 0; i < planeRes->count_planes; ++i) {
+        drmModePlane *plane = drmModeGetPlane(m_drmFd, planeRes->planes[i]);
+        if (plane == nullptr) {
+            continue;
+        }
+
+        uint64_t type = DRM_PLANE_TYPE_OVERLAY;
+        m_props.value(plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", type);
+        // Other primary planes belong to other CRTCs, cursors are too small
+        bool usable = ((plane->possible_crtcs & (1U << crtcIndex)) != 0U)
+                      && (type != DRM_PLANE_TYPE_CURSOR)
+                      && ((type != DRM_PLANE_TYPE_PRIMARY) || (plane->plane_id == primaryPlaneId));
+        if (usable == false) {
+            drmModeFreePlane(plane);
+            continue;
+        }
+
+        Plane info = {};
+        info.id = plane->plane_id;
+        info.type = type;
+        info.formats.assign(plane->formats, plane->formats + plane->count_formats);
+        m_props.formatModifiers(plane->plane_id, info.modifiers);
+        info.zposMutable = false;
+        info.zposMin = (type == DRM_PLANE_TYPE_PRIMARY) ? 0U : 1U;
+        info.zposMax = info.zposMin;
+
+        uint32_t zposId = m_props.id(plane->plane_id, DRM_MODE_OBJECT_PLANE, "zpos");
+        drmModePropertyRes *zpos = (zposId != 0U) ? drmModeGetProperty(m_drmFd, zposId) : nullptr;
+        if (zpos != nullptr) {
+            uint64_t current = info.zposMin;
+            m_props.value(plane->plane_id, DRM_MODE_OBJECT_PLANE, "zpos", current);
+            info.zposMutable = ((zpos->flags & DRM_MODE_PROP_IMMUTABLE) == 0U);
+            if (((zpos->flags & DRM_MODE_PROP_RANGE) != 0U) && (zpos->count_values >= 2) && info.zposMutable) {
+                info.zposMin = zpos->values[0];
+                info.zposMax = zpos->values[1];
+            } else {
+                info.zposMin = current;
+                info.zposMax = current;
+            }
+            drmModeFreeProperty(zpos);
+        }
+
+        // Overlays left on by a previous user are switched off by the first commit
+        if ((type != DRM_PLANE_TYPE_PRIMARY) && (plane->crtc_id == crtcId) && (plane->fb_id != 0U)) {
+            m_active.insert(plane->plane_id);
+        }
+        m_planes.push_back(std::move(info));
+        drmModeFreePlane(plane);
+    }
+    drmModeFreePlaneResources(planeRes);
+
+    std::stable_sort(m_planes.begin(), m_planes.end(), [](const Plane &a, const Plane &b) {
+        bool aPrimary = (a.type == DRM_PLANE_TYPE_PRIMARY);
+        bool bPrimary = (b.type == DRM_PLANE_TYPE_PRIMARY);
+        if (aPrimary != bPrimary) {
+            return aPrimary;
+        }
+        return (a.zposMin != b.zposMin) ? (a.zposMin < b.zposMin) : (a.id < b.id);
+    });
+    EARLY_DEBUG("%zu planes usable on CRTC %u\n", m_planes.size(), crtcId);
+    return (m_planes.empty() == false);
+}
+
+void DrmPlaneAssigner::reset() {
+    m_crtcId = 0U;
+    m_planes.clear();
+    m_active.clear();
+    m_cache.clear();
+    m_cacheValid = false;
+}
+
+bool DrmPlaneAssigner::supports(const Plane &plane, const DrmLayer &layer) const {
+    if (std::find(plane.formats.begin(), plane.formats.end(), layer.format) == plane.formats.end()) {
+        return false;
+    }
+    // The swapchain is linear, other buffers bring their layout
+    uint64_t modifier = (layer.buffer != nullptr) ? layer.buffer->modifier : DRM_FORMAT_MOD_LINEAR;
+    return DrmFormat::supportsModifier(plane.modifiers, layer.format, modifier);
+}
+
+bool DrmPlaneAssigner::mapPlanes(std::vector<DrmLayer> &layers, size_t lo, size_t hi, int client) const {
+    for (auto &layer : layers) {
+        layer.planeId = 0U;
+    }
+
+    // Layers [lo, hi] are composed on the GPU and share the plane of the client layer
+    size_t p = 0;
+    for (size_t i = 0; i < layers.size(); ++i) {
+        size_t index = i;
+        if ((client >= 0) && (i >= lo) && (i <= hi)) {
+            if (i != lo) {
+                continue;
+            }
+            index = static_cast<size_t>(client);
+        }
+        while ((p < m_planes.size()) && (supports(m_planes[p], layers[index]) == false)) {
+            p++;
+        }
+        if (p == m_planes.size()) {
+            return false;
+        }
+        layers[index].planeId = m_planes[p].id;
+        p++;
+    }
+    return true;
+}
+
+bool DrmPlaneAssigner::addLayer(DrmAtomicRequest &req, const DrmLayer &layer, uint32_t fbId, uint64_t zpos) {
+    uint32_t planeId = layer.planeId;
+    bool added = req.add(planeId, DRM_MODE_OBJECT_PLANE, "FB_ID", fbId)
+                 && req.add(planeId, DRM_MODE_OBJECT_PLANE, "CRTC_ID", m_crtcId)
+                 && req.add(planeId, DRM_MODE_OBJECT_PLANE, "SRC_X", static_cast<uint64_t>(layer.src.x) << 16)
+                 && req.add(planeId, DRM_MODE_OBJECT_PLANE, "SRC_Y", static_cast<uint64_t>(layer.src.y) << 16)
+                 && req.add(planeId, DRM_MODE_OBJECT_PLANE, "SRC_W", static_cast<uint64_t>(layer.src.width) << 16)
+                 && req.add(planeId, DRM_MODE_OBJECT_PLANE, "SRC_H", static_cast<uint64_t>(layer.src.height) << 16)
+                 && req.add(planeId, DRM_MODE_OBJECT_PLANE, "CRTC_X", static_cast<uint64_t>(static_cast<int64_t>(layer.dst.x)))
+                 && req.add(planeId, DRM_MODE_OBJECT_PLANE, "CRTC_Y", static_cast<uint64_t>(static_cast<int64_t>(layer.dst.y)))
+                 && req.add(planeId, DRM_MODE_OBJECT_PLANE, "CRTC_W", layer.dst.width)
+                 && req.add(planeId, DRM_MODE_OBJECT_PLANE, "CRTC_H", layer.dst.height);
+    if (added == false) {
+        return false;
+    }
+
+    // A plane that cannot convert as asked would show wrong colours, fail the mapping instead
+    const char *encoding = colorEncodingName(layer.encoding);
+    const char *range = colorRangeName(layer.range);
+    uint64_t value = 0U;
+    if (encoding != nullptr) {
+        if ((m_props.enumValue(planeId, DRM_MODE_OBJECT_PLANE, "COLOR_ENCODING", encoding, value) == false)
+            || (req.add(planeId, DRM_MODE_OBJECT_PLANE, "COLOR_ENCODING", value) == false)) {
+            return false;
+        }
+    }
+    if (range != nullptr) {
+        if ((m_props.enumValue(planeId, DRM_MODE_OBJECT_PLANE, "COLOR_RANGE", range, value) == false)
+            || (req.add(planeId, DRM_MODE_OBJECT_PLANE, "COLOR_RANGE", value) == false)) {
+            return false;
+        }
+    }
+
+    for (const Plane &plane : m_planes) {
+        if ((plane.id == planeId) && (plane.zposMutable == true)) {
+            req.add(planeId, DRM_MODE_OBJECT_PLANE, "zpos", zpos);
+            break;
+        }
+    }
+    return true;
+}
+
+bool DrmPlaneAssigner::addDisable(DrmAtomicRequest &req, uint32_t planeId) {
+    return req.add(planeId, DRM_MODE_OBJECT_PLANE, "FB_ID", 0U)
+           && req.add(planeId, DRM_MODE_OBJECT_PLANE, "CRTC_ID", 0U);
+}
+
+bool DrmPlaneAssigner::addToRequest(DrmAtomicRequest &req, const std::vector<DrmLayer> &layers, uint32_t clientFbId) {
+    std::unordered_set<uint32_t> used{};
+    uint64_t zpos = 0U;
+    for (const DrmLayer &layer : layers) {
+        if (layer.planeId == 0U) {
+            continue;
+        }
+        uint32_t fbId = (layer.buffer != nullptr) ? layer.buffer->fbId : clientFbId;
+        if (fbId == 0U) {
+            return false;
+        }
+
+        // Stack the planes in layer order within the zpos range of each plane
+        for (const Plane &plane : m_planes) {
+            if (plane.id == layer.planeId) {
+                zpos = std::min(std::max(zpos, plane.zposMin), plane.zposMax);
+                break;
+            }
+        }
+        if (addLayer(req, layer, fbId, zpos) == false) {
+            EARLY_DEBUG("Plane %u cannot show layer format %08x\n", layer.planeId, layer.format);
+            return false;
+        }
+        used.insert(layer.planeId);
+        zpos++;
+    }
+
+    for (uint32_t planeId : m_active) {
+        if ((used.count(planeId) == 0U) && (addDisable(req, planeId) == false)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void DrmPlaneAssigner::commitDone(const std::vector<DrmLayer> &layers) {
+    m_active.clear();
+    for (const DrmLayer &layer : layers) {
+        if (layer.planeId != 0U) {
+            m_active.insert(layer.planeId);
+        }
+    }
+}
+
+bool DrmPlaneAssigner::test(const std::vector<DrmLayer> &layers, uint32_t clientFbId) {
+    DrmAtomicRequest req(m_props);
+    if (addToRequest(req, layers, clientFbId) == false) {
+        return false;
+    }
+    m_tests++;
+    return (req.commit(m_drmFd, DRM_MODE_ATOMIC_TEST_ONLY) == 0);
+}
+
+bool DrmPlaneAssigner::matchesCache(const std::vector<DrmLayer> &layers) const {
+    if ((m_cacheValid == false) || (m_cache.size() != layers.size())) {
+        return false;
+    }
+    for (size_t i = 0; i < layers.size(); ++i) {
+        const CachedLayer &cached = m_cache[i];
+        const DrmLayer &layer = layers[i];
+        uint64_t modifier = (layer.buffer != nullptr) ? layer.buffer->modifier : DRM_FORMAT_MOD_LINEAR;
+        if ((cached.format != layer.format) || (cached.modifier != modifier) || (cached.client != (layer.buffer == nullptr))
+            || (sameRect(cached.src, layer.src) == false) || (sameRect(cached.dst, layer.dst) == false)
+            || (cached.encoding != layer.encoding) || (cached.range != layer.range)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void DrmPlaneAssigner::storeCache(const std::vector<DrmLayer> &layers) {
+    m_cache.clear();
+    for (const DrmLayer &layer : layers) {
+        uint64_t modifier = (layer.buffer != nullptr) ? layer.buffer->modifier : DRM_FORMAT_MOD_LINEAR;
+        m_cache.push_back(CachedLayer{layer.format, modifier, layer.buffer == nullptr, layer.src, layer.dst, layer.encoding, layer.range, layer.planeId});
+    }
+    m_cacheValid = true;
+}
+
+size_t DrmPlaneAssigner::assign(std::vector<DrmLayer> &layers, uint32_t clientFbId) {
+    size_t placed = 0U;
+    if (matchesCache(layers) == true) {
+        m_cacheHits++;
+        for (size_t i = 0; i < layers.size(); ++i) {
+            layers[i].planeId = m_cache[i].planeId;
+            placed += ((layers[i].buffer != nullptr) && (layers[i].planeId != 0U)) ? 1U : 0U;
+        }
+        return placed;
+    }
+
+    int client = -1;
+    for (size_t i = 0; i < layers.size(); ++i) {
+        if (layers[i].buffer == nullptr) {
+            client = static_cast<int>(i);
+            break;
+        }
+    }
+
+    bool found = false;
+    size_t count = layers.size();
+    if ((count > 0U) && (m_planes.empty() == false)) {
+        if (client < 0) {
+            found = mapPlanes(layers, count, count, client) && test(layers, clientFbId);
+        }
+        // Grow the GPU range around the client layer, upwards first: the
+        // bottom layers (the camera) are the expensive ones to compose
+        size_t c = static_cast<size_t>(client);
+        for (size_t width = 1; (client >= 0) && (width <= count) && (found == false); ++width) {
+            for (size_t lo = c + 1; (lo-- > 0U) && (found == false);) {
+                size_t hi = lo + width - 1U;
+                if ((hi < c) || (hi >= count)) {
+                    continue;
+                }
+                found = mapPlanes(layers, lo, hi, client) && test(layers, clientFbId);
+            }
+        }
+    }
+
+    if (found == false) {
+        for (auto &layer : layers) {
+            layer.planeId = 0U;
+        }
+        EARLY_WARN("No plane mapping for %zu layers, composing on the GPU\n", count);
+    }
+    for (const DrmLayer &layer : layers) {
+        placed += ((layer.buffer != nullptr) && (layer.planeId != 0U)) ? 1U : 0U;
+    }
+    EARLY_DEBUG("%zu of %zu layers on planes after %llu tests\n", placed, count, static_cast<unsigned long long>(m_tests));
+    storeCache(layers);
+    return placed;
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
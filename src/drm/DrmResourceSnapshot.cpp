@@ -0,0 +1,214 @@
+#include "DrmResourceSnapshot.h"
+#include "CommonUtil.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay DrmResourceSnapshot"
+#endif
+
+#define CACHE_MAGIC   "earlydrm-connectors"
+#define CACHE_VERSION (2)
+#define CACHE_LINE    (256)
+
+namespace evs {
+namespace early {
+namespace drm {
+
+DrmSnapshotPtr DrmResourceSnapshot::updated(const std::vector<DrmConnectorInfo> &probed,
+                                            const std::vector<uint32_t> &removed,
+                                            uint32_t calls) const {
+    auto next = std::make_shared<DrmResourceSnapshot>(*this);
+    next->m_calls = calls;
+    next->m_probed = static_cast<uint32_t>(probed.size());
+    next->m_cached = 0U;
+    for (uint32_t id : removed) {
+        next->m_connectors.erase(id);
+    }
+    for (const DrmConnectorInfo &connector : probed) {
+        DrmConnectorInfo info = connector;
+        if (info.encoder.id != 0U) {
+            // The CRTCs are only changed by DrmDevice, the encoder binding may be
+            auto crtc = m_crtcs.find(info.encoder.crtc.id);
+            info.encoder.crtc = (crtc != m_crtcs.end()) ? crtc->second : DrmCrtcInfo{};
+            next->m_encoders[info.encoder.id] = info.encoder;
+        }
+        next->m_connectors[info.id] = info;
+    }
+    return next;
+}
+
+bool DrmResourceSnapshot::save(const std::string &path) const {
+    bool success = false;
+    std::string tmpPath = path + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "w");
+    do {
+        if (file == nullptr) {
+            EARLY_ERROR("Failed to create %s: %s\n", tmpPath.c_str(), strerror(errno));
+            break;
+        }
+
+        fprintf(file, "%s %d\n", CACHE_MAGIC, CACHE_VERSION);
+        fprintf(file, "card %s %s\n", m_card.driverName.c_str(), m_card.deviceId.c_str());
+        for (const auto &entry : m_connectors) {
+            const DrmConnectorInfo &connector = entry.second;
+            fprintf(file,
+                    "connector %u %d %u %d %d %zu %s\n",
+                    connector.id,
+                    static_cast<int>(connector.type),
+                    connector.typeId,
+                    connector.connected ? 1 : 0,
+                    connector.vrrCapable ? 1 : 0,
+                    connector.modes.size(),
+                    connector.name.c_str());
+            for (const auto &mode : connector.modes) {
+                fprintf(file,
+                        "mode %u %u %u %u %u %u %u %u %u %u %u %u %u %u %u %d %s\n",
+                        mode.clock,
+                        mode.width,
+                        mode.hsyncStart,
+                        mode.hsyncEnd,
+                        mode.htotal,
+                        mode.hskew,
+                        mode.height,
+                        mode.vsyncStart,
+                        mode.vsyncEnd,
+                        mode.vtotal,
+                        mode.vscan,
+                        mode.refreshRate,
+                        mode.refreshMilliHz,
+                        mode.flags,
+                        mode.type,
+                        mode.preferred ? 1 : 0,
+                        mode.name.empty() ? "-" : mode.name.c_str());
+            }
+        }
+
+        // The old cache stays in place until the new one is complete
+        bool written = (fflush(file) == 0) && (fsync(fileno(file)) == 0);
+        written = (fclose(file) == 0) && written;
+        file = nullptr;
+        if ((written == false) || (rename(tmpPath.c_str(), path.c_str()) != 0)) {
+            EARLY_ERROR("Failed to write %s: %s\n", path.c_str(), strerror(errno));
+            unlink(tmpPath.c_str());
+            break;
+        }
+        success = true;
+    } while (false);
+
+    if (file != nullptr) {
+        fclose(file);
+        unlink(tmpPath.c_str());
+    }
+    return success;
+}
+
+bool DrmResourceSnapshot::load(const std::string &path,
+                               const DrmCardInfo &card,
+                               std::unordered_map<uint32_t, DrmConnectorInfo> &connectors) {
+    bool success = false;
+    FILE *file = fopen(path.c_str(), "r");
+    std::unordered_map<uint32_t, DrmConnectorInfo> loaded{};
+    do {
+        if (file == nullptr) {
+            EARLY_DEBUG("No connector cache %s: %s\n", path.c_str(), strerror(errno));
+            break;
+        }
+
+        char line[CACHE_LINE] = {};
+        char driver[CACHE_LINE] = {};
+        char bus[CACHE_LINE] = {};
+        int version = 0;
+        if ((fgets(line, sizeof(line), file) == nullptr) || (sscanf(line, CACHE_MAGIC " %d", &version) != 1)
+            || (version != CACHE_VERSION)) {
+            EARLY_WARN("Connector cache %s has an unknown format\n", path.c_str());
+            break;
+        }
+        // A cache of another GPU, or of a device that could not be told apart, is not used
+        if ((fgets(line, sizeof(line), file) == nullptr) || (sscanf(line, "card %255s %255s", driver, bus) != 2)
+            || (card.driverName != driver) || (card.deviceId.empty() == true) || (card.deviceId != bus)) {
+            EARLY_DEBUG("Connector cache %s is of another device\n", path.c_str());
+            break;
+        }
+
+        bool valid = true;
+        DrmConnectorInfo *connector = nullptr;
+        size_t pending = 0;
+        while ((valid == true) && (fgets(line, sizeof(line), file) != nullptr)) {
+            char name[CACHE_LINE] = {};
+            if (strncmp(line, "connector ", 10) == 0) {
+                unsigned int id = 0;
+                int type = 0;
+                unsigned int typeId = 0;
+                int connected = 0;
+                int vrr = 0;
+                size_t count = 0;
+                valid = (pending == 0U)
+                        && (sscanf(line, "connector %u %d %u %d %d %zu %255s", &id, &type, &typeId, &connected, &vrr, &count, name) == 7);
+                if (valid == true) {
+                    connector = &loaded[id];
+                    connector->id = id;
+                    connector->type = static_cast<ConnectorType>(type);
+                    connector->typeId = typeId;
+                    connector->connected = (connected != 0);
+                    connector->vrrCapable = (vrr != 0);
+                    connector->name = name;
+                    pending = count;
+                }
+            } else if (strncmp(line, "mode ", 5) == 0) {
+                DrmModeInfo mode = {};
+                unsigned int timings[15] = {};
+                int preferred = 0;
+                valid = (connector != nullptr) && (pending > 0U)
+                        && (sscanf(line,
+                                   "mode %u %u %u %u %u %u %u %u %u %u %u %u %u %u %u %d %255s",
+                                   &timings[0], &timings[1], &timings[2], &timings[3], &timings[4], &timings[5],
+                                   &timings[6], &timings[7], &timings[8], &timings[9], &timings[10], &timings[11],
+                                   &timings[12], &timings[13], &timings[14], &preferred, name)
+                            == 17);
+                if (valid == true) {
+                    mode.clock = timings[0];
+                    mode.width = timings[1];
+                    mode.hsyncStart = static_cast<uint16_t>(timings[2]);
+                    mode.hsyncEnd = static_cast<uint16_t>(timings[3]);
+                    mode.htotal = static_cast<uint16_t>(timings[4]);
+                    mode.hskew = static_cast<uint16_t>(timings[5]);
+                    mode.height = timings[6];
+                    mode.vsyncStart = static_cast<uint16_t>(timings[7]);
+                    mode.vsyncEnd = static_cast<uint16_t>(timings[8]);
+                    mode.vtotal = static_cast<uint16_t>(timings[9]);
+                    mode.vscan = static_cast<uint16_t>(timings[10]);
+                    mode.refreshRate = timings[11];
+                    mode.refreshMilliHz = timings[12];
+                    mode.flags = timings[13];
+                    mode.type = timings[14];
+                    mode.preferred = (preferred != 0);
+                    mode.name = (strcmp(name, "-") == 0) ? std::string() : std::string(name);
+                    connector->modes.push_back(mode);
+                    pending--;
+                }
+            } else {
+                valid = false;
+            }
+        }
+        if ((valid == false) || (pending != 0U)) {
+            EARLY_WARN("Connector cache %s is truncated or corrupt, ignored\n", path.c_str());
+            break;
+        }
+        connectors.swap(loaded);
+        success = true;
+    } while (false);
+
+    if (file != nullptr) {
+        fclose(file);
+    }
+    return success;
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
@@ -0,0 +1,296 @@
+#include "DrmWriteback.h"
+#include "DrmFormat.h"
+#include "CommonUtil.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay DrmWriteback"
+#endif
+
+namespace evs {
+namespace early {
+namespace drm {
+
+DrmWriteback::DrmWriteback(int drmFd, DrmPropertyCache &props, DrmBufferPool &pool)
+    : m_drmFd(drmFd)
+    , m_props(props)
+    , m_pool(pool) {
+}
+
+DrmWriteback::~DrmWriteback() {
+    reset();
+    for (Slot &slot : m_slots) {
+        EARLY_WARN("Writeback buffer fbId=%u is still held by the receiver, parked anyway\n", slot.buffer->fbId);
+        m_pool.park(slot.buffer);
+    }
+    m_slots.clear();
+}
+
+bool DrmWriteback::init(uint32_t crtcId,
+                        int crtcIndex,
+                        uint32_t width,
+                        uint32_t height,
+                        uint32_t preferredFormat,
+                        AllocatorType allocatorType,
+                        uint32_t bufferCount) {
+    bool success = false;
+    do {
+        reset();
+        if ((crtcIndex < 0) || (findConnector(1U << crtcIndex) == false)) {
+            EARLY_ERROR("No writeback connector for CRTC %u\n", crtcId);
+            break;
+        }
+        if (pickFormat(preferredFormat) == false) {
+            EARLY_ERROR("Writeback connector %u writes no RGB format\n", m_connectorId);
+            break;
+        }
+        m_crtcId = crtcId;
+
+        const DrmFormatInfo *fmt = DrmFormat::info(m_format);
+        BufferInfo info = {};
+        info.width = width;
+        info.height = height;
+        info.bpp = static_cast<uint8_t>(fmt->cpp[0] * 8U);
+        info.depth = 24U;
+        info.format = static_cast<int>(m_format);
+        info.tag = MemoryTag::RECORDER;
+        bool allocated = true;
+        for (uint32_t i = 0U; (i < bufferCount) && (allocated == true); i++) {
+            Slot slot = {};
+            slot.buffer = m_pool.acquire(allocatorType, info);
+            slot.outFence = -1;
+            slot.held = false;
+            slot.retired = false;
+            allocated = (slot.buffer != nullptr);
+            if (allocated == true) {
+                m_slots.push_back(slot);
+            }
+        }
+        if (allocated == false) {
+            EARLY_ERROR("Failed to allocate %u writeback buffers of %ux%u\n", bufferCount, width, height);
+            break;
+        }
+        EARLY_INFO("Writeback connector %u on CRTC %u, %u buffers of %ux%u format 0x%x\n",
+                   m_connectorId,
+                   crtcId,
+                   bufferCount,
+                   width,
+                   height,
+                   m_format);
+        success = true;
+    } while (false);
+
+    if (success == false) {
+        reset();
+    }
+    return success;
+}
+
+void DrmWriteback::reset() {
+    if (m_attached == true) {
+        detach();
+    }
+    // The receiver may still read what it holds
+    std::vector<Slot> held{};
+    for (Slot &slot : m_slots) {
+        if (slot.held == true) {
+            slot.retired = true;
+            held.push_back(slot);
+        } else {
+            m_pool.park(slot.buffer);
+        }
+    }
+    m_slots.swap(held);
+    m_added = -1;
+    m_connectorId = 0U;
+    m_crtcId = 0U;
+    m_format = 0U;
+    m_frames = 0U;
+}
+
+bool DrmWriteback::attach() {
+    if (m_connectorId == 0U) {
+        return false;
+    }
+    // Routing a connector is a modeset, even on a running CRTC
+    DrmAtomicRequest req(m_props);
+    int ret = req.add(m_connectorId, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", m_crtcId)
+                  ? req.commit(m_drmFd, DRM_MODE_ATOMIC_ALLOW_MODESET)
+                  : -EINVAL;
+    if (ret != 0) {
+        EARLY_ERROR("Failed to attach writeback connector %u to CRTC %u: %s\n", m_connectorId, m_crtcId, strerror(-ret));
+        return false;
+    }
+    m_attached = true;
+    return true;
+}
+
+void DrmWriteback::detach() {
+    DrmAtomicRequest req(m_props);
+    if ((req.add(m_connectorId, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", 0U) == false)
+        || (req.commit(m_drmFd, DRM_MODE_ATOMIC_ALLOW_MODESET) != 0)) {
+        EARLY_WARN("Failed to detach writeback connector %u\n", m_connectorId);
+    }
+    m_attached = false;
+}
+
+bool DrmWriteback::addToRequest(DrmAtomicRequest &req) {
+    if ((m_attached == false) || (m_frames == 0U)) {
+        return false;
+    }
+    int free = -1;
+    for (size_t i = 0; (i < m_slots.size()) && (free < 0); i++) {
+        free = (m_slots[i].held == false) ? static_cast<int>(i) : free;
+    }
+    if (free < 0) {
+        m_dropped++;
+        return false;
+    }
+
+    Slot &slot = m_slots[static_cast<size_t>(free)];
+    slot.outFence = -1;
+    int cursor = req.cursor();
+    if ((req.add(m_connectorId, DRM_MODE_OBJECT_CONNECTOR, "WRITEBACK_FB_ID", slot.buffer->fbId) == false)
+        || (req.add(m_connectorId,
+                    DRM_MODE_OBJECT_CONNECTOR,
+                    "WRITEBACK_OUT_FENCE_PTR",
+                    static_cast<uint64_t>(reinterpret_cast<uintptr_t>(&slot.outFence)))
+            == false)) {
+        req.rollback(cursor);
+        return false;
+    }
+    slot.held = true;
+    m_added = free;
+    return true;
+}
+
+void DrmWriteback::commitDone(DrmCapture &capture) {
+    capture = {};
+    capture.fence = -1;
+    if (m_added < 0) {
+        return;
+    }
+    Slot &slot = m_slots[static_cast<size_t>(m_added)];
+    m_added = -1;
+    capture.buffer = slot.buffer;
+    capture.fence = slot.outFence;
+    capture.frame = m_captured++;
+    if (m_frames != CONTINUOUS) {
+        m_frames--;
+    }
+}
+
+void DrmWriteback::commitFailed() {
+    if (m_added >= 0) {
+        Slot &slot = m_slots[static_cast<size_t>(m_added)];
+        if (slot.outFence >= 0) {
+            close(slot.outFence);
+            slot.outFence = -1;
+        }
+        slot.held = false;
+        m_added = -1;
+    }
+}
+
+bool DrmWriteback::release(const DrmBuffer *buffer) {
+    for (auto iter = m_slots.begin(); iter != m_slots.end(); ++iter) {
+        if ((iter->buffer != buffer) || (iter->held == false)) {
+            continue;
+        }
+        if (iter->retired == true) {
+            m_pool.park(iter->buffer);
+            m_slots.erase(iter);
+        } else {
+            iter->held = false;
+        }
+        return true;
+    }
+    return false;
+}
+
+uint32_t DrmWriteback::bufferCount() const {
+    uint32_t count = 0U;
+    for (const Slot &slot : m_slots) {
+        count += (slot.retired == false) ? 1U : 0U;
+    }
+    return count;
+}
+
+uint32_t DrmWriteback::held() const {
+    uint32_t count = 0U;
+    for (const Slot &slot : m_slots) {
+        count += (slot.held == true) ? 1U : 0U;
+    }
+    return count;
+}
+
+bool DrmWriteback::findConnector(uint32_t crtcIndexMask) {
+    drmModeRes *res = drmModeGetResources(m_drmFd);
+    if (res == nullptr) {
+        EARLY_ERROR("Failed to get DRM resources: %s\n", strerror(errno));
+        return false;
+    }
+    for (int i = 0; (i < res->count_connectors) && (m_connectorId == 0U); i++) {
+        drmModeConnector *conn = drmModeGetConnectorCurrent(m_drmFd, res->connectors[i]);
+        if (conn == nullptr) {
+            continue;
+        }
+        if (conn->connector_type == DRM_MODE_CONNECTOR_WRITEBACK) {
+            for (int j = 0; (j < conn->count_encoders) && (m_connectorId == 0U); j++) {
+                drmModeEncoder *encoder = drmModeGetEncoder(m_drmFd, conn->encoders[j]);
+                if (encoder == nullptr) {
+                    continue;
+                }
+                if (((encoder->possible_crtcs & crtcIndexMask) != 0U)
+                    && (m_props.id(conn->connector_id, DRM_MODE_OBJECT_CONNECTOR, "WRITEBACK_FB_ID") != 0U)
+                    && (m_props.id(conn->connector_id, DRM_MODE_OBJECT_CONNECTOR, "WRITEBACK_OUT_FENCE_PTR") != 0U)) {
+                    m_connectorId = conn->connector_id;
+                }
+                drmModeFreeEncoder(encoder);
+            }
+        }
+        drmModeFreeConnector(conn);
+    }
+    drmModeFreeResources(res);
+    return (m_connectorId != 0U);
+}
+
+bool DrmWriteback::pickFormat(uint32_t preferredFormat) {
+    uint64_t blobId = 0U;
+    if ((m_props.value(m_connectorId, DRM_MODE_OBJECT_CONNECTOR, "WRITEBACK_PIXEL_FORMATS", blobId) == false)
+        || (blobId == 0U)) {
+        return false;
+    }
+    drmModePropertyBlobRes *blob = drmModeGetPropertyBlob(m_drmFd, static_cast<uint32_t>(blobId));
+    if (blob == nullptr) {
+        return false;
+    }
+    // Single plane RGB only, what the recorder and a readback expect
+    const uint32_t *formats = static_cast<const uint32_t *>(blob->data);
+    size_t count = blob->length / sizeof(uint32_t);
+    uint32_t fallback = 0U;
+    for (size_t i = 0; i < count; i++) {
+        const DrmFormatInfo *fmt = DrmFormat::info(formats[i]);
+        if ((fmt == nullptr) || (fmt->planes != 1U) || (DrmFormat::isYuv(formats[i]) == true)) {
+            continue;
+        }
+        if (formats[i] == preferredFormat) {
+            m_format = formats[i];
+        } else if ((fallback == 0U) || (formats[i] == DRM_FORMAT_XRGB8888)) {
+            fallback = formats[i];
+        }
+    }
+    drmModeFreePropertyBlob(blob);
+    m_format = (m_format != 0U) ? m_format : fallback;
+    return (m_format != 0U);
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
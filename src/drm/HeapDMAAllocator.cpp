@@ -1,5 +1,6 @@
 #include "DrmAllocator.h"
 #include "CommonUtil.h"
+#include "FastCopy.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -26,14 +27,13 @@ constexpr const char *DMA_HEAP_DEVICE = "/dev/dma_heap/system";
 DrmBuffer *HeapDMAAllocator::allocate(int drmFd, const BufferInfo &info) {
     int heapFd = -1;
     int dmaFd = -1;
-    uint32_t stride = 0;
-    uint32_t handle = 0;
-    uint32_t fbId = 0;
-    uint32_t offset = 0;
+    uint32_t planes = 0;
+    uint32_t pitches[DRM_MAX_PLANES] = {};
+    uint32_t offsets[DRM_MAX_PLANES] = {};
     size_t size = 0;
     struct dma_heap_allocation_data alloc = {};
-    struct drm_prime_handle prime = {};
     DrmBuffer *buf = nullptr;
+    bool reserved = false;
 
     do {
         heapFd = open(DMA_HEAP_DEVICE, O_RDWR | O_CLOEXEC);
@@ -42,8 +42,21 @@ DrmBuffer *HeapDMAAllocator::allocate(int drmFd, const BufferInfo &info) {
             break;
         }
 
-        stride = info.width * (info.bpp / 8);
-        size = stride * info.height;
+        BufferInfo layoutInfo = info;
+        layoutInfo.offset = 0;
+        size = resolvePlaneLayout(layoutInfo, planes, pitches, offsets);
+        if (size == 0) {
+            EARLY_ERROR("Invalid buffer layout %ux%u format 0x%x\n", info.width, info.height, info.format);
+            close(heapFd);
+            break;
+        }
+
+        if (MemoryAccounting::instance().reserve(info.tag, size) == false) {
+            EARLY_ERROR("Budget of tag %s exceeded, refusing buffer of %zu bytes\n", MemoryAccounting::tagName(info.tag), size);
+            close(heapFd);
+            break;
+        }
+        reserved = true;
 
         alloc.len = size;
         alloc.fd_flags = O_RDWR | O_CLOEXEC;
@@ -58,76 +71,24 @@ DrmBuffer *HeapDMAAllocator::allocate(int drmFd, const BufferInfo &info) {
 
         dmaFd = alloc.fd;
 
-        prime.fd = dmaFd;
-        prime.flags = DRM_CLOEXEC | DRM_RDWR;
-
-        if (drmIoctl(drmFd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &prime) != 0) {
-            close(dmaFd);
-            EARLY_ERROR("DRM_IOCTL_PRIME_FD_TO_HANDLE failed\n");
-            break;
-        }
-
-        struct drm_gem_close req = {};
-        handle = prime.handle;
-        fbId = 0;
-
-        if (info.format > 0) {
-            if (drmModeAddFB2(drmFd, info.width, info.height, static_cast<uint32_t>(info.format), &handle, &stride, &offset, &fbId, 0) != 0) {
-                EARLY_ERROR("Failed to add framebuffer with format\n");
-                req.handle = handle;
-                if (drmIoctl(drmFd, DRM_IOCTL_GEM_CLOSE, &req) != 0) {
-                    EARLY_ERROR("Failed to close GEM handle after framebuffer addition failure\n");
-                }
-                close(dmaFd);
-                break;
-            }
-        } else {
-            if (drmModeAddFB(drmFd, info.width, info.height, info.depth, info.bpp, stride, handle, &fbId) != 0) {
-                EARLY_ERROR("Failed to add framebuffer without format\n");
-                req.handle = handle;
-                if (drmIoctl(drmFd, DRM_IOCTL_GEM_CLOSE, &req) != 0) {
-                    EARLY_ERROR("Failed to close GEM handle after framebuffer addition failure\n");
-                }
-                close(dmaFd);
-                break;
-            }
-        }
-
-        void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, dmaFd, 0);
-        if (map == MAP_FAILED) {
-            map = nullptr;
-            req.handle = handle;
-            if (drmIoctl(drmFd, DRM_IOCTL_GEM_CLOSE, &req) != 0) {
-                EARLY_ERROR("Failed to close GEM handle after mmap failure\n");
-            }
-            close(dmaFd);
-            EARLY_ERROR("mmap failed\n");
-            break;
+        BufferInfo importInfo = info;
+        importInfo.pitch = static_cast<int>(pitches[0]);
+        importInfo.offset = 0;
+        importInfo.size = size;
+        importInfo.planes = planes;
+        for (uint32_t plane = 0U; plane < DRM_MAX_PLANES; plane++) {
+            importInfo.pitches[plane] = pitches[plane];
+            importInfo.offsets[plane] = offsets[plane];
         }
-
-        buf = new (std::nothrow) DrmBuffer();
+        buf = PrimeImportAllocator::import(drmFd, dmaFd, importInfo, true);
+        close(dmaFd);
         if (buf == nullptr) {
-            EARLY_ERROR("Failed to allocate memory for DrmBuffer\n");
-            if (munmap(map, size) != 0) {
-                EARLY_ERROR("munmap failed after DrmBuffer allocation failure\n");
-            }
-            req.handle = handle;
-            if (drmIoctl(drmFd, DRM_IOCTL_GEM_CLOSE, &req) != 0) {
-                EARLY_ERROR("Failed to close GEM handle after DrmBuffer allocation failure\n");
-            }
-            close(dmaFd);
+            EARLY_ERROR("Failed to import heap buffer into DRM\n");
             break;
         }
-        close(dmaFd);
 
-        memset(buf, 0, sizeof(DrmBuffer));
-        memset(map, 0, size);
-        buf->fbId = fbId;
-        buf->ptr = map;
-        buf->size = size;
-        buf->handle = handle;
-        buf->stride = stride;
-        buf->offset = offset;
+        buf->allocator = AllocatorType::DRM_ALLOCATOR_HEAP_DMA;
+        FastCopy::fill(buf->ptr, size, 0U);
         EARLY_DEBUG("Allocated buffer: fbId=%u, handle=0x%x, size=%zu, stride=%u, offset=%u, ptr=%p\n",
                     buf->fbId,
                     buf->handle,
@@ -136,30 +97,23 @@ DrmBuffer *HeapDMAAllocator::allocate(int drmFd, const BufferInfo &info) {
                     buf->offset,
                     buf->ptr);
     } while (false);
+
+    if ((buf == nullptr) && (reserved == true)) {
+        MemoryAccounting::instance().release(info.tag, size);
+    }
     return buf;
 }
 
 void HeapDMAAllocator::release(int drmFd, DrmBuffer *buf) {
-    struct drm_gem_close req = {};
-
     if (buf == nullptr) {
         EARLY_ERROR("Buffer is null, nothing to release\n");
         return;
     }
-    if (buf->ptr && buf->size > 0) {
-        munmap(buf->ptr, buf->size);
-    }
-    if (buf->fbId) {
-        drmModeRmFB(drmFd, buf->fbId);
-    }
-    if (buf->handle) {
-        req.handle = buf->handle;
-        drmIoctl(drmFd, DRM_IOCTL_GEM_CLOSE, &req);
-    }
-    delete buf;
+    MemoryAccounting::instance().release(buf->tag, buf->size);
+    PrimeImportAllocator::release(drmFd, buf);
 }
 
-int HeapDMAAllocator::exposeHandleToFd(int fd, const DrmBuffer *buf) {
+int HeapDMAAllocator::exposeHandleToFd(int fd, DrmBuffer *buf) {
     int dmaFd = -1;
     do {
         if (buf == nullptr) {
@@ -167,17 +121,16 @@ int HeapDMAAllocator::exposeHandleToFd(int fd, const DrmBuffer *buf) {
             break;
         }
 
+        if (buf->fd >= 0) {
+            dmaFd = buf->fd;
+            break;
+        }
+
         if (buf->handle == 0) {
             EARLY_ERROR("Buffer handle is zero, cannot expose DMA buffer\n");
             break;
         }
 
-        // if (drmPrimeHandleToFD(fd, buf->handle, DRM_CLOEXEC | DRM_RDWR, &dmaFd) != 0) {
-        //     EARLY_ERROR("drmPrimeHandleToFD failed for handle %u: %s\n", buf->handle, strerror(errno));
-        //     break;
-        // }
-        // EARLY_DEBUG("Exposed DMA buffer handle %u to FD %d\n", buf->handle, dmaFd);
-
         struct drm_prime_handle prime = {};
         prime.handle = buf->handle;
         prime.flags = DRM_CLOEXEC | DRM_RDWR;
@@ -185,6 +138,7 @@ int HeapDMAAllocator::exposeHandleToFd(int fd, const DrmBuffer *buf) {
             EARLY_ERROR("DRM_IOCTL_PRIME_HANDLE_TO_FD failed: %s\n", strerror(errno));
             break;
         }
+        buf->fd = prime.fd;
         dmaFd = prime.fd;
     } while (false);
 
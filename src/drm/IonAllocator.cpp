@@ -1,5 +1,6 @@
 #include "DrmAllocator.h"
 #include "CommonUtil.h"
+#include "FastCopy.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -28,15 +29,17 @@ static constexpr int ION_HEAP_TYPE_SYSTEM = 1;
 DrmBuffer *IonAllocator::allocate(int drmFd, const BufferInfo &info) {
     int ioFd = -1;
     int dmaBufFd = -1;
-    uint32_t stride = 0;
+    uint32_t planes = 0;
+    uint32_t pitches[DRM_MAX_PLANES] = {};
+    uint32_t offsets[DRM_MAX_PLANES] = {};
+    uint32_t handles[DRM_MAX_PLANES] = {};
     uint32_t handle = 0;
     uint32_t fbId = 0;
-    uint32_t offset = 0;
     size_t size = 0;
     struct ion_allocation_data alloc = {};
     struct ion_fd_data fdData = {};
-    struct drm_prime_handle prime = {};
     DrmBuffer *buf = nullptr;
+    bool reserved = false;
 
     do {
         ionFd = open(ION_DEVICE, O_RDWR);
@@ -44,8 +47,16 @@ DrmBuffer *IonAllocator::allocate(int drmFd, const BufferInfo &info) {
             EARLY_ERROR("Failed to open %s\n", ION_DEVICE);
             break;
         }
-        stride = info.width * (info.bpp / 8);
-        size = stride * info.height;
+        BufferInfo layoutInfo = info;
+        layoutInfo.offset = 0;
+        size = resolvePlaneLayout(layoutInfo, planes, pitches, offsets);
+
+        if (MemoryAccounting::instance().reserve(info.tag, size) == false) {
+            EARLY_ERROR("Budget of tag %s exceeded, refusing buffer of %zu bytes\n", MemoryAccounting::tagName(info.tag), size);
+            close(ionFd);
+            break;
+        }
+        reserved = true;
 
         alloc.len = size;
         alloc.align = 0;
@@ -68,29 +79,20 @@ DrmBuffer *IonAllocator::allocate(int drmFd, const BufferInfo &info) {
         }
 
         dmaBufFd = fdData.fd;
-        prime.fd = dmaBufFd;
-        prime.flags = DRM_CLOEXEC | DRM_RDWR;
-
-        if (drmIoctl(drmFd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &prime) != 0) {
+        if (PrimeHandles::import(drmFd, dmaBufFd, handle) != 0) {
             close(dmaBufFd);
             close(ionFd);
             EARLY_ERROR("DRM_IOCTL_PRIME_FD_TO_HANDLE failed\n");
             break;
         }
 
-        handle = prime.handle;
         fbId = 0;
 
-        if (info.format > 0) {
-            if (drmModeAddFB2(drmFd, info.width, info.height, static_cast<uint32_t>(info.format), &handle, &stride, &offset, &fbId, 0) != 0) {
-                EARLY_ERROR("Failed to add framebuffer with format\n");
-                break;
-            }
-        } else {
-            if (drmModeAddFB(drmFd, info.width, info.height, info.depth, info.bpp, stride, handle, &fbId) != 0) {
-                EARLY_ERROR("Failed to add framebuffer without format\n");
-                break;
-            }
+        for (uint32_t plane = 0U; plane < planes; plane++) {
+            handles[plane] = handle;
+        }
+        if (addFramebuffer(drmFd, info, handles, pitches, offsets, fbId) != 0) {
+            break;
         }
 
         void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, dmaBufFd, 0);
@@ -105,23 +107,34 @@ DrmBuffer *IonAllocator::allocate(int drmFd, const BufferInfo &info) {
         freeData.handle = alloc.handle;
         ioctl(ionFd, ION_IOC_FREE, &freeData);
         close(ionFd);
-        close(dmaBufFd);
 
         buf = new (std::nothrow) DrmBuffer();
         if (buf == nullptr) {
             EARLY_ERROR("Failed to allocate memory for DrmBuffer\n");
             munmap(map, size);
+            close(dmaBufFd);
             break;
         }
 
         memset(buf, 0, sizeof(DrmBuffer));
-        memset(map, 0, size);
+        FastCopy::fill(map, size, 0U);
         buf->fbId = fbId;
         buf->ptr = map;
         buf->size = size;
         buf->handle = handle;
-        buf->stride = stride;
-        buf->offset = offset;
+        buf->stride = pitches[0];
+        buf->offset = offsets[0];
+        buf->tag = info.tag;
+        buf->fd = dmaBufFd;
+        buf->allocator = AllocatorType::DRM_ALLOCATOR_ION;
+        buf->format = static_cast<uint32_t>(info.format);
+        buf->planeCount = planes;
+        for (uint32_t plane = 0U; plane < DRM_MAX_PLANES; plane++) {
+            buf->handles[plane] = handles[plane];
+            buf->strides[plane] = pitches[plane];
+            buf->offsets[plane] = offsets[plane];
+            buf->planeFds[plane] = -1;
+        }
         EARLY_DEBUG("Allocated buffer: fbId=%u, handle=0x%x, size=%zu, stride=%u, offset=%u, ptr=%p\n",
                     buf->fbId,
                     buf->handle,
@@ -130,6 +143,10 @@ DrmBuffer *IonAllocator::allocate(int drmFd, const BufferInfo &info) {
                     buf->offset,
                     buf->ptr);
     } while (false);
+
+    if ((buf == nullptr) && (reserved == true)) {
+        MemoryAccounting::instance().release(info.tag, size);
+    }
     return buf;
 }
 
@@ -145,14 +162,16 @@ void IonAllocator::release(int drmFd, DrmBuffer *buf) {
         drmModeRmFB(drmFd, buf->fbId);
     }
     if (buf->handle) {
-        struct drm_gem_close req = {};
-        req.handle = buf->handle;
-        drmIoctl(drmFd, DRM_IOCTL_GEM_CLOSE, &req);
+        PrimeHandles::release(drmFd, buf->handle);
     }
+    if (buf->fd >= 0) {
+        close(buf->fd);
+    }
+    MemoryAccounting::instance().release(buf->tag, buf->size);
     delete buf;
 }
 
-int IonAllocator::exposeHandleToFd(int fd, const DrmBuffer *buf) {
+int IonAllocator::exposeHandleToFd(int fd, DrmBuffer *buf) {
     int dmaFd = -1;
     do {
         if (buf == nullptr) {
@@ -160,6 +179,11 @@ int IonAllocator::exposeHandleToFd(int fd, const DrmBuffer *buf) {
             break;
         }
 
+        if (buf->fd >= 0) {
+            dmaFd = buf->fd;
+            break;
+        }
+
         if (buf->handle == 0) {
             EARLY_ERROR("Buffer handle is zero, cannot expose DMA buffer\n");
             break;
@@ -173,6 +197,7 @@ int IonAllocator::exposeHandleToFd(int fd, const DrmBuffer *buf) {
             EARLY_ERROR("DRM_IOCTL_PRIME_HANDLE_TO_FD failed: %s\n", strerror(errno));
             break;
         }
+        buf->fd = prime.fd;
         dmaFd = prime.fd;
     } while (false);
 
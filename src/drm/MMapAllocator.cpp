@@ -1,5 +1,6 @@
 #include "DrmAllocator.h"
 #include "CommonUtil.h"
+#include "FastCopy.h"
 
 #include <drm/drm.h>
 #include <xf86drm.h>
@@ -8,6 +9,7 @@
 #include <cstring>
 #include <stdexcept>
 #include <fcntl.h>
+#include <unistd.h>
 
 #ifdef DEBUG_TAG
 #undef DEBUG_TAG
@@ -22,14 +24,37 @@ DrmBuffer *MMapAllocator::allocate(int drmFd, const BufferInfo &info) {
     struct drm_mode_create_dumb creq = {};
     struct drm_mode_map_dumb mreq = {};
     DrmBuffer *buf = nullptr;
+    size_t reserved = 0;
 
     do {
         if (info.flags > 0) {
             creq.flags = info.flags;
         }
+        // Multi-planar formats are allocated as one dumb buffer with the
+        // bpp of the first plane and enough rows to hold the chroma planes.
+        const DrmFormatInfo *fmt = DrmFormat::info(static_cast<uint32_t>(info.format));
+        uint32_t planes = 0;
+        uint32_t pitches[DRM_MAX_PLANES] = {};
+        uint32_t offsets[DRM_MAX_PLANES] = {};
+        BufferInfo layoutInfo = info;
+        layoutInfo.pitch = 0;
+        layoutInfo.offset = 0;
+        layoutInfo.planes = 0;
+        size_t layoutSize = resolvePlaneLayout(layoutInfo, planes, pitches, offsets);
         creq.width = info.width;
         creq.height = info.height;
         creq.bpp = info.bpp;
+        if ((fmt != nullptr) && (pitches[0] > 0U) && ((planes > 1U) || (info.bpp == 0))) {
+            creq.bpp = fmt->cpp[0] * 8U;
+            creq.height = static_cast<uint32_t>((layoutSize + pitches[0] - 1U) / pitches[0]);
+        }
+        // Fail fast on the budget, before the kernel allocates anything
+        size_t estimate = static_cast<size_t>(creq.width) * creq.height * creq.bpp / 8U;
+        if (MemoryAccounting::instance().reserve(info.tag, estimate) == false) {
+            EARLY_ERROR("Budget of tag %s exceeded, refusing dumb buffer of %zu bytes\n", MemoryAccounting::tagName(info.tag), estimate);
+            break;
+        }
+        reserved = estimate;
         if (drmIoctl(drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0) {
             EARLY_ERROR("Failed to create dumb buffer\n");
             break;
@@ -39,28 +64,39 @@ DrmBuffer *MMapAllocator::allocate(int drmFd, const BufferInfo &info) {
         uint32_t stride = creq.pitch;
         size_t size = creq.size;
         uint32_t fbId = 0;
-        uint32_t offset = 0;
         struct drm_mode_destroy_dumb dreq = {};
         dreq.handle = handle;
 
-        if (info.format > 0) {
-            if (drmModeAddFB2(drmFd, info.width, info.height, static_cast<uint32_t>(info.format), &handle, &stride, &offset, &fbId, 0) != 0) {
-                EARLY_ERROR("Failed to add framebuffer with format %u\n", info.format);
-                drmModeRmFB(drmFd, fbId);
-                if (drmIoctl(drmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq) != 0) {
-                    EARLY_ERROR("Failed to destroy dumb buffer after failed framebuffer addition\n");
-                }
-                break;
+        // The kernel may align the pitch, lay the planes out with it
+        layoutInfo.pitch = static_cast<int>(stride);
+        layoutSize = resolvePlaneLayout(layoutInfo, planes, pitches, offsets);
+        if (layoutSize > size) {
+            EARLY_ERROR("Dumb buffer of %zu bytes is too small for %u planes of %zu bytes\n", size, planes, layoutSize);
+            if (drmIoctl(drmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq) != 0) {
+                EARLY_ERROR("Failed to destroy dumb buffer after layout failure\n");
             }
-        } else {
-            if (drmModeAddFB(drmFd, info.width, info.height, info.depth, info.bpp, stride, handle, &fbId) != 0) {
-                EARLY_ERROR("Failed to add framebuffer without format\n");
-                drmModeRmFB(drmFd, fbId);
-                if (drmIoctl(drmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq) != 0) {
-                    EARLY_ERROR("Failed to destroy dumb buffer after failed framebuffer addition\n");
-                }
-                break;
+            break;
+        }
+
+        // The kernel aligned the pitch or the size, account what it allocated
+        if (MemoryAccounting::instance().adjust(info.tag, reserved, size) == false) {
+            EARLY_ERROR("Budget of tag %s exceeded, refusing dumb buffer of %zu bytes\n", MemoryAccounting::tagName(info.tag), size);
+            if (drmIoctl(drmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq) != 0) {
+                EARLY_ERROR("Failed to destroy dumb buffer after budget failure\n");
             }
+            break;
+        }
+        reserved = size;
+
+        uint32_t handles[DRM_MAX_PLANES] = {};
+        for (uint32_t plane = 0U; plane < planes; plane++) {
+            handles[plane] = handle;
+        }
+        if (addFramebuffer(drmFd, info, handles, pitches, offsets, fbId) != 0) {
+            if (drmIoctl(drmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq) != 0) {
+                EARLY_ERROR("Failed to destroy dumb buffer after failed framebuffer addition\n");
+            }
+            break;
         }
 
         mreq.handle = handle;
@@ -96,13 +132,24 @@ DrmBuffer *MMapAllocator::allocate(int drmFd, const BufferInfo &info) {
         }
 
         std::memset(buf, 0, sizeof(DrmBuffer));
-        std::memset(map, 0, size);
+        FastCopy::fill(map, size, 0U, FastCopy::Mode::STREAMING);
         buf->fbId = fbId;
         buf->ptr = map;
         buf->size = size;
         buf->handle = handle;
         buf->stride = stride;
         buf->offset = mreq.offset;
+        buf->tag = info.tag;
+        buf->fd = -1;
+        buf->allocator = AllocatorType::DRM_ALLOCATOR_MMAP;
+        buf->format = static_cast<uint32_t>(info.format);
+        buf->planeCount = planes;
+        for (uint32_t plane = 0U; plane < DRM_MAX_PLANES; plane++) {
+            buf->handles[plane] = handles[plane];
+            buf->strides[plane] = pitches[plane];
+            buf->offsets[plane] = offsets[plane];
+            buf->planeFds[plane] = -1;
+        }
 
         EARLY_DEBUG("Allocated buffer: fbId=%u, handle=0x%x, size=%zu, stride=%u, offset=%u, ptr=%p\n",
                     buf->fbId,
@@ -113,6 +160,10 @@ DrmBuffer *MMapAllocator::allocate(int drmFd, const BufferInfo &info) {
                     buf->ptr);
     } while (false);
 
+    if ((buf == nullptr) && (reserved > 0)) {
+        MemoryAccounting::instance().release(info.tag, reserved);
+    }
+
     return buf;
 }
 
@@ -132,10 +183,14 @@ void MMapAllocator::release(int drmFd, DrmBuffer *buf) {
         dreq.handle = buf->handle;
         drmIoctl(drmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
     }
+    if (buf->fd >= 0) {
+        close(buf->fd);
+    }
+    MemoryAccounting::instance().release(buf->tag, buf->size);
     delete buf;
 }
 
-int MMapAllocator::exposeHandleToFd(int fd, const DrmBuffer *buf) {
+int MMapAllocator::exposeHandleToFd(int fd, DrmBuffer *buf) {
     int dmaFd = -1;
     do {
         if (buf == nullptr) {
@@ -143,6 +198,11 @@ int MMapAllocator::exposeHandleToFd(int fd, const DrmBuffer *buf) {
             break;
         }
 
+        if (buf->fd >= 0) {
+            dmaFd = buf->fd;
+            break;
+        }
+
         if (buf->handle == 0) {
             EARLY_ERROR("Buffer handle is zero, cannot expose DMA buffer\n");
             break;
@@ -156,6 +216,7 @@ int MMapAllocator::exposeHandleToFd(int fd, const DrmBuffer *buf) {
             EARLY_ERROR("DRM_IOCTL_PRIME_HANDLE_TO_FD failed: %s\n", strerror(errno));
             break;
         }
+        buf->fd = prime.fd;
         dmaFd = prime.fd;
     } while (false);
 
@@ -0,0 +1,248 @@
+#include "DrmAllocator.h"
+#include "CommonUtil.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <drm/drm.h>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyDisplay PrimeImportAllocator"
+#endif
+
+namespace evs {
+namespace early {
+namespace drm {
+
+// References of each GEM handle, keyed by DRM fd and handle
+static std::mutex g_handleMtx;
+static std::map<std::pair<int, uint32_t>, uint32_t> g_handleRefs;
+
+int PrimeHandles::import(int drmFd, int dmaFd, uint32_t &handle) {
+    std::unique_lock<std::mutex> lock(g_handleMtx);
+    struct drm_prime_handle prime = {};
+    prime.fd = dmaFd;
+    prime.flags = DRM_CLOEXEC | DRM_RDWR;
+    if (drmIoctl(drmFd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &prime) != 0) {
+        return -errno;
+    }
+    handle = prime.handle;
+    g_handleRefs[std::make_pair(drmFd, handle)] += 1U;
+    return 0;
+}
+
+void PrimeHandles::release(int drmFd, uint32_t handle) {
+    std::unique_lock<std::mutex> lock(g_handleMtx);
+    auto iter = g_handleRefs.find(std::make_pair(drmFd, handle));
+    if (iter != g_handleRefs.end()) {
+        iter->second -= 1U;
+        if (iter->second > 0U) {
+            return;
+        }
+        g_handleRefs.erase(iter);
+    }
+    struct drm_gem_close req = {};
+    req.handle = handle;
+    drmIoctl(drmFd, DRM_IOCTL_GEM_CLOSE, &req);
+}
+
+/**
+ * @brief Release the handle references and fds of an import, one reference
+ *        per distinct handle.
+ */
+static void closePlanes(int drmFd, const uint32_t handles[DRM_MAX_PLANES], const int fds[DRM_MAX_PLANES]) {
+    for (uint32_t plane = 0U; plane < DRM_MAX_PLANES; plane++) {
+        bool shared = false;
+        for (uint32_t prev = 0U; prev < plane; prev++) {
+            shared = shared || (handles[prev] == handles[plane]);
+        }
+        if ((handles[plane] != 0U) && (shared == false)) {
+            PrimeHandles::release(drmFd, handles[plane]);
+        }
+        if (fds[plane] >= 0) {
+            close(fds[plane]);
+        }
+    }
+}
+
+DrmBuffer *PrimeImportAllocator::import(int drmFd, int dmaFd, const BufferInfo &info, bool map) {
+    const int dmaFds[DRM_MAX_PLANES] = {dmaFd, dmaFd, dmaFd, dmaFd};
+    return import(drmFd, dmaFds, info, map);
+}
+
+DrmBuffer *PrimeImportAllocator::import(int drmFd, const int dmaFds[DRM_MAX_PLANES], const BufferInfo &info, bool map) {
+    uint32_t planes = 0;
+    uint32_t pitches[DRM_MAX_PLANES] = {};
+    uint32_t offsets[DRM_MAX_PLANES] = {};
+    uint32_t handles[DRM_MAX_PLANES] = {};
+    int ownFds[DRM_MAX_PLANES] = {-1, -1, -1, -1};
+    uint32_t fbId = 0;
+    size_t size = info.size;
+    void *ptr = nullptr;
+    DrmBuffer *buf = nullptr;
+    bool imported = true;
+
+    size_t layoutSize = resolvePlaneLayout(info, planes, pitches, offsets);
+
+    do {
+        for (uint32_t plane = 0U; plane < planes; plane++) {
+            if (dmaFds[plane] < 0) {
+                EARLY_ERROR("Invalid dma-buf fd %d for plane %u\n", dmaFds[plane], plane);
+                imported = false;
+                break;
+            }
+
+            // Planes of the same dma-buf share its GEM handle
+            bool shared = false;
+            for (uint32_t prev = 0U; prev < plane; prev++) {
+                if (dmaFds[prev] == dmaFds[plane]) {
+                    handles[plane] = handles[prev];
+                    shared = true;
+                    break;
+                }
+            }
+            if (shared == true) {
+                continue;
+            }
+
+            ownFds[plane] = fcntl(dmaFds[plane], F_DUPFD_CLOEXEC, 0);
+            if (ownFds[plane] < 0) {
+                EARLY_ERROR("Failed to duplicate dma-buf fd %d: %s\n", dmaFds[plane], strerror(errno));
+                imported = false;
+                break;
+            }
+
+            int ret = PrimeHandles::import(drmFd, ownFds[plane], handles[plane]);
+            if (ret != 0) {
+                EARLY_ERROR("DRM_IOCTL_PRIME_FD_TO_HANDLE failed for plane %u: %s\n", plane, strerror(-ret));
+                imported = false;
+                break;
+            }
+            for (uint32_t prev = 0U; prev < plane; prev++) {
+                if (handles[prev] == handles[plane]) {
+                    // Another fd of the same dma-buf, one reference per handle
+                    PrimeHandles::release(drmFd, handles[plane]);
+                    break;
+                }
+            }
+        }
+        if (imported == false) {
+            closePlanes(drmFd, handles, ownFds);
+            break;
+        }
+
+        if (size == 0) {
+            off_t end = lseek(ownFds[0], 0, SEEK_END);
+            if (end <= 0) {
+                EARLY_ERROR("Failed to query size of dma-buf fd %d: %s\n", dmaFds[0], strerror(errno));
+                closePlanes(drmFd, handles, ownFds);
+                break;
+            }
+            lseek(ownFds[0], 0, SEEK_SET);
+            size = static_cast<size_t>(end);
+        }
+        if ((planes == 1U) || (ownFds[1] < 0)) {
+            if (layoutSize > size) {
+                EARLY_ERROR("dma-buf of %zu bytes is too small for the requested layout of %zu bytes\n", size, layoutSize);
+                closePlanes(drmFd, handles, ownFds);
+                break;
+            }
+        }
+
+        if (addFramebuffer(drmFd, info, handles, pitches, offsets, fbId) != 0) {
+            closePlanes(drmFd, handles, ownFds);
+            break;
+        }
+
+        if (map == true) {
+            ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, ownFds[0], 0);
+            if (ptr == MAP_FAILED) {
+                EARLY_ERROR("mmap of imported dma-buf failed: %s\n", strerror(errno));
+                ptr = nullptr;
+                drmModeRmFB(drmFd, fbId);
+                closePlanes(drmFd, handles, ownFds);
+                break;
+            }
+        }
+
+        buf = new (std::nothrow) DrmBuffer();
+        if (buf == nullptr) {
+            EARLY_ERROR("Failed to allocate memory for DrmBuffer\n");
+            if (ptr != nullptr) {
+                munmap(ptr, size);
+            }
+            drmModeRmFB(drmFd, fbId);
+            closePlanes(drmFd, handles, ownFds);
+            break;
+        }
+
+        memset(buf, 0, sizeof(DrmBuffer));
+        buf->fbId = fbId;
+        buf->ptr = ptr;
+        buf->size = size;
+        buf->handle = handles[0];
+        buf->stride = pitches[0];
+        buf->offset = offsets[0];
+        buf->tag = info.tag;
+        buf->fd = ownFds[0];
+        buf->allocator = AllocatorType::DRM_ALLOCATOR_IMPORT;
+        buf->format = static_cast<uint32_t>(info.format);
+        buf->modifier = DrmFormat::hasModifier(info.modifier) ? info.modifier : DRM_FORMAT_MOD_LINEAR;
+        buf->planeCount = planes;
+        for (uint32_t plane = 0U; plane < DRM_MAX_PLANES; plane++) {
+            buf->handles[plane] = handles[plane];
+            buf->strides[plane] = pitches[plane];
+            buf->offsets[plane] = offsets[plane];
+            buf->planeFds[plane] = (plane > 0U) ? ownFds[plane] : -1;
+        }
+        EARLY_DEBUG("Imported dma-buf %d: fbId=%u, handle=0x%x, size=%zu, stride=%u, offset=%u, planes=%u, modifier=0x%llx, ptr=%p\n",
+                    dmaFds[0],
+                    buf->fbId,
+                    buf->handle,
+                    buf->size,
+                    buf->stride,
+                    buf->offset,
+                    buf->planeCount,
+                    static_cast<unsigned long long>(buf->modifier),
+                    buf->ptr);
+    } while (false);
+
+    return buf;
+}
+
+void PrimeImportAllocator::release(int drmFd, DrmBuffer *buf) {
+    if (buf == nullptr) {
+        EARLY_ERROR("Buffer is null, nothing to release\n");
+        return;
+    }
+    if (buf->ptr && buf->size > 0) {
+        munmap(buf->ptr, buf->size);
+    }
+    if (buf->fbId) {
+        drmModeRmFB(drmFd, buf->fbId);
+    }
+    uint32_t handles[DRM_MAX_PLANES] = {buf->handle, 0, 0, 0};
+    int fds[DRM_MAX_PLANES] = {buf->fd, -1, -1, -1};
+    for (uint32_t plane = 1U; plane < buf->planeCount && plane < DRM_MAX_PLANES; plane++) {
+        handles[plane] = buf->handles[plane];
+        fds[plane] = buf->planeFds[plane];
+    }
+    closePlanes(drmFd, handles, fds);
+    delete buf;
+}
+
+int PrimeImportAllocator::exposeHandleToFd(int fd, DrmBuffer *buf) {
+    return (buf != nullptr) ? buf->fd : -1;
+}
+
+} // namespace drm
+} // namespace early
+} // namespace evs
@@ -0,0 +1,133 @@
+#include "ColorLut.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace evs {
+namespace early {
+
+static const float IDENTITY_CTM[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+
+static inline uint16_t toEntry(float value) {
+    return static_cast<uint16_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f));
+}
+
+static inline uint16_t lerp(uint16_t a, uint16_t b, float t) {
+    return static_cast<uint16_t>(std::lround(static_cast<float>(a) + (static_cast<float>(b) - static_cast<float>(a)) * t));
+}
+
+static void mixLut(const std::vector<ColorLutEntry> &from,
+                   const std::vector<ColorLutEntry> &to,
+                   float t,
+                   size_t size,
+                   std::vector<ColorLutEntry> &out) {
+    if ((from.empty() == true) && (to.empty() == true)) {
+        out.clear();
+        return;
+    }
+    std::vector<ColorLutEntry> a{};
+    std::vector<ColorLutEntry> b{};
+    ColorLut::resample(from, size, a);
+    ColorLut::resample(to, size, b);
+    out.resize(size);
+    for (size_t i = 0; i < size; i++) {
+        out[i].red = lerp(a[i].red, b[i].red, t);
+        out[i].green = lerp(a[i].green, b[i].green, t);
+        out[i].blue = lerp(a[i].blue, b[i].blue, t);
+        out[i].reserved = 0U;
+    }
+}
+
+ColorState ColorLut::identity() {
+    ColorState state = {};
+    std::copy(IDENTITY_CTM, IDENTITY_CTM + 9, state.ctm);
+    state.ctmEnabled = false;
+    return state;
+}
+
+std::vector<ColorLutEntry> ColorLut::power(size_t size, float exponent, float gainRed, float gainGreen, float gainBlue) {
+    std::vector<ColorLutEntry> lut(size);
+    for (size_t i = 0; i < size; i++) {
+        float x = (size > 1U) ? static_cast<float>(i) / static_cast<float>(size - 1U) : 0.0f;
+        float value = std::pow(x, exponent);
+        lut[i].red = toEntry(gainRed * value);
+        lut[i].green = toEntry(gainGreen * value);
+        lut[i].blue = toEntry(gainBlue * value);
+        lut[i].reserved = 0U;
+    }
+    return lut;
+}
+
+void ColorLut::resample(const std::vector<ColorLutEntry> &lut, size_t size, std::vector<ColorLutEntry> &out) {
+    out.resize(size);
+    for (size_t i = 0; i < size; i++) {
+        float x = (size > 1U) ? static_cast<float>(i) / static_cast<float>(size - 1U) : 0.0f;
+        if (lut.empty() == true) {
+            uint16_t value = toEntry(x);
+            out[i] = {value, value, value, 0U};
+            continue;
+        }
+        float pos = x * static_cast<float>(lut.size() - 1U);
+        size_t lo = std::min(static_cast<size_t>(pos), lut.size() - 1U);
+        size_t hi = std::min(lo + 1U, lut.size() - 1U);
+        float t = pos - static_cast<float>(lo);
+        out[i].red = lerp(lut[lo].red, lut[hi].red, t);
+        out[i].green = lerp(lut[lo].green, lut[hi].green, t);
+        out[i].blue = lerp(lut[lo].blue, lut[hi].blue, t);
+        out[i].reserved = 0U;
+    }
+}
+
+void ColorLut::mix(const ColorState &from, const ColorState &to, float t, size_t degammaSize, size_t gammaSize, ColorState &out) {
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    mixLut(from.degamma, to.degamma, t, degammaSize, out.degamma);
+    mixLut(from.gamma, to.gamma, t, gammaSize, out.gamma);
+
+    out.ctmEnabled = (from.ctmEnabled == true) || (to.ctmEnabled == true);
+    const float *a = from.ctmEnabled ? from.ctm : IDENTITY_CTM;
+    const float *b = to.ctmEnabled ? to.ctm : IDENTITY_CTM;
+    for (size_t i = 0; i < 9U; i++) {
+        out.ctm[i] = a[i] + (b[i] - a[i]) * t;
+    }
+}
+
+bool ColorLut::equal(const std::vector<ColorLutEntry> &a, const std::vector<ColorLutEntry> &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if ((a[i].red != b[i].red) || (a[i].green != b[i].green) || (a[i].blue != b[i].blue)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ColorLut::equalCtm(const ColorState &a, const ColorState &b) {
+    if (a.ctmEnabled != b.ctmEnabled) {
+        return false;
+    }
+    return (a.ctmEnabled == false) || std::equal(a.ctm, a.ctm + 9, b.ctm);
+}
+
+bool ColorLut::equal(const ColorState &a, const ColorState &b) {
+    return (equal(a.degamma, b.degamma) == true) && (equalCtm(a, b) == true) && (equal(a.gamma, b.gamma) == true);
+}
+
+bool ColorLut::isIdentity(const ColorState &state) {
+    return (state.degamma.empty() == true) && (state.gamma.empty() == true)
+           && ((state.ctmEnabled == false) || std::equal(state.ctm, state.ctm + 9, IDENTITY_CTM));
+}
+
+uint32_t ColorLut::step(uint64_t startUs, uint64_t durationUs, uint64_t nowUs) {
+    if ((durationUs == 0U) || (nowUs >= startUs + durationUs)) {
+        return TRANSITION_STEPS;
+    }
+    if (nowUs <= startUs) {
+        return 0U;
+    }
+    return static_cast<uint32_t>(((nowUs - startUs) * TRANSITION_STEPS) / durationUs);
+}
+
+} // namespace early
+} // namespace evs
@@ -0,0 +1,89 @@
+#ifndef COLOR_LUT_H
+#define COLOR_LUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace evs {
+namespace early {
+
+/**
+ * @struct ColorLutEntry
+ * @brief One entry of a 1D lookup table, 0..0xffff per channel.
+ * Same layout as struct drm_color_lut, so a table can be used as
+ * DEGAMMA_LUT or GAMMA_LUT blob as is.
+ */
+typedef struct {
+    uint16_t red;
+    uint16_t green;
+    uint16_t blue;
+    uint16_t reserved;
+} ColorLutEntry;
+
+/**
+ * @struct ColorState
+ * @brief Colour correction of the display, applied as
+ *        out = gamma(ctm * degamma(in)).
+ * An empty table or a disabled matrix is a bypass of that stage.
+ */
+typedef struct {
+    std::vector<ColorLutEntry> degamma; // to linear light
+    float ctm[9];                       // row major, in linear light
+    bool ctmEnabled;
+    std::vector<ColorLutEntry> gamma;   // back to the display encoding
+} ColorState;
+
+/**
+ * @brief Helpers to build colour states and step between them.
+ *
+ * A transition is cut into TRANSITION_STEPS fixed steps. Both the CRTC
+ * properties of the display and the shader fallback only change on a step
+ * boundary, so a transition costs a bounded number of table updates no
+ * matter the frame rate or duration.
+ */
+class ColorLut
+{
+public:
+    static constexpr uint32_t TRANSITION_STEPS = 16U;
+
+    /**
+     * @brief State with every stage in bypass.
+     */
+    static ColorState identity();
+
+    /**
+     * @brief Table of @p size entries with out = gain * in ^ exponent per
+     *        channel, e.g. a display calibration or night-mode dimming.
+     */
+    static std::vector<ColorLutEntry> power(size_t size, float exponent, float gainRed = 1.0f, float gainGreen = 1.0f, float gainBlue = 1.0f);
+
+    /**
+     * @brief Linear interpolation of @p lut to @p size entries, an empty
+     *        table gives the identity ramp.
+     */
+    static void resample(const std::vector<ColorLutEntry> &lut, size_t size, std::vector<ColorLutEntry> &out);
+
+    /**
+     * @brief State @p t (0..1) of the way from @p from to @p to, tables
+     *        sampled to @p degammaSize and @p gammaSize entries. A stage in
+     *        bypass on both ends stays in bypass.
+     */
+    static void mix(const ColorState &from, const ColorState &to, float t, size_t degammaSize, size_t gammaSize, ColorState &out);
+
+    static bool equal(const ColorState &a, const ColorState &b);
+    static bool equal(const std::vector<ColorLutEntry> &a, const std::vector<ColorLutEntry> &b);
+    static bool equalCtm(const ColorState &a, const ColorState &b);
+    static bool isIdentity(const ColorState &state);
+
+    /**
+     * @brief Step of a transition started at @p startUs, 0 up to
+     *        TRANSITION_STEPS once @p durationUs passed.
+     */
+    static uint32_t step(uint64_t startUs, uint64_t durationUs, uint64_t nowUs);
+};
+
+} // namespace early
+} // namespace evs
+
+#endif // COLOR_LUT_H
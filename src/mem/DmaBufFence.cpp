@@ -0,0 +1,118 @@
+#include "DmaBufFence.h"
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/dma-buf.h>
+#include <stdio.h>
+
+namespace evs {
+namespace early {
+
+static void print_errno(const char *msg) {
+    int e;
+    e = errno;
+    fprintf(stderr, "%s: %s (%d)\n", msg, strerror(e), e);
+}
+
+static int pollFd(int fd, short events, int timeoutMs) {
+    if (fd < 0) {
+        return -EINVAL;
+    }
+    struct pollfd pfd = {};
+    pfd.fd = fd;
+    pfd.events = events;
+
+    int ret = 0;
+    do {
+        ret = ::poll(&pfd, 1, timeoutMs);
+    } while ((ret < 0) && (errno == EINTR));
+
+    if (ret < 0) {
+        print_errno("DmaBufFence: poll failed");
+        return -errno;
+    }
+    if (ret == 0) {
+        return -ETIME;
+    }
+    if ((pfd.revents & (POLLERR | POLLNVAL)) != 0) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int DmaBufFence::wait(int dmaFd, int access, int timeoutMs) {
+    // A writer has to wait for readers as well, a reader only for writers
+    short events = ((access & ACCESS_WRITE) != 0) ? POLLOUT : POLLIN;
+    return pollFd(dmaFd, events, timeoutMs);
+}
+
+int DmaBufFence::exportSyncFile(int dmaFd, int access) {
+    if (dmaFd < 0) {
+        return -EINVAL;
+    }
+#ifdef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+    struct dma_buf_export_sync_file data;
+    std::memset(&data, 0, sizeof(data));
+    data.flags = ((access & ACCESS_READ) ? DMA_BUF_SYNC_READ : 0U) | ((access & ACCESS_WRITE) ? DMA_BUF_SYNC_WRITE : 0U);
+    data.fd = -1;
+    if (data.flags == 0U) {
+        data.flags = DMA_BUF_SYNC_RW;
+    }
+
+    if (::ioctl(dmaFd, DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &data) < 0) {
+        if (errno == ENOTTY) {
+            return -EOPNOTSUPP;
+        }
+        print_errno("DMA_BUF_IOCTL_EXPORT_SYNC_FILE failed");
+        return -errno;
+    }
+    return data.fd;
+#else
+    return -EOPNOTSUPP;
+#endif
+}
+
+int DmaBufFence::importSyncFile(int dmaFd, int syncFd, int access) {
+    if ((dmaFd < 0) || (syncFd < 0)) {
+        return -EINVAL;
+    }
+#ifdef DMA_BUF_IOCTL_IMPORT_SYNC_FILE
+    struct dma_buf_import_sync_file data;
+    std::memset(&data, 0, sizeof(data));
+    data.flags = ((access & ACCESS_WRITE) != 0) ? DMA_BUF_SYNC_WRITE : DMA_BUF_SYNC_READ;
+    data.fd = syncFd;
+
+    if (::ioctl(dmaFd, DMA_BUF_IOCTL_IMPORT_SYNC_FILE, &data) < 0) {
+        if (errno == ENOTTY) {
+            return -EOPNOTSUPP;
+        }
+        print_errno("DMA_BUF_IOCTL_IMPORT_SYNC_FILE failed");
+        return -errno;
+    }
+    return 0;
+#else
+    return -EOPNOTSUPP;
+#endif
+}
+
+int DmaBufFence::waitSyncFile(int syncFd, int timeoutMs) {
+    return pollFd(syncFd, POLLIN, timeoutMs);
+}
+
+int DmaBufFence::attachOrWait(int dmaFd, int syncFd, int access, int timeoutMs) {
+    if (syncFd < 0) {
+        return -EINVAL;
+    }
+    int ret = importSyncFile(dmaFd, syncFd, access);
+    if (ret != 0) {
+        ret = waitSyncFile(syncFd, timeoutMs);
+    }
+    ::close(syncFd);
+    return ret;
+}
+
+} // namespace early
+} // namespace evs
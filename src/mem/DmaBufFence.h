@@ -0,0 +1,75 @@
+#ifndef DMA_BUF_FENCE_H
+#define DMA_BUF_FENCE_H
+
+#include <cstdint>
+
+namespace evs {
+namespace early {
+
+/**
+ * @brief Implicit synchronisation helpers for dma-buf fds.
+ *
+ * Every dma-buf carries the fences of the devices (GPU, display, camera)
+ * still accessing it. Polling the fd waits for them: POLLIN becomes ready
+ * when all writers are done (safe to read), POLLOUT when all readers and
+ * writers are done (safe to write). With DMA_BUF_IOCTL_EXPORT_SYNC_FILE the
+ * same fences can be taken out as a sync_file, and IMPORT_SYNC_FILE attaches
+ * an explicit fence (e.g. an EGL native fence) so that implicit-sync users
+ * of the buffer wait for it. Both ioctls need kernel 6.0; without them the
+ * helpers return -EOPNOTSUPP and callers fall back to waiting on the CPU.
+ *
+ * @p access is BufferHandle::ACCESS_READ / ACCESS_WRITE, the access the
+ * caller is about to do (wait/export) or the access the fence stands for
+ * (import).
+ */
+class DmaBufFence
+{
+public:
+    static constexpr int ACCESS_READ = 1 << 0;
+    static constexpr int ACCESS_WRITE = 1 << 1;
+    static constexpr int ACCESS_RW = ACCESS_READ | ACCESS_WRITE;
+
+    /**
+     * @brief Wait until the buffer can be accessed with @p access.
+     * @param timeoutMs -1 waits forever, 0 only checks.
+     * @return 0 when ready, -ETIME on timeout, -errno on failure.
+     */
+    static int wait(int dmaFd, int access, int timeoutMs);
+
+    /**
+     * @brief True when no fence blocks @p access, never blocks.
+     */
+    static bool isIdle(int dmaFd, int access) { return wait(dmaFd, access, 0) == 0; }
+
+    /**
+     * @brief Export the fences an @p access has to wait for as a sync_file.
+     * @return The sync_file fd (owned by the caller) or -errno, -EOPNOTSUPP
+     *         when the kernel lacks the ioctl.
+     */
+    static int exportSyncFile(int dmaFd, int access);
+
+    /**
+     * @brief Attach @p syncFd as a fence of an @p access to the buffer.
+     * @p syncFd stays owned by the caller.
+     * @return 0 or -errno, -EOPNOTSUPP when the kernel lacks the ioctl.
+     */
+    static int importSyncFile(int dmaFd, int syncFd, int access);
+
+    /**
+     * @brief Wait until a sync_file (or any fence fd) signals.
+     * @return 0 when signalled, -ETIME on timeout, -errno on failure.
+     */
+    static int waitSyncFile(int syncFd, int timeoutMs);
+
+    /**
+     * @brief Hand a render fence to the buffer, or wait for it when the
+     *        kernel cannot import it. Closes @p syncFd in both cases.
+     * @return 0 when the buffer is safe to hand to an implicit-sync consumer.
+     */
+    static int attachOrWait(int dmaFd, int syncFd, int access, int timeoutMs);
+};
+
+} // namespace early
+} // namespace evs
+
+#endif // DMA_BUF_FENCE_H
@@ -28,9 +28,10 @@ static void print_errno(const char *msg) {
     fprintf(stderr, "%s: %s (%d)\n", msg, strerror(e), e);
 }
 
-DmaHeapDevice::DmaHeapDevice(const std::string &path)
+DmaHeapDevice::DmaHeapDevice(const std::string &path, MemoryTag tag)
     : m_fd(-1)
-    , m_path(path) {}
+    , m_path(path)
+    , m_tag(tag) {}
 
 DmaHeapDevice::~DmaHeapDevice() {
 }
@@ -68,8 +69,14 @@ BufferHandlePtr DmaHeapDevice::allocate(size_t length, int fd_flags, uint32_t he
         return nullptr;
     }
 
+    if (MemoryAccounting::instance().reserve(m_tag, length) == false) {
+        fprintf(stderr, "DmaHeapDevice: budget of tag %s exceeded, refusing %zu bytes\n", MemoryAccounting::tagName(m_tag), length);
+        return nullptr;
+    }
+
     if (::ioctl(m_fd, DMA_HEAP_IOCTL_ALLOC, &data) < 0) {
         print_errno("DMA_HEAP_IOCTL_ALLOC failed");
+        MemoryAccounting::instance().release(m_tag, length);
         return nullptr;
     }
 
@@ -79,12 +86,15 @@ BufferHandlePtr DmaHeapDevice::allocate(size_t length, int fd_flags, uint32_t he
             print_errno("Close fd after mmap failed");
         }
         print_errno("mmap failed");
+        MemoryAccounting::instance().release(m_tag, length);
         return nullptr;
     }
 
     BufferHandle *raw = new BufferHandle(data.fd, -1, addr, 0, length);
+    raw->tag = m_tag;
     raw->beginAccessFnc = DmaHeapDevice::syncBuffer;
     raw->endAccessFnc = DmaHeapDevice::syncBuffer;
+    raw->syncRangeFnc = DmaHeapDevice::syncRange;
 
     return BufferHandlePtr(raw, deleteDmaHeapBufferHandle);
 }
@@ -107,6 +117,35 @@ int DmaHeapDevice::syncBuffer(const BufferHandle *buf, bool start, int write_fla
     return 0;
 }
 
+int DmaHeapDevice::syncRange(const BufferHandle *buf, bool start, int write_flags, size_t offset, size_t length) {
+    if (!buf || buf->fd < 0 || offset + length > buf->length) {
+        return -EINVAL;
+    }
+    if (write_flags == 0) {
+        write_flags = static_cast<int>(ReadWriteFlags::SYNC_RW);
+    }
+
+#ifdef DMA_BUF_IOCTL_SYNC_PARTIAL
+    struct dma_buf_sync_partial sync;
+    std::memset(&sync, 0, sizeof(sync));
+    sync.flags = start ? DMA_BUF_SYNC_START | write_flags
+                       : DMA_BUF_SYNC_END | write_flags;
+    sync.offset = static_cast<__u32>(offset);
+    sync.len = static_cast<__u32>(length);
+
+    if (::ioctl(buf->fd, DMA_BUF_IOCTL_SYNC_PARTIAL, &sync) < 0) {
+        if (errno == ENOTTY) {
+            return -EOPNOTSUPP;
+        }
+        print_errno("DMA_BUF_IOCTL_SYNC_PARTIAL failed");
+        return -errno;
+    }
+    return 0;
+#else
+    return -EOPNOTSUPP;
+#endif
+}
+
 int DmaHeapDevice::freeBuffer(BufferHandle *buf) {
     if (!buf) {
         return -EINVAL;
@@ -122,6 +161,7 @@ int DmaHeapDevice::freeBuffer(BufferHandle *buf) {
     if (buf->fd >= 0) {
         ::close(buf->fd);
         buf->fd = -1;
+        MemoryAccounting::instance().release(buf->tag, buf->length);
     }
 
     buf->handle = 0;
@@ -21,7 +21,8 @@ public:
         SYNC_RW = SYNC_READ | SYNC_WRITE,
     };
 
-    explicit DmaHeapDevice(const std::string &heapName = "/dev/dma_heap/system");
+    explicit DmaHeapDevice(const std::string &heapName = "/dev/dma_heap/system",
+                           MemoryTag tag = MemoryTag::OTHER);
     ~DmaHeapDevice();
 
     int open();
@@ -37,13 +38,26 @@ public:
                           bool start,
                           int write_flags = (static_cast<int>(ReadWriteFlags::SYNC_RW)));
 
+    /**
+     * @brief Cache maintenance of [offset, offset + length) only.
+     * Needs a kernel with DMA_BUF_IOCTL_SYNC_PARTIAL (Android common kernel),
+     * returns -EOPNOTSUPP otherwise so callers fall back to syncBuffer().
+     */
+    static int syncRange(const BufferHandle *buf,
+                         bool start,
+                         int write_flags,
+                         size_t offset,
+                         size_t length);
+
     bool isOpen() const { return m_fd >= 0; };
     const std::string &path(void) const { return m_path; }
     int fd(void) const { return m_fd; }
+    MemoryTag tag(void) const { return m_tag; }
 
 private:
     int m_fd = -1;
     std::string m_path = "";
+    MemoryTag m_tag = MemoryTag::OTHER;
 };
 
 } // namespace early
@@ -0,0 +1,319 @@
+#include "FastCopy.h"
+
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define FAST_COPY_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FAST_COPY_NEON 1
+#endif
+
+namespace evs {
+namespace early {
+
+static constexpr size_t BURST = 64U;
+
+static inline bool useStreaming(FastCopy::Mode mode, size_t size) {
+    if (mode == FastCopy::Mode::AUTO) {
+        return size >= FastCopy::STREAMING_THRESHOLD;
+    }
+    return mode == FastCopy::Mode::STREAMING;
+}
+
+/**
+ * @brief Bytes to write before @p dst is aligned to a burst.
+ */
+static inline size_t headBytes(const void *dst, size_t size) {
+    size_t misalign = reinterpret_cast<uintptr_t>(dst) & (BURST - 1U);
+    size_t head = (misalign == 0U) ? 0U : BURST - misalign;
+    return (head < size) ? head : size;
+}
+
+static inline uint32_t rotatePattern(uint32_t pattern, size_t bytes) {
+    unsigned shift = static_cast<unsigned>((bytes & 3U) * 8U);
+    return (shift == 0U) ? pattern : ((pattern >> shift) | (pattern << (32U - shift)));
+}
+
+static inline void fillBytes(uint8_t *dst, size_t size, uint32_t pattern) {
+    for (size_t i = 0; i < size; i++) {
+        dst[i] = static_cast<uint8_t>(pattern >> ((i & 3U) * 8U));
+    }
+}
+
+/**
+ * @brief Copy whole bursts to a burst aligned destination with
+ *        non-temporal stores.
+ */
+static void streamBursts(uint8_t *dst, const uint8_t *src, size_t bursts) {
+#if defined(FAST_COPY_SSE2)
+    for (size_t i = 0; i < bursts; i++) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst), a);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 48), d);
+        src += BURST;
+        dst += BURST;
+    }
+#elif defined(FAST_COPY_NEON) && defined(__aarch64__)
+    for (size_t i = 0; i < bursts; i++) {
+        uint8x16_t a = vld1q_u8(src);
+        uint8x16_t b = vld1q_u8(src + 16);
+        uint8x16_t c = vld1q_u8(src + 32);
+        uint8x16_t d = vld1q_u8(src + 48);
+        __asm__ volatile("stnp %q0, %q1, [%2]\n\t"
+                         "stnp %q3, %q4, [%2, #32]"
+                         :
+                         : "w"(a), "w"(b), "r"(dst), "w"(c), "w"(d)
+                         : "memory");
+        src += BURST;
+        dst += BURST;
+    }
+#elif defined(FAST_COPY_NEON)
+    for (size_t i = 0; i < bursts; i++) {
+        uint8x16_t a = vld1q_u8(src);
+        uint8x16_t b = vld1q_u8(src + 16);
+        uint8x16_t c = vld1q_u8(src + 32);
+        uint8x16_t d = vld1q_u8(src + 48);
+        vst1q_u8(dst, a);
+        vst1q_u8(dst + 16, b);
+        vst1q_u8(dst + 32, c);
+        vst1q_u8(dst + 48, d);
+        src += BURST;
+        dst += BURST;
+    }
+#else
+    std::memcpy(dst, src, bursts * BURST);
+#endif
+}
+
+static void streamFillBursts(uint8_t *dst, uint32_t pattern, size_t bursts) {
+#if defined(FAST_COPY_SSE2)
+    __m128i v = _mm_set1_epi32(static_cast<int>(pattern));
+    for (size_t i = 0; i < bursts; i++) {
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst), v);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 16), v);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 32), v);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 48), v);
+        dst += BURST;
+    }
+#elif defined(FAST_COPY_NEON) && defined(__aarch64__)
+    uint8x16_t v = vreinterpretq_u8_u32(vdupq_n_u32(pattern));
+    for (size_t i = 0; i < bursts; i++) {
+        __asm__ volatile("stnp %q0, %q0, [%1]\n\t"
+                         "stnp %q0, %q0, [%1, #32]"
+                         :
+                         : "w"(v), "r"(dst)
+                         : "memory");
+        dst += BURST;
+    }
+#elif defined(FAST_COPY_NEON)
+    uint8x16_t v = vreinterpretq_u8_u32(vdupq_n_u32(pattern));
+    for (size_t i = 0; i < bursts; i++) {
+        vst1q_u8(dst, v);
+        vst1q_u8(dst + 16, v);
+        vst1q_u8(dst + 32, v);
+        vst1q_u8(dst + 48, v);
+        dst += BURST;
+    }
+#else
+    for (size_t i = 0; i < bursts; i++) {
+        fillBytes(dst, BURST, pattern);
+        dst += BURST;
+    }
+#endif
+}
+
+/**
+ * @brief Order the non-temporal stores before the buffer is handed to the
+ *        display. stnp and plain NEON stores are ordered as normal stores.
+ */
+static inline void streamFence() {
+#if defined(FAST_COPY_SSE2)
+    _mm_sfence();
+#endif
+}
+
+static void streamCopy(uint8_t *dst, const uint8_t *src, size_t size) {
+    size_t head = headBytes(dst, size);
+    std::memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    size -= head;
+
+    size_t bursts = size / BURST;
+    streamBursts(dst, src, bursts);
+    dst += bursts * BURST;
+    src += bursts * BURST;
+    size -= bursts * BURST;
+
+    std::memcpy(dst, src, size);
+}
+
+static void streamFill(uint8_t *dst, size_t size, uint32_t pattern) {
+    size_t head = headBytes(dst, size);
+    fillBytes(dst, head, pattern);
+    pattern = rotatePattern(pattern, head);
+    dst += head;
+    size -= head;
+
+    size_t bursts = size / BURST;
+    streamFillBursts(dst, pattern, bursts);
+    dst += bursts * BURST;
+    size -= bursts * BURST;
+
+    fillBytes(dst, size, pattern);
+}
+
+static void cachedFill(uint8_t *dst, size_t size, uint32_t pattern) {
+    uint8_t byte = static_cast<uint8_t>(pattern);
+    if (pattern == (byte * 0x01010101U)) {
+        std::memset(dst, byte, size);
+        return;
+    }
+    size_t words = size / sizeof(uint32_t);
+    for (size_t i = 0; i < words; i++) {
+        std::memcpy(dst + i * sizeof(uint32_t), &pattern, sizeof(uint32_t));
+    }
+    fillBytes(dst + words * sizeof(uint32_t), size - words * sizeof(uint32_t), pattern);
+}
+
+const char *FastCopy::backend() {
+#if defined(FAST_COPY_SSE2)
+    return "sse2";
+#elif defined(FAST_COPY_NEON) && defined(__aarch64__)
+    return "neon-stnp";
+#elif defined(FAST_COPY_NEON)
+    return "neon";
+#else
+    return "generic";
+#endif
+}
+
+void FastCopy::copy(void *dst, const void *src, size_t size, Mode mode) {
+    if ((dst == nullptr) || (src == nullptr) || (size == 0U)) {
+        return;
+    }
+    if (useStreaming(mode, size) == false) {
+        std::memcpy(dst, src, size);
+        return;
+    }
+    streamCopy(static_cast<uint8_t *>(dst), static_cast<const uint8_t *>(src), size);
+    streamFence();
+}
+
+void FastCopy::copy2D(void *dst,
+                      size_t dstStride,
+                      const void *src,
+                      size_t srcStride,
+                      size_t widthBytes,
+                      size_t rows,
+                      Mode mode) {
+    if ((dst == nullptr) || (src == nullptr) || (widthBytes == 0U) || (rows == 0U)) {
+        return;
+    }
+    // Both buffers packed the same way, one linear copy
+    if ((dstStride == srcStride) && (dstStride == widthBytes)) {
+        copy(dst, src, widthBytes * rows, mode);
+        return;
+    }
+
+    uint8_t *d = static_cast<uint8_t *>(dst);
+    const uint8_t *s = static_cast<const uint8_t *>(src);
+    bool streaming = useStreaming(mode, widthBytes * rows);
+    for (size_t row = 0; row < rows; row++) {
+        if (streaming == true) {
+            streamCopy(d, s, widthBytes);
+        } else {
+            std::memcpy(d, s, widthBytes);
+        }
+        d += dstStride;
+        s += srcStride;
+    }
+    if (streaming == true) {
+        streamFence();
+    }
+}
+
+void FastCopy::fill(void *dst, size_t size, uint32_t pattern, Mode mode) {
+    if ((dst == nullptr) || (size == 0U)) {
+        return;
+    }
+    if (useStreaming(mode, size) == false) {
+        cachedFill(static_cast<uint8_t *>(dst), size, pattern);
+        return;
+    }
+    streamFill(static_cast<uint8_t *>(dst), size, pattern);
+    streamFence();
+}
+
+void FastCopy::fillRect(void *dst,
+                        size_t dstStride,
+                        uint32_t x,
+                        uint32_t y,
+                        uint32_t width,
+                        uint32_t height,
+                        uint32_t bytesPerPixel,
+                        uint32_t color,
+                        Mode mode) {
+    if ((dst == nullptr) || (width == 0U) || (height == 0U) || (bytesPerPixel == 0U) || (bytesPerPixel > 4U)) {
+        return;
+    }
+
+    uint8_t *row = static_cast<uint8_t *>(dst) + static_cast<size_t>(y) * dstStride + static_cast<size_t>(x) * bytesPerPixel;
+    size_t rowBytes = static_cast<size_t>(width) * bytesPerPixel;
+    bool streaming = useStreaming(mode, rowBytes * height);
+
+    if (bytesPerPixel == 3U) {
+        // 24 bit pixels repeat every 12 bytes, 4 pixels in 3 words. One row
+        // is built in cached memory and stored like a copy, so the target
+        // only sees whole words and bursts.
+        uint32_t c = color & 0x00ffffffU;
+        const uint32_t words[3] = {c | (c << 24), (c >> 8) | (c << 16), (c >> 16) | (c << 8)};
+        std::vector<uint32_t> line((rowBytes + 11U) / 12U * 3U);
+        for (size_t i = 0; i < line.size(); i++) {
+            line[i] = words[i % 3U];
+        }
+        const uint8_t *src = reinterpret_cast<const uint8_t *>(line.data());
+        for (uint32_t i = 0; i < height; i++) {
+            if (streaming == true) {
+                streamCopy(row, src, rowBytes);
+            } else {
+                std::memcpy(row, src, rowBytes);
+            }
+            row += dstStride;
+        }
+        if (streaming == true) {
+            streamFence();
+        }
+        return;
+    }
+
+    uint32_t pattern = color;
+    if (bytesPerPixel == 1U) {
+        pattern = (color & 0xffU) * 0x01010101U;
+    } else if (bytesPerPixel == 2U) {
+        pattern = (color & 0xffffU) | ((color & 0xffffU) << 16);
+    }
+
+    for (uint32_t line = 0; line < height; line++) {
+        if (streaming == true) {
+            streamFill(row, rowBytes, pattern);
+        } else {
+            cachedFill(row, rowBytes, pattern);
+        }
+        row += dstStride;
+    }
+    if (streaming == true) {
+        streamFence();
+    }
+}
+
+} // namespace early
+} // namespace evs
@@ -0,0 +1,605 @@
+#include "FrameChannel.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdio.h>
+
+namespace evs {
+namespace early {
+
+static void print_errno(const char *msg) {
+    int e;
+    e = errno;
+    fprintf(stderr, "%s: %s (%d)\n", msg, strerror(e), e);
+}
+
+static int fillAddress(const std::string &path, struct sockaddr_un &addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "FrameChannel: invalid socket path '%s'\n", path.c_str());
+        return -EINVAL;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    return 0;
+}
+
+static void initMessage(FrameMessage &msg, FrameMessageType type, uint32_t bufferId) {
+    std::memset(&msg, 0, sizeof(msg));
+    msg.magic = FRAME_CHANNEL_MAGIC;
+    msg.version = FRAME_CHANNEL_VERSION;
+    msg.type = static_cast<uint16_t>(type);
+    msg.bufferId = bufferId;
+}
+
+/**
+ * @brief Send one message, attaching @p fd with SCM_RIGHTS when fd >= 0.
+ */
+static int sendMessage(int sock, const FrameMessage &msg, int fd) {
+    struct iovec iov = {};
+    iov.iov_base = const_cast<FrameMessage *>(&msg);
+    iov.iov_len = sizeof(msg);
+
+    struct msghdr hdr = {};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    if (fd >= 0) {
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t ret = ::sendmsg(sock, &hdr, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (ret < 0) {
+        return -errno;
+    }
+    return (ret == static_cast<ssize_t>(sizeof(msg))) ? 0 : -EMSGSIZE;
+}
+
+/**
+ * @brief Receive one message, returning a passed fd in @p fd (-1 if none).
+ */
+static int recvMessage(int sock, FrameMessage &msg, int &fd) {
+    struct iovec iov = {};
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr hdr = {};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    fd = -1;
+    ssize_t ret = ::recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+    if (ret < 0) {
+        return -errno;
+    }
+    if (ret == 0) {
+        return -EPIPE;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+            std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    if ((ret != static_cast<ssize_t>(sizeof(msg))) || (msg.magic != FRAME_CHANNEL_MAGIC) || (msg.version != FRAME_CHANNEL_VERSION)) {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        return -EPROTO;
+    }
+    return 0;
+}
+
+FramePublisher::~FramePublisher() {
+    stop();
+}
+
+int FramePublisher::start(const std::string &path) {
+    int ret = 0;
+    struct sockaddr_un addr = {};
+
+    do {
+        if (m_thread.joinable() == true) {
+            ret = -EBUSY;
+            break;
+        }
+
+        ret = fillAddress(path, addr);
+        if (ret < 0) {
+            break;
+        }
+
+        m_listenFd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (m_listenFd < 0) {
+            print_errno("FramePublisher: socket failed");
+            ret = -errno;
+            break;
+        }
+
+        ::unlink(path.c_str());
+        if ((::bind(m_listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0)
+            || (::listen(m_listenFd, 4) < 0)) {
+            print_errno("FramePublisher: bind/listen failed");
+            ret = -errno;
+            ::close(m_listenFd);
+            m_listenFd = -1;
+            break;
+        }
+
+        m_wakeFd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (m_wakeFd < 0) {
+            print_errno("FramePublisher: eventfd failed");
+            ret = -errno;
+            ::close(m_listenFd);
+            m_listenFd = -1;
+            ::unlink(path.c_str());
+            break;
+        }
+
+        m_path = path;
+        m_running.store(true);
+        m_thread = std::thread(&FramePublisher::run, this);
+    } while (false);
+
+    return ret;
+}
+
+void FramePublisher::stop() {
+    if (m_thread.joinable() == false) {
+        return;
+    }
+
+    m_running.store(false);
+    uint64_t one = 1;
+    if (::write(m_wakeFd, &one, sizeof(one)) < 0) {
+        print_errno("FramePublisher: wake write failed");
+    }
+    m_thread.join();
+
+    std::vector<uint32_t> released{};
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        for (auto &consumer : m_consumers) {
+            dropConsumer(consumer, released);
+        }
+        m_consumers.clear();
+    }
+    notifyReleased(released);
+
+    ::close(m_wakeFd);
+    m_wakeFd = -1;
+    ::close(m_listenFd);
+    m_listenFd = -1;
+    ::unlink(m_path.c_str());
+    m_path.clear();
+}
+
+int FramePublisher::publish(uint32_t bufferId, int dmaFd, const FrameLayout &layout, uint64_t sequence, uint64_t timestampNs) {
+    if (dmaFd < 0) {
+        return -EINVAL;
+    }
+
+    FrameMessage msg;
+    initMessage(msg, FrameMessageType::FRAME, bufferId);
+    msg.sequence = sequence;
+    msg.timestampNs = timestampNs;
+    msg.layout = layout;
+
+    int sent = 0;
+    std::vector<uint32_t> released{};
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        for (auto it = m_consumers.begin(); it != m_consumers.end();) {
+            Consumer &consumer = *it;
+            if (consumer.credits == 0U) {
+                m_dropped.fetch_add(1);
+                ++it;
+                continue;
+            }
+
+            bool attach = (consumer.attached.count(bufferId) == 0U);
+            int ret = sendMessage(consumer.fd, msg, attach ? dmaFd : -1);
+            if (ret == -EAGAIN) {
+                m_dropped.fetch_add(1);
+                ++it;
+                continue;
+            }
+            if (ret < 0) {
+                dropConsumer(consumer, released);
+                it = m_consumers.erase(it);
+                continue;
+            }
+
+            if (attach == true) {
+                consumer.attached.insert(bufferId);
+            }
+            consumer.credits -= 1U;
+            consumer.held[bufferId] += 1U;
+            m_busy[bufferId] += 1U;
+            sent++;
+            ++it;
+        }
+    }
+    notifyReleased(released);
+    return sent;
+}
+
+int FramePublisher::publish(uint32_t bufferId, const BufferHandle &handle, const FrameLayout &layout, uint64_t sequence, uint64_t timestampNs) {
+    FrameLayout bufferLayout = layout;
+    if (bufferLayout.size == 0U) {
+        bufferLayout.size = handle.length;
+    }
+    return publish(bufferId, handle.fd, bufferLayout, sequence, timestampNs);
+}
+
+void FramePublisher::removeBuffer(uint32_t bufferId) {
+    FrameMessage msg;
+    initMessage(msg, FrameMessageType::DETACH, bufferId);
+
+    std::unique_lock<std::mutex> lock(m_mtx);
+    for (auto &consumer : m_consumers) {
+        if (consumer.attached.erase(bufferId) > 0U) {
+            if (sendMessage(consumer.fd, msg, -1) < 0) {
+                fprintf(stderr, "FramePublisher: failed to detach buffer %u\n", bufferId);
+            }
+        }
+    }
+}
+
+bool FramePublisher::isBusy(uint32_t bufferId) const {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    auto it = m_busy.find(bufferId);
+    return (it != m_busy.end()) && (it->second > 0U);
+}
+
+void FramePublisher::setReleaseCallback(ReleaseFnc fnc, void *param) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_releaseFnc = fnc;
+    m_releaseParam = param;
+}
+
+size_t FramePublisher::consumerCount() const {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    return m_consumers.size();
+}
+
+void FramePublisher::run() {
+    std::vector<struct pollfd> fds{};
+
+    while (m_running.load() == true) {
+        fds.clear();
+        fds.push_back({m_wakeFd, POLLIN, 0});
+        fds.push_back({m_listenFd, POLLIN, 0});
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            for (const auto &consumer : m_consumers) {
+                fds.push_back({consumer.fd, POLLIN, 0});
+            }
+        }
+
+        int ret = ::poll(fds.data(), fds.size(), -1);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            print_errno("FramePublisher: poll failed");
+            break;
+        }
+
+        if (fds[0].revents != 0) {
+            break;
+        }
+        if ((fds[1].revents & POLLIN) != 0) {
+            acceptConsumer();
+        }
+
+        std::vector<uint32_t> released{};
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            for (size_t i = 2; i < fds.size(); i++) {
+                if (fds[i].revents == 0) {
+                    continue;
+                }
+                for (auto it = m_consumers.begin(); it != m_consumers.end(); ++it) {
+                    if (it->fd != fds[i].fd) {
+                        continue;
+                    }
+                    if (handleMessage(*it, released) == false) {
+                        dropConsumer(*it, released);
+                        m_consumers.erase(it);
+                    }
+                    break;
+                }
+            }
+        }
+        notifyReleased(released);
+    }
+}
+
+void FramePublisher::acceptConsumer() {
+    int fd = ::accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+        print_errno("FramePublisher: accept failed");
+        return;
+    }
+
+    // The consumer announces its credits first, nothing is sent before that
+    Consumer consumer;
+    consumer.fd = fd;
+    consumer.credits = 0U;
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_consumers.push_back(std::move(consumer));
+}
+
+bool FramePublisher::handleMessage(Consumer &consumer, std::vector<uint32_t> &released) {
+    FrameMessage msg;
+    int fd = -1;
+    int ret = recvMessage(consumer.fd, msg, fd);
+    if (fd >= 0) {
+        // Consumers never send buffers
+        ::close(fd);
+    }
+    if (ret == -EAGAIN || ret == -EINTR) {
+        return true;
+    }
+    if (ret < 0) {
+        return false;
+    }
+
+    switch (static_cast<FrameMessageType>(msg.type)) {
+    case FrameMessageType::HELLO:
+        consumer.credits = msg.credits;
+        break;
+    case FrameMessageType::RELEASE: {
+        auto it = consumer.held.find(msg.bufferId);
+        if (it == consumer.held.end()) {
+            fprintf(stderr, "FramePublisher: release of buffer %u which is not held\n", msg.bufferId);
+            break;
+        }
+        if (--it->second == 0U) {
+            consumer.held.erase(it);
+        }
+        consumer.credits += 1U;
+        if (releaseLocked(msg.bufferId) == true) {
+            released.push_back(msg.bufferId);
+        }
+        break;
+    }
+    default:
+        fprintf(stderr, "FramePublisher: unexpected message type %u\n", msg.type);
+        break;
+    }
+    return true;
+}
+
+void FramePublisher::dropConsumer(Consumer &consumer, std::vector<uint32_t> &released) {
+    for (const auto &held : consumer.held) {
+        for (uint32_t i = 0; i < held.second; i++) {
+            if (releaseLocked(held.first) == true) {
+                released.push_back(held.first);
+            }
+        }
+    }
+    consumer.held.clear();
+    consumer.attached.clear();
+    if (consumer.fd >= 0) {
+        ::close(consumer.fd);
+        consumer.fd = -1;
+    }
+}
+
+bool FramePublisher::releaseLocked(uint32_t bufferId) {
+    auto it = m_busy.find(bufferId);
+    if (it == m_busy.end()) {
+        return false;
+    }
+    if (it->second > 0U) {
+        it->second -= 1U;
+    }
+    if (it->second == 0U) {
+        m_busy.erase(it);
+        return true;
+    }
+    return false;
+}
+
+void FramePublisher::notifyReleased(const std::vector<uint32_t> &released) {
+    if (released.empty()) {
+        return;
+    }
+    ReleaseFnc fnc = nullptr;
+    void *param = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        fnc = m_releaseFnc;
+        param = m_releaseParam;
+    }
+    if (fnc == nullptr) {
+        return;
+    }
+    for (uint32_t bufferId : released) {
+        fnc(bufferId, param);
+    }
+}
+
+FrameConsumer::~FrameConsumer() {
+    disconnect();
+}
+
+int FrameConsumer::connect(const std::string &path, uint32_t credits) {
+    int ret = 0;
+    struct sockaddr_un addr = {};
+
+    do {
+        if (m_fd >= 0) {
+            ret = -EISCONN;
+            break;
+        }
+
+        ret = fillAddress(path, addr);
+        if (ret < 0) {
+            break;
+        }
+
+        m_fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (m_fd < 0) {
+            print_errno("FrameConsumer: socket failed");
+            ret = -errno;
+            break;
+        }
+
+        if (::connect(m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+            ret = -errno;
+            ::close(m_fd);
+            m_fd = -1;
+            break;
+        }
+
+        FrameMessage msg;
+        initMessage(msg, FrameMessageType::HELLO, 0U);
+        msg.credits = (credits > 0U) ? credits : 1U;
+        ret = sendMessage(m_fd, msg, -1);
+        if (ret < 0) {
+            ::close(m_fd);
+            m_fd = -1;
+            break;
+        }
+    } while (false);
+
+    return ret;
+}
+
+void FrameConsumer::disconnect() {
+    for (auto &buffer : m_buffers) {
+        ::close(buffer.second);
+    }
+    m_buffers.clear();
+    for (int fd : m_retired) {
+        ::close(fd);
+    }
+    m_retired.clear();
+    m_held.clear();
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+int FrameConsumer::receive(SharedFrame &frame, int timeoutMs) {
+    if (m_fd < 0) {
+        return -ENOTCONN;
+    }
+
+    // Control messages do not extend the wait, the timeout is for the frame
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (true) {
+        int remaining = -1;
+        if (timeoutMs >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            remaining = (left.count() > 0) ? static_cast<int>(left.count()) : 0;
+        }
+        struct pollfd pfd = {m_fd, POLLIN, 0};
+        int ret = ::poll(&pfd, 1, remaining);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (ret == 0) {
+            return -ETIMEDOUT;
+        }
+
+        FrameMessage msg;
+        int fd = -1;
+        ret = recvMessage(m_fd, msg, fd);
+        if (ret < 0) {
+            return (ret == -EPROTO) ? ret : -EPIPE;
+        }
+
+        if (static_cast<FrameMessageType>(msg.type) == FrameMessageType::DETACH) {
+            auto it = m_buffers.find(msg.bufferId);
+            if (it != m_buffers.end()) {
+                retire(it->second);
+                m_buffers.erase(it);
+            }
+            continue;
+        }
+        if (static_cast<FrameMessageType>(msg.type) != FrameMessageType::FRAME) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            continue;
+        }
+
+        if (fd >= 0) {
+            auto it = m_buffers.find(msg.bufferId);
+            if (it != m_buffers.end()) {
+                retire(it->second);
+            }
+            m_buffers[msg.bufferId] = fd;
+        }
+
+        auto it = m_buffers.find(msg.bufferId);
+        if (it == m_buffers.end()) {
+            fprintf(stderr, "FrameConsumer: frame for unknown buffer %u\n", msg.bufferId);
+            return -EPROTO;
+        }
+
+        frame.bufferId = msg.bufferId;
+        frame.fd = it->second;
+        frame.layout = msg.layout;
+        frame.sequence = msg.sequence;
+        frame.timestampNs = msg.timestampNs;
+        m_held[frame.fd] += 1U;
+        return 0;
+    }
+}
+
+void FrameConsumer::retire(int fd) {
+    // A frame still held keeps its fd until release()
+    if (m_held.find(fd) != m_held.end()) {
+        m_retired.insert(fd);
+    } else {
+        ::close(fd);
+    }
+}
+
+int FrameConsumer::release(const SharedFrame &frame) {
+    if (m_fd < 0) {
+        return -ENOTCONN;
+    }
+    auto it = m_held.find(frame.fd);
+    if ((it != m_held.end()) && (--it->second == 0U)) {
+        m_held.erase(it);
+        if (m_retired.erase(frame.fd) > 0U) {
+            ::close(frame.fd);
+        }
+    }
+    FrameMessage msg;
+    initMessage(msg, FrameMessageType::RELEASE, frame.bufferId);
+    msg.sequence = frame.sequence;
+    return sendMessage(m_fd, msg, -1);
+}
+
+} // namespace early
+} // namespace evs
@@ -0,0 +1,202 @@
+#ifndef FRAME_CHANNEL_H
+#define FRAME_CHANNEL_H
+
+#include "BufferHandle.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace evs {
+namespace early {
+
+static constexpr uint32_t FRAME_CHANNEL_MAGIC = 0x45564643U; // "EVFC"
+static constexpr uint16_t FRAME_CHANNEL_VERSION = 1U;
+static constexpr uint32_t FRAME_CHANNEL_MAX_PLANES = 4U;
+
+/**
+ * @struct FrameLayout
+ * @brief Memory layout of a shared frame buffer.
+ */
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;                              ///< DRM fourcc
+    uint32_t planes;                              ///< Number of planes in the dma-buf
+    uint32_t strides[FRAME_CHANNEL_MAX_PLANES];   ///< Pitch of each plane in bytes
+    uint32_t offsets[FRAME_CHANNEL_MAX_PLANES];   ///< Offset of each plane in bytes
+    uint64_t modifier;                            ///< DRM format modifier
+    uint64_t size;                                ///< Size of the dma-buf in bytes
+} FrameLayout;
+
+/**
+ * @enum FrameMessageType
+ * @brief Messages exchanged on a frame channel.
+ */
+enum class FrameMessageType : uint16_t {
+    HELLO = 1,   ///< consumer -> publisher, grants the initial credits
+    FRAME = 2,   ///< publisher -> consumer, a new frame (carries the fd the first time)
+    RELEASE = 3, ///< consumer -> publisher, the frame is no longer used, returns one credit
+    DETACH = 4,  ///< publisher -> consumer, the buffer is gone, drop the cached fd
+};
+
+/**
+ * @struct FrameMessage
+ * @brief Fixed size message sent over the SOCK_SEQPACKET socket.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;        ///< FrameMessageType
+    uint32_t bufferId;    ///< Publisher side buffer identifier
+    uint32_t credits;     ///< HELLO: number of frames the consumer may hold
+    uint64_t sequence;    ///< Frame sequence number
+    uint64_t timestampNs; ///< Capture time, CLOCK_MONOTONIC
+    FrameLayout layout;
+} FrameMessage;
+
+/**
+ * @struct SharedFrame
+ * @brief Frame received by a FrameConsumer.
+ * fd is owned by the consumer and stays valid until the publisher detaches
+ * the buffer, so it may be imported once and cached by bufferId. A frame
+ * not released yet keeps its fd open across a detach.
+ */
+typedef struct {
+    uint32_t bufferId;
+    int fd;
+    FrameLayout layout;
+    uint64_t sequence;
+    uint64_t timestampNs;
+} SharedFrame;
+
+/**
+ * @brief Publishes dma-buf frames to other processes without copies.
+ *
+ * Consumers connect to a Unix domain socket. Each buffer fd is passed once
+ * per consumer with SCM_RIGHTS; later frames only send the fixed header.
+ * Every consumer grants a number of credits on connect, each frame sent
+ * consumes one and each RELEASE returns it, so a slow consumer drops
+ * frames instead of stalling the camera. The release callback tells the
+ * producer when no consumer holds a buffer any more and it may be reused.
+ */
+class FramePublisher
+{
+    FramePublisher(const FramePublisher &) = delete;
+    FramePublisher &operator=(const FramePublisher &) = delete;
+    FramePublisher(FramePublisher &&) = delete;
+    FramePublisher &operator=(FramePublisher &&) = delete;
+
+public:
+    using ReleaseFnc = void (*)(uint32_t bufferId, void *param);
+
+    FramePublisher() = default;
+    ~FramePublisher();
+
+    int start(const std::string &path);
+    void stop();
+
+    /**
+     * @brief Send a frame to every consumer which has a credit left.
+     * @return Number of consumers the frame was sent to, negative errno on error.
+     */
+    int publish(uint32_t bufferId, int dmaFd, const FrameLayout &layout, uint64_t sequence, uint64_t timestampNs);
+    int publish(uint32_t bufferId, const BufferHandle &handle, const FrameLayout &layout, uint64_t sequence, uint64_t timestampNs);
+
+    /**
+     * @brief Tell consumers to drop their copy of @p bufferId's fd.
+     */
+    void removeBuffer(uint32_t bufferId);
+
+    /**
+     * @brief true while at least one consumer holds @p bufferId.
+     */
+    bool isBusy(uint32_t bufferId) const;
+
+    void setReleaseCallback(ReleaseFnc fnc, void *param);
+
+    size_t consumerCount() const;
+    uint64_t droppedFrames() const { return m_dropped.load(); }
+    bool isRunning() const { return m_running.load(); }
+
+private:
+    typedef struct {
+        int fd;
+        uint32_t credits;
+        std::unordered_set<uint32_t> attached;
+        std::unordered_map<uint32_t, uint32_t> held;
+    } Consumer;
+
+    void run();
+    void acceptConsumer();
+    bool handleMessage(Consumer &consumer, std::vector<uint32_t> &released);
+    void dropConsumer(Consumer &consumer, std::vector<uint32_t> &released);
+    bool releaseLocked(uint32_t bufferId);
+    void notifyReleased(const std::vector<uint32_t> &released);
+
+    int m_listenFd{-1};
+    int m_wakeFd{-1};
+    std::string m_path{};
+    std::atomic<bool> m_running{false};
+    std::atomic<uint64_t> m_dropped{0};
+    std::thread m_thread{};
+    mutable std::mutex m_mtx;
+    std::vector<Consumer> m_consumers{};
+    std::unordered_map<uint32_t, uint32_t> m_busy{};
+    ReleaseFnc m_releaseFnc{nullptr};
+    void *m_releaseParam{nullptr};
+};
+
+/**
+ * @brief Receiving side of a frame channel.
+ * Not thread safe, meant to be driven by the consumer's render loop.
+ */
+class FrameConsumer
+{
+    FrameConsumer(const FrameConsumer &) = delete;
+    FrameConsumer &operator=(const FrameConsumer &) = delete;
+    FrameConsumer(FrameConsumer &&) = delete;
+    FrameConsumer &operator=(FrameConsumer &&) = delete;
+
+public:
+    static constexpr uint32_t DEFAULT_CREDITS = 2U;
+
+    FrameConsumer() = default;
+    ~FrameConsumer();
+
+    int connect(const std::string &path, uint32_t credits = DEFAULT_CREDITS);
+    void disconnect();
+
+    /**
+     * @brief Wait up to @p timeoutMs (-1 forever) in total for the next frame.
+     * @return 0 on success, -ETIMEDOUT, -EPIPE if the publisher is gone.
+     */
+    int receive(SharedFrame &frame, int timeoutMs = -1);
+
+    /**
+     * @brief Hand @p frame back to the publisher, returning one credit.
+     */
+    int release(const SharedFrame &frame);
+
+    bool isConnected() const { return m_fd >= 0; }
+    int fd() const { return m_fd; }
+
+private:
+    void retire(int fd);
+
+    int m_fd{-1};
+    std::unordered_map<uint32_t, int> m_buffers{};
+    std::unordered_map<int, uint32_t> m_held{}; // fd -> frames received and not released
+    std::unordered_set<int> m_retired{};        // detached fds, closed on the last release()
+};
+
+} // namespace early
+} // namespace evs
+
+#endif // FRAME_CHANNEL_H
@@ -22,9 +22,10 @@ static void print_errno(const char *msg) {
     fprintf(stderr, "%s: %s (%d)\n", msg, strerror(e), e);
 }
 
-IonDevice::IonDevice(const std::string &devicePath)
+IonDevice::IonDevice(const std::string &devicePath, MemoryTag tag)
     : m_fd(-1)
-    , m_path(devicePath) {}
+    , m_path(devicePath)
+    , m_tag(tag) {}
 
 IonDevice::~IonDevice() {
     close();
@@ -66,8 +67,14 @@ BufferHandlePtr IonDevice::allocate(size_t length,
     alloc_data.heap_id_mask = heapMask;
     alloc_data.flags = flags;
 
+    if (MemoryAccounting::instance().reserve(m_tag, length) == false) {
+        fprintf(stderr, "IonDevice: budget of tag %s exceeded, refusing %zu bytes\n", MemoryAccounting::tagName(m_tag), length);
+        return nullptr;
+    }
+
     if (ioctl(m_fd, ION_IOC_ALLOC, &alloc_data) < 0) {
         print_errno("ION_IOC_ALLOC failed");
+        MemoryAccounting::instance().release(m_tag, length);
         return nullptr;
     }
 
@@ -75,10 +82,12 @@ BufferHandlePtr IonDevice::allocate(size_t length,
     if (virt == MAP_FAILED) {
         print_errno("IonDevice mmap failed");
         ::close(alloc_data.fd);
+        MemoryAccounting::instance().release(m_tag, length);
         return nullptr;
     }
 
     auto raw = new BufferHandle(alloc_data.fd, virt, 0, length, 0);
+    raw->tag = m_tag;
     raw->beginAccessFnc = IonDevice::syncBuffer;
     raw->endAccessFnc = IonDevice::syncBuffer;
 
@@ -94,6 +103,7 @@ int IonDevice::freeBuffer(BufferHandle *buf) {
     }
     if (buf->fd >= 0) {
         ::close(buf->fd);
+        MemoryAccounting::instance().release(buf->tag, buf->length);
     }
     return 0;
 }
@@ -21,7 +21,8 @@ public:
         SYNC_RW = SYNC_READ | SYNC_WRITE,
     };
 
-    explicit IonDevice(const std::string &devPath = "/dev/ion");
+    explicit IonDevice(const std::string &devPath = "/dev/ion",
+                       MemoryTag tag = MemoryTag::OTHER);
     ~IonDevice();
 
     int open();
@@ -41,10 +42,12 @@ public:
     bool isOpen() const { return m_fd >= 0; }
     const std::string &path() const { return m_path; }
     int fd() const { return m_fd; }
+    MemoryTag tag() const { return m_tag; }
 
 private:
     int m_fd = -1;
     std::string m_path;
+    MemoryTag m_tag = MemoryTag::OTHER;
 };
 
 } // namespace early
@@ -41,7 +41,7 @@ bool BlitToScreen::onInit(int w, int h) {
     };
     
     do {
-        for (int i = 0; i < 2; i++) {
+        for (int i = 0; i < bufferCount; i++) {
             if (mapedBuf[i].init(w, h) == false) {
                 RENDER_ERROR("Initialize frame buffer failed\n");
                 ret = false;
@@ -86,7 +86,11 @@ void BlitToScreen::onRender() {
         RENDER_WARN("Input fb is not initialized, skip execution for %s\n", name.c_str());
         return;
     }
-    int currentIndex = currentBuf ^ 1;
+    int currentIndex = (currentBuf + 1) % bufferCount;
+    if ((targetBuf >= 0) && (targetBuf < bufferCount)) {
+        currentIndex = targetBuf;
+        targetBuf = -1;
+    }
     glBindFramebuffer(GL_FRAMEBUFFER, mapedBuf[currentIndex].getFBO());
     glViewport(0, 0, width, height);
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
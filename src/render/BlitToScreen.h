@@ -19,6 +19,23 @@ public:
     void onRender() override;
     void onDestroy() override;
 
+    static constexpr int MAX_BUFFERS = 4;
+
+    /**
+     * @brief Number of target buffers, matching the display swapchain.
+     *        Set before onInit().
+     */
+    inline void setBufferCount(int count) {
+        bufferCount = (count < 1) ? 1 : ((count > MAX_BUFFERS) ? MAX_BUFFERS : count);
+    }
+    inline int getBufferCount() const { return bufferCount; }
+
+    /**
+     * @brief Render the next frame into buffer @p idx, e.g. the one acquired
+     *        from the display. Without it the buffers are used round-robin.
+     */
+    inline void setTargetBuffer(int idx) { targetBuf = idx; }
+
     inline int bufferIdx() const { return currentBuf; }
 
     FrameBuffer *getMapBuf() {
@@ -31,8 +48,10 @@ private:
     GLuint vbo = 0;
     int width = 0;
     int height = 0;
-    FrameBuffer mapedBuf[2];
+    FrameBuffer mapedBuf[MAX_BUFFERS];
+    int bufferCount = 2;
     int currentBuf = 0;
+    int targetBuf = -1;
 };
 
 } // namespace early
@@ -0,0 +1,234 @@
+#include "ColorCorrection.h"
+#include "FrameBuffer.h"
+#include "RenderUtil.h"
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include <chrono>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyRender ColorCorrection"
+#endif
+
+namespace evs {
+namespace early {
+
+static const char *vsSrc = R"(
+attribute vec2 aPos;
+attribute vec2 aTex;
+varying vec2 vTexCoord;
+void main() {
+    vTexCoord = aTex;
+    gl_Position = vec4(aPos, 0.0, 1.0);
+}
+)";
+
+// LUT entries are sampled at their centres, as the CRTC interpolates them
+static const char *fsSrc = R"(
+precision mediump float;
+varying vec2 vTexCoord;
+uniform sampler2D uTexture;
+uniform sampler2D uDegamma;
+uniform sampler2D uGamma;
+uniform mat3 uCtm;
+vec3 lookup(sampler2D lut, vec3 c) {
+    vec3 x = c * (255.0 / 256.0) + (0.5 / 256.0);
+    return vec3(texture2D(lut, vec2(x.r, 0.5)).r, texture2D(lut, vec2(x.g, 0.5)).g, texture2D(lut, vec2(x.b, 0.5)).b);
+}
+void main() {
+    vec4 color = texture2D(uTexture, vTexCoord);
+    vec3 linear = clamp(uCtm * lookup(uDegamma, color.rgb), 0.0, 1.0);
+    gl_FragColor = vec4(lookup(uGamma, linear), color.a);
+}
+)";
+
+static inline uint64_t getTimeUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+void ColorCorrection::setColorState(const ColorState &state, uint32_t transitionMs) {
+    std::unique_lock<std::mutex> lock(stateMtx);
+    // Starts from what is on screen, also in the middle of a transition
+    fromState = current;
+    toState = state;
+    startUs = getTimeUs();
+    durationUs = static_cast<uint64_t>(transitionMs) * 1000U;
+    appliedStep = -1;
+}
+
+bool ColorCorrection::onInit(int w, int h) {
+    bool success = true;
+    const float quad[] = {
+        -1.0f, -1.0f, 0.0f, 0.0f,  // Bottom left
+        1.0f, -1.0f, 1.0f, 0.0f,   // Bottom right
+        -1.0f,  1.0f, 0.0f, 1.0f,  // Top left
+        1.0f,  1.0f, 1.0f, 1.0f    // Top right
+    };
+
+    do {
+        width = w;
+        height = h;
+
+        if (colorFB.init(w, h) == false) {
+            RENDER_ERROR("Initialize frame buffer failed\n");
+            success = false;
+            break;
+        }
+
+        GLuint vs = compileShader(GL_VERTEX_SHADER, vsSrc);
+        GLuint fs = compileShader(GL_FRAGMENT_SHADER, fsSrc);
+        GLint linked = 0;
+
+        shaderProgram = glCreateProgram();
+        glAttachShader(shaderProgram, vs);
+        glAttachShader(shaderProgram, fs);
+        glBindAttribLocation(shaderProgram, 0, "aPos");
+        glBindAttribLocation(shaderProgram, 1, "aTex");
+        glLinkProgram(shaderProgram);
+
+        glGetProgramiv(shaderProgram, GL_LINK_STATUS, &linked);
+        if (linked == false) {
+            char log[512];
+            glGetProgramInfoLog(shaderProgram, sizeof(log), nullptr, log);
+            RENDER_ERROR("Shader link error: %s\n", log);
+            success = false;
+            break;
+        }
+
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        GLuint textures[2] = {};
+        glGenTextures(2, textures);
+        degammaTexture = textures[0];
+        gammaTexture = textures[1];
+        for (GLuint texture : textures) {
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, LUT_SIZE, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    } while (false);
+    return success;
+}
+
+void ColorCorrection::uploadLut(GLuint texture, const std::vector<ColorLutEntry> &lut) {
+    // An empty table is a bypass, drawn as the identity ramp
+    std::vector<ColorLutEntry> sampled{};
+    ColorLut::resample(lut, LUT_SIZE, sampled);
+    uint8_t pixels[LUT_SIZE * 4U] = {};
+    for (size_t i = 0; i < LUT_SIZE; i++) {
+        pixels[i * 4U + 0U] = static_cast<uint8_t>(sampled[i].red >> 8);
+        pixels[i * 4U + 1U] = static_cast<uint8_t>(sampled[i].green >> 8);
+        pixels[i * 4U + 2U] = static_cast<uint8_t>(sampled[i].blue >> 8);
+        pixels[i * 4U + 3U] = 0xffU;
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LUT_SIZE, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+}
+
+bool ColorCorrection::updateState() {
+    std::unique_lock<std::mutex> lock(stateMtx);
+    uint32_t step = ColorLut::step(startUs, durationUs, getTimeUs());
+    if (static_cast<int>(step) == appliedStep) {
+        return false;
+    }
+    // The last step is the target itself, so stages in bypass stay so
+    const ColorState &from = (step == ColorLut::TRANSITION_STEPS) ? toState : fromState;
+    ColorLut::mix(from, toState, static_cast<float>(step) / ColorLut::TRANSITION_STEPS, LUT_SIZE, LUT_SIZE, current);
+    appliedStep = static_cast<int>(step);
+    if (ColorLut::isIdentity(current) == false) {
+        uploadLut(degammaTexture, current.degamma);
+        uploadLut(gammaTexture, current.gamma);
+    }
+    return true;
+}
+
+void ColorCorrection::onRender() {
+    if (inputFB.isinit() == false) {
+        RENDER_WARN("Input fb is not initialized, skip execution for %s\n", name.c_str());
+        return;
+    }
+    if (updateState() == true) {
+        addFullDamage();
+    }
+    if (ColorLut::isIdentity(current) == true) {
+        // Nothing to correct, or the CRTC does it
+        outputFB = inputFB;
+        return;
+    }
+
+    // GLSL matrices are column major
+    const float *m = current.ctm;
+    const float ctm[9] = {m[0], m[3], m[6], m[1], m[4], m[7], m[2], m[5], m[8]};
+    const float identity[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+
+    colorFB.bind();
+    glViewport(0, 0, width, height);
+    glUseProgram(shaderProgram);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+    GLint aPos = glGetAttribLocation(shaderProgram, "aPos");
+    GLint aTex = glGetAttribLocation(shaderProgram, "aTex");
+    if (aPos >= 0) {
+        glEnableVertexAttribArray(aPos);
+        glVertexAttribPointer(aPos, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+    }
+    if (aTex >= 0) {
+        glEnableVertexAttribArray(aTex);
+        glVertexAttribPointer(aTex, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, inputFB.getTexture());
+    glUniform1i(glGetUniformLocation(shaderProgram, "uTexture"), 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, degammaTexture);
+    glUniform1i(glGetUniformLocation(shaderProgram, "uDegamma"), 1);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, gammaTexture);
+    glUniform1i(glGetUniformLocation(shaderProgram, "uGamma"), 2);
+    glUniformMatrix3fv(glGetUniformLocation(shaderProgram, "uCtm"), 1, GL_FALSE, current.ctmEnabled ? ctm : identity);
+
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    if (aPos >= 0) {
+        glDisableVertexAttribArray(aPos);
+    }
+    if (aTex >= 0) {
+        glDisableVertexAttribArray(aTex);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    outputFB = colorFB;
+}
+
+void ColorCorrection::onDestroy() {
+    if (vbo > 0) {
+        glDeleteBuffers(1, &vbo);
+    }
+    if (shaderProgram != 0) {
+        glDeleteProgram(shaderProgram);
+    }
+    if (degammaTexture != 0) {
+        glDeleteTextures(1, &degammaTexture);
+    }
+    if (gammaTexture != 0) {
+        glDeleteTextures(1, &gammaTexture);
+    }
+    colorFB.destroy();
+}
+
+} // namespace early
+} // namespace evs
@@ -0,0 +1,68 @@
+#ifndef COLORCORRECTION_H
+#define COLORCORRECTION_H
+
+#include "Renderable.h"
+#include "ColorLut.h"
+
+#include <mutex>
+
+namespace evs {
+namespace early {
+
+/**
+ * @brief Shader fallback of the CRTC colour pipeline, for displays
+ *        without GAMMA_LUT (see DrmDevice::setColorState()).
+ * Applies out = gamma(ctm * degamma(in)) with 256 entry LUT textures. The
+ * textures are only updated on a transition step, and an identity state
+ * hands the input through without drawing.
+ */
+class ColorCorrection : public Renderable
+{
+public:
+    static constexpr size_t LUT_SIZE = 256U;
+
+    explicit ColorCorrection()
+        : Renderable("ColorCorrection")
+        , shaderProgram(0)
+        , vbo(0)
+        , degammaTexture(0)
+        , gammaTexture(0)
+        , width(0)
+        , height(0) {}
+
+    /**
+     * @brief Go from the current state to @p state in @p transitionMs.
+     *        Can be called from any thread.
+     */
+    void setColorState(const ColorState &state, uint32_t transitionMs = 0U);
+
+protected:
+    bool onInit(int w, int h) override;
+    void onRender() override;
+    void onDestroy() override;
+
+private:
+    bool updateState();
+    void uploadLut(GLuint texture, const std::vector<ColorLutEntry> &lut);
+
+    GLuint shaderProgram = 0;
+    GLuint vbo = 0;
+    GLuint degammaTexture = 0;
+    GLuint gammaTexture = 0;
+    int width = 0;
+    int height = 0;
+    FrameBuffer colorFB{};
+
+    std::mutex stateMtx;
+    ColorState fromState = ColorLut::identity();
+    ColorState toState = ColorLut::identity();
+    ColorState current = ColorLut::identity();  // drawn by the last onRender()
+    uint64_t startUs = 0;
+    uint64_t durationUs = 0;
+    int appliedStep = -1;                        // -1 after setColorState()
+};
+
+} // namespace early
+} // namespace evs
+
+#endif // COLORCORRECTION_H
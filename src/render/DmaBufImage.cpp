@@ -0,0 +1,107 @@
+#include "DmaBufImage.h"
+#include "RenderUtil.h"
+
+#include <cstring>
+
+#ifdef DEBUG_TAG
+#undef DEBUG_TAG
+#define DEBUG_TAG "EarlyRender DmaBufImage"
+#endif
+
+namespace evs {
+namespace early {
+
+static const EGLint PLANE_ATTRIBS[FRAME_CHANNEL_MAX_PLANES][5] = {
+    {EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE0_OFFSET_EXT, EGL_DMA_BUF_PLANE0_PITCH_EXT, EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT},
+    {EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT, EGL_DMA_BUF_PLANE1_PITCH_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT},
+    {EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT, EGL_DMA_BUF_PLANE2_PITCH_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT},
+    {EGL_DMA_BUF_PLANE3_FD_EXT, EGL_DMA_BUF_PLANE3_OFFSET_EXT, EGL_DMA_BUF_PLANE3_PITCH_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT},
+};
+
+static bool hasExtension(EGLDisplay display, const char *name) {
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    return (extensions != nullptr) && (strstr(extensions, name) != nullptr);
+}
+
+size_t DmaBufImage::attribs(const FrameLayout &layout, const int fds[], bool withModifier, EGLint attribs[MAX_ATTRIBS]) {
+    uint32_t planes = (layout.planes > 0U) ? layout.planes : 1U;
+    if ((planes > FRAME_CHANNEL_MAX_PLANES) || (fds == nullptr)) {
+        return 0U;
+    }
+
+    size_t count = 0U;
+    attribs[count++] = EGL_WIDTH;
+    attribs[count++] = static_cast<EGLint>(layout.width);
+    attribs[count++] = EGL_HEIGHT;
+    attribs[count++] = static_cast<EGLint>(layout.height);
+    attribs[count++] = EGL_LINUX_DRM_FOURCC_EXT;
+    attribs[count++] = static_cast<EGLint>(layout.format);
+    for (uint32_t plane = 0U; plane < planes; plane++) {
+        if (fds[plane] < 0) {
+            return 0U;
+        }
+        attribs[count++] = PLANE_ATTRIBS[plane][0];
+        attribs[count++] = fds[plane];
+        attribs[count++] = PLANE_ATTRIBS[plane][1];
+        attribs[count++] = static_cast<EGLint>(layout.offsets[plane]);
+        attribs[count++] = PLANE_ATTRIBS[plane][2];
+        attribs[count++] = static_cast<EGLint>(layout.strides[plane]);
+        if (withModifier == true) {
+            // Every plane carries the same modifier
+            attribs[count++] = PLANE_ATTRIBS[plane][3];
+            attribs[count++] = static_cast<EGLint>(layout.modifier & 0xffffffffULL);
+            attribs[count++] = PLANE_ATTRIBS[plane][4];
+            attribs[count++] = static_cast<EGLint>(layout.modifier >> 32);
+        }
+    }
+    attribs[count++] = EGL_NONE;
+    return count;
+}
+
+EGLImageKHR DmaBufImage::create(EGLDisplay display, const FrameLayout &layout, const int fds[]) {
+    EGLImageKHR image = EGL_NO_IMAGE_KHR;
+    do {
+        static PFNEGLCREATEIMAGEKHRPROC createImage = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+        if ((createImage == nullptr) || (hasExtension(display, "EGL_EXT_image_dma_buf_import") == false)) {
+            RENDER_ERROR("EGL_EXT_image_dma_buf_import not supported\n");
+            break;
+        }
+
+        // A linear buffer imports without modifier on any driver, an
+        // explicit LINEAR is passed on when the driver takes modifiers
+        bool modifiers = hasExtension(display, "EGL_EXT_image_dma_buf_import_modifiers");
+        if ((drm::DrmFormat::hasModifier(layout.modifier) == true) && (modifiers == false)) {
+            RENDER_ERROR("Modifier 0x%llx needs EGL_EXT_image_dma_buf_import_modifiers\n",
+                         static_cast<unsigned long long>(layout.modifier));
+            break;
+        }
+
+        EGLint attribs[MAX_ATTRIBS] = {};
+        bool withModifier = modifiers && (layout.modifier != DRM_FORMAT_MOD_INVALID);
+        if (DmaBufImage::attribs(layout, fds, withModifier, attribs) == 0U) {
+            RENDER_ERROR("Invalid dma-buf layout of %u planes\n", layout.planes);
+            break;
+        }
+        image = createImage(display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attribs);
+        if (image == EGL_NO_IMAGE_KHR) {
+            RENDER_ERROR("Failed to import dma-buf %d %ux%u format 0x%x modifier 0x%llx: 0x%x\n",
+                         fds[0],
+                         layout.width,
+                         layout.height,
+                         layout.format,
+                         static_cast<unsigned long long>(layout.modifier),
+                         eglGetError());
+        }
+    } while (false);
+    return image;
+}
+
+void DmaBufImage::destroy(EGLDisplay display, EGLImageKHR image) {
+    static PFNEGLDESTROYIMAGEKHRPROC destroyImage = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+    if ((destroyImage != nullptr) && (image != EGL_NO_IMAGE_KHR)) {
+        destroyImage(display, image);
+    }
+}
+
+} // namespace early
+} // namespace evs
@@ -0,0 +1,49 @@
+#ifndef DMABUFIMAGE_H
+#define DMABUFIMAGE_H
+
+#include "FrameChannel.h"
+#include "DrmFormat.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace evs {
+namespace early {
+
+/**
+ * @brief EGLImage import of a dma-buf (EGL_EXT_image_dma_buf_import).
+ * The modifier of the layout is passed on with
+ * EGL_EXT_image_dma_buf_import_modifiers, so the GPU reads tiled or
+ * compressed buffers (e.g. from a display engine with framebuffer
+ * compression) in their real layout. Without the extension only linear
+ * buffers are imported.
+ */
+class DmaBufImage
+{
+public:
+    // Size and fourcc, fd/offset/pitch/modifier lo/hi per plane, as pairs, then EGL_NONE
+    static constexpr size_t MAX_ATTRIBS = 2U * (3U + FRAME_CHANNEL_MAX_PLANES * 5U) + 1U;
+
+    /**
+     * @brief Fill @p attribs for eglCreateImageKHR(EGL_LINUX_DMA_BUF_EXT).
+     * @param fds dma-buf fd of each plane, planes of one dma-buf repeat it.
+     * @param withModifier add the PLANEn_MODIFIER_LO/HI attributes.
+     * @return Number of EGLint written including EGL_NONE, 0 if the layout
+     *         has no plane or more than EGL can take.
+     */
+    static size_t attribs(const FrameLayout &layout, const int fds[], bool withModifier, EGLint attribs[MAX_ATTRIBS]);
+
+    /**
+     * @brief Import @p layout into an EGLImage, EGL_NO_IMAGE_KHR on failure
+     *        or when the display cannot read its modifier.
+     */
+    static EGLImageKHR create(EGLDisplay display, const FrameLayout &layout, const int fds[]);
+    static void destroy(EGLDisplay display, EGLImageKHR image);
+};
+
+} // namespace early
+} // namespace evs
+
+#endif // DMABUFIMAGE_H
@@ -6,6 +6,7 @@
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
+#include <algorithm>
 #include <chrono>
 
 #ifdef DEBUG_TAG
@@ -44,6 +45,8 @@ bool DrawGuidelines::onInit(int w, int h) {
     bool success = true;
 
     do {
+        width = w;
+        height = h;
         GLuint vs = compileShader(GL_VERTEX_SHADER, vsSrc);
         GLuint fs = compileShader(GL_FRAGMENT_SHADER, fsSrc);
         shaderProgram = glCreateProgram();
@@ -79,6 +82,21 @@ bool DrawGuidelines::onInit(int w, int h) {
     return success;
 }
 
+// Pixels covered by the line, a few more for its width and antialiasing
+static DamageRect lineRect(int width, int height) {
+    const int margin = 2;
+    float xMin = std::min(lineVerts[0], lineVerts[2]);
+    float xMax = std::max(lineVerts[0], lineVerts[2]);
+    float yMin = std::min(lineVerts[1], lineVerts[3]);
+    float yMax = std::max(lineVerts[1], lineVerts[3]);
+    DamageRect rect = {};
+    rect.x1 = static_cast<int32_t>((xMin + 1.0f) * 0.5f * width) - margin;
+    rect.y1 = static_cast<int32_t>((yMin + 1.0f) * 0.5f * height) - margin;
+    rect.x2 = static_cast<int32_t>((xMax + 1.0f) * 0.5f * width) + margin + 1;
+    rect.y2 = static_cast<int32_t>((yMax + 1.0f) * 0.5f * height) + margin + 1;
+    return rect;
+}
+
 static void updateLinePositon() {
     auto currentTime = std::chrono::steady_clock::now();
     float dt = std::chrono::duration<float>(currentTime - lastTime).count();
@@ -104,7 +122,10 @@ void DrawGuidelines::onRender() {
     // glEnable(GL_BLEND);
     // glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+    // The line of the previous frame is erased, the new one drawn
+    addDamage(lineRect(width, height));
     updateLinePositon();
+    addDamage(lineRect(width, height));
 
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(lineVerts), lineVerts);
@@ -4,6 +4,7 @@
 #include <EGL/eglext.h>
 
 #include "RenderUtil.h"
+#include "MemoryAccounting.h"
 
 #ifdef DEBUG_TAG
 #undef DEBUG_TAG
@@ -28,6 +29,13 @@ bool FrameBuffer::init(int w, int h) {
     width = w;
     height = h;
 
+    size_t bytes = static_cast<size_t>(width) * static_cast<size_t>(height) * 4U;
+    if (MemoryAccounting::instance().reserve(MemoryTag::RENDER, bytes) == false) {
+        RENDER_ERROR("Render budget exceeded, refusing %dx%d frame buffer\n", width, height);
+        return false;
+    }
+    accountedBytes = bytes;
+
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
 
@@ -70,6 +78,10 @@ void FrameBuffer::destroy() {
         glDeleteTextures(1, &texture);
         texture = 0;
     }
+    if (accountedBytes > 0) {
+        MemoryAccounting::instance().release(MemoryTag::RENDER, accountedBytes);
+        accountedBytes = 0;
+    }
     isInited = false;
 }
 
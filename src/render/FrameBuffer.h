@@ -5,6 +5,7 @@
 #include <GLES2/gl2.h>
 #include <EGL/eglext.h>
 #include <atomic>
+#include <cstddef>
 
 namespace evs {
 namespace early {
@@ -26,7 +27,8 @@ public:
         , texture(fb.texture)
         , width(fb.width)
         , height(fb.height)
-        , isInited(fb.isInited) {
+        , isInited(fb.isInited)
+        , accountedBytes(0) {
     }
 
     explicit FrameBuffer(FrameBuffer &&fb)
@@ -34,8 +36,10 @@ public:
         , texture(fb.texture)
         , width(fb.width)
         , height(fb.height)
-        , isInited(fb.isInited) {
+        , isInited(fb.isInited)
+        , accountedBytes(fb.accountedBytes) {
         fb.isInited = false;
+        fb.accountedBytes = 0;
     }
 
     FrameBuffer &operator=(const FrameBuffer &fb) {
@@ -53,7 +57,9 @@ public:
         this->width = fb.width;
         this->height = fb.height;
         this->isInited = fb.isInited;
+        this->accountedBytes = fb.accountedBytes;
         fb.isInited = false;
+        fb.accountedBytes = 0;
         return *this;
     }
 
@@ -72,6 +78,7 @@ private:
     int width = 0;
     int height = 0;
     bool isInited = false;
+    size_t accountedBytes = 0; // Only the owner of the GL objects releases the accounted bytes
 };
 
 } // namespace early
@@ -3,6 +3,8 @@
 #include "RendererAbstraction.h"
 #include "RenderContext.h"
 
+#include <algorithm>
+#include <chrono>
 #include <future>
 #include <functional>
 
@@ -11,9 +13,17 @@
 #define DEBUG_TAG "EarlyRender RenderLoop"
 #endif
 
+#define WAIT_SLICE_US (10000U) // a scheduled start is waited for in slices to notice stop()
+
 namespace evs {
 namespace early {
 
+static inline uint64_t nowUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
 RenderLoop::RenderLoop(RendererAbstraction *pl,
                        RenderContext *context)
     : m_isRuning(false)
@@ -96,9 +106,18 @@ void RenderLoop::run() {
         }
 
         if (m_rd->nextFrameReady() == true) {
+            // Start no earlier than needed for the next vblank, so the
+            // freshest camera frame is the one rendered
+            uint64_t start = m_rd->renderStartUs(nowUs());
+            for (uint64_t now = nowUs(); (now < start) && (m_isRuning.load() == true); now = nowUs()) {
+                std::this_thread::sleep_for(std::chrono::microseconds(std::min<uint64_t>(start - now, WAIT_SLICE_US)));
+            }
+
+            uint64_t begin = nowUs();
             if (m_rd->rendering() == false) {
                 RENDER_DEBUG("Error while rendering a frame\n");
             }
+            m_rd->onFrameRendered(nowUs() - begin);
         } else {
             std::this_thread::sleep_for(std::chrono::microseconds(100));
         }
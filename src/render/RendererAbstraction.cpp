@@ -1,6 +1,10 @@
 #include "RendererAbstraction.h"
 #include "RenderUtil.h"
 
+#include <GLES2/gl2.h>
+#include <cstring>
+#include <unistd.h>
+
 #ifdef DEBUG_TAG
 #undef DEBUG_TAG
 #define DEBUG_TAG "EarlyRender RendererAbstraction"
@@ -49,6 +53,20 @@ bool RendererAbstraction::initRederer() {
             }
         }
         m_state = -1;
+
+        // Explicit fences let the display wait for the GPU instead of the CPU
+        const char *extensions = eglQueryString(m_context->eglDisplay(), EGL_EXTENSIONS);
+        if ((extensions != nullptr) && (strstr(extensions, "EGL_ANDROID_native_fence_sync") != nullptr)) {
+            m_eglCreateSyncKHR = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+            m_eglDestroySyncKHR = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+            m_eglDupNativeFenceFD = (PFNEGLDUPNATIVEFENCEFDANDROIDPROC)eglGetProcAddress("eglDupNativeFenceFDANDROID");
+        }
+        if ((m_eglCreateSyncKHR == nullptr) || (m_eglDestroySyncKHR == nullptr) || (m_eglDupNativeFenceFD == nullptr)) {
+            RENDER_INFO("EGL_ANDROID_native_fence_sync not available, rendering ends with glFinish\n");
+            m_eglCreateSyncKHR = nullptr;
+            m_eglDestroySyncKHR = nullptr;
+            m_eglDupNativeFenceFD = nullptr;
+        }
     } while (false);
     return success;
 }
@@ -65,6 +83,7 @@ void RendererAbstraction::deInitRenderer() {
             job->destroy();
         }
         m_renderJobs.clear();
+        releaseRenderFence();
         m_context->shutdown();
         m_context = nullptr;
         m_state = -1;
@@ -81,18 +100,62 @@ bool RendererAbstraction::rendering() {
     {
         std::unique_lock<std::mutex> lock(m_mtx);
         FrameBuffer prevFB{};
+        m_frameDamage.setBounds(static_cast<uint32_t>(m_context->width()), static_cast<uint32_t>(m_context->height()));
+        m_frameDamage.clear();
         for (auto &job : m_renderJobs) {
+            if (job->isEnabled() == false) {
+                // Damage of a pass that was just disabled still counts
+                m_frameDamage.add(job->getDamage());
+                job->clearDamage();
+                continue;
+            }
             job->setInputFB(prevFB);
             job->execute();
             prevFB = job->getOutputFB();
+            m_frameDamage.add(job->getDamage());
+            job->clearDamage();
         }
     }
 
-    // glFlush();
-    glFinish();
+    finishPass();
     // m_context->swapBuffers();
     return true;
 }
 
+int RendererAbstraction::takeRenderFence() {
+    int fence = m_renderFence;
+    m_renderFence = -1;
+    return fence;
+}
+
+void RendererAbstraction::releaseRenderFence() {
+    if (m_renderFence >= 0) {
+        ::close(m_renderFence);
+        m_renderFence = -1;
+    }
+}
+
+void RendererAbstraction::finishPass() {
+    // A fence nobody took belongs to a pass that was never displayed
+    releaseRenderFence();
+
+    if (m_eglCreateSyncKHR != nullptr) {
+        EGLDisplay display = m_context->eglDisplay();
+        EGLSyncKHR sync = m_eglCreateSyncKHR(display, EGL_SYNC_NATIVE_FENCE_ANDROID, nullptr);
+        if (sync != EGL_NO_SYNC_KHR) {
+            // The fence fd only exists once the commands are flushed
+            glFlush();
+            m_renderFence = m_eglDupNativeFenceFD(display, sync);
+            m_eglDestroySyncKHR(display, sync);
+            if (m_renderFence != EGL_NO_NATIVE_FENCE_FD_ANDROID) {
+                return;
+            }
+            m_renderFence = -1;
+        }
+        RENDER_WARN("Failed to create render fence: 0x%0X, falling back to glFinish\n", eglGetError());
+    }
+    glFinish();
+}
+
 } // namespace early
 } // namespace evs
\ No newline at end of file
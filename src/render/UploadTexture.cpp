@@ -1,5 +1,8 @@
 #include "UploadTexture.h"
 #include "RenderUtil.h"
+#include "DmaBufImage.h"
+#include <GLES2/gl2ext.h>
+#include <algorithm>
 #include <stdint.h>
 
 #ifdef DEBUG_TAG
@@ -12,6 +15,8 @@ namespace early {
 
 bool UploadTexture::onInit(int width, int height) {
     bool success = true;
+    outputWidth = width;
+    outputHeight = height;
     if (outputFB.init(width, height) == false) {
         RENDER_ERROR("Initialize frame buffer failed\n");
         success = false;
@@ -23,27 +28,103 @@ UploadTexture::UploadTexture()
     : Renderable("UploadTexture")
     , pixelData(nullptr)
     , imageWidth(0)
-    , imageHeight(0) {
+    , imageHeight(0)
+    , imageChanged(false) {
 }
 
 void UploadTexture::setImageData(const void *pixels, int width, int height) {
     pixelData = pixels;
     imageWidth = width;
     imageHeight = height;
+    imageChanged = true;
+    dmaFd = -1;
+}
+
+void UploadTexture::setImageDmaBuf(const FrameLayout &layout, int fd) {
+    dmaLayout = layout;
+    dmaFd = fd;
+    imageChanged = true;
+}
+
+bool UploadTexture::copyDmaBuf() {
+    const drm::DrmFormatInfo *fmt = drm::DrmFormat::info(dmaLayout.format);
+    if ((dmaFd < 0) || (fmt == nullptr) || (fmt->planes != 1U) || (drm::DrmFormat::isYuv(dmaLayout.format) == true)) {
+        return false;
+    }
+    static PFNGLEGLIMAGETARGETTEXTURE2DOESPROC targetTexture =
+        (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    EGLDisplay display = (ctxPtr != nullptr) ? ctxPtr->eglDisplay() : eglGetCurrentDisplay();
+    if (targetTexture == nullptr) {
+        return false;
+    }
+
+    auto iter = dmaImages.find(dmaFd);
+    if (iter == dmaImages.end()) {
+        int fds[FRAME_CHANNEL_MAX_PLANES] = {dmaFd, dmaFd, dmaFd, dmaFd};
+        iter = dmaImages.emplace(dmaFd, DmaBufImage::create(display, dmaLayout, fds)).first;
+    }
+    if (iter->second == EGL_NO_IMAGE_KHR) {
+        // Not importable, stays on the CPU upload
+        return false;
+    }
+    if (dmaTexture == 0U) {
+        glGenTextures(1, &dmaTexture);
+        glGenFramebuffers(1, &dmaFbo);
+    }
+
+    // Read the camera buffer through a framebuffer, copy into the output
+    glBindTexture(GL_TEXTURE_2D, dmaTexture);
+    targetTexture(GL_TEXTURE_2D, static_cast<GLeglImageOES>(iter->second));
+    glBindFramebuffer(GL_FRAMEBUFFER, dmaFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dmaTexture, 0);
+    bool complete = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    if (complete == true) {
+        glBindTexture(GL_TEXTURE_2D, outputFB.getTexture());
+        glCopyTexSubImage2D(GL_TEXTURE_2D,
+                            0,
+                            0,
+                            0,
+                            0,
+                            0,
+                            std::min(static_cast<int>(dmaLayout.width), outputWidth),
+                            std::min(static_cast<int>(dmaLayout.height), outputHeight));
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return complete;
 }
 
 void UploadTexture::onRender() {
-    if ((pixelData == nullptr)
-        || (imageWidth == 0)
-        || (imageHeight == 0)) {
+    bool copied = copyDmaBuf();
+    if ((copied == false)
+        && ((pixelData == nullptr)
+            || (imageWidth == 0)
+            || (imageHeight == 0))) {
         return;
     }
 
-    glBindTexture(GL_TEXTURE_2D, outputFB.getTexture());
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, imageWidth, imageHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixelData);
+    if (copied == false) {
+        glBindTexture(GL_TEXTURE_2D, outputFB.getTexture());
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, imageWidth, imageHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixelData);
+    }
+    // A camera frame changes the whole image
+    if (imageChanged == true) {
+        addFullDamage();
+        imageChanged = false;
+    }
 }
 
 void UploadTexture::onDestroy() {
+    EGLDisplay display = (ctxPtr != nullptr) ? ctxPtr->eglDisplay() : eglGetCurrentDisplay();
+    for (const auto &entry : dmaImages) {
+        DmaBufImage::destroy(display, entry.second);
+    }
+    dmaImages.clear();
+    if (dmaTexture != 0U) {
+        glDeleteFramebuffers(1, &dmaFbo);
+        glDeleteTextures(1, &dmaTexture);
+        dmaFbo = 0U;
+        dmaTexture = 0U;
+    }
     outputFB.destroy();
 }
 
@@ -3,6 +3,11 @@
 
 #include "Renderable.h"
 #include "FrameBuffer.h"
+#include "FrameChannel.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <unordered_map>
 
 #define USED_FRAME_BUFFER_SIZE (2)
 
@@ -15,15 +20,35 @@ public:
     explicit UploadTexture();
     void setImageData(const void *pixels, int width, int height);
 
+    /**
+     * @brief Take the next image from dma-buf @p fd (all planes in it)
+     *        instead of uploading the pixels of setImageData(), which stay
+     *        the fallback. The GPU copies it, single-plane RGB formats only.
+     * Each fd is imported once, so they must stay the same buffers, e.g.
+     * the buffer ring of a camera.
+     */
+    void setImageDmaBuf(const FrameLayout &layout, int fd);
+
 protected:
     bool onInit(int width, int height) override;
     void onRender() override;
     void onDestroy() override;
 
+private:
+    bool copyDmaBuf();
+
 private:
     const void *pixelData = nullptr;
     int imageWidth = 0;
     int imageHeight = 0;
+    bool imageChanged = false;  // setImageData() since the last upload
+    int outputWidth = 0;
+    int outputHeight = 0;
+    FrameLayout dmaLayout{};
+    int dmaFd = -1;
+    std::unordered_map<int, EGLImageKHR> dmaImages{}; // imports by fd
+    GLuint dmaTexture = 0;
+    GLuint dmaFbo = 0;
 };
 
 } // namespace early